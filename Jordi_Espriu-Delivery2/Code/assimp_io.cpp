@@ -0,0 +1,107 @@
+#include "assimp_io.h"
+#include "file_cache.h"
+
+MappedIOStream::MappedIOStream(const MappedFile* file) : file(file), position(0)
+{
+}
+
+MappedIOStream::~MappedIOStream()
+{
+    ReleaseFile(file);
+}
+
+size_t MappedIOStream::Read(void* buffer, size_t size, size_t count)
+{
+    if (size == 0)
+        return 0;
+
+    // Whole elements only, like fread
+    size_t available = (size_t)file->size - position;
+    size_t elementCount = glm::min(count, available / size);
+    memcpy(buffer, file->data + position, elementCount * size);
+    position += elementCount * size;
+    return elementCount;
+}
+
+size_t MappedIOStream::Write(const void*, size_t, size_t)
+{
+    return 0;
+}
+
+aiReturn MappedIOStream::Seek(size_t offset, aiOrigin origin)
+{
+    size_t newPosition;
+    switch (origin)
+    {
+        case aiOrigin_SET: newPosition = offset; break;
+        // Offsets back (CUR, and always for END, as with fseek) come as negative values wrapped to size_t
+        case aiOrigin_CUR: newPosition = position + offset; break;
+        case aiOrigin_END: newPosition = (size_t)file->size + offset; break;
+        default: return aiReturn_FAILURE;
+    }
+
+    if (newPosition > file->size)
+        return aiReturn_FAILURE;
+
+    position = newPosition;
+    return aiReturn_SUCCESS;
+}
+
+size_t MappedIOStream::Tell() const
+{
+    return position;
+}
+
+size_t MappedIOStream::FileSize() const
+{
+    return (size_t)file->size;
+}
+
+void MappedIOStream::Flush()
+{
+}
+
+MappedIOSystem::~MappedIOSystem()
+{
+    for (const MappedFile* file : openedFiles)
+        ReleaseFile(file);
+}
+
+bool MappedIOSystem::Exists(const char* filepath) const
+{
+    // Mapping it is as cheap as a stat, and the Open that usually follows gets it from the cache
+    const MappedFile* file = AcquireFile(filepath);
+    if (!file)
+        return false;
+
+    ReleaseFile(file);
+    return true;
+}
+
+char MappedIOSystem::getOsSeparator() const
+{
+    // Also understood by Windows
+    return '/';
+}
+
+Assimp::IOStream* MappedIOSystem::Open(const char* filepath, const char* mode)
+{
+    if (strchr(mode, 'w') || strchr(mode, 'a') || strchr(mode, '+'))
+    {
+        ELOG("Assimp tried to write %s, the importer IO is read-only", filepath);
+        return NULL;
+    }
+
+    const MappedFile* file = AcquireFile(filepath);
+    if (!file)
+        return NULL;
+
+    // A reference for the stream and another one until the import ends
+    openedFiles.push_back(AcquireFile(filepath));
+    return new MappedIOStream(file);
+}
+
+void MappedIOSystem::Close(Assimp::IOStream* stream)
+{
+    delete stream;
+}
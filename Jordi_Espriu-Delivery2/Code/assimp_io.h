@@ -0,0 +1,48 @@
+//
+// assimp_io.h: File access of the Assimp importers through the file cache. The files
+// are memory mapped instead of read through stdio buffers, and the importers opening a
+// file several times (to detect its format, for the material libraries...) share the
+// mapping with the rest of the loading code.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+// Reads of an importer from a mapped file
+class MappedIOStream : public Assimp::IOStream
+{
+public:
+    MappedIOStream(const MappedFile* file);
+    ~MappedIOStream();
+
+    size_t Read(void* buffer, size_t size, size_t count) override;
+    size_t Write(const void* buffer, size_t size, size_t count) override;
+    aiReturn Seek(size_t offset, aiOrigin origin) override;
+    size_t Tell() const override;
+    size_t FileSize() const override;
+    void Flush() override;
+
+private:
+    const MappedFile* file;
+    size_t            position;
+};
+
+// Read-only, opening the files through the file cache. The files opened are kept
+// mapped while the IO system lives (an import), as the importers reopen them
+class MappedIOSystem : public Assimp::IOSystem
+{
+public:
+    ~MappedIOSystem();
+
+    bool Exists(const char* filepath) const override;
+    char getOsSeparator() const override;
+    Assimp::IOStream* Open(const char* filepath, const char* mode) override;
+    void Close(Assimp::IOStream* stream) override;
+
+private:
+    std::vector<const MappedFile*> openedFiles;
+};
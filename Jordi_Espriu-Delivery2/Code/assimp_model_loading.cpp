@@ -1,41 +1,151 @@
 
-#include <assimp/cimport.h>
+#include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "assimp_model_loading.h"
+#include "assimp_io.h"
+#include "obj_loader.h"
+#include "gltf_loader.h"
 #include "engine.h"
+#include "mesh_cache.h"
+#include "file_cache.h"
+#include "job_system.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <chrono>
+
+// Normals, tangent space and vertex welding are done by mesh_kernels.h instead of Assimp's
+// post processing steps (single threaded), 0 to compare them
+#define MODEL_ENGINE_MESH_KERNELS 1
+
+#if MODEL_ENGINE_MESH_KERNELS
+#define MODEL_VERTEX_PROCESSING_FLAGS 0
+#else
+#define MODEL_VERTEX_PROCESSING_FLAGS (aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices)
+#endif
+
+// The triangle and vertex order is left to OptimizeMesh
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate           | \
+                            MODEL_VERTEX_PROCESSING_FLAGS   | \
+                            aiProcess_PreTransformVertices  | \
+                            aiProcess_OptimizeMeshes        | \
+                            aiProcess_SortByPType)
+
+// Imports through memory mapped files (assimp_io.h), 0 for the default stdio based IO, to compare the import times
+#define MODEL_IMPORT_MAPPED_IO 1
+
+// .obj files are loaded by obj_loader.h instead of Assimp, 0 to compare them
+#define MODEL_NATIVE_OBJ_LOADER 1
+
+// .gltf and .glb files are loaded by gltf_loader.h instead of Assimp, 0 to compare them
+#define MODEL_NATIVE_GLTF_LOADER 1
+
+// Import flags of the models loaded by the native loaders, so their caches aren't taken for Assimp ones
+// (and the other way around). No Assimp step uses these bits
+#define MODEL_IMPORT_NATIVE_OBJ  0x80000000u
+#define MODEL_IMPORT_NATIVE_GLTF 0x40000000u
+
+// Keeps the node transforms out of the vertices, so the meshes referenced by several nodes are imported once
+#define MODEL_HIERARCHY_IMPORT_FLAGS (aiProcess_Triangulate           | \
+                                      MODEL_VERTEX_PROCESSING_FLAGS   | \
+                                      aiProcess_SortByPType)
+
+VertexBufferLayout MakeModelVertexLayout(bool hasTexCoords, bool hasTangentSpace)
+{
+    VertexBufferLayout vertexBufferLayout = {};
+    vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 0, 3, 0 } );
+    vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 1, 3, 3*sizeof(float) } );
+    vertexBufferLayout.stride = 6 * sizeof(float);
+    if (hasTexCoords)
+    {
+        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride } );
+        vertexBufferLayout.stride += 2 * sizeof(float);
+    }
+    if (hasTangentSpace)
+    {
+        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride } );
+        vertexBufferLayout.stride += 3 * sizeof(float);
+
+        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride } );
+        vertexBufferLayout.stride += 3 * sizeof(float);
+    }
+    return vertexBufferLayout;
+}
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+// Optimizes the triangles of a submesh (with its vertexBufferLayout set) and builds its levels of
+// detail, meshlets and bounds. Lines and points (SortByPType puts them in their own meshes) are left as they are
+static void BuildSubmesh(const char* name, bool triangles, Submesh& submesh, std::vector<float>& vertices, std::vector<u32>& indices)
 {
-    std::vector<float> vertices;
-    std::vector<u32> indices;
+    const u32 strideInFloats = submesh.vertexBufferLayout.stride / sizeof(float);
+    submesh.lods[0] = SubmeshLod{ 0, (u32)indices.size(), 0.0f, 0, 0 };
+    submesh.lodCount = 1;
+    if (triangles)
+    {
+#if MESH_OPTIMIZATION_REPORT
+        const MeshAnalysis before = AnalyzeMesh(vertices, indices, strideInFloats);
+#endif
+        OptimizeMesh(vertices, indices, strideInFloats);
+#if MESH_OPTIMIZATION_REPORT
+        const MeshAnalysis after = AnalyzeMesh(vertices, indices, strideInFloats);
+        ILOG("Submesh %s (%u triangles): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overfetch %.3f -> %.3f, overdraw %.3f -> %.3f",
+             name, (u32)indices.size() / 3,
+             before.vertexCache.acmr, after.vertexCache.acmr, before.vertexCache.atvr, after.vertexCache.atvr,
+             before.vertexFetch.overfetch, after.vertexFetch.overfetch, before.overdraw.overdraw, after.overdraw.overdraw);
+#endif
+
+        BuildLodChain(vertices, strideInFloats, indices, submesh.lods, submesh.lodCount);
+
+        // Only closed surfaces have their clusters culled by facing, open or double sided ones are seen from behind
+        const u32 vertexCount = (u32)vertices.size() / strideInFloats;
+        submesh.closed = true;
+        for (u32 lod = 0; lod < submesh.lodCount; ++lod)
+        {
+            SubmeshLod& submeshLod = submesh.lods[lod];
+            submeshLod.firstMeshlet = (u32)submesh.meshlets.size();
+            BuildMeshlets(indices.data() + submeshLod.firstIndex, submeshLod.indexCount, submeshLod.firstIndex, vertices.data(), strideInFloats, submesh.meshlets);
+            submeshLod.meshletCount = (u32)submesh.meshlets.size() - submeshLod.firstMeshlet;
+            submesh.closed = submesh.closed && IsClosedMesh(indices.data() + submeshLod.firstIndex, submeshLod.indexCount, vertices.data(), vertexCount, strideInFloats);
+        }
+    }
 
-    bool hasTexCoords = false;
-    bool hasTangentSpace = false;
+    submesh.bounds = ComputeBounds(vertices.data(), (u32)vertices.size() / strideInFloats, strideInFloats);
+}
 
-    // process vertices
+// Converts an aiMesh into the float vertices and the indices of a submesh, encoded once the
+// bounds of the whole mesh are known. Runs on the job system, so it only touches its own submesh.
+void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Submesh& submesh, std::vector<float>& vertices, std::vector<u32>& indices, MeshKernelTimings& timings)
+{
+    const bool triangles = mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE;
+    const bool hasTexCoords = mesh->mTextureCoords[0] != nullptr;
+#if MODEL_ENGINE_MESH_KERNELS
+    const bool hasTangentSpace = hasTexCoords && triangles;
+#else
+    const bool hasTangentSpace = mesh->mTangents != nullptr && mesh->mBitangents != nullptr;
+#endif
+    const u32 strideInFloats = 6 + (hasTexCoords ? 2 : 0) + (hasTangentSpace ? 6 : 0);
+
+    // process vertices, straight into their place of the interleaved buffer
+    vertices.resize(mesh->mNumVertices * strideInFloats);
     for(unsigned int i = 0; i < mesh->mNumVertices; i++)
     {
-        vertices.push_back(mesh->mVertices[i].x);
-        vertices.push_back(mesh->mVertices[i].y);
-        vertices.push_back(mesh->mVertices[i].z);
-        vertices.push_back(mesh->mNormals[i].x);
-        vertices.push_back(mesh->mNormals[i].y);
-        vertices.push_back(mesh->mNormals[i].z);
-
-        if(mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+        float* vertex = &vertices[i * strideInFloats];
+        memcpy(vertex, &mesh->mVertices[i], 3 * sizeof(float));
+        if (mesh->mNormals) // Lines and points have none, and without Assimp's steps neither do the triangles of some files
+            memcpy(vertex + 3, &mesh->mNormals[i], 3 * sizeof(float));
+        else
+            memset(vertex + 3, 0, 3 * sizeof(float));
+
+        if(hasTexCoords)
         {
-            hasTexCoords = true;
-            vertices.push_back(mesh->mTextureCoords[0][i].x);
-            vertices.push_back(mesh->mTextureCoords[0][i].y);
+            vertex[6] = mesh->mTextureCoords[0][i].x;
+            vertex[7] = mesh->mTextureCoords[0][i].y;
         }
 
-        if(mesh->mTangents != nullptr && mesh->mBitangents)
+#if !MODEL_ENGINE_MESH_KERNELS
+        if(hasTangentSpace)
         {
-            hasTangentSpace = true;
-            vertices.push_back(mesh->mTangents[i].x);
-            vertices.push_back(mesh->mTangents[i].y);
-            vertices.push_back(mesh->mTangents[i].z);
+            memcpy(vertex + 8, &mesh->mTangents[i], 3 * sizeof(float));
 
             // For some reason ASSIMP gives me the bitangents flipped.
             // Maybe it's my fault, but when I generate my own geometry
@@ -45,53 +155,65 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
             // I think that (even if the documentation says the opposite)
             // it returns a left-handed tangent space matrix.
             // SOLUTION: I invert the components of the bitangent here.
-            vertices.push_back(-mesh->mBitangents[i].x);
-            vertices.push_back(-mesh->mBitangents[i].y);
-            vertices.push_back(-mesh->mBitangents[i].z);
+            // (GenerateTangentSpace computes them along +V already)
+            vertex[11] = -mesh->mBitangents[i].x;
+            vertex[12] = -mesh->mBitangents[i].y;
+            vertex[13] = -mesh->mBitangents[i].z;
         }
+#endif
     }
 
     // process indices
+    u32 indexCount = 0;
+    for(unsigned int i = 0; i < mesh->mNumFaces; i++)
+        indexCount += mesh->mFaces[i].mNumIndices;
+    indices.resize(indexCount);
+    u32* index = indices.data();
     for(unsigned int i = 0; i < mesh->mNumFaces; i++)
     {
-        aiFace face = mesh->mFaces[i];
-        for(unsigned int j = 0; j < face.mNumIndices; j++)
-        {
-            indices.push_back(face.mIndices[j]);
-        }
+        memcpy(index, mesh->mFaces[i].mIndices, mesh->mFaces[i].mNumIndices * sizeof(u32));
+        index += mesh->mFaces[i].mNumIndices;
     }
 
-    // store the proper (previously proceessed) material for this mesh
-    submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+#if MODEL_ENGINE_MESH_KERNELS
+    // Same order as Assimp's steps: normals smoothed over the copies of each position, then
+    // the copies welded, and the tangent space of the welded vertices
+    if (triangles)
+    {
+        if (!mesh->mNormals)
+            GenerateSmoothNormals(vertices.data(), mesh->mNumVertices, strideInFloats, indices.data(), indexCount, &timings);
+        WeldVertices(vertices, strideInFloats, indices, &timings);
+        if (hasTangentSpace)
+            GenerateTangentSpace(vertices, indices, &timings);
+    }
+#endif
 
-    // create the vertex format
-    VertexBufferLayout vertexBufferLayout = {};
-    vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 0, 3, 0 } );
-    vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 1, 3, 3*sizeof(float) } );
-    vertexBufferLayout.stride = 6 * sizeof(float);
-    if (hasTexCoords)
+    submesh.vertexBufferLayout = MakeModelVertexLayout(hasTexCoords, hasTangentSpace);
+    BuildSubmesh(mesh->mName.C_Str(), triangles, submesh, vertices, indices);
+}
+
+// Encodes the vertices (as MODEL_VERTEX_ENCODING) and indices of a submesh
+static void EncodeSubmesh(const VertexDecoding& decoding, const std::vector<float>& vertices, const std::vector<u32>& indices, Submesh& submesh)
+{
+    submesh.vertexCount = (u32)(vertices.size() * sizeof(float)) / submesh.vertexBufferLayout.stride;
+    submesh.indexCount = (u32)indices.size();
+
+    if (MODEL_VERTEX_ENCODING == VERTEX_ENCODING_COMPACT)
     {
-        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride } );
-        vertexBufferLayout.stride += 2 * sizeof(float);
+        VertexBufferLayout floatLayout = submesh.vertexBufferLayout;
+        EncodeCompactVertices(vertices.data(), submesh.vertexCount, floatLayout, decoding, submesh.vertexBufferLayout, submesh.vertices);
     }
-    if (hasTangentSpace)
+    else
     {
-        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride } );
-        vertexBufferLayout.stride += 3 * sizeof(float);
-
-        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride } );
-        vertexBufferLayout.stride += 3 * sizeof(float);
+        submesh.vertices.resize(vertices.size() * sizeof(float));
+        memcpy(submesh.vertices.data(), vertices.data(), submesh.vertices.size());
     }
 
-    // add the submesh into the mesh
-    Submesh submesh = {};
-    submesh.vertexBufferLayout = vertexBufferLayout;
-    submesh.vertices.swap(vertices);
-    submesh.indices.swap(indices);
-    myMesh->submeshes.push_back( submesh );
+    submesh.indexType = EncodeIndices(indices.data(), submesh.indexCount, submesh.vertexCount, submesh.indices);
 }
 
-void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial, String directory)
+// Only collects the texture paths, the textures are loaded once back on the main thread
+void ProcessAssimpMaterial(aiMaterial *material, Material& myMaterial, std::string* texturePaths, const std::string& directory)
 {
     aiString name;
     aiColor3D diffuseColor;
@@ -109,141 +231,503 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
     myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
     myMaterial.smoothness = shininess / 256.0f;
 
-    aiString aiFilename;
-    if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+    // Same order as the material texture slots
+    const aiTextureType textureTypes[MATERIAL_TEXTURE_SLOTS] = {
+        aiTextureType_DIFFUSE,
+        aiTextureType_EMISSIVE,
+        aiTextureType_SPECULAR,
+        aiTextureType_NORMALS,
+        aiTextureType_HEIGHT
+    };
+    for (u32 slot = 0; slot < MATERIAL_TEXTURE_SLOTS; ++slot)
     {
-        material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
+        aiString aiFilename;
+        if (material->GetTextureCount(textureTypes[slot]) > 0)
+        {
+            material->GetTexture(textureTypes[slot], 0, &aiFilename);
+            texturePaths[slot] = directory + "/" + aiFilename.C_Str();
+        }
     }
-    if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
+
+    //myMaterial.createNormalFromBump();
+}
+
+// Collects the meshes of the node hierarchy, in the order they become submeshes
+void ProcessAssimpNode(const aiScene* scene, aiNode *node, std::vector<aiMesh*>& meshes)
+{
+    // process all the node's meshes (if any)
+    for(unsigned int i = 0; i < node->mNumMeshes; i++)
     {
-        material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
+        meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
     }
-    if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
+
+    // then do the same for each of its children
+    for(unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
+        ProcessAssimpNode(scene, node->mChildren[i], meshes);
     }
-    if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
+}
+
+// Collects a node per mesh reference of the hierarchy, with the transform from the root
+void ProcessAssimpNodeHierarchy(aiNode *node, const glm::mat4& parentTransform, std::vector<ModelNode>& nodes)
+{
+    // Assimp matrices are row major
+    glm::mat4 transform = parentTransform * glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+
+    for(unsigned int i = 0; i < node->mNumMeshes; i++)
     {
-        material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
+        nodes.push_back(ModelNode{ node->mMeshes[i], transform });
     }
-    if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
+
+    for(unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+        ProcessAssimpNodeHierarchy(node->mChildren[i], transform, nodes);
     }
+}
 
-    //myMaterial.createNormalFromBump();
+struct ProcessAssimpMeshesData
+{
+    const aiScene*        scene;
+    aiMesh**              meshes;
+    Submesh*              submeshes;
+    std::vector<float>*   vertices; // Per submesh, until encoded
+    std::vector<u32>*     indices;
+    const VertexDecoding* decodings;
+    const Material*       materials; // Of the native loaders' submeshes, indexed by materialIdx
+    const u32*            materialIdx;
+    MeshKernelTimings*    kernelTimings; // Per submesh
+};
+
+static void ProcessAssimpMeshes(u32 begin, u32 end, void* data)
+{
+    ProcessAssimpMeshesData* processData = (ProcessAssimpMeshesData*)data;
+    for (u32 i = begin; i < end; ++i)
+        ProcessAssimpMesh(processData->scene, processData->meshes[i], processData->submeshes[i], processData->vertices[i], processData->indices[i], processData->kernelTimings[i]);
 }
 
-void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+static void BuildImportedSubmeshes(u32 begin, u32 end, void* data)
 {
-    // process all the node's meshes (if any)
-    for(unsigned int i = 0; i < node->mNumMeshes; i++)
+    ProcessAssimpMeshesData* processData = (ProcessAssimpMeshesData*)data;
+    for (u32 i = begin; i < end; ++i)
+        BuildSubmesh(processData->materials[processData->materialIdx[i]].name.c_str(), true, processData->submeshes[i], processData->vertices[i], processData->indices[i]);
+}
+
+static void AddKernelTimings(MeshKernelTimings& total, const MeshKernelTimings& timings)
+{
+    total.normals += timings.normals;
+    total.tangents += timings.tangents;
+    total.welding += timings.welding;
+}
+
+static void EncodeSubmeshes(u32 begin, u32 end, void* data)
+{
+    ProcessAssimpMeshesData* processData = (ProcessAssimpMeshesData*)data;
+    for (u32 i = begin; i < end; ++i)
+        EncodeSubmesh(processData->decodings[i], processData->vertices[i], processData->indices[i], processData->submeshes[i]);
+}
+
+enum ModelLoader
+{
+    MODEL_LOADER_ASSIMP,
+    MODEL_LOADER_OBJ,
+    MODEL_LOADER_GLTF,
+};
+
+static ModelLoader GetModelLoader(const char* filename)
+{
+    const char* extension = strrchr(filename, '.');
+    if (!extension)
+        return MODEL_LOADER_ASSIMP;
+
+    // Any case, as exporters and file systems spell them (.Obj, .GLB...)
+    if (MODEL_NATIVE_OBJ_LOADER && _stricmp(extension, ".obj") == 0)
+        return MODEL_LOADER_OBJ;
+    if (MODEL_NATIVE_GLTF_LOADER && (_stricmp(extension, ".gltf") == 0 || _stricmp(extension, ".glb") == 0))
+        return MODEL_LOADER_GLTF;
+    return MODEL_LOADER_ASSIMP;
+}
+
+u32 GetModelImportFlags(const char* filename, bool hierarchy)
+{
+    switch (GetModelLoader(filename))
     {
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        case MODEL_LOADER_OBJ:  return MODEL_IMPORT_NATIVE_OBJ;
+        case MODEL_LOADER_GLTF: return MODEL_IMPORT_NATIVE_GLTF;
+        default:                return hierarchy ? MODEL_HIERARCHY_IMPORT_FLAGS : MODEL_IMPORT_FLAGS;
     }
+}
 
-    // then do the same for each of its children
-    for(unsigned int i = 0; i < node->mNumChildren; i++)
+// Converts the meshes of the file, each one into the float vertices and indices of a submesh
+static bool ImportAssimpMeshes(const char* filename, ModelData& data, std::vector<std::vector<float>>& vertices, std::vector<std::vector<u32>>& indices, MeshKernelTimings& kernelTimings)
+{
+    Assimp::Importer importer;
+#if MODEL_IMPORT_MAPPED_IO
+    importer.SetIOHandler(new MappedIOSystem); // Owned by the importer
+#endif
+
+    const aiScene* scene = importer.ReadFile(filename, GetModelImportFlags(filename, data.hierarchy));
+    if (!scene)
     {
-        ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        ELOG("Error loading mesh %s: %s", filename, importer.GetErrorString());
+        return false;
     }
+
+    // Not the frame arena's MakePath, this can run outside of the main thread
+    std::string directory = filename;
+    size_t separator = directory.find_last_of("/\\");
+    directory = separator == std::string::npos ? "." : directory.substr(0, separator);
+
+    // Create a list of materials
+    data.materials.resize(scene->mNumMaterials);
+    data.texturePaths.resize(scene->mNumMaterials * MATERIAL_TEXTURE_SLOTS);
+    for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+    {
+        ProcessAssimpMaterial(scene->mMaterials[i], data.materials[i], &data.texturePaths[i * MATERIAL_TEXTURE_SLOTS], directory);
+    }
+
+    // Every mesh of the file once, referenced by the nodes, or as many times as the nodes reference them (baked)
+    std::vector<aiMesh*> assimpMeshes;
+    if (data.hierarchy)
+    {
+        assimpMeshes.assign(scene->mMeshes, scene->mMeshes + scene->mNumMeshes);
+        ProcessAssimpNodeHierarchy(scene->mRootNode, glm::mat4(1.0f), data.nodes);
+    }
+    else
+    {
+        ProcessAssimpNode(scene, scene->mRootNode, assimpMeshes);
+    }
+
+    // Convert the meshes in parallel, each one into its own submesh
+    const u32 submeshCount = (u32)assimpMeshes.size();
+    vertices.resize(submeshCount);
+    indices.resize(submeshCount);
+    data.submeshes.resize(submeshCount);
+    std::vector<MeshKernelTimings> submeshTimings(submeshCount);
+    ProcessAssimpMeshesData processData = { scene, assimpMeshes.data(), data.submeshes.data(), vertices.data(), indices.data() };
+    processData.kernelTimings = submeshTimings.data();
+    ParallelFor(submeshCount, 1, ProcessAssimpMeshes, &processData);
+    for (const MeshKernelTimings& timings : submeshTimings)
+        AddKernelTimings(kernelTimings, timings);
+
+    // store the proper (previously proceessed) material for each submesh
+    for (aiMesh* assimpMesh : assimpMeshes)
+        data.materialIdx.push_back(assimpMesh->mMaterialIndex);
+
+    return true;
 }
 
-u32 LoadModel(App* app, const char* filename)
+// Same as ImportAssimpMeshes with the native loaders: the OBJ one gives a submesh per material,
+// the glTF one a submesh per primitive (and the nodes in hierarchy imports). OBJ files have no
+// node hierarchy, in hierarchy imports every submesh gets a node at the origin
+static bool ImportNativeMeshes(const char* filename, ModelLoader loader, ModelData& data, std::vector<std::vector<float>>& vertices, std::vector<std::vector<u32>>& indices, MeshKernelTimings& kernelTimings)
 {
-    const aiScene* scene = aiImportFile(filename,
-                                        aiProcess_Triangulate           |
-                                        aiProcess_GenSmoothNormals      |
-                                        aiProcess_CalcTangentSpace      |
-                                        aiProcess_JoinIdenticalVertices |
-                                        aiProcess_PreTransformVertices  |
-                                        aiProcess_ImproveCacheLocality  |
-                                        aiProcess_OptimizeMeshes        |
-                                        aiProcess_SortByPType);
+    std::vector<ImportedMesh> importedMeshes;
+    if (!(loader == MODEL_LOADER_OBJ ? ImportObj(filename, data, importedMeshes) : ImportGltf(filename, data, importedMeshes)))
+        return false;
+
+    const u32 submeshCount = (u32)importedMeshes.size();
+    vertices.resize(submeshCount);
+    indices.resize(submeshCount);
+    data.submeshes.resize(submeshCount);
+    for (u32 i = 0; i < submeshCount; ++i)
+    {
+        vertices[i].swap(importedMeshes[i].vertices);
+        indices[i].swap(importedMeshes[i].indices);
+        data.submeshes[i].vertexBufferLayout = MakeModelVertexLayout(importedMeshes[i].hasTexCoords, importedMeshes[i].hasTexCoords);
+        AddKernelTimings(kernelTimings, importedMeshes[i].kernelTimings);
+        if (data.hierarchy && loader == MODEL_LOADER_OBJ)
+            data.nodes.push_back(ModelNode{ i, glm::mat4(1.0f) });
+    }
 
-    if (!scene)
+    ProcessAssimpMeshesData processData = {};
+    processData.submeshes = data.submeshes.data();
+    processData.vertices = vertices.data();
+    processData.indices = indices.data();
+    processData.materials = data.materials.data();
+    processData.materialIdx = data.materialIdx.data();
+    ParallelFor(submeshCount, 1, BuildImportedSubmeshes, &processData);
+    return true;
+}
+
+// Everything but the GL work, so it can run on the job system
+static bool ImportModel(const char* filename, ModelData& data)
+{
+    const ModelLoader loader = GetModelLoader(filename);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<float>> vertices;
+    std::vector<std::vector<u32>> indices;
+    MeshKernelTimings kernelTimings;
+    bool imported = loader == MODEL_LOADER_ASSIMP ? ImportAssimpMeshes(filename, data, vertices, indices, kernelTimings)
+                                                  : ImportNativeMeshes(filename, loader, data, vertices, indices, kernelTimings);
+    if (!imported)
+        return false;
+
+    // Positions are quantized in the AABB of the whole mesh, so its instances decode all the submeshes alike.
+    // In hierarchy imports every submesh is a mesh, with its own AABB
+    const u32 submeshCount = (u32)data.submeshes.size();
+    glm::vec3 aabbMin = glm::vec3(0.0f), aabbMax = glm::vec3(0.0f);
+    for (u32 i = 0; i < submeshCount; ++i)
     {
-        ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-        return UINT32_MAX;
+        aabbMin = i == 0 ? data.submeshes[i].bounds.aabbMin : glm::min(aabbMin, data.submeshes[i].bounds.aabbMin);
+        aabbMax = i == 0 ? data.submeshes[i].bounds.aabbMax : glm::max(aabbMax, data.submeshes[i].bounds.aabbMax);
     }
+    data.vertexDecodings.resize(submeshCount);
+    for (u32 i = 0; i < submeshCount; ++i)
+    {
+        const BoundingVolume& bounds = data.submeshes[i].bounds;
+        data.vertexDecodings[i] = data.hierarchy ? MakeVertexDecoding(MODEL_VERTEX_ENCODING, bounds.aabbMin, bounds.aabbMax)
+                                                 : MakeVertexDecoding(MODEL_VERTEX_ENCODING, aabbMin, aabbMax);
+    }
+    ProcessAssimpMeshesData processData = {};
+    processData.submeshes = data.submeshes.data();
+    processData.vertices = vertices.data();
+    processData.indices = indices.data();
+    processData.decodings = data.vertexDecodings.data();
+    ParallelFor(submeshCount, 1, EncodeSubmeshes, &processData);
 
+    u32 indicesOffset = 0;
+    u32 verticesOffset = 0;
+    for (Submesh& submesh : data.submeshes)
+    {
+        submesh.vertexOffset = verticesOffset;
+        verticesOffset += (u32)submesh.vertices.size();
+        submesh.indexOffset = indicesOffset;
+        indicesOffset += (u32)submesh.indices.size();
+    }
+
+    // All the loaders go through the same processing, so the times compare the loaders (and the Assimp IO)
+    auto end = std::chrono::high_resolution_clock::now();
+    ILOG("Imported %s in %.2f ms (%s)", filename, std::chrono::duration<f32, std::milli>(end - start).count(),
+         loader == MODEL_LOADER_OBJ ? "OBJ loader" : loader == MODEL_LOADER_GLTF ? "glTF loader" :
+         MODEL_IMPORT_MAPPED_IO ? "Assimp, mapped IO" : "Assimp, stdio IO");
+    ILOG("Mesh kernels of %s: normals %.2f ms, tangents %.2f ms, welding %.2f ms", filename,
+         kernelTimings.normals, kernelTimings.tangents, kernelTimings.welding);
+
+    return true;
+}
+
+// Reads the model from the cache, or imports it and writes the cache
+static bool ReadModel(const char* filename, ModelData& data, bool reimport = false)
+{
+    const u32 importFlags = GetModelImportFlags(filename, data.hierarchy);
+    if (!reimport && ReadModelCache(filename, importFlags, data))
+        return true;
+
+    // What the import reads is what the cache depends on (Assimp with stdio IO reads around
+    // the file cache, then only the model itself is known)
+    BeginFileRecording();
+    const bool imported = ImportModel(filename, data);
+    EndFileRecording(data.sourceFiles);
+    if (!imported)
+        return false;
+    if (std::find(data.sourceFiles.begin(), data.sourceFiles.end(), filename) == data.sourceFiles.end())
+        data.sourceFiles.push_back(filename);
+
+    SaveModelCache(filename, importFlags, data);
+    return true;
+}
+
+bool ReadModelData(const char* filename, bool hierarchy, bool reimport, ModelData& data)
+{
+    data.hierarchy = hierarchy;
+    return ReadModel(filename, data, reimport);
+}
+
+// Per material texture slot: albedo, emissive, specular, normals, bump
+static const u32 MaterialTextureUsageFlags[MATERIAL_TEXTURE_SLOTS] = { TEXTURE_USAGE_SRGB, TEXTURE_USAGE_SRGB, 0, TEXTURE_USAGE_NORMAL_MAP, 0 };
+
+u32 GetMaterialTextureUsageFlags(u32 slot)
+{
+    return MaterialTextureUsageFlags[slot];
+}
+
+static u32 CreateEmptyModel(App* app)
+{
     app->meshes.push_back(Mesh{});
-    Mesh& mesh = app->meshes.back();
+    app->meshes.back().vertexDecoding = MakeVertexDecoding(VERTEX_ENCODING_FLOAT, glm::vec3(0.0f), glm::vec3(0.0f));
     u32 meshIdx = (u32)app->meshes.size() - 1u;
 
     app->models.push_back(Model{});
     Model& model = app->models.back();
     model.meshIdx = meshIdx;
-    u32 modelIdx = (u32)app->models.size() - 1u;
+    return (u32)app->models.size() - 1u;
+}
 
-    String directory = GetDirectoryPart(MakeString(filename));
+// Creates the materials (and their textures) of the model, returns the index of the first one
+static u32 CreateMaterials(App* app, ModelData& data, bool asyncTextures)
+{
+    // Missing textures use the placeholders, in slot order
+    const u32 placeholders[MATERIAL_TEXTURE_SLOTS] = { app->whiteTexIdx, app->blackTexIdx, app->whiteTexIdx, app->normalTexIdx, app->blackTexIdx };
 
-    // Create a list of materials
     u32 baseMeshMaterialIndex = (u32)app->materials.size();
-    for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+    for (u32 i = 0; i < data.materials.size(); ++i)
     {
-        app->materials.push_back(Material{});
-        Material& material = app->materials.back();
-        ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
-    }
+        Material& material = data.materials[i];
+        u32* textureSlots[MATERIAL_TEXTURE_SLOTS] = {
+            &material.albedoTextureIdx,
+            &material.emissiveTextureIdx,
+            &material.specularTextureIdx,
+            &material.normalsTextureIdx,
+            &material.bumpTextureIdx
+        };
+        for (u32 slot = 0; slot < MATERIAL_TEXTURE_SLOTS; ++slot)
+        {
+            const std::string& texturePath = data.texturePaths[i * MATERIAL_TEXTURE_SLOTS + slot];
+            u32 textureIdx = UINT32_MAX;
+            if (!texturePath.empty())
+                textureIdx = asyncTextures ? LoadTexture2DAsync(app, texturePath.c_str(), placeholders[slot], MaterialTextureUsageFlags[slot]) : LoadTexture2D(app, texturePath.c_str(), MaterialTextureUsageFlags[slot]);
+            if (textureIdx != UINT32_MAX)
+                AddTextureRef(app, textureIdx);
+            *textureSlots[slot] = textureIdx != UINT32_MAX ? textureIdx : placeholders[slot];
+        }
 
-    ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+        app->materials.push_back(material);
+    }
 
-    aiReleaseImport(scene);
+    return baseMeshMaterialIndex;
+}
 
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
+// Uploads the geometry of the submeshes [begin, end) of the data as the mesh of a model
+static void CreateModelMesh(App* app, ModelData& data, u32 begin, u32 end, u32 baseMeshMaterialIndex, u32 modelIdx)
+{
+    Model& model = app->models[modelIdx];
+    Mesh& mesh = app->meshes[model.meshIdx];
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    // Moved before allocating, the upload queue reads the vertices and indices from there
+    mesh.submeshes.reserve(end - begin);
+    for (u32 i = begin; i < end; ++i)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize  += mesh.submeshes[i].indices.size()  * sizeof(u32);
+        mesh.submeshes.push_back(std::move(data.submeshes[i]));
+        Submesh& submesh = mesh.submeshes.back();
+        submesh.geometry = AllocateGeometry(app, submesh.vertexBufferLayout, submesh.vertices.data(), submesh.vertexCount, submesh.indices.data(), submesh.indexCount, submesh.indexType);
+
+        model.materialIdx.push_back(baseMeshMaterialIndex + data.materialIdx[i]);
     }
 
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+    if (begin < end)
+        mesh.vertexDecoding = data.vertexDecodings[begin];
+    ComputeMeshBounds(mesh);
+    ComputeMeshLods(mesh);
+    model.state = ASSET_LOADED;
+}
+
+static void CreateModelFromData(App* app, ModelData& data, u32 modelIdx, bool asyncTextures)
+{
+    u32 baseMeshMaterialIndex = CreateMaterials(app, data, asyncTextures);
+    CreateModelMesh(app, data, 0, (u32)data.submeshes.size(), baseMeshMaterialIndex, modelIdx);
+}
+
+// A model per submesh and an entity per node, returns the index of the first entity
+static u32 CreateHierarchyFromData(App* app, ModelData& data, const glm::mat4& transform, bool asyncTextures)
+{
+    u32 baseMeshMaterialIndex = CreateMaterials(app, data, asyncTextures);
 
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+    const u32 firstModel = (u32)app->models.size();
+    for (u32 i = 0; i < data.submeshes.size(); ++i)
+        CreateModelMesh(app, data, i, i + 1, baseMeshMaterialIndex, CreateEmptyModel(app));
 
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
+    // Nodes referencing the same mesh are entities of the same model, so they are drawn instanced
+    const u32 firstEntity = (u32)app->entities.size();
+    for (const ModelNode& node : data.nodes)
+        app->entities.push_back(Entity(transform * node.transform, firstModel + node.submeshIdx));
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-    {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
+    return firstEntity;
+}
+
+u32 LoadModel(App* app, const char* filename)
+{
+    ModelData data;
+    if (!ReadModel(filename, data))
+        return UINT32_MAX;
+
+    u32 modelIdx = CreateEmptyModel(app);
+    CreateModelFromData(app, data, modelIdx, false);
+    return modelIdx;
+}
+
+u32 LoadModelHierarchy(App* app, const char* filename, const glm::mat4& transform, u32* entityCount)
+{
+    ModelData data;
+    data.hierarchy = true;
+    *entityCount = 0;
+    if (!ReadModel(filename, data))
+        return UINT32_MAX;
 
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
+    *entityCount = (u32)data.nodes.size();
+    return CreateHierarchyFromData(app, data, transform, false);
+}
+
+struct ModelLoadRequest
+{
+    App*        app;
+    u32         modelIdx;  // UINT32_MAX for hierarchy loads, whose models are created once read
+    glm::mat4   transform; // Of the entities of hierarchy loads
+    std::string filename;
+    ModelData   data;
+    bool        loaded;
+};
+
+static void FinishModelLoadJob(void* data)
+{
+    ModelLoadRequest* request = (ModelLoadRequest*)data;
+    App* app = request->app;
+
+    if (request->data.hierarchy)
+    {
+        if (request->loaded)
+            CreateHierarchyFromData(app, request->data, request->transform, true);
+        else
+            ELOG("Error loading the hierarchy of %s", request->filename.c_str());
+    }
+    else if (request->loaded)
+    {
+        CreateModelFromData(app, request->data, request->modelIdx, true);
+    }
+    else
+    {
+        app->models[request->modelIdx].state = ASSET_FAILED;
     }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    app->pendingAssetLoads--;
+    delete request;
+}
+
+static void ReadModelJob(void* data)
+{
+    ModelLoadRequest* request = (ModelLoadRequest*)data;
+    request->loaded = ReadModel(request->filename.c_str(), request->data);
 
+    // Materials and geometry upload need the GL context
+    Job finish = { FinishModelLoadJob, request, NULL, JOB_QUEUE_MAIN_THREAD };
+    RunJobs(&finish, 1);
+}
+
+static void StartModelLoad(App* app, const char* filename, u32 modelIdx, bool hierarchy, const glm::mat4& transform)
+{
+    ModelLoadRequest* request = new ModelLoadRequest;
+    request->app = app;
+    request->modelIdx = modelIdx;
+    request->transform = transform;
+    request->filename = filename;
+    request->data.hierarchy = hierarchy;
+    request->loaded = false;
+    app->pendingAssetLoads++;
+
+    Job read = { ReadModelJob, request, NULL, JOB_QUEUE_BACKGROUND };
+    RunJobs(&read, 1);
+}
+
+u32 LoadModelAsync(App* app, const char* filename)
+{
+    u32 modelIdx = CreateEmptyModel(app);
+    app->models[modelIdx].state = ASSET_LOADING;
+
+    StartModelLoad(app, filename, modelIdx, false, glm::mat4(1.0f));
     return modelIdx;
-}
\ No newline at end of file
+}
+
+void LoadModelHierarchyAsync(App* app, const char* filename, const glm::mat4& transform)
+{
+    StartModelLoad(app, filename, UINT32_MAX, true, transform);
+}
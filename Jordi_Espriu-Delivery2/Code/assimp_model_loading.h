@@ -7,5 +7,52 @@
 #endif // !_CRT_SECURE_NO_WARNINGS
 
 struct App;
+struct ModelData;
+struct VertexBufferLayout;
 
-u32 LoadModel(App* app, const char* filename);
\ No newline at end of file
+u32 LoadModel(App* app, const char* filename);
+
+/**
+ * Returns the index of a model that has no submeshes (so entities using it draw
+ * nothing) until it is read from the cache or imported on the job system, and its
+ * geometry uploaded at the end of a frame. Its textures are loaded asynchronously too.
+ */
+u32 LoadModelAsync(App* app, const char* filename);
+
+/**
+ * Imports the file keeping its node hierarchy: a model per mesh of the file, loaded
+ * once however many nodes reference it, and an entity per node reference with the node
+ * transform (under 'transform'), so the repeated meshes are drawn instanced. Returns the
+ * index of the first entity, the rest follow it, or UINT32_MAX on failure.
+ */
+u32 LoadModelHierarchy(App* app, const char* filename, const glm::mat4& transform, u32* entityCount);
+
+/**
+ * LoadModelHierarchy on the job system. The models and the entities are only created
+ * once the file is read, at the end of a frame.
+ */
+void LoadModelHierarchyAsync(App* app, const char* filename, const glm::mat4& transform);
+
+/**
+ * Layout of the float vertices of the imported meshes, before they are encoded: position,
+ * normal, then the texture coordinates and the tangent and bitangent if present.
+ */
+VertexBufferLayout MakeModelVertexLayout(bool hasTexCoords, bool hasTangentSpace);
+
+/**
+ * Reads the data of a model as the loads do, from the cache or importing it and writing the
+ * cache, without any GL work. With 'reimport' the cache is ignored and written again. Used by
+ * the cooker, which packs the caches.
+ */
+bool ReadModelData(const char* filename, bool hierarchy, bool reimport, ModelData& data);
+
+/**
+ * Flags the model is imported with, which its cache is valid for.
+ */
+u32 GetModelImportFlags(const char* filename, bool hierarchy);
+
+/**
+ * Usage flags (TextureUsageFlags) the textures of a material slot are loaded with, besides
+ * TEXTURE_USAGE_FLIP_VERTICALLY, which the texture loads add.
+ */
+u32 GetMaterialTextureUsageFlags(u32 slot);
@@ -1,5 +1,6 @@
 #include "buffer_management.h"
 #include "engine.h"
+#include "gl_extensions.h"
 
 bool IsPowerOf2(u32 value)
 {
@@ -22,6 +23,10 @@ Buffer CreateBuffer(u32 size, GLenum type, GLenum usage)
     glBufferData(type, buffer.size, NULL, usage);
     glBindBuffer(type, 0);
 
+    buffer.regionSize = size;
+    buffer.regionCount = 1;
+    buffer.regionEnd = size;
+
     return buffer;
 }
 
@@ -39,6 +44,7 @@ void MapBuffer(Buffer& buffer, GLenum access)
     glBindBuffer(buffer.type, buffer.handle);
     buffer.data = (u8*)glMapBuffer(buffer.type, access);
     buffer.head = 0;
+    buffer.regionEnd = buffer.size;
 }
 
 void UnmapBuffer(Buffer& buffer)
@@ -47,6 +53,95 @@ void UnmapBuffer(Buffer& buffer)
     glBindBuffer(buffer.type, 0);
 }
 
+Buffer CreateRingBuffer(u32 regionSize, u32 regionCount, GLenum type)
+{
+    ASSERT(regionCount > 0 && regionCount <= MAX_BUFFER_REGIONS, "Invalid number of buffer regions");
+
+    // 256 is the largest offset alignment required by any implementation
+    Buffer buffer = {};
+    buffer.type = type;
+    buffer.regionSize = Align(regionSize, 256);
+    buffer.regionCount = regionCount;
+    buffer.size = buffer.regionSize * regionCount;
+
+    glGenBuffers(1, &buffer.handle);
+    glBindBuffer(type, buffer.handle);
+
+    if (GLExt.bufferStorage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(type, buffer.size, NULL, flags);
+        buffer.data = glMapBufferRange(type, 0, buffer.size, flags);
+        buffer.persistent = buffer.data != NULL;
+
+        // Storage is immutable, glBufferData can't reallocate it, so the fallback needs a new buffer
+        if (!buffer.persistent)
+        {
+            glDeleteBuffers(1, &buffer.handle);
+            glGenBuffers(1, &buffer.handle);
+            glBindBuffer(type, buffer.handle);
+        }
+    }
+
+    if (!buffer.persistent)
+    {
+        // Fallback: the buffer is mapped unsynchronized every frame, fences still protect the regions
+        glBufferData(type, buffer.size, NULL, GL_STREAM_DRAW);
+        buffer.data = NULL;
+    }
+
+    glBindBuffer(type, 0);
+
+    return buffer;
+}
+
+void BeginBufferRegion(Buffer& buffer)
+{
+    GLsync& fence = buffer.regionFences[buffer.regionIdx];
+    if (fence)
+    {
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+        {
+            buffer.fenceWaitCount++;
+            do {
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1ms
+            } while (result == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fence = NULL;
+    }
+
+    if (!buffer.persistent)
+    {
+        glBindBuffer(buffer.type, buffer.handle);
+        buffer.data = glMapBufferRange(buffer.type, 0, buffer.size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(buffer.type, 0);
+    }
+
+    buffer.head = buffer.regionIdx * buffer.regionSize;
+    buffer.regionEnd = buffer.head + buffer.regionSize;
+}
+
+void UnmapBufferRegion(Buffer& buffer)
+{
+    if (!buffer.persistent && buffer.data)
+    {
+        glBindBuffer(buffer.type, buffer.handle);
+        glUnmapBuffer(buffer.type);
+        glBindBuffer(buffer.type, 0);
+        buffer.data = NULL;
+    }
+}
+
+void EndBufferRegion(Buffer& buffer)
+{
+    UnmapBufferRegion(buffer);
+
+    buffer.regionFences[buffer.regionIdx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    buffer.regionIdx = (buffer.regionIdx + 1) % buffer.regionCount;
+}
+
 void AlignHead(Buffer& buffer, u32 alignment)
 {
     ASSERT(IsPowerOf2(alignment), "The alignment must be a power of 2");
@@ -57,6 +152,7 @@ void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
 {
     ASSERT(buffer.data != NULL, "The buffer must be mapped first");
     AlignHead(buffer, alignment);
+    ASSERT(buffer.head + size <= buffer.regionEnd, "Trying to push more data than the buffer (region) can hold");
     memcpy((u8*)buffer.data + buffer.head, data, size);
     buffer.head += size;
 }
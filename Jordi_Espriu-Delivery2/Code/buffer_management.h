@@ -18,6 +18,25 @@ void MapBuffer(Buffer& buffer, GLenum access);
 
 void UnmapBuffer(Buffer& buffer);
 
+/**
+ * Creates a buffer split in regionCount regions of regionSize bytes. If the driver
+ * supports it, the buffer is persistently mapped, so there is no map/unmap per frame.
+ * Each frame, BeginBufferRegion waits (if needed) until the GPU is done with the next
+ * region and EndBufferRegion fences it. The Push* functions work as with MapBuffer,
+ * and buffer.head is an absolute offset that can be used with glBindBufferRange.
+ */
+Buffer CreateRingBuffer(u32 regionSize, u32 regionCount, GLenum type);
+
+void BeginBufferRegion(Buffer& buffer);
+
+void EndBufferRegion(Buffer& buffer);
+
+/**
+ * Unmaps the current region of a ring buffer that isn't persistently mapped, for when
+ * the GPU has to read it before EndBufferRegion (e.g. as the source of a copy).
+ */
+void UnmapBufferRegion(Buffer& buffer);
+
 void AlignHead(Buffer& buffer, u32 alignment);
 
 void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
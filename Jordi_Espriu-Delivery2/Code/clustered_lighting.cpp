@@ -0,0 +1,245 @@
+#include "clustered_lighting.h"
+#include "engine.h"
+#include "buffer_management.h"
+
+#include <chrono>
+
+struct ClusterBounds
+{
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
+};
+
+static f32 SliceDepth(u32 slice, f32 nearPlane, f32 farPlane)
+{
+    // Exponential slicing, so clusters keep a similar shape along the view direction
+    return nearPlane * powf(farPlane / nearPlane, (f32)slice / (f32)CLUSTER_GRID_Z);
+}
+
+static u32 DepthToSlice(f32 depth, const glm::vec4& depthParams)
+{
+    f32 slice = logf(glm::max(depth, depthParams.x)) * depthParams.z + depthParams.w;
+    return (u32)glm::clamp(slice, 0.0f, (f32)(CLUSTER_GRID_Z - 1));
+}
+
+static void ComputeClusterBounds(ClusterBounds* bounds, const glm::mat4& projection, f32 nearPlane, f32 farPlane)
+{
+    // View space position of a point in NDC (x, y) at a given (positive) depth
+    const f32 invScaleX = 1.0f / projection[0][0];
+    const f32 invScaleY = 1.0f / projection[1][1];
+
+    for (u32 z = 0; z < CLUSTER_GRID_Z; ++z)
+    {
+        f32 depths[2] = { SliceDepth(z, nearPlane, farPlane), SliceDepth(z + 1, nearPlane, farPlane) };
+
+        for (u32 y = 0; y < CLUSTER_GRID_Y; ++y)
+        {
+            f32 ndcY[2] = { -1.0f + 2.0f * y / CLUSTER_GRID_Y, -1.0f + 2.0f * (y + 1) / CLUSTER_GRID_Y };
+
+            for (u32 x = 0; x < CLUSTER_GRID_X; ++x)
+            {
+                f32 ndcX[2] = { -1.0f + 2.0f * x / CLUSTER_GRID_X, -1.0f + 2.0f * (x + 1) / CLUSTER_GRID_X };
+
+                glm::vec3 aabbMin = glm::vec3(FLT_MAX);
+                glm::vec3 aabbMax = glm::vec3(-FLT_MAX);
+                for (f32 depth : depths)
+                    for (f32 nx : ndcX)
+                        for (f32 ny : ndcY)
+                        {
+                            glm::vec3 corner = glm::vec3(nx * depth * invScaleX, ny * depth * invScaleY, -depth);
+                            aabbMin = glm::min(aabbMin, corner);
+                            aabbMax = glm::max(aabbMax, corner);
+                        }
+
+                ClusterBounds& cluster = bounds[(z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x];
+                cluster.aabbMin = aabbMin;
+                cluster.aabbMax = aabbMax;
+            }
+        }
+    }
+}
+
+static bool SphereIntersectsAabb(const glm::vec3& center, f32 radius, const ClusterBounds& bounds)
+{
+    glm::vec3 closest = glm::clamp(center, bounds.aabbMin, bounds.aabbMax);
+    glm::vec3 d = closest - center;
+    return glm::dot(d, d) <= radius * radius;
+}
+
+static u32 NdcToTile(f32 ndc, u32 tileCount)
+{
+    return (u32)glm::clamp((ndc * 0.5f + 0.5f) * tileCount, 0.0f, (f32)(tileCount - 1));
+}
+
+void BuildLightClusters(App* app, const glm::mat4& view, const glm::mat4& projection, f32 nearPlane, f32 farPlane)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    static ClusterBounds clusterBounds[CLUSTER_COUNT];
+    ComputeClusterBounds(clusterBounds, projection, nearPlane, farPlane);
+
+    ClusteredLighting& cl = app->clusteredLighting;
+    const f32 logDepthRange = logf(farPlane / nearPlane);
+    cl.depthParams = glm::vec4(nearPlane, farPlane, CLUSTER_GRID_Z / logDepthRange, -CLUSTER_GRID_Z * logf(nearPlane) / logDepthRange);
+
+    // Lights in the GPU format, directional lights go first since they affect all clusters
+    cl.gpuLights.clear();
+    for (const Light& light : app->lights)
+        if (light.type == DIRECTIONAL && cl.gpuLights.size() < MAX_LIGHTS)
+            cl.gpuLights.push_back(GpuLight{ glm::vec4(light.position, light.radius), glm::vec4(light.color, light.intensity), glm::vec4(light.direction, (f32)light.type) });
+    cl.directionalLightCount = (u32)cl.gpuLights.size();
+
+    for (const Light& light : app->lights)
+        if (light.type == POINTT && cl.gpuLights.size() < MAX_LIGHTS)
+            cl.gpuLights.push_back(GpuLight{ glm::vec4(light.position, light.radius), glm::vec4(light.color, light.intensity), glm::vec4(light.direction, (f32)light.type) });
+
+    // Find the (light, cluster) pairs
+    cl.hitClusters.clear();
+    cl.hitLights.clear();
+
+    for (u32 lightIdx = cl.directionalLightCount; lightIdx < cl.gpuLights.size(); ++lightIdx)
+    {
+        const GpuLight& light = cl.gpuLights[lightIdx];
+        const f32 radius = light.positionRadius.w;
+        const glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(light.positionRadius), 1.0f));
+        const f32 depth = -center.z;
+
+        if (depth + radius < nearPlane || depth - radius > farPlane)
+            continue;
+
+        u32 z0 = DepthToSlice(depth - radius, cl.depthParams);
+        u32 z1 = DepthToSlice(depth + radius, cl.depthParams);
+
+        // Screen rect of the sphere: project the corners of its view space box. If the box
+        // crosses the near plane, the projection is not bounded, so take the whole screen.
+        u32 x0 = 0, x1 = CLUSTER_GRID_X - 1;
+        u32 y0 = 0, y1 = CLUSTER_GRID_Y - 1;
+        if (depth - radius > nearPlane)
+        {
+            glm::vec2 ndcMin = glm::vec2(FLT_MAX);
+            glm::vec2 ndcMax = glm::vec2(-FLT_MAX);
+            for (f32 dz : { -radius, radius })
+                for (f32 dx : { -radius, radius })
+                    for (f32 dy : { -radius, radius })
+                    {
+                        glm::vec4 clip = projection * glm::vec4(center.x + dx, center.y + dy, center.z + dz, 1.0f);
+                        glm::vec2 ndc = glm::vec2(clip) / clip.w;
+                        ndcMin = glm::min(ndcMin, ndc);
+                        ndcMax = glm::max(ndcMax, ndc);
+                    }
+
+            if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+                continue;
+
+            x0 = NdcToTile(ndcMin.x, CLUSTER_GRID_X);
+            x1 = NdcToTile(ndcMax.x, CLUSTER_GRID_X);
+            y0 = NdcToTile(ndcMin.y, CLUSTER_GRID_Y);
+            y1 = NdcToTile(ndcMax.y, CLUSTER_GRID_Y);
+        }
+
+        for (u32 z = z0; z <= z1; ++z)
+            for (u32 y = y0; y <= y1; ++y)
+                for (u32 x = x0; x <= x1; ++x)
+                {
+                    u32 clusterIdx = (z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;
+                    if (SphereIntersectsAabb(center, radius, clusterBounds[clusterIdx]))
+                    {
+                        cl.hitClusters.push_back(clusterIdx);
+                        cl.hitLights.push_back(lightIdx);
+                    }
+                }
+    }
+
+    // Counting sort of the pairs by cluster
+    cl.clusters.assign(CLUSTER_COUNT, glm::uvec2(0, 0));
+    for (u32 clusterIdx : cl.hitClusters)
+        cl.clusters[clusterIdx].y++;
+
+    u32 offset = 0;
+    cl.maxLightsPerCluster = 0;
+    for (glm::uvec2& cluster : cl.clusters)
+    {
+        cluster.x = offset;
+        offset += cluster.y;
+        cl.maxLightsPerCluster = glm::max(cl.maxLightsPerCluster, cluster.y);
+        cluster.y = 0;
+    }
+
+    cl.overflowedIndices = 0;
+    cl.lightIndices.resize(glm::min(offset, (u32)MAX_CLUSTER_LIGHT_INDICES));
+    for (u32 i = 0; i < cl.hitClusters.size(); ++i)
+    {
+        glm::uvec2& cluster = cl.clusters[cl.hitClusters[i]];
+        u32 indexPos = cluster.x + cluster.y;
+        if (indexPos >= MAX_CLUSTER_LIGHT_INDICES)
+        {
+            cl.overflowedIndices++;
+            continue;
+        }
+        cl.lightIndices[indexPos] = cl.hitLights[i];
+        cluster.y++;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    cl.buildTimeMs = std::chrono::duration<f32, std::milli>(end - start).count();
+}
+
+static void PushStorageRange(App* app, Buffer& buffer, GLuint binding, const void* data, u32 size)
+{
+    AlignHead(buffer, app->storageBlockAlignmentOffset);
+    u32 offset = buffer.head;
+    if (size > 0)
+        PushData(buffer, data, size);
+
+    // Empty ranges are not allowed, bind a few bytes in that case
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer.handle, offset, glm::max(size, 16u));
+    buffer.head = glm::max(buffer.head, offset + 16u);
+}
+
+void UploadLightClusters(App* app)
+{
+    ClusteredLighting& cl = app->clusteredLighting;
+    Buffer& buffer = app->lightBuffer;
+
+    PushStorageRange(app, buffer, LIGHTS_BINDING, cl.gpuLights.data(), (u32)(cl.gpuLights.size() * sizeof(GpuLight)));
+    PushStorageRange(app, buffer, LIGHT_CLUSTERS_BINDING, cl.clusters.data(), (u32)(cl.clusters.size() * sizeof(glm::uvec2)));
+    PushStorageRange(app, buffer, LIGHT_INDICES_BINDING, cl.lightIndices.data(), (u32)(cl.lightIndices.size() * sizeof(u32)));
+}
+
+void CreateStressTestLights(App* app, u32 count)
+{
+    RemoveStressTestLights(app);
+
+    app->stressTestFirstLight = (u32)app->lights.size();
+
+    // Point lights over a grid on the floor, with random colors and ranges
+    const u32 side = (u32)ceilf(sqrtf((f32)count));
+    const f32 extent = 15.0f;
+    srand(1234);
+    for (u32 i = 0; i < count; ++i)
+    {
+        f32 x = -extent + 2.0f * extent * ((i % side) + 0.5f) / side;
+        f32 z = -extent + 2.0f * extent * ((i / side) + 0.5f) / side;
+        f32 y = 0.2f + 1.5f * (rand() / (f32)RAND_MAX);
+        vec3 color = vec3(rand() / (f32)RAND_MAX, rand() / (f32)RAND_MAX, rand() / (f32)RAND_MAX);
+        f32 radius = 1.0f + 2.0f * (rand() / (f32)RAND_MAX);
+        app->lights.push_back(Light(LightType::POINTT, color, vec3(0.0, -1.0, 0.0), vec3(x, y, z), 0.5f, radius));
+    }
+
+    // And a floor big enough to see them
+    app->entities.push_back(Entity(glm::scale(glm::vec3(extent, 1.0f, extent)), app->model));
+    app->stressTestFloorEntity = (u32)app->entities.size() - 1u;
+}
+
+void RemoveStressTestLights(App* app)
+{
+    if (app->stressTestFirstLight == UINT32_MAX)
+        return;
+
+    app->lights.erase(app->lights.begin() + app->stressTestFirstLight, app->lights.end());
+    app->entities.erase(app->entities.begin() + app->stressTestFloorEntity);
+    if (app->instancingTestFirstEntity != UINT32_MAX && app->instancingTestFirstEntity > app->stressTestFloorEntity)
+        app->instancingTestFirstEntity--;
+    app->stressTestFirstLight = UINT32_MAX;
+    app->stressTestFloorEntity = UINT32_MAX;
+}
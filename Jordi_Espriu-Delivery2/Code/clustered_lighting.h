@@ -0,0 +1,65 @@
+//
+// clustered_lighting.h: Clustered (froxel based) light assignment. The view frustum
+// is split in a grid of clusters, and each cluster gets the list of point lights whose
+// range touches it. The lighting pass then only evaluates the lights of its cluster.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct App;
+
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT  (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+#define MAX_LIGHTS               4096
+#define MAX_CLUSTER_LIGHT_INDICES (256 * 1024)
+
+#define LIGHTS_BINDING          2
+#define LIGHT_CLUSTERS_BINDING  3
+#define LIGHT_INDICES_BINDING   4
+
+// Matches the Light struct (std430) of the lighting shaders
+struct GpuLight
+{
+    glm::vec4 positionRadius;
+    glm::vec4 colorIntensity;
+    glm::vec4 directionType;
+};
+
+struct ClusteredLighting
+{
+    std::vector<GpuLight>   gpuLights;      // Directional lights first, then point lights
+    std::vector<glm::uvec2> clusters;       // Offset and count in lightIndices
+    std::vector<u32>        lightIndices;
+    std::vector<u32>        hitClusters;
+    std::vector<u32>        hitLights;
+
+    u32       directionalLightCount;
+    glm::vec4 depthParams;                  // near, far, slice scale, slice bias
+
+    // Stats
+    u32 maxLightsPerCluster;
+    u32 overflowedIndices;
+    f32 buildTimeMs;
+};
+
+/**
+ * Assigns the lights of the app to the clusters of the given camera.
+ */
+void BuildLightClusters(App* app, const glm::mat4& view, const glm::mat4& projection, f32 nearPlane, f32 farPlane);
+
+/**
+ * Pushes the lights, clusters and light index lists into the light buffer and binds
+ * the ranges to their shader storage bindings.
+ */
+void UploadLightClusters(App* app);
+
+/**
+ * Adds (or removes) a grid of point lights used to stress the lighting path.
+ */
+void CreateStressTestLights(App* app, u32 count);
+void RemoveStressTestLights(App* app);
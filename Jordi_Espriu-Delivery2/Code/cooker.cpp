@@ -0,0 +1,461 @@
+//
+// cooker.cpp: Offline asset cooker, an executable of its own (the Cooker project) built from
+// the engine sources with ENGINE_COOKER defined. It reads a list of assets, brings their
+// caches up to date (the same .mcache and .btex files the engine writes next to the sources)
+// and writes them in a pack (pack_file.h), along with the files the engine reads as they are.
+// Run from the working directory:
+//
+//     Cooker.exe [assets.cook] [assets.pack]
+//
+// Each line of the list is an asset, '#' starts a comment:
+//
+//     model Cube/Plane.obj                    Its cache and the textures of its materials
+//     model_hierarchy Sponza/Sponza.gltf      The same, imported keeping the node hierarchy
+//     texture Cube/toy_box_normal.png normal_map flip
+//                                             Its cache, for the usage flags it is loaded with
+//     file shaders.glsl                       The file as it is
+//
+// Entries of the previous pack whose dependencies haven't changed are copied from it, so
+// only what was edited since is imported, compressed and packed again.
+//
+
+#include "pack_file.h"
+#include "engine.h"
+#include "assimp_model_loading.h"
+#include "mesh_cache.h"
+#include "texture_compression.h"
+#include "gl_extensions.h"
+#include "job_system.h"
+#include "file_cache.h"
+
+#include <chrono>
+#include <map>
+
+#define COOKER_DEFAULT_MANIFEST "assets.cook"
+
+struct CookedFile
+{
+    u64                      hash;
+    u64                      size;
+    u32                      cookFlags;
+    u32                      cookVersion;
+    bool                     hasData;
+    u32                      compression;  // PackCompression
+    std::vector<u8>          blob;         // As it is stored in the pack
+    std::vector<std::string> dependencies; // Files it was cooked from
+};
+
+struct Cooker
+{
+    Pack                              previous; // Its entries are reused while up to date
+    std::map<std::string, CookedFile> files;    // By normalized path, sorted so the packs come out the same
+    u32                               cookedCount;
+    u32                               reusedCount;
+    u32                               failedCount;
+};
+
+struct CompressChunksData
+{
+    const u8*                     bytes;
+    u64                           size;
+    std::vector<std::vector<u8>>* chunks; // Empty if the chunk doesn't compress
+};
+
+static void CompressChunks(u32 begin, u32 end, void* data)
+{
+    CompressChunksData& compress = *(CompressChunksData*)data;
+    for (u32 i = begin; i < end; ++i)
+    {
+        u64 offset = (u64)i * PACK_CHUNK_SIZE;
+        u32 size = (u32)glm::min<u64>(PACK_CHUNK_SIZE, compress.size - offset);
+
+        // Only worth it if it saves something
+        std::vector<u8>& chunk = (*compress.chunks)[i];
+        chunk.resize(size);
+        u32 compressedSize = size > 1 ? CompressPackChunk(compress.bytes + offset, size, chunk.data(), size - 1) : 0;
+        chunk.resize(compressedSize);
+    }
+}
+
+// Compresses the chunks in parallel, the file is stored as it is if none of them compresses
+static void CompressBlob(const u8* bytes, u64 size, CookedFile& file)
+{
+    u32 chunkCount = (u32)((size + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE);
+    std::vector<std::vector<u8>> chunks(chunkCount);
+    CompressChunksData compress = { bytes, size, &chunks };
+    ParallelFor(chunkCount, 1, CompressChunks, &compress);
+
+    bool anyCompressed = false;
+    for (const std::vector<u8>& chunk : chunks)
+        anyCompressed = anyCompressed || !chunk.empty();
+
+    if (!anyCompressed)
+    {
+        file.compression = PACK_COMPRESSION_NONE;
+        file.blob.assign(bytes, bytes + size);
+        return;
+    }
+
+    file.compression = PACK_COMPRESSION_LZ4;
+    file.blob.resize(chunkCount * sizeof(u32));
+    for (u32 i = 0; i < chunkCount; ++i)
+    {
+        const u8* chunkBytes = chunks[i].data();
+        u32 chunkSize = (u32)chunks[i].size();
+        u32 storedSize = chunkSize;
+        if (chunkSize == 0)
+        {
+            chunkBytes = bytes + (u64)i * PACK_CHUNK_SIZE;
+            chunkSize = (u32)glm::min<u64>(PACK_CHUNK_SIZE, size - (u64)i * PACK_CHUNK_SIZE);
+            storedSize = chunkSize | PACK_CHUNK_STORED;
+        }
+        memcpy(file.blob.data() + i * sizeof(u32), &storedSize, sizeof(u32));
+        file.blob.insert(file.blob.end(), chunkBytes, chunkBytes + chunkSize);
+    }
+}
+
+// Records a file the cooked ones depend on, only its hash, unless it is packed anyway
+static bool AddSource(Cooker& cooker, const std::string& path)
+{
+    if (cooker.files.count(path))
+        return true;
+
+    CookedFile source = {};
+    if (!HashFile(path.c_str(), source.hash, source.size))
+        return false;
+
+    cooker.files[path] = source;
+    return true;
+}
+
+static bool AddFileData(Cooker& cooker, const std::string& path, u32 cookFlags, u32 cookVersion, const std::vector<std::string>& dependencies)
+{
+    MappedFile mapped = MapFile(path.c_str());
+    if (!mapped.data)
+        return false;
+
+    CookedFile file = {};
+    file.hash = HashBytes(mapped.data, mapped.size);
+    file.size = mapped.size;
+    file.cookFlags = cookFlags;
+    file.cookVersion = cookVersion;
+    file.hasData = true;
+    file.dependencies = dependencies;
+    CompressBlob(mapped.data, mapped.size, file);
+    UnmapFile(mapped);
+
+    for (const std::string& dependency : dependencies)
+        AddSource(cooker, dependency);
+
+    cooker.files[path] = std::move(file);
+    cooker.cookedCount++;
+    return true;
+}
+
+static bool IsSourceUnchanged(const char* path, u64 hash, u64 size)
+{
+    u64 currentHash, currentSize;
+    return HashFile(path, currentHash, currentSize) && currentHash == hash && currentSize == size;
+}
+
+// Copies the entry of the previous pack if it was cooked the same way from the same files
+static bool ReuseEntry(Cooker& cooker, const std::string& path, u32 cookFlags, u32 cookVersion)
+{
+    const Pack& previous = cooker.previous;
+    const PackEntry* entry = previous.file.data ? FindPackEntry(previous, path.c_str()) : NULL;
+    if (!entry || !entry->hasData || entry->cookFlags != cookFlags || entry->cookVersion != cookVersion)
+        return false;
+
+    // Files packed as they are depend on themselves only
+    if (entry->dependencyCount == 0 && !IsSourceUnchanged(path.c_str(), entry->contentHash, entry->size))
+        return false;
+
+    std::vector<std::string> dependencies;
+    for (u32 i = 0; i < entry->dependencyCount; ++i)
+    {
+        const PackEntry& dependency = previous.entries[previous.dependencies[entry->firstDependency + i]];
+        const char* dependencyPath = GetPackEntryPath(previous, dependency);
+        if (!IsSourceUnchanged(dependencyPath, dependency.contentHash, dependency.size))
+            return false;
+        dependencies.push_back(dependencyPath);
+    }
+
+    CookedFile file = {};
+    file.hash = entry->contentHash;
+    file.size = entry->size;
+    file.cookFlags = cookFlags;
+    file.cookVersion = cookVersion;
+    file.hasData = true;
+    file.compression = entry->compression;
+    file.blob.assign(previous.file.data + entry->blobOffset, previous.file.data + entry->blobOffset + entry->blobSize);
+    file.dependencies = dependencies;
+
+    for (const std::string& dependency : dependencies)
+        AddSource(cooker, dependency);
+
+    cooker.files[path] = std::move(file);
+    cooker.reusedCount++;
+    return true;
+}
+
+static bool CookFile(Cooker& cooker, const std::string& path)
+{
+    if (ReuseEntry(cooker, path, 0, 0))
+        return true;
+
+    return AddFileData(cooker, path, 0, 0, {});
+}
+
+static bool CookTexture(Cooker& cooker, const std::string& path, u32 usageFlags)
+{
+    // The cache is per image, the engine would keep compressing it again if loaded with other flags
+    std::string cachePath = path + TEXTURE_CACHE_EXTENSION;
+    auto it = cooker.files.find(cachePath);
+    if (it != cooker.files.end() && it->second.hasData)
+    {
+        if (it->second.cookFlags != usageFlags)
+            printf("Warning: %s is used with different usage flags (%u and %u), packed with the first ones\n", path.c_str(), it->second.cookFlags, usageFlags);
+        return true;
+    }
+
+    if (ReuseEntry(cooker, cachePath, usageFlags, TEXTURE_CACHE_VERSION))
+        return true;
+
+    CompressedTexture texture;
+    if (!LoadCompressedTexture(path.c_str(), usageFlags, texture))
+        return false;
+
+    return AddFileData(cooker, cachePath, usageFlags, TEXTURE_CACHE_VERSION, { path });
+}
+
+static bool CookModel(Cooker& cooker, const std::string& path, bool hierarchy)
+{
+    std::string cachePath = path + (hierarchy ? MESH_CACHE_HIERARCHY_EXTENSION : MESH_CACHE_EXTENSION);
+    const u32 importFlags = GetModelImportFlags(path.c_str(), hierarchy);
+
+    // Reused, the data only has to give the texture paths, the cache is usually there. Otherwise
+    // the model is imported even if the cache is valid, to see every file the import reads
+    ModelData data;
+    bool reused = ReuseEntry(cooker, cachePath, importFlags, MESH_CACHE_VERSION);
+    if (reused)
+    {
+        if (!ReadModelData(path.c_str(), hierarchy, false, data))
+            return false;
+    }
+    else
+    {
+        // Whatever is still mapped from the previous cooks is dropped, the import maps its files again
+        EvictUnusedFiles();
+        if (!ReadModelData(path.c_str(), hierarchy, true, data))
+            return false;
+
+        // The files the import acquired, as recorded for the mesh cache
+        std::vector<std::string> dependencies = data.sourceFiles;
+        for (std::string& dependency : dependencies)
+            dependency = NormalizePackPath(dependency.c_str());
+        if (!AddFileData(cooker, cachePath, importFlags, MESH_CACHE_VERSION, dependencies))
+            return false;
+    }
+
+    bool texturesCooked = true;
+    for (u32 i = 0; i < data.texturePaths.size(); ++i)
+    {
+        const std::string& texturePath = data.texturePaths[i];
+        if (texturePath.empty())
+            continue;
+
+        u32 usageFlags = GetMaterialTextureUsageFlags(i % MATERIAL_TEXTURE_SLOTS) | TEXTURE_USAGE_FLIP_VERTICALLY;
+        if (!CookTexture(cooker, NormalizePackPath(texturePath.c_str()), usageFlags))
+        {
+            printf("Error: couldn't cook texture %s of %s\n", texturePath.c_str(), path.c_str());
+            texturesCooked = false;
+        }
+    }
+    return texturesCooked;
+}
+
+static u32 ParseUsageFlags(char* flags)
+{
+    u32 usageFlags = 0;
+    for (char* flag = strtok(flags, " \t"); flag; flag = strtok(NULL, " \t"))
+    {
+        if (strcmp(flag, "srgb") == 0)            usageFlags |= TEXTURE_USAGE_SRGB;
+        else if (strcmp(flag, "normal_map") == 0) usageFlags |= TEXTURE_USAGE_NORMAL_MAP;
+        else if (strcmp(flag, "flip") == 0)       usageFlags |= TEXTURE_USAGE_FLIP_VERTICALLY;
+        else printf("Warning: unknown texture flag %s\n", flag);
+    }
+    return usageFlags;
+}
+
+static bool CookManifest(Cooker& cooker, const char* manifestPath)
+{
+    FILE* manifest = fopen(manifestPath, "rb");
+    if (!manifest)
+    {
+        printf("Error: couldn't open %s\n", manifestPath);
+        return false;
+    }
+
+    char line[1024];
+    u32 lineNumber = 0;
+    while (fgets(line, sizeof(line), manifest))
+    {
+        lineNumber++;
+        char* comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        char* kind = strtok(line, " \t\r\n");
+        char* path = strtok(NULL, " \t\r\n");
+        char* flags = strtok(NULL, "\r\n");
+        if (!kind)
+            continue;
+        if (!path)
+        {
+            printf("%s(%u): Error: %s without a path\n", manifestPath, lineNumber, kind);
+            cooker.failedCount++;
+            continue;
+        }
+
+        std::string assetPath = NormalizePackPath(path);
+        bool cooked;
+        if (strcmp(kind, "model") == 0)                cooked = CookModel(cooker, assetPath, false);
+        else if (strcmp(kind, "model_hierarchy") == 0) cooked = CookModel(cooker, assetPath, true);
+        else if (strcmp(kind, "texture") == 0)         cooked = CookTexture(cooker, assetPath, flags ? ParseUsageFlags(flags) : 0);
+        else if (strcmp(kind, "file") == 0)            cooked = CookFile(cooker, assetPath);
+        else
+        {
+            printf("%s(%u): Error: unknown asset kind %s\n", manifestPath, lineNumber, kind);
+            cooked = false;
+        }
+
+        if (!cooked)
+        {
+            printf("%s(%u): Error: couldn't cook %s\n", manifestPath, lineNumber, path);
+            cooker.failedCount++;
+        }
+    }
+
+    fclose(manifest);
+    return true;
+}
+
+static void WritePadding(FILE* file, u64& offset)
+{
+    static const u8 zeros[PACK_ALIGNMENT] = {};
+    u64 padding = (PACK_ALIGNMENT - offset % PACK_ALIGNMENT) % PACK_ALIGNMENT;
+    fwrite(zeros, 1, padding, file);
+    offset += padding;
+}
+
+static bool WritePack(const Cooker& cooker, const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+    if (!file)
+        return false;
+
+    std::map<std::string, u32> entryIndices;
+    for (auto& it : cooker.files)
+        entryIndices[it.first] = (u32)entryIndices.size();
+
+    std::vector<PackEntry> entries;
+    std::vector<u32> dependencies;
+    std::string strings;
+
+    PackHeader header = {};
+    fwrite(&header, sizeof(header), 1, file);
+    u64 offset = sizeof(header);
+
+    for (auto& it : cooker.files)
+    {
+        const CookedFile& cooked = it.second;
+        PackEntry entry = {};
+        entry.pathHash = HashPackPath(it.first.c_str());
+        entry.contentHash = cooked.hash;
+        entry.size = cooked.size;
+        entry.pathOffset = (u32)strings.size();
+        entry.compression = cooked.compression;
+        entry.cookFlags = cooked.cookFlags;
+        entry.cookVersion = cooked.cookVersion;
+        entry.hasData = cooked.hasData;
+        entry.firstDependency = (u32)dependencies.size();
+        for (const std::string& dependency : cooked.dependencies)
+        {
+            auto dependencyIt = entryIndices.find(dependency);
+            if (dependencyIt != entryIndices.end())
+                dependencies.push_back(dependencyIt->second);
+        }
+        entry.dependencyCount = (u32)dependencies.size() - entry.firstDependency;
+        strings.append(it.first.c_str(), it.first.size() + 1);
+
+        if (cooked.hasData)
+        {
+            WritePadding(file, offset);
+            entry.blobOffset = offset;
+            entry.blobSize = cooked.blob.size();
+            fwrite(cooked.blob.data(), 1, cooked.blob.size(), file);
+            offset += cooked.blob.size();
+        }
+        entries.push_back(entry);
+    }
+
+    WritePadding(file, offset);
+
+    std::vector<u8> toc;
+    toc.insert(toc.end(), (const u8*)entries.data(), (const u8*)(entries.data() + entries.size()));
+    toc.insert(toc.end(), (const u8*)dependencies.data(), (const u8*)(dependencies.data() + dependencies.size()));
+    toc.insert(toc.end(), strings.begin(), strings.end());
+    if (strings.empty())
+        toc.push_back(0);
+
+    header.magic = PACK_MAGIC;
+    header.version = PACK_VERSION;
+    header.entryCount = (u32)entries.size();
+    header.dependencyCount = (u32)dependencies.size();
+    header.stringTableSize = strings.empty() ? 1 : (u32)strings.size();
+    header.tocOffset = offset;
+    header.tocHash = HashBytes(toc.data(), toc.size());
+    fwrite(toc.data(), 1, toc.size(), file);
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    bool written = ferror(file) == 0;
+    fclose(file);
+    return written;
+}
+
+int main(int argc, char** argv)
+{
+    const char* manifestPath = argc > 1 ? argv[1] : COOKER_DEFAULT_MANIFEST;
+    const char* packPath = argc > 2 ? argv[2] : DEFAULT_PACK_FILENAME;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    InitJobSystem();
+
+    // The caches are cooked for the machines the engine targets, not the one cooking them
+    GLExt.textureCompressionS3TC = true;
+
+    Cooker cooker = {};
+    OpenPack(packPath, cooker.previous);
+    bool cooked = CookManifest(cooker, manifestPath);
+
+    // Written next to the previous pack, which is still mapped, then put in its place
+    std::string temporaryPath = std::string(packPath) + ".tmp";
+    bool written = cooked && WritePack(cooker, temporaryPath.c_str());
+    ClosePack(cooker.previous);
+    if (written)
+    {
+        remove(packPath);
+        written = rename(temporaryPath.c_str(), packPath) == 0;
+    }
+
+    ShutdownFileCache();
+    ShutdownJobSystem();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    printf("%s: %u files cooked, %u reused from the previous pack, %u failed, %u entries in %.1f s\n",
+           written ? packPath : "Nothing written", cooker.cookedCount, cooker.reusedCount, cooker.failedCount,
+           (u32)cooker.files.size(), std::chrono::duration<f32>(end - start).count());
+
+    return written && cooker.failedCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+#include "culling.h"
+#include "engine.h"
+
+#include <immintrin.h>
+
+BoundingVolume ComputeBounds(const float* vertices, u32 vertexCount, u32 strideInFloats)
+{
+    BoundingVolume bounds = {};
+    if (vertexCount == 0)
+        return bounds;
+
+    glm::vec3 aabbMin = glm::vec3(vertices[0], vertices[1], vertices[2]);
+    glm::vec3 aabbMax = aabbMin;
+    for (u32 i = 1; i < vertexCount; ++i)
+    {
+        const float* p = vertices + i * strideInFloats;
+        aabbMin = glm::min(aabbMin, glm::vec3(p[0], p[1], p[2]));
+        aabbMax = glm::max(aabbMax, glm::vec3(p[0], p[1], p[2]));
+    }
+
+    // Sphere centered in the box, but with the radius of the farthest vertex (tighter than the half diagonal)
+    glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+    f32 radiusSq = 0.0f;
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        const float* p = vertices + i * strideInFloats;
+        glm::vec3 d = glm::vec3(p[0], p[1], p[2]) - center;
+        radiusSq = glm::max(radiusSq, glm::dot(d, d));
+    }
+
+    bounds.aabbMin = aabbMin;
+    bounds.aabbMax = aabbMax;
+    bounds.sphereCenter = center;
+    bounds.sphereRadius = sqrtf(radiusSq);
+    return bounds;
+}
+
+void ComputeMeshBounds(Mesh& mesh)
+{
+    mesh.bounds = {};
+    if (mesh.submeshes.empty())
+        return;
+
+    glm::vec3 aabbMin = mesh.submeshes[0].bounds.aabbMin;
+    glm::vec3 aabbMax = mesh.submeshes[0].bounds.aabbMax;
+    for (const Submesh& submesh : mesh.submeshes)
+    {
+        aabbMin = glm::min(aabbMin, submesh.bounds.aabbMin);
+        aabbMax = glm::max(aabbMax, submesh.bounds.aabbMax);
+    }
+
+    glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+    f32 radius = 0.0f;
+    for (const Submesh& submesh : mesh.submeshes)
+        radius = glm::max(radius, glm::length(submesh.bounds.sphereCenter - center) + submesh.bounds.sphereRadius);
+
+    mesh.bounds.aabbMin = aabbMin;
+    mesh.bounds.aabbMax = aabbMax;
+    mesh.bounds.sphereCenter = center;
+    mesh.bounds.sphereRadius = glm::min(radius, glm::length(aabbMax - center));
+}
+
+Frustum ExtractFrustum(const glm::mat4& m)
+{
+    // Gribb-Hartmann: planes are combinations of the rows of the clip matrix (glm is column major)
+    glm::vec4 row0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    frustum.planes[4] = row3 + row2;
+    frustum.planes[5] = row3 - row2;
+
+    for (u32 i = 0; i < 6; ++i)
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+
+    return frustum;
+}
+
+void CullSpheres(const Frustum& frustum, const f32* centersX, const f32* centersY, const f32* centersZ, const f32* radii, u32 count, u8* visible)
+{
+    u32 i = 0;
+
+#if defined(__AVX__)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(centersX + i);
+        __m256 cy = _mm256_loadu_ps(centersY + i);
+        __m256 cz = _mm256_loadu_ps(centersZ + i);
+        __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radii + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for (u32 p = 0; p < 6; ++p)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)), _mm256_set1_ps(plane.w));
+            d = _mm256_add_ps(d, _mm256_mul_ps(cy, _mm256_set1_ps(plane.y)));
+            d = _mm256_add_ps(d, _mm256_mul_ps(cz, _mm256_set1_ps(plane.z)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negRadius, _CMP_GT_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (u32 j = 0; j < 8; ++j)
+            visible[i + j] = (mask >> j) & 1;
+    }
+#endif
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(centersX + i);
+        __m128 cy = _mm_loadu_ps(centersY + i);
+        __m128 cz = _mm_loadu_ps(centersZ + i);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radii + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for (u32 p = 0; p < 6; ++p)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            __m128 d = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_set1_ps(plane.w));
+            d = _mm_add_ps(d, _mm_mul_ps(cy, _mm_set1_ps(plane.y)));
+            d = _mm_add_ps(d, _mm_mul_ps(cz, _mm_set1_ps(plane.z)));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, negRadius));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (u32 j = 0; j < 4; ++j)
+            visible[i + j] = (mask >> j) & 1;
+    }
+
+    for (; i < count; ++i)
+    {
+        u8 inside = 1;
+        for (u32 p = 0; p < 6; ++p)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            f32 d = plane.x * centersX[i] + plane.y * centersY[i] + plane.z * centersZ[i] + plane.w;
+            inside &= d > -radii[i];
+        }
+        visible[i] = inside;
+    }
+}
+
+struct SphereBatch
+{
+    std::vector<f32> x, y, z, radius;
+    std::vector<u8>  visible;
+
+    void Clear()
+    {
+        x.clear(); y.clear(); z.clear(); radius.clear();
+    }
+
+    void Push(const glm::mat4& world, const BoundingVolume& bounds)
+    {
+        // Conservative world space radius: scale by the largest axis scale
+        glm::vec3 center = glm::vec3(world * glm::vec4(bounds.sphereCenter, 1.0f));
+        f32 scaleSq = glm::max(glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+                      glm::max(glm::dot(glm::vec3(world[1]), glm::vec3(world[1])),
+                               glm::dot(glm::vec3(world[2]), glm::vec3(world[2]))));
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        radius.push_back(bounds.sphereRadius * sqrtf(scaleSq));
+    }
+
+    void Cull(const Frustum& frustum)
+    {
+        visible.resize(x.size());
+        CullSpheres(frustum, x.data(), y.data(), z.data(), radius.data(), (u32)x.size(), visible.data());
+    }
+};
+
+void CullEntities(App* app, const glm::mat4& viewProjection, const glm::mat4* worldMatrices)
+{
+    static SphereBatch entityBatch;
+    static SphereBatch submeshBatch;
+
+    Frustum frustum = ExtractFrustum(viewProjection);
+    CullingStats& stats = app->cullingStats;
+    stats = {};
+
+    // Whole entities first
+    entityBatch.Clear();
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        const Mesh& mesh = app->meshes[app->models[app->entities[i].modelId].meshIdx];
+        entityBatch.Push(worldMatrices[i], mesh.bounds);
+    }
+    entityBatch.Cull(frustum);
+
+    // Then the submeshes of the entities that survived
+    submeshBatch.Clear();
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        Entity& entity = app->entities[i];
+        entity.visible = entityBatch.visible[i] != 0 || !app->frustumCulling;
+        entity.submeshVisibilityOffset = (u32)submeshBatch.x.size();
+
+        const Mesh& mesh = app->meshes[app->models[entity.modelId].meshIdx];
+        if (entity.visible)
+            for (const Submesh& submesh : mesh.submeshes)
+                submeshBatch.Push(worldMatrices[i], submesh.bounds);
+
+        stats.entitiesTested++;
+        stats.entitiesVisible += entity.visible;
+    }
+    submeshBatch.Cull(frustum);
+
+    app->submeshVisibility.swap(submeshBatch.visible);
+    if (!app->frustumCulling)
+        std::fill(app->submeshVisibility.begin(), app->submeshVisibility.end(), 1);
+
+    stats.submeshesTested = (u32)app->submeshVisibility.size();
+    for (u8 visible : app->submeshVisibility)
+        stats.submeshesVisible += visible;
+}
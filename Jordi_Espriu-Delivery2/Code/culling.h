@@ -0,0 +1,57 @@
+//
+// culling.h: Bounding volumes and CPU frustum culling.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct App;
+struct Mesh;
+
+struct BoundingVolume
+{
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
+    glm::vec3 sphereCenter;
+    f32       sphereRadius;
+};
+
+struct Frustum
+{
+    glm::vec4 planes[6]; // Normalized, pointing inwards: left, right, bottom, top, near, far
+};
+
+struct CullingStats
+{
+    u32 entitiesTested;
+    u32 entitiesVisible;
+    u32 submeshesTested;
+    u32 submeshesVisible;
+};
+
+/**
+ * Computes the AABB and bounding sphere of the positions found at the beginning of
+ * each vertex (strideInFloats floats apart).
+ */
+BoundingVolume ComputeBounds(const float* vertices, u32 vertexCount, u32 strideInFloats);
+
+/**
+ * Recomputes the bounds of a mesh from the bounds of its submeshes.
+ */
+void ComputeMeshBounds(Mesh& mesh);
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+/**
+ * Tests a batch of spheres given in SoA form against the frustum using SIMD.
+ * visible[i] is set to 1 if the sphere i intersects the frustum, 0 otherwise.
+ */
+void CullSpheres(const Frustum& frustum, const f32* centersX, const f32* centersY, const f32* centersZ, const f32* radii, u32 count, u8* visible);
+
+/**
+ * Culls all the entities (and then the submeshes of the visible ones) of the app.
+ * worldMatrices holds one matrix per entity. Results are written into Entity::visible
+ * and App::submeshVisibility, and the counters into App::cullingStats.
+ */
+void CullEntities(App* app, const glm::mat4& viewProjection, const glm::mat4* worldMatrices);
@@ -13,8 +13,12 @@
 #include "assimp_model_loading.h"
 #include "buffer_management.h"
 #include "Shaders.h"
+#include "job_system.h"
+#include "file_cache.h"
+#include "texture_compression.h"
+
+#include <chrono>
 
-#define BINDING(b) b
 
 bool mode;
 Shader cShader;
@@ -115,11 +119,18 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
     return app->programs.size() - 1;
 }
 
-Image LoadImage(const char* filename)
+Image LoadImage(const char* filename, bool flipVertically)
 {
     Image img = {};
-    stbi_set_flip_vertically_on_load(true);
-    img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
+    // Per thread, images are decoded on the job system
+    stbi_set_flip_vertically_on_load_thread(flipVertically);
+    // Decoded from the mapping, shared with the hashing of the file done just before
+    const MappedFile* file = AcquireFile(filename);
+    if (file)
+    {
+        img.pixels = stbi_load_from_memory(file->data, (int)file->size, &img.size.x, &img.size.y, &img.nchannels, 0);
+        ReleaseFile(file);
+    }
     if (img.pixels)
     {
         img.stride = img.size.x * img.nchannels;
@@ -164,75 +175,30 @@ GLuint CreateTexture2DFromImage(Image image)
     return texHandle;
 }
 
-u32 LoadTexture2D(App* app, const char* filepath)
+static u32 CreatePlaceholderTexture(App* app, u8 r, u8 g, u8 b)
 {
-    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-        if (app->textures[texIdx].filepath == filepath)
-            return texIdx;
+    u8 pixel[4] = { r, g, b, 255 };
 
-    Image image = LoadImage(filepath);
-
-    if (image.pixels)
-    {
-        Texture tex = {};
-        tex.handle = CreateTexture2DFromImage(image);
-        tex.filepath = filepath;
+    Image image = {};
+    image.pixels = pixel;
+    image.size = ivec2(1, 1);
+    image.nchannels = 4;
+    image.stride = 4;
 
-        u32 texIdx = app->textures.size();
-        app->textures.push_back(tex);
+    Texture tex = {};
+    tex.handle = CreateTexture2DFromImage(image);
 
-        FreeImage(image);
-        return texIdx;
-    }
-    else
-    {
-        return UINT32_MAX;
-    }
+    u32 texIdx = app->textures.size();
+    app->textures.push_back(tex);
+    return texIdx;
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+void InitPlaceholderTextures(App* app)
 {
-    Submesh& submesh = mesh.submeshes[submeshIndex];
-
-    for (u32 i = 0; i < (u32)submesh.vaos.size(); ++i)
-        if (submesh.vaos[i].programHandle == program.handle)
-            return submesh.vaos[i].handle;
-
-    GLuint vaoHandle = 0;
-
-    {
-        glGenVertexArrays(1, &vaoHandle);
-        glBindVertexArray(vaoHandle);
-
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-
-        for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i) {
-            bool attributeWasLinked = false;
-
-            for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j) {
-                if (program.vertexInputLayout.attributes[i].location != submesh.vertexBufferLayout.attributes[j].location)
-                    continue;
-                const u32 index = submesh.vertexBufferLayout.attributes[j].location;
-                const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-                const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset;
-                const u32 stride = submesh.vertexBufferLayout.stride;
-                glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)offset);
-                glEnableVertexAttribArray(index);
-
-                attributeWasLinked = true;
-                break;
-            }
-            assert(attributeWasLinked);
-        }
-
-        glBindVertexArray(0);
-    }
-
-    Vao vao = { vaoHandle, program.handle };
-    submesh.vaos.push_back(vao);
-
-    return vaoHandle;
+    app->whiteTexIdx = CreatePlaceholderTexture(app, 255, 255, 255);
+    app->blackTexIdx = CreatePlaceholderTexture(app, 0, 0, 0);
+    app->normalTexIdx = CreatePlaceholderTexture(app, 128, 128, 255);
+    app->magentaTexIdx = CreatePlaceholderTexture(app, 255, 0, 255);
 }
 
 void Init(App* app)
@@ -242,12 +208,21 @@ void Init(App* app)
 
     InitGPUInfo(app);
 
+    InitTextureRegistry(app);
+
+    // Before anything that loads textures, they are the placeholders of the async loads
+    InitPlaceholderTextures(app);
+
     InitModes(app);
 
     InitCubeMap(app);
 
     InitBuffers(app);
 
+    InitGeometryPool(app->geometryPool);
+
+    InitUploadQueue(app);
+
     CreateEntities(app);
 
 }
@@ -258,6 +233,38 @@ void Gui(App* app)
     ImGui::StyleColorsClassic();
     ImGui::Begin("Info");
     ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
+    ImGui::Text("Constant buffer: %s, fence waits: %u", app->cBuffer.persistent ? "persistent" : "mapped per frame", app->cBuffer.fenceWaitCount);
+
+    if (ImGui::CollapsingHeader("Job workers"))
+    {
+        for (u32 i = 0; i < GetJobWorkerCount(); ++i)
+        {
+            const JobWorkerStats& workerStats = GetJobWorkerStats(i);
+            ImGui::Text("Worker %u: %5.1f%% busy, %u jobs, %u stolen", i, workerStats.utilization * 100.0f, workerStats.jobsExecuted, workerStats.jobsStolen);
+        }
+    }
+    if (app->pendingAssetLoads > 0)
+        ImGui::Text("Loading assets: %u", app->pendingAssetLoads);
+
+    const UploadQueue& uploadQueue = app->uploadQueue;
+    ImGui::Text("Uploads: %.1f KB in %u copies, %.3f ms", uploadQueue.stats.bytes / 1024.0f, uploadQueue.stats.copies, uploadQueue.stats.timeMs);
+    ImGui::Text("Upload queue: %u requests, %.1f KB", (u32)uploadQueue.requests.size(), uploadQueue.pendingBytes / 1024.0f);
+    const TextureRegistry& textureRegistry = app->textureRegistry;
+    ImGui::Text("Texture memory: %.1f MB (%.1f MB decoded), quality %s", textureRegistry.residentBytes / (1024.0f * 1024.0f), textureRegistry.decodedBytes / (1024.0f * 1024.0f), GetTextureQualityName(app->textureQuality));
+    ImGui::Text("Textures: %u evicted, %u reloaded, %u shared", textureRegistry.stats.evictions, textureRegistry.stats.reloads, textureRegistry.stats.dedups);
+    if (ImGui::CollapsingHeader("Texture budget"))
+    {
+        int budgetMB = (int)(app->textureRegistry.budgetBytes / (1024 * 1024));
+        if (ImGui::SliderInt("MB (0 for none)", &budgetMB, 0, 4096))
+            app->textureRegistry.budgetBytes = (u64)budgetMB * 1024 * 1024;
+    }
+    if (ImGui::CollapsingHeader("Upload budget"))
+    {
+        int budgetKB = (int)(app->uploadQueue.byteBudget / 1024);
+        if (ImGui::SliderInt("KB per frame", &budgetKB, 64, UPLOAD_STAGING_REGION_SIZE / 1024))
+            app->uploadQueue.byteBudget = (u32)budgetKB * 1024;
+        ImGui::SliderFloat("ms per frame", &app->uploadQueue.timeBudgetMs, 0.1f, 16.0f);
+    }
     
     // GPU info
     ImGui::Separator();
@@ -282,6 +289,19 @@ void Gui(App* app)
 
 	ImGui::Checkbox("Show Light Gizmo", &app->showGizmo);
 
+    if (ImGui::Checkbox("Stress test (1024 point lights)", &app->stressTestLights))
+    {
+        if (app->stressTestLights)
+            CreateStressTestLights(app, 1024);
+        else
+            RemoveStressTestLights(app);
+    }
+    const ClusteredLighting& clusteredLighting = app->clusteredLighting;
+    ImGui::Text("Lights: %u, cluster light indices: %u", (u32)clusteredLighting.gpuLights.size(), (u32)clusteredLighting.lightIndices.size());
+    ImGui::Text("Max lights per cluster: %u, build: %.3f ms", clusteredLighting.maxLightsPerCluster, clusteredLighting.buildTimeMs);
+    if (clusteredLighting.overflowedIndices > 0)
+        ImGui::Text("Dropped cluster light indices: %u", clusteredLighting.overflowedIndices);
+
 	if (ImGui::CollapsingHeader("Light Inspector")) {
 
         // Lights counter
@@ -304,6 +324,7 @@ void Gui(App* app)
                 ImGui::SameLine();
                 ImGui::Text("%i", pointCount);
 				ImGui::DragFloat3("transform", glm::value_ptr(app->lights[i].position), 0.01f);
+				ImGui::DragFloat("radius", &app->lights[i].radius, 0.01f, 0.01f, 100.f);
 			}
 			ImGui::DragFloat3("color", glm::value_ptr(app->lights[i].color), 0.01f);
 			ImGui::DragFloat("intensity", &app->lights[i].intensity, 0.01f);
@@ -313,12 +334,12 @@ void Gui(App* app)
 	}
 
     ImGui::Separator();
-    const char* controller[] = { "Deferred", "Forward" };
+    const char* controller[] = { "Deferred", "Forward", "Deferred (multi-draw indirect)" };
     ImGui::Text("Rendering");
     static int select = 0;
     if (ImGui::BeginCombo("Type", controller[select]))
     {
-        for (int i = 0; i < 2; ++i)
+        for (int i = 0; i < ARRAY_COUNT(controller); ++i)
         {
             if (ImGui::Selectable(controller[i]))
             {
@@ -336,6 +357,9 @@ void Gui(App* app)
     case 1:
         app->mode = Mode::FORWARD;
         break;
+    case 2:
+        app->mode = Mode::DEFERRED_INDIRECT;
+        break;
     default:
         break;
     }
@@ -350,6 +374,69 @@ void Gui(App* app)
 
     ImGui::Separator();
 
+    ImGui::Checkbox("Frustum culling", &app->frustumCulling);
+    const CullingStats& cullingStats = app->cullingStats;
+    ImGui::Text("Entities: %u visible, %u culled", cullingStats.entitiesVisible, cullingStats.entitiesTested - cullingStats.entitiesVisible);
+    ImGui::Text("Submeshes: %u visible, %u culled", cullingStats.submeshesVisible, cullingStats.submeshesTested - cullingStats.submeshesVisible);
+
+    const RenderQueueStats& queueStats = app->renderQueue.stats;
+    ImGui::Text("Draw calls: %u, draws: %u, instances: %u, sort: %.3f ms", queueStats.drawCalls, queueStats.draws, queueStats.instances, queueStats.sortTimeMs);
+    ImGui::Text("Triangles: %u", queueStats.triangles);
+
+    ImGui::Checkbox("Cluster culling (indirect)", &app->clusterCulling);
+    ImGui::SameLine();
+    ImGui::Checkbox("Backface cones", &app->clusterBackfaceCulling);
+    const ClusterCullingStats& clusterStats = queueStats.clusters;
+    ImGui::Text("Clusters: %u tested, %u frustum culled, %u backface culled", clusterStats.clustersTested, clusterStats.frustumCulled, clusterStats.backfaceCulled);
+    ImGui::Text("State changes: %u programs, %u VAOs, %u textures", queueStats.programChanges, queueStats.vaoChanges, queueStats.textureChanges);
+
+    ImGui::Checkbox("Mesh LODs", &app->meshLods);
+    ImGui::SliderFloat("LOD error (pixels)", &app->lodErrorPixels, 0.25f, 16.0f);
+    const LodStats& lodStats = app->lodStats;
+    for (u32 lod = 0; lod < MAX_LODS; ++lod)
+        ImGui::Text("LOD %u: %u entities", lod, lodStats.entities[lod]);
+    if (ImGui::CollapsingHeader("Triangles per LOD"))
+    {
+        for (u32 modelIdx = 0; modelIdx < app->models.size(); ++modelIdx)
+        {
+            const Mesh& mesh = app->meshes[app->models[modelIdx].meshIdx];
+            if (mesh.lodCount <= 1)
+                continue;
+
+            char text[128];
+            int length = snprintf(text, sizeof(text), "Model %u:", modelIdx);
+            for (u32 lod = 0; lod < mesh.lodCount && length < (int)sizeof(text); ++lod)
+            {
+                u32 triangles = 0;
+                for (const Submesh& submesh : mesh.submeshes)
+                    triangles += GetSubmeshLod(submesh, lod).indexCount / 3;
+                length += snprintf(text + length, sizeof(text) - length, " %u (%.3g)", triangles, mesh.lodErrors[lod]);
+            }
+            ImGui::TextUnformatted(text);
+        }
+    }
+
+    const GeometryPool& geometryPool = app->geometryPool;
+    for (u32 i = 0; i < geometryPool.vertexPools.size(); ++i)
+    {
+        const VertexPool& vertexPool = geometryPool.vertexPools[i];
+        ImGui::Text("Vertex pool %u (stride %u): %u / %u vertices, %u free ranges", i, vertexPool.layout.stride, vertexPool.allocator.used, vertexPool.allocator.capacity, (u32)vertexPool.allocator.freeRanges.size());
+    }
+    ImGui::Text("Index pool: %u / %u indices, %u free ranges", geometryPool.indexAllocator.used, geometryPool.indexAllocator.capacity, (u32)geometryPool.indexAllocator.freeRanges.size());
+    ImGui::Text("Pool grows: %u, compactions: %u", geometryPool.growCount, geometryPool.compactCount);
+    if (ImGui::Button("Compact geometry"))
+        CompactGeometryPool(app);
+
+    if (ImGui::Checkbox("Instancing test (10k cubes)", &app->instancingTest))
+    {
+        if (app->instancingTest)
+            CreateInstancingTestEntities(app, 100);
+        else
+            RemoveInstancingTestEntities(app);
+    }
+
+    ImGui::Separator();
+
     // Render info
     static int sel = 0;
     ImGui::Text("Target render");
@@ -447,8 +534,48 @@ void Update(App* app)
 
 }
 
+glm::mat4 GetEntityWorldMatrix(const App* app, const Entity& entity)
+{
+    if (app->mode == FORWARD)
+    {
+        float angle = 70;
+        return glm::rotate(glm::scale(entity.matrix, glm::vec3(2, 2, 2)), glm::radians(angle), glm::vec3(1, 0, 0));
+    }
+
+    return entity.matrix;
+}
+
+static void PrepareEntityMatrices(u32 begin, u32 end, void* data)
+{
+    App* app = (App*)data;
+    for (u32 i = begin; i < end; ++i)
+        app->entityWorldMatrices[i] = GetEntityWorldMatrix(app, app->entities[i]);
+}
+
+void PushGlobalParams(App* app)
+{
+    const ClusteredLighting& clusteredLighting = app->clusteredLighting;
+
+    AlignHead(app->cBuffer, app->uniformBlockAlignmentOffset);
+    app->globalParamsOffset = app->cBuffer.head;
+
+    PushVec3(app->cBuffer, app->camera.cameraPos);
+    PushUInt(app->cBuffer, clusteredLighting.gpuLights.size());
+    PushUInt(app->cBuffer, clusteredLighting.directionalLightCount);
+    PushMat4(app->cBuffer, app->camera.GetLookAtMatrix());
+    PushMat4(app->cBuffer, app->camera.GetViewMatrix(app->displaySize));
+    PushVec4(app->cBuffer, glm::uvec4(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, 0));
+    PushVec4(app->cBuffer, clusteredLighting.depthParams);
+
+    app->globalParamsSize = app->cBuffer.head - app->globalParamsOffset;
+}
+
 void Render(App* app)
 {
+    // Before any draw, so what gets uploaded is already usable this frame
+    ProcessUploadQueue(app);
+    UpdateTextureRegistry(app);
+
     glBindFramebuffer(GL_FRAMEBUFFER, app->frameBufferController);
     GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,  GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
     glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
@@ -463,6 +590,28 @@ void Render(App* app)
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     glEnable(GL_DEPTH_TEST);
+
+    // Wait until the GPU is done with this frame's region of the ring buffers
+    BeginBufferRegion(app->cBuffer);
+    BeginBufferRegion(app->lightBuffer);
+    BeginBufferRegion(app->instanceBuffer);
+    BeginBufferRegion(app->indirectBuffer);
+
+    // Cull everything before issuing any draw
+    if (app->mode != TEXTUREDQUAD)
+    {
+        app->entityWorldMatrices.resize(app->entities.size());
+        ParallelFor((u32)app->entities.size(), 1024, PrepareEntityMatrices, app);
+
+        CullEntities(app, app->camera.GetViewMatrix(app->displaySize), app->entityWorldMatrices.data());
+        SelectEntityLods(app, app->entityWorldMatrices.data());
+
+        // Assign the lights to the clusters of the view and upload everything for the lighting pass
+        BuildLightClusters(app, app->camera.GetLookAtMatrix(), app->camera.GetProjectionMatrix(app->displaySize), app->camera.nearPlane, app->camera.farPlane);
+        UploadLightClusters(app);
+        PushGlobalParams(app);
+    }
+
     switch (app->mode)
     {
         case TEXTUREDQUAD:
@@ -489,29 +638,21 @@ void Render(App* app)
             break;
         
         case DEFERRED:
+        case DEFERRED_INDIRECT:
         {
             Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
             glUseProgram(texturedMeshProgram.handle);
 
-            MapBuffer(app->cBuffer, GL_WRITE_ONLY);
-            app->globalParamsOffset = app->cBuffer.head;
-
-
-            PushVec3(app->cBuffer, app->camera.cameraPos);
-            PushUInt(app->cBuffer, app->lights.size());
-            app->globalParamsSize = app->cBuffer.head - app->globalParamsOffset;
-
-
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, app->textures[app->toyDiffuseTexIdx].handle);
+            glBindTexture(GL_TEXTURE_2D, UseTexture(app, app->toyDiffuseTexIdx));
             glUniform1i(app->texturedMeshProgramIdx_Deferred, 0);
 
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, app->textures[app->toyNormalTexIdx].handle);
+            glBindTexture(GL_TEXTURE_2D, UseTexture(app, app->toyNormalTexIdx));
             glUniform1i(app->texturedMeshProgramIdx_RelieveNormal, 1);
 
             glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, app->textures[app->toyHeightTexIdx].handle);
+            glBindTexture(GL_TEXTURE_2D, UseTexture(app, app->toyHeightTexIdx));
             glUniform1i(app->texturedMeshProgramIdx_RelieveHeight, 2);
 
             if (app->showCubeMap)
@@ -520,36 +661,15 @@ void Render(App* app)
             }
   
 
+            glUseProgram(texturedMeshProgram.handle);
             glUniform1i(glGetUniformLocation(texturedMeshProgram.handle, "uShowRelief"), app->showRelief);
-            for (int i = 0; i < app->entities.size(); ++i)
-            {
-                Model& model = app->models[app->entities[i].modelId];
-                Mesh& mesh = app->meshes[model.meshIdx];
-
-                AlignHead(app->cBuffer, app->uniformBlockAlignmentOffset);
-                app->entities[i].localParamsOffset = app->cBuffer.head;
-                PushMat4(app->cBuffer, app->entities[i].matrix);
-                PushMat4(app->cBuffer, app->camera.GetViewMatrix(app->displaySize));
-                app->entities[i].localParamsSize = app->cBuffer.head - app->entities[i].localParamsOffset;
 
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cBuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
-
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
-                    GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
-                    glBindVertexArray(vao);
-
-                    u32 submeshMaterialIdx = model.materialIdx[i];
-                    Material& submeshmaterial = app->materials[submeshMaterialIdx];
-
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submeshmaterial.albedoTextureIdx].handle);
-                    glUniform1i(app->programUniformTexture, 0);
-
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                }
-            }
+            BuildRenderQueue(app, app->renderQueue, RENDER_PASS_OPAQUE, app->texturedMeshProgramIdx);
+            SortRenderQueue(app->renderQueue);
+            if (app->mode == DEFERRED_INDIRECT)
+                SubmitRenderQueueIndirect(app, app->renderQueue);
+            else
+                SubmitRenderQueue(app, app->renderQueue);
 
             glBindFramebuffer(GL_FRAMEBUFFER, NULL);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -574,26 +694,7 @@ void Render(App* app)
            
 
 
-            AlignHead(app->cBuffer, app->uniformBlockAlignmentOffset);
-
-            app->globalParamsOffset = app->cBuffer.head;
-
-            PushVec3(app->cBuffer, app->camera.cameraPos);
-            PushUInt(app->cBuffer, app->lights.size());
-
-            for (int i = 0; i < app->lights.size(); ++i)
-            {
-                AlignHead(app->cBuffer, sizeof(glm::vec4));
-                PushUInt(app->cBuffer, app->lights[i].type);
-                PushVec3(app->cBuffer, app->lights[i].color);
-                PushVec3(app->cBuffer, app->lights[i].direction);
-                PushVec3(app->cBuffer, app->lights[i].position);
-                PushFloat(app->cBuffer, app->lights[i].intensity);
-            }
-
-            app->globalParamsSize = app->cBuffer.head - app->globalParamsOffset;
             glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-            UnmapBuffer(app->cBuffer);
             renderQuad();
 
 
@@ -631,53 +732,10 @@ void Render(App* app)
             Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
             glUseProgram(texturedMeshProgram.handle);
 
-            MapBuffer(app->cBuffer, GL_WRITE_ONLY);
-            app->globalParamsOffset = app->cBuffer.head;
-
-            PushVec3(app->cBuffer, app->camera.cameraPos);
-            PushUInt(app->cBuffer, app->lights.size());
-
-            for (auto& light : app->lights)
-            {
-                AlignHead(app->cBuffer, sizeof(glm::vec4));
-                PushUInt(app->cBuffer, light.type);
-                PushVec3(app->cBuffer, light.color);
-                PushVec3(app->cBuffer, light.direction);
-
-                app->globalParamsSize = app->cBuffer.head - app->globalParamsOffset;
-            }
+            BuildRenderQueue(app, app->renderQueue, RENDER_PASS_OPAQUE, app->texturedMeshProgramIdx);
+            SortRenderQueue(app->renderQueue);
+            SubmitRenderQueue(app, app->renderQueue);
 
-            for (int i = 0; i < app->entities.size(); ++i)
-            {
-                Model& model = app->models[app->entities[i].modelId];
-                Mesh& mesh = app->meshes[model.meshIdx];
-
-                AlignHead(app->cBuffer, app->uniformBlockAlignmentOffset);
-                app->entities[i].localParamsOffset = app->cBuffer.head;
-
-                float angle = 70;
-                PushMat4(app->cBuffer, glm::rotate(glm::scale(app->entities[i].matrix, glm::vec3(2, 2, 2)), glm::radians(angle), glm::vec3(1, 0, 0)));
-                PushMat4(app->cBuffer, app->camera.GetViewMatrix(app->displaySize));
-                app->entities[i].localParamsSize = app->cBuffer.head - app->entities[i].localParamsOffset;
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cBuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
-
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-                {
-                    GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
-                    glBindVertexArray(vao);
-                    u32 submeshMaterialIdx = model.materialIdx[i];
-                    Material& submeshMaterial = app->materials[submeshMaterialIdx];
-
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-                    glUniform1i(app->texturedMeshProgramIdx, 0);
-
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)submesh.indexOffset);
-                }
-            }
-            UnmapBuffer(app->cBuffer);
             glBindBuffer(GL_READ_FRAMEBUFFER, app->frameBufferController);
             glBindBuffer(GL_DRAW_FRAMEBUFFER, 0);
             glBlitFramebuffer(0, 0, app->displaySize.x, app->displaySize.y, 0, 0, app->displaySize.x, app->displaySize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
@@ -688,14 +746,24 @@ void Render(App* app)
         default:;
     }
 
-
+    EndBufferRegion(app->cBuffer);
+    EndBufferRegion(app->lightBuffer);
+    EndBufferRegion(app->instanceBuffer);
+    EndBufferRegion(app->indirectBuffer);
 }
 
 void CreateEntities(App* app)
 {
-    app->model = LoadModel(app, "Cube/Plane.obj");
+    app->model = LoadModelAsync(app, "Cube/Plane.obj");
     app->entities.push_back(Entity(glm::mat4(1.f), app->model));
 
+    // Standing on the plane
+    const glm::mat4 patrickTransform = glm::scale(glm::translate(glm::vec3(0.0f, 0.86f, 0.0f)), glm::vec3(0.25f));
+#if SCENE_MODEL_HIERARCHY
+    LoadModelHierarchyAsync(app, "Patrick/Patrick.obj", patrickTransform);
+#else
+    app->entities.push_back(Entity(patrickTransform, LoadModelAsync(app, "Patrick/Patrick.obj")));
+#endif
 
     app->lights.push_back(Light(LightType::DIRECTIONAL, vec3(0.8, 0.8, 0.8), vec3(0.0, -1.0, 1.0), vec3(4.f, 4.f, 0.f), 0.1)); 
     app->lights.push_back(Light(LightType::POINTT, vec3(0.0, 0.8, 0.9), vec3(0.4, -1.0, 2.0), vec3(2.f, 1.6f, 2.f), 0.7)); 
@@ -707,6 +775,40 @@ void CreateEntities(App* app)
 
 }
 
+void CreateInstancingTestEntities(App* app, u32 side)
+{
+    RemoveInstancingTestEntities(app);
+
+    if (app->cubeModel == UINT32_MAX)
+        app->cubeModel = LoadModelAsync(app, "Cube/Cube_obj.obj");
+
+    // side x side grid of small cubes, all sharing the same model
+    app->instancingTestFirstEntity = (u32)app->entities.size();
+    app->instancingTestEntityCount = side * side;
+    const f32 spacing = 1.5f;
+    const f32 offset = -0.5f * spacing * (side - 1);
+    for (u32 z = 0; z < side; ++z)
+        for (u32 x = 0; x < side; ++x)
+        {
+            glm::mat4 matrix = glm::translate(glm::vec3(offset + x * spacing, 0.0f, offset + z * spacing));
+            app->entities.push_back(Entity(glm::scale(matrix, glm::vec3(0.005f)), app->cubeModel));
+        }
+}
+
+void RemoveInstancingTestEntities(App* app)
+{
+    if (app->instancingTestFirstEntity == UINT32_MAX)
+        return;
+
+    auto first = app->entities.begin() + app->instancingTestFirstEntity;
+    app->entities.erase(first, first + app->instancingTestEntityCount);
+    if (app->stressTestFloorEntity != UINT32_MAX && app->stressTestFloorEntity > app->instancingTestFirstEntity)
+        app->stressTestFloorEntity -= app->instancingTestEntityCount;
+
+    app->instancingTestFirstEntity = UINT32_MAX;
+    app->instancingTestEntityCount = 0;
+}
+
 void InitGPUInfo(App* app)
 {
     app->version = glGetString(GL_VERSION);
@@ -726,10 +828,23 @@ void InitModes(App* app)
     GLint maxBufferSize;
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignmentOffset);
     glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBufferSize);
-    app->cBuffer = CreateBuffer(maxBufferSize, GL_UNIFORM_BUFFER, GL_STREAM_DRAW);
-    app->toyNormalTexIdx = LoadTexture2D(app, "Cube/toy_box_normal.png");
-    app->toyHeightTexIdx = LoadTexture2D(app, "Cube/toy_box_disp.png");
-    app->toyDiffuseTexIdx = LoadTexture2D(app, "Cube/toy_box_diffuse.png");
+    app->cBuffer = CreateRingBuffer(maxBufferSize, CONSTANT_BUFFER_FRAMES, GL_UNIFORM_BUFFER);
+
+    // Lights, clusters and cluster light lists for the lighting pass
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &app->storageBlockAlignmentOffset);
+    u32 lightBufferSize = MAX_LIGHTS * sizeof(GpuLight) + CLUSTER_COUNT * sizeof(glm::uvec2) + MAX_CLUSTER_LIGHT_INDICES * sizeof(u32) + 3 * app->storageBlockAlignmentOffset + 3 * 16;
+    app->lightBuffer = CreateRingBuffer(lightBufferSize, CONSTANT_BUFFER_FRAMES, GL_SHADER_STORAGE_BUFFER);
+
+    // Instance matrices and vertex decodings, and the per draw instance indices (also read as a vertex attribute)
+    u32 instanceBufferSize = MAX_INSTANCES * (sizeof(glm::mat4) + sizeof(VertexDecoding)) + MAX_INSTANCE_INDICES * sizeof(u32) + 2 * app->storageBlockAlignmentOffset;
+    app->instanceBuffer = CreateRingBuffer(instanceBufferSize, CONSTANT_BUFFER_FRAMES, GL_SHADER_STORAGE_BUFFER);
+    app->indirectBuffer = CreateRingBuffer(MAX_DRAW_COMMANDS * sizeof(DrawElementsIndirectCommand), CONSTANT_BUFFER_FRAMES, GL_DRAW_INDIRECT_BUFFER);
+    app->toyNormalTexIdx = LoadTexture2DAsync(app, "Cube/toy_box_normal.png", app->normalTexIdx, TEXTURE_USAGE_NORMAL_MAP);
+    app->toyHeightTexIdx = LoadTexture2DAsync(app, "Cube/toy_box_disp.png", app->blackTexIdx);
+    app->toyDiffuseTexIdx = LoadTexture2DAsync(app, "Cube/toy_box_diffuse.png", app->whiteTexIdx, TEXTURE_USAGE_SRGB);
+    AddTextureRef(app, app->toyNormalTexIdx);
+    AddTextureRef(app, app->toyHeightTexIdx);
+    AddTextureRef(app, app->toyDiffuseTexIdx);
 
     app->mode = Mode::DEFERRED;
 
@@ -755,6 +870,7 @@ void InitModes(App* app)
         texturedMeshProgram.vertexInputLayout.attributes.push_back({ 2,2 });
         texturedMeshProgram.vertexInputLayout.attributes.push_back({ 3,3 });
         texturedMeshProgram.vertexInputLayout.attributes.push_back({ 4,3 });
+        texturedMeshProgram.vertexInputLayout.attributes.push_back({ INSTANCE_INDEX_LOCATION,1 });
 
         app->lightsProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_LIGHT");
         Program& light = app->programs[app->lightsProgramIdx];
@@ -773,12 +889,6 @@ void InitModes(App* app)
         break;
     }
     }
-
-    app->cubemapTexture = loadCubeMap(app->cubeFaces);
-    glUseProgram(app->cubeProgramIdx);
-    glUniform1i(app->cubeProgramIdx, app->showCubeMap);
-
-    RenderCubeMap(app);
 }
 
 void InitBuffers(App* app)
@@ -947,7 +1057,7 @@ void RenderCubeMap(App* app)
     cShader.setVec3("cameraPos", app->camera.cameraPos);
 
     glBindVertexArray(cubeVAO);
-    glActiveTexture(GL_TEXTURE3);
+    glActiveTexture(GL_TEXTURE0 + CUBEMAP_TEXTURE_UNIT);
     glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
@@ -961,7 +1071,7 @@ void RenderCubeMap(App* app)
     
     // skybox cube
     glBindVertexArray(skyVAO);
-    glActiveTexture(GL_TEXTURE3);
+    glActiveTexture(GL_TEXTURE0 + CUBEMAP_TEXTURE_UNIT);
     glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
@@ -969,38 +1079,162 @@ void RenderCubeMap(App* app)
 
 }
 
-unsigned int loadCubeMap(std::vector<std::string> faces)
+struct CubeMapFaceLoad
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    std::string       filepath;
+    u32               maxSize; // Of the texture quality tier
+    Image             image;
+    CompressedTexture compressed;
+    bool              loaded;
+};
+
+struct CubeMapLoadRequest
+{
+    App*            app;
+    CubeMapFaceLoad faces[6];
+    JobCounter      decodedFaces;
+    std::chrono::high_resolution_clock::time_point start;
+};
 
-    int width, height, nrChannels;
+static void DecodeCubeMapFaceJob(void* data)
+{
+    CubeMapFaceLoad* face = (CubeMapFaceLoad*)data;
+#if COMPRESS_TEXTURES
+    face->loaded = LoadCompressedTexture(face->filepath.c_str(), TEXTURE_USAGE_SRGB, face->compressed);
+    if (face->loaded)
+        DropTopLevels(face->compressed, face->maxSize);
+#else
+    face->image = LoadImage(face->filepath.c_str(), false);
+    face->loaded = face->image.pixels != NULL;
+#endif
+}
 
-    for (unsigned int i = 0; i < faces.size(); ++i)
+// Every face is compressed on its own, they must have ended up with the same layout
+static bool CanUploadCompressedCubeMap(const CubeMapFaceLoad faces[6])
+{
+    for (u32 i = 1; i < 6; ++i)
     {
-        stbi_set_flip_vertically_on_load(false);
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        stbi_set_flip_vertically_on_load(true);
-        
-        if (data)
+        const CompressedTexture& face = faces[i].compressed;
+        if (face.format != faces[0].compressed.format || face.width != faces[0].compressed.width ||
+            face.height != faces[0].compressed.height || face.levelCount != faces[0].compressed.levelCount)
+            return false;
+    }
+    return true;
+}
+
+// The storage of a cubemap is allocated once for all the faces, square and of the same size
+static bool CanUploadCubeMapImages(const CubeMapFaceLoad faces[6])
+{
+    for (u32 i = 0; i < 6; ++i)
+        if (faces[i].image.size != faces[0].image.size || faces[i].image.size.x != faces[i].image.size.y)
+            return false;
+    return true;
+}
+
+static void UploadCubeMapJob(void* data)
+{
+    CubeMapLoadRequest* request = (CubeMapLoadRequest*)data;
+    App* app = request->app;
+
+    bool complete = true;
+    for (const CubeMapFaceLoad& face : request->faces)
+        complete &= face.loaded;
+
+#if COMPRESS_TEXTURES
+    complete = complete && CanUploadCompressedCubeMap(request->faces);
+#else
+    complete = complete && CanUploadCubeMapImages(request->faces);
+#endif
+
+    if (complete)
+    {
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+#if COMPRESS_TEXTURES
+        const CompressedTexture& first = request->faces[0].compressed;
+        const GLenum format = GetCompressedFormatGL(first.format);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, first.levelCount, format, first.width, first.height);
+        for (u32 i = 0; i < 6; ++i)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            const CompressedTexture& face = request->faces[i].compressed;
+            for (u32 levelIdx = 0; levelIdx < face.levelCount; ++levelIdx)
+            {
+                const CompressedTextureLevel& level = face.levels[levelIdx];
+                glCompressedTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, levelIdx, 0, 0, level.width, level.height, format, level.size, face.data.data() + level.offset);
+            }
+            AddTextureMemory(app, request->faces[i].filepath.c_str(), face.decodedSize, face.data.size());
         }
-        else
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, first.levelCount - 1);
+#else
+        // Immutable storage with the full mip chain, generated from the faces as the compressed ones come with it
+        const ivec2 faceSize = request->faces[0].image.size;
+        u32 levelCount = 0;
+        while ((faceSize.x >> levelCount) > 0)
+            levelCount++;
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, levelCount, GL_RGB8, faceSize.x, faceSize.y);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (u32 i = 0; i < 6; ++i)
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            const Image& image = request->faces[i].image;
+            GLenum dataFormat = image.nchannels == 4 ? GL_RGBA : GL_RGB;
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, image.size.x, image.size.y, dataFormat, GL_UNSIGNED_BYTE, image.pixels);
+            const u64 size = (u64)image.size.y * image.stride;
+            AddTextureMemory(app, request->faces[i].filepath.c_str(), size, size);
         }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+#endif
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+        glDeleteTextures(1, &app->cubemapTexture);
+        app->cubemapTexture = textureID;
+
+        auto end = std::chrono::high_resolution_clock::now();
+        ILOG("Cubemap %s.. loaded in %.1f ms (faces decoded in parallel)", request->faces[0].filepath.c_str(),
+             std::chrono::duration<f32, std::milli>(end - request->start).count());
+    }
+    else
+    {
+        ELOG("Cubemap failed to load, keeping the placeholder");
+    }
+
+    for (CubeMapFaceLoad& face : request->faces)
+        if (face.image.pixels)
+            FreeImage(face.image);
+
+    app->pendingAssetLoads--;
+    delete request;
+}
+
+void LoadCubeMapAsync(App* app, const std::vector<std::string>& faces)
+{
+    ASSERT(faces.size() == 6, "A cubemap needs 6 faces");
+
+    CubeMapLoadRequest* request = new CubeMapLoadRequest;
+    request->app = app;
+    request->start = std::chrono::high_resolution_clock::now();
+    app->pendingAssetLoads++;
+
+    // One job per face, and the upload once all of them are decoded
+    Job decodeJobs[6];
+    for (u32 i = 0; i < 6; ++i)
+    {
+        request->faces[i].filepath = faces[i];
+        request->faces[i].image = {};
+        request->faces[i].loaded = false;
+        request->faces[i].maxSize = GetTextureQualityMaxSize(app->textureQuality);
+        decodeJobs[i] = Job{ DecodeCubeMapFaceJob, &request->faces[i], &request->decodedFaces, JOB_QUEUE_BACKGROUND };
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    RunJobs(decodeJobs, 6);
 
-    return textureID;
+    Job upload = { UploadCubeMapJob, request, NULL, JOB_QUEUE_MAIN_THREAD };
+    RunJobs(&upload, 1, &request->decodedFaces);
 }
 
 void InitCubeMap(App* app)
@@ -1133,14 +1367,23 @@ void InitCubeMap(App* app)
         "back.jpg",
     };
 
-    
-    app->cubemapTexture = loadCubeMap(cubeFaces);
+    // Plain grey sky until the faces are decoded
+    glGenTextures(1, &app->cubemapTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
+    const u8 placeholderPixel[3] = { 64, 64, 64 };
+    for (u32 i = 0; i < 6; ++i)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB8, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, placeholderPixel);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    LoadCubeMapAsync(app, cubeFaces);
 
+    // Both sample the same cubemap, bound once per draw to its own unit
     cShader.use();
-    cShader.setInt("skybox",0);
+    cShader.setInt("skybox", CUBEMAP_TEXTURE_UNIT);
 
     sShader.use();
-    sShader.setInt("skybox", 0);
+    sShader.setInt("skybox", CUBEMAP_TEXTURE_UNIT);
 
 
 }
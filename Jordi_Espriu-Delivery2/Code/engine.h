@@ -9,6 +9,17 @@
 #include "assimp_model_loading.h"
 #include <map>
 #include "Shaders.h"
+#include "culling.h"
+#include "clustered_lighting.h"
+#include "render_queue.h"
+#include "geometry_pool.h"
+#include "upload_queue.h"
+#include "texture_compression.h"
+#include "texture_registry.h"
+#include "vertex_encoding.h"
+#include "mesh_lod.h"
+#include "meshlets.h"
+#include "mesh_kernels.h"
 
 #include <glm/gtx/quaternion.hpp>
 
@@ -20,12 +31,26 @@ typedef glm::ivec2 ivec2;
 typedef glm::ivec3 ivec3;
 typedef glm::ivec4 ivec4;
 
+#define BINDING(b) b
+
+#define MAX_BUFFER_REGIONS 4
+#define CONSTANT_BUFFER_FRAMES 3
+
 struct Buffer {
     GLuint  handle;
     GLenum  type;
     u32     size;
     u32     head;
     void* data;
+
+    // Ring buffers are split into regions (one per frame in flight) guarded by fences
+    u32     regionSize;
+    u32     regionCount;
+    u32     regionIdx;
+    u32     regionEnd;
+    GLsync  regionFences[MAX_BUFFER_REGIONS];
+    bool    persistent;
+    u32     fenceWaitCount;
 };
 
 struct VertexV3V2
@@ -42,10 +67,27 @@ struct Image
     i32   stride;
 };
 
+enum AssetState
+{
+    ASSET_LOADED,
+    ASSET_LOADING, // Decoding on the job system, a placeholder is used meanwhile
+    ASSET_FAILED,
+    ASSET_EVICTED, // Over the texture budget, reloaded when used again
+};
+
 struct Texture
 {
     GLuint      handle;
     std::string filepath;
+    AssetState  state;
+    u32         usageFlags;        // TextureUsageFlags it was loaded with
+    u32         placeholderTexIdx; // Its handle is used while loading or evicted
+    u64         contentKey;        // Hash of the source file and usageFlags
+    u32         aliasOf = UINT32_MAX; // Texture with the same content whose storage is shared
+    u32         refCount;          // Including the ones of its aliases
+    u32         lastUsedFrame;
+    u64         residentSize;      // 0 if it does not own its storage
+    u64         decodedSize;
 };
 
 struct VertexShaderAttribute
@@ -59,25 +101,6 @@ struct VertexShaderLayout
     std::vector<VertexShaderAttribute> attributes;
 };
 
-struct VertexBufferAttribute
-{
-    u8 location;
-    u8 componentCount;
-    u8 offset;
-};
-
-struct VertexBufferLayout
-{
-    std::vector<VertexBufferAttribute> attributes;
-    u8                                 stride;
-};
-
-struct Vao
-{
-    GLuint handle;
-    GLuint programHandle;
-};
-
 struct Program
 {
     GLuint             handle;
@@ -92,29 +115,41 @@ enum Mode
     TEXTUREDQUAD,
     DEFERRED,
     FORWARD,
+    DEFERRED_INDIRECT, // Deferred, with the geometry pass submitted through multi-draw indirect
 };
 
 struct Model
 {
     u32 meshIdx;
     std::vector<u32> materialIdx;
+    AssetState state; // While loading, its mesh has no submeshes
 };
 
 struct Submesh
 {
     VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
-    std::vector<u32> indices;
-    u32              vertexOffset;
-    u32              indexOffset;
-    std::vector<Vao> vaos;
+    std::vector<u8>  vertices;     // In the layout above
+    std::vector<u8>  indices;      // Of indexType, the levels of detail one after the other
+    u32              vertexCount;
+    u32              indexCount;   // Of all the levels
+    GLenum           indexType;
+    u32              vertexOffset; // In bytes, in the vertex data of the whole mesh (as stored in the mesh cache)
+    u32              indexOffset;  // In bytes, in the index data of the whole mesh
+    GeometryAllocation geometry;
+    BoundingVolume   bounds;
+    u32              lodCount;
+    SubmeshLod       lods[MAX_LODS];
+    std::vector<Meshlet> meshlets; // Of all the levels
+    bool             closed;       // Every level is a closed surface (IsClosedMesh), its clusters can be culled by facing
 };
 
 struct Mesh
 {
     std::vector<Submesh> submeshes;
-    GLuint               vertexBufferHandle;
-    GLuint               indexBufferHandle;
+    BoundingVolume       bounds;
+    VertexDecoding       vertexDecoding; // Shared by all the submeshes
+    u32                  lodCount;       // Of the submesh with the most
+    f32                  lodErrors[MAX_LODS];
 };
 
 struct Material
@@ -130,6 +165,39 @@ struct Material
     u32         bumpTextureIdx;
 };
 
+#define MATERIAL_TEXTURE_SLOTS 5 // albedo, emissive, specular, normals, bump
+
+// A node of the file referencing a submesh, in hierarchy imports
+struct ModelNode
+{
+    u32       submeshIdx;
+    glm::mat4 transform; // Relative to the root of the file
+};
+
+// Float vertices (in the layout of MakeModelVertexLayout) and triangle indices of a mesh
+// converted by one of the native loaders, before it becomes a submesh
+struct ImportedMesh
+{
+    std::vector<float> vertices;
+    std::vector<u32>   indices;
+    bool               hasTexCoords; // And so the tangent space
+    MeshKernelTimings  kernelTimings; // Of the kernels run on it by the loader
+};
+
+// CPU side result of importing a model or reading it from the cache. Filled by the
+// loading jobs, and turned into a model (GL resources included) on the main thread.
+struct ModelData
+{
+    std::vector<Material>       materials;       // Texture indices not assigned yet
+    std::vector<std::string>    texturePaths;    // MATERIAL_TEXTURE_SLOTS per material, empty if unused
+    std::vector<Submesh>        submeshes;       // Geometry not allocated yet
+    std::vector<u32>            materialIdx;     // Per submesh, relative to the first material
+    std::vector<VertexDecoding> vertexDecodings; // Per submesh, the same for all of them unless hierarchy is set
+    std::vector<ModelNode>      nodes;           // Only with hierarchy
+    std::vector<std::string>    sourceFiles;     // Files the import read (the model, its material libraries...)
+    bool                        hierarchy = false; // Every submesh is a model of its own, instanced by the nodes
+};
+
 struct Camera {
     float pitch = 0.f;
     float yaw = -90.f;
@@ -145,15 +213,20 @@ struct Camera {
 	glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
 
 	float fov = 60.f;
+	float nearPlane = 0.1f;
+	float farPlane = 100.f;
 
-    glm::mat4 GetViewMatrix(const vec2& size) {
-        
-		float Phi = glm::radians(pitch);
-		float Theta = glm::radians(yaw);
+    glm::mat4 GetLookAtMatrix() const {
+        return glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+    }
 
-		glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+    glm::mat4 GetProjectionMatrix(const vec2& size) const {
+        return glm::perspective(glm::radians(fov), size.x / size.y, nearPlane, farPlane);
+    }
 
-        return glm::perspective(glm::radians(fov), size.x / size.y, 0.1f, 100.f) * view;
+    // Projection * view
+    glm::mat4 GetViewMatrix(const vec2& size) {
+        return GetProjectionMatrix(size) * GetLookAtMatrix();
     }
 };
 
@@ -161,8 +234,9 @@ struct Entity
 {
     glm::mat4 matrix = glm::mat4(0.f);
     u32 modelId;
-    u32 localParamsOffset;
-    u32 localParamsSize;
+    bool visible = true;
+    u32 submeshVisibilityOffset = 0; // Index of the first submesh in App::submeshVisibility
+    u8 lod = 0;                      // Level of detail it was last drawn at
 
     Entity(const glm::mat4& mat, u32 mdlId) : matrix(mat), modelId(mdlId) {};
 };
@@ -180,8 +254,9 @@ struct Light
     vec3 direction;
     vec3 position;
     float intensity;
+    float radius; // Point lights have no effect beyond it
 
-    Light(const LightType t, const vec3 c, vec3 dir, vec3 pos, float intensity) : type(t), color(c), direction(dir), position(pos), intensity(intensity) {}
+    Light(const LightType t, const vec3 c, vec3 dir, vec3 pos, float intensity, float radius = 8.f) : type(t), color(c), direction(dir), position(pos), intensity(intensity), radius(radius) {}
 };
 
 
@@ -249,16 +324,6 @@ struct App
     GLuint texturedMeshProgramIdx_RelieveHeight;
     GLuint texturedCube;
 
-    std::vector<std::string> cubeFaces
-    {
-        "front.png",
-        "back.png",
-        "top.png",
-        "bottom.jpg",
-        "left.png",
-        "right.png"
-    };
-    
 
     GLuint vao;
     GLuint frameBufferController;
@@ -289,17 +354,60 @@ struct App
     const const unsigned char* extensions = nullptr;
     bool showRelief;
     bool showCubeMap;
-    unsigned int cubemapTexture;
+    unsigned int cubemapTexture; // Loaded once (InitCubeMap), sampled by the skybox and the reflective cube
     unsigned int cubeTexture;
 
     std::vector<Shader> vecShaders;
+
+    bool frustumCulling = true;
+    CullingStats cullingStats;
+    std::vector<u8> submeshVisibility;
+    std::vector<glm::mat4> entityWorldMatrices;
+
+    bool clusterCulling = true;
+    bool clusterBackfaceCulling = true;
+
+    bool meshLods = true;
+    f32 lodErrorPixels = LOD_ERROR_PIXELS;
+    LodStats lodStats;
+
+    Buffer lightBuffer;
+    int storageBlockAlignmentOffset;
+    ClusteredLighting clusteredLighting;
+    bool stressTestLights = false;
+    u32 stressTestFirstLight = UINT32_MAX;
+    u32 stressTestFloorEntity = UINT32_MAX;
+
+    RenderQueue renderQueue;
+    Buffer instanceBuffer;
+    Buffer indirectBuffer;
+
+    GeometryPool geometryPool;
+    u32 cubeModel = UINT32_MAX;
+    bool instancingTest = false;
+    u32 instancingTestFirstEntity = UINT32_MAX;
+    u32 instancingTestEntityCount = 0;
+
+    u32 pendingAssetLoads = 0;
+    TextureRegistry textureRegistry;
+    TextureQuality textureQuality = DEFAULT_TEXTURE_QUALITY; // For the textures loaded (or reloaded) from now on
+
+    Buffer uploadBuffer;
+    UploadQueue uploadQueue;
    
 };
 
 
 
 
-u32 LoadTexture2D(App* app, const char* filepath);
+Image LoadImage(const char* filename, bool flipVertically = true);
+
+void FreeImage(Image image);
+
+GLuint CreateTexture2DFromImage(Image image);
+
+// 1x1 white, black, flat normal and magenta textures, used while the real ones load
+void InitPlaceholderTextures(App* app);
 
 void Init(App* app);
 
@@ -309,8 +417,16 @@ void InitBuffers(App* app);
 
 void InitModes(App* app);
 
+// Patrick is loaded keeping its node hierarchy, an entity per submesh so its parts are culled
+// and pick their levels of detail one by one. 0 loads it as a single model, to compare.
+#define SCENE_MODEL_HIERARCHY 1
+
 void CreateEntities(App* app);
 
+// Grid of side x side cubes sharing a model, to test the instanced path
+void CreateInstancingTestEntities(App* app, u32 side);
+void RemoveInstancingTestEntities(App* app);
+
 void Gui(App* app);
 
 void Update(App* app);
@@ -322,8 +438,13 @@ void RenderSphere();
 void RenderCube();
 
 // Skybox functions
+
+// Unit the cubemap is bound to, after the ones of the material textures
+#define CUBEMAP_TEXTURE_UNIT 3
+
 void RenderCubeMap(App* app);
-unsigned int loadCubeMap(std::vector<std::string> faces);
+// Decodes (and compresses) the faces on the job system and replaces app->cubemapTexture once uploaded
+void LoadCubeMapAsync(App* app, const std::vector<std::string>& faces);
 void InitCubeMap(App* app);
 
 
@@ -0,0 +1,136 @@
+#include "file_cache.h"
+#include "pack_file.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+struct FileCacheEntry
+{
+    MappedFile file;     // First, so the MappedFile pointers handed out are the entry ones
+    u32        refCount;
+    bool       used;     // Since the last trim
+};
+
+struct FileCache
+{
+    std::mutex                                      mutex;
+    std::unordered_map<std::string, FileCacheEntry> entries; // Nodes, so the entries don't move
+};
+
+static FileCache GlobalFileCache;
+
+// Files acquired by this thread since each BeginFileRecording, the innermost one last.
+// Nested when a thread waiting on its jobs runs another import meanwhile.
+static thread_local std::vector<std::unordered_set<std::string>> FileRecordings;
+
+const MappedFile* AcquireFile(const char* filepath)
+{
+    FileCache& cache = GlobalFileCache;
+    std::unique_lock<std::mutex> lock(cache.mutex);
+
+    auto it = cache.entries.find(filepath);
+    if (it == cache.entries.end())
+    {
+        // Mapped without the lock: files from the pack are decompressed on the job system,
+        // and the jobs this thread runs meanwhile can acquire files too
+        lock.unlock();
+        MappedFile file = MapAssetFile(filepath);
+        if (!file.data)
+            return NULL;
+        lock.lock();
+
+        auto inserted = cache.entries.emplace(filepath, FileCacheEntry{ file, 0, false });
+        if (!inserted.second)
+            UnmapAssetFile(file); // Another thread mapped it meanwhile
+        it = inserted.first;
+    }
+
+    if (!FileRecordings.empty())
+        FileRecordings.back().insert(it->first);
+
+    FileCacheEntry& entry = it->second;
+    entry.refCount++;
+    entry.used = true;
+    return &entry.file;
+}
+
+void ReleaseFile(const MappedFile* file)
+{
+    FileCache& cache = GlobalFileCache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    FileCacheEntry* entry = (FileCacheEntry*)file;
+    ASSERT(entry->refCount > 0, "File released more times than acquired");
+    entry->refCount--;
+}
+
+void TrimFileCache()
+{
+    FileCache& cache = GlobalFileCache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (auto it = cache.entries.begin(); it != cache.entries.end();)
+    {
+        FileCacheEntry& entry = it->second;
+        if (entry.refCount == 0 && !entry.used)
+        {
+            UnmapAssetFile(entry.file);
+            it = cache.entries.erase(it);
+        }
+        else
+        {
+            entry.used = false;
+            ++it;
+        }
+    }
+}
+
+void EvictUnusedFiles()
+{
+    FileCache& cache = GlobalFileCache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (auto it = cache.entries.begin(); it != cache.entries.end();)
+    {
+        if (it->second.refCount == 0)
+        {
+            UnmapAssetFile(it->second.file);
+            it = cache.entries.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void ShutdownFileCache()
+{
+    FileCache& cache = GlobalFileCache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (auto& it : cache.entries)
+    {
+        ASSERT(it.second.refCount == 0, "File still referenced at shutdown");
+        UnmapAssetFile(it.second.file);
+    }
+    cache.entries.clear();
+}
+
+void BeginFileRecording()
+{
+    FileRecordings.emplace_back();
+}
+
+void EndFileRecording(std::vector<std::string>& paths)
+{
+    ASSERT(!FileRecordings.empty(), "EndFileRecording without BeginFileRecording");
+
+    // Sorted, so the same import always lists them in the same order
+    paths.assign(FileRecordings.back().begin(), FileRecordings.back().end());
+    std::sort(paths.begin(), paths.end());
+    FileRecordings.pop_back();
+}
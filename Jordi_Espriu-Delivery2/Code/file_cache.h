@@ -0,0 +1,45 @@
+//
+// file_cache.h: Shared read-only mappings of the asset files. Everything reading a source
+// file (hashing it to validate the caches, importing it, decoding an image) goes through
+// here, so a file read several times while loading is mapped once and its pages read from
+// disk once. Mappings live while referenced, and are kept until the next trim after that.
+//
+
+#pragma once
+
+#include "platform.h"
+
+/**
+ * Maps the file, or returns the mapping already there, and adds a reference to it.
+ * Returns NULL if the file can't be mapped (it doesn't exist or is empty).
+ * Can be called from any thread.
+ */
+const MappedFile* AcquireFile(const char* filepath);
+
+void ReleaseFile(const MappedFile* file);
+
+/**
+ * Unmaps the files that nobody has used since the last trim. Called once per frame, so
+ * unused files don't stay mapped (and locked against writes on Windows) for long.
+ */
+void TrimFileCache();
+
+/**
+ * Unmaps every file with no references, used since the last trim or not.
+ */
+void EvictUnusedFiles();
+
+/**
+ * Unmaps every file, with no references left to them.
+ */
+void ShutdownFileCache();
+
+/**
+ * Records the paths of the files the calling thread acquires until EndFileRecording returns
+ * them. Model imports record what they read (the loaders acquire their files on the thread
+ * they run on), so the mesh cache and the cooker know what the model depends on. Recordings
+ * can be nested, each one only sees the files acquired while it is the innermost.
+ */
+void BeginFileRecording();
+
+void EndFileRecording(std::vector<std::string>& paths);
@@ -0,0 +1,354 @@
+#include "geometry_pool.h"
+#include "engine.h"
+#include "vertex_encoding.h"
+
+#include <algorithm>
+
+bool SameVertexBufferLayout(const VertexBufferLayout& a, const VertexBufferLayout& b)
+{
+    if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+        return false;
+
+    for (u32 i = 0; i < (u32)a.attributes.size(); ++i)
+        if (a.attributes[i].location != b.attributes[i].location ||
+            a.attributes[i].componentCount != b.attributes[i].componentCount ||
+            a.attributes[i].offset != b.attributes[i].offset ||
+            a.attributes[i].type != b.attributes[i].type ||
+            a.attributes[i].normalized != b.attributes[i].normalized)
+            return false;
+
+    return true;
+}
+
+void InitFreeList(FreeListAllocator& allocator, u32 capacity)
+{
+    allocator.capacity = capacity;
+    allocator.used = 0;
+    allocator.freeRanges.clear();
+    if (capacity > 0)
+        allocator.freeRanges.push_back(FreeRange{ 0, capacity });
+}
+
+u32 AllocateRange(FreeListAllocator& allocator, u32 size)
+{
+    for (u32 i = 0; i < (u32)allocator.freeRanges.size(); ++i)
+    {
+        FreeRange& range = allocator.freeRanges[i];
+        if (range.size < size)
+            continue;
+
+        u32 offset = range.offset;
+        range.offset += size;
+        range.size -= size;
+        if (range.size == 0)
+            allocator.freeRanges.erase(allocator.freeRanges.begin() + i);
+
+        allocator.used += size;
+        return offset;
+    }
+
+    return UINT32_MAX;
+}
+
+void ReleaseRange(FreeListAllocator& allocator, u32 offset, u32 size)
+{
+    if (size == 0)
+        return;
+
+    std::vector<FreeRange>& ranges = allocator.freeRanges;
+    auto next = std::lower_bound(ranges.begin(), ranges.end(), offset, [](const FreeRange& range, u32 offset) {
+        return range.offset < offset;
+    });
+
+    auto inserted = ranges.insert(next, FreeRange{ offset, size });
+    allocator.used -= size;
+
+    // Merge with the following and the previous ranges
+    auto following = inserted + 1;
+    if (following != ranges.end() && inserted->offset + inserted->size == following->offset)
+    {
+        inserted->size += following->size;
+        ranges.erase(following);
+    }
+    if (inserted != ranges.begin())
+    {
+        auto previous = inserted - 1;
+        if (previous->offset + previous->size == inserted->offset)
+        {
+            previous->size += inserted->size;
+            ranges.erase(inserted);
+        }
+    }
+}
+
+// Grows the allocator to newCapacity, the new space is a free range at the end
+static void GrowFreeList(FreeListAllocator& allocator, u32 newCapacity)
+{
+    u32 oldCapacity = allocator.capacity;
+    allocator.capacity = newCapacity;
+    allocator.used += newCapacity - oldCapacity;
+    ReleaseRange(allocator, oldCapacity, newCapacity - oldCapacity);
+}
+
+static GLuint CreateGeometryBuffer(GLenum type, u32 size)
+{
+    GLuint handle;
+    glGenBuffers(1, &handle);
+    glBindBuffer(type, handle);
+    glBufferData(type, size, NULL, GL_STATIC_DRAW);
+    glBindBuffer(type, 0);
+    return handle;
+}
+
+// Creates a buffer of newSize bytes and copies the ranges (in bytes) of the old one
+static GLuint ReallocateGeometryBuffer(GLenum type, GLuint oldHandle, u32 newSize, const std::vector<FreeRange>& copies)
+{
+    GLuint newHandle = CreateGeometryBuffer(type, newSize);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, oldHandle);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newHandle);
+    for (const FreeRange& copy : copies)
+        if (copy.size > 0)
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, copy.offset, copy.offset, copy.size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glDeleteBuffers(1, &oldHandle);
+    return newHandle;
+}
+
+static void RebindPoolBuffers(GeometryPool& pool)
+{
+    for (VertexPool& vertexPool : pool.vertexPools)
+        for (Vao& vao : vertexPool.vaos)
+        {
+            glBindVertexArray(vao.handle);
+            glBindVertexBuffer(GEOMETRY_VERTEX_BINDING, vertexPool.bufferHandle, 0, vertexPool.layout.stride);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBufferHandle);
+        }
+    glBindVertexArray(0);
+}
+
+void InitGeometryPool(GeometryPool& pool)
+{
+    pool.vertexPools.clear();
+    pool.indexBufferHandle = CreateGeometryBuffer(GL_ELEMENT_ARRAY_BUFFER, GEOMETRY_POOL_INITIAL_INDICES * sizeof(u32));
+    InitFreeList(pool.indexAllocator, GEOMETRY_POOL_INITIAL_INDICES);
+    pool.growCount = 0;
+    pool.compactCount = 0;
+}
+
+static u32 FindVertexPool(GeometryPool& pool, const VertexBufferLayout& layout)
+{
+    for (u32 i = 0; i < (u32)pool.vertexPools.size(); ++i)
+        if (SameVertexBufferLayout(pool.vertexPools[i].layout, layout))
+            return i;
+
+    pool.vertexPools.push_back(VertexPool{});
+    VertexPool& vertexPool = pool.vertexPools.back();
+    vertexPool.layout = layout;
+    vertexPool.bufferHandle = CreateGeometryBuffer(GL_ARRAY_BUFFER, GEOMETRY_POOL_INITIAL_VERTICES * layout.stride);
+    InitFreeList(vertexPool.allocator, GEOMETRY_POOL_INITIAL_VERTICES);
+    return (u32)pool.vertexPools.size() - 1u;
+}
+
+// Allocates count elements, growing the buffer (at least doubling it) if needed
+static u32 AllocateOrGrow(GeometryPool& pool, FreeListAllocator& allocator, GLuint& bufferHandle, GLenum type, u32 elementSize, u32 count)
+{
+    u32 offset = AllocateRange(allocator, count);
+    if (offset != UINT32_MAX)
+        return offset;
+
+    u32 newCapacity = glm::max(allocator.capacity * 2, allocator.capacity + count);
+
+    // Copy everything that is allocated, the free ranges are the holes between the live ranges
+    std::vector<FreeRange> copies;
+    u32 cursor = 0;
+    for (const FreeRange& range : allocator.freeRanges)
+    {
+        copies.push_back(FreeRange{ cursor * elementSize, (range.offset - cursor) * elementSize });
+        cursor = range.offset + range.size;
+    }
+    copies.push_back(FreeRange{ cursor * elementSize, (allocator.capacity - cursor) * elementSize });
+
+    bufferHandle = ReallocateGeometryBuffer(type, bufferHandle, newCapacity * elementSize, copies);
+    GrowFreeList(allocator, newCapacity);
+    RebindPoolBuffers(pool);
+    pool.growCount++;
+
+    offset = AllocateRange(allocator, count);
+    ASSERT(offset != UINT32_MAX, "Geometry pool allocation failed after growing");
+    return offset;
+}
+
+GeometryAllocation AllocateGeometry(App* app, const VertexBufferLayout& layout, const void* vertices, u32 vertexCount, const void* indices, u32 indexCount, GLenum indexType)
+{
+    GeometryPool& pool = app->geometryPool;
+
+    GeometryAllocation allocation = {};
+    allocation.poolIdx = FindVertexPool(pool, layout);
+    allocation.vertexCount = vertexCount;
+    allocation.indexCount = indexCount;
+    allocation.indexType = indexType;
+
+    const u32 indexSize = GetIndexSize(indexType);
+    allocation.indexSlotCount = (indexCount * indexSize + sizeof(u32) - 1) / sizeof(u32);
+
+    VertexPool& vertexPool = pool.vertexPools[allocation.poolIdx];
+    allocation.baseVertex = AllocateOrGrow(pool, vertexPool.allocator, vertexPool.bufferHandle, GL_ARRAY_BUFFER, layout.stride, vertexCount);
+    allocation.indexSlot = AllocateOrGrow(pool, pool.indexAllocator, pool.indexBufferHandle, GL_ELEMENT_ARRAY_BUFFER, sizeof(u32), allocation.indexSlotCount);
+    allocation.firstIndex = allocation.indexSlot * sizeof(u32) / indexSize;
+
+    // Buffer handles are resolved when the uploads are issued, so growing meanwhile is fine
+    u32 verticesTicket = QueueGeometryUpload(app, UPLOAD_VERTICES, allocation.poolIdx, allocation.baseVertex * layout.stride, vertices, vertexCount * layout.stride);
+    u32 indicesTicket = QueueGeometryUpload(app, UPLOAD_INDICES, 0, allocation.indexSlot * sizeof(u32), indices, indexCount * indexSize);
+    allocation.uploadTicket = glm::max(verticesTicket, indicesTicket);
+
+    return allocation;
+}
+
+void FreeGeometry(App* app, GeometryAllocation& allocation)
+{
+    GeometryPool& pool = app->geometryPool;
+    ReleaseRange(pool.vertexPools[allocation.poolIdx].allocator, allocation.baseVertex, allocation.vertexCount);
+    ReleaseRange(pool.indexAllocator, allocation.indexSlot, allocation.indexSlotCount);
+    allocation.vertexCount = 0;
+    allocation.indexCount = 0;
+    allocation.indexSlotCount = 0;
+}
+
+void RemoveMeshGeometry(App* app, u32 meshIdx)
+{
+    // Pending uploads point to the CPU copy of the submeshes
+    FlushUploadQueue(app);
+
+    Mesh& mesh = app->meshes[meshIdx];
+    for (Submesh& submesh : mesh.submeshes)
+        FreeGeometry(app, submesh.geometry);
+    mesh.submeshes.clear();
+}
+
+// Moves the given ranges (in elements) to the front of a new buffer of the same size, in offset order
+static void CompactBuffer(GLenum type, GLuint& bufferHandle, FreeListAllocator& allocator, u32 elementSize, std::vector<u32*>& offsets, const std::vector<u32>& sizes)
+{
+    std::vector<u32> order(offsets.size());
+    for (u32 i = 0; i < (u32)order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&offsets](u32 a, u32 b) { return *offsets[a] < *offsets[b]; });
+
+    GLuint newHandle = CreateGeometryBuffer(type, allocator.capacity * elementSize);
+    glBindBuffer(GL_COPY_READ_BUFFER, bufferHandle);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newHandle);
+
+    u32 cursor = 0;
+    for (u32 i : order)
+    {
+        if (sizes[i] > 0)
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)*offsets[i] * elementSize, (GLintptr)cursor * elementSize, (GLsizeiptr)sizes[i] * elementSize);
+        *offsets[i] = cursor;
+        cursor += sizes[i];
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &bufferHandle);
+    bufferHandle = newHandle;
+
+    InitFreeList(allocator, allocator.capacity);
+    if (cursor > 0)
+        AllocateRange(allocator, cursor);
+}
+
+void CompactGeometryPool(App* app)
+{
+    GeometryPool& pool = app->geometryPool;
+
+    // Pending uploads have the offsets from before moving things around
+    FlushUploadQueue(app);
+
+    for (u32 poolIdx = 0; poolIdx < (u32)pool.vertexPools.size(); ++poolIdx)
+    {
+        VertexPool& vertexPool = pool.vertexPools[poolIdx];
+
+        std::vector<u32*> offsets;
+        std::vector<u32> sizes;
+        for (Mesh& mesh : app->meshes)
+            for (Submesh& submesh : mesh.submeshes)
+                if (submesh.geometry.poolIdx == poolIdx)
+                {
+                    offsets.push_back(&submesh.geometry.baseVertex);
+                    sizes.push_back(submesh.geometry.vertexCount);
+                }
+
+        CompactBuffer(GL_ARRAY_BUFFER, vertexPool.bufferHandle, vertexPool.allocator, vertexPool.layout.stride, offsets, sizes);
+    }
+
+    std::vector<u32*> offsets;
+    std::vector<u32> sizes;
+    for (Mesh& mesh : app->meshes)
+        for (Submesh& submesh : mesh.submeshes)
+        {
+            offsets.push_back(&submesh.geometry.indexSlot);
+            sizes.push_back(submesh.geometry.indexSlotCount);
+        }
+
+    CompactBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBufferHandle, pool.indexAllocator, sizeof(u32), offsets, sizes);
+
+    for (Mesh& mesh : app->meshes)
+        for (Submesh& submesh : mesh.submeshes)
+            submesh.geometry.firstIndex = submesh.geometry.indexSlot * sizeof(u32) / GetIndexSize(submesh.geometry.indexType);
+
+    RebindPoolBuffers(pool);
+    pool.compactCount++;
+}
+
+Vao FindVAO(App* app, Mesh& mesh, u32 submeshIndex, const Program& program)
+{
+    GeometryPool& pool = app->geometryPool;
+    Submesh& submesh = mesh.submeshes[submeshIndex];
+    VertexPool& vertexPool = pool.vertexPools[submesh.geometry.poolIdx];
+
+    for (const Vao& vao : vertexPool.vaos)
+        if (vao.programHandle == program.handle)
+            return Vao{ vao.handle, vao.programHandle, (GLint)submesh.geometry.baseVertex };
+
+    GLuint vaoHandle = 0;
+
+    {
+        glGenVertexArrays(1, &vaoHandle);
+        glBindVertexArray(vaoHandle);
+
+        glBindVertexBuffer(GEOMETRY_VERTEX_BINDING, vertexPool.bufferHandle, 0, vertexPool.layout.stride);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBufferHandle);
+
+        // Inputs the layout does not have (the tangents of the compact encoding) keep their constant value
+        for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i) {
+            // Per instance index into the instance matrices, advanced by the draw's base instance
+            if (program.vertexInputLayout.attributes[i].location == INSTANCE_INDEX_LOCATION)
+            {
+                glBindVertexBuffer(INSTANCE_VERTEX_BINDING, app->instanceBuffer.handle, 0, sizeof(u32));
+                glVertexBindingDivisor(INSTANCE_VERTEX_BINDING, 1);
+                glVertexAttribIFormat(INSTANCE_INDEX_LOCATION, 1, GL_UNSIGNED_INT, 0);
+                glVertexAttribBinding(INSTANCE_INDEX_LOCATION, INSTANCE_VERTEX_BINDING);
+                glEnableVertexAttribArray(INSTANCE_INDEX_LOCATION);
+                continue;
+            }
+
+            for (u32 j = 0; j < vertexPool.layout.attributes.size(); ++j) {
+                const VertexBufferAttribute& attribute = vertexPool.layout.attributes[j];
+                if (program.vertexInputLayout.attributes[i].location != attribute.location)
+                    continue;
+                glVertexAttribFormat(attribute.location, attribute.componentCount, attribute.type, attribute.normalized, attribute.offset);
+                glVertexAttribBinding(attribute.location, GEOMETRY_VERTEX_BINDING);
+                glEnableVertexAttribArray(attribute.location);
+                break;
+            }
+        }
+
+        glBindVertexArray(0);
+    }
+
+    vertexPool.vaos.push_back(Vao{ vaoHandle, program.handle, 0 });
+
+    return Vao{ vaoHandle, program.handle, (GLint)submesh.geometry.baseVertex };
+}
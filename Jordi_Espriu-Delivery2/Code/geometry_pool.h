@@ -0,0 +1,130 @@
+//
+// geometry_pool.h: Shared GL buffers for the geometry of all meshes. There is a vertex
+// buffer per vertex layout and a single index buffer, and submeshes get ranges of them
+// from free-list allocators. Submeshes are drawn with a base vertex and a first index.
+// The index buffer is allocated in 4 byte slots, so 16 and 32 bit indices can share it.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+struct App;
+struct Mesh;
+struct Program;
+
+#define GEOMETRY_POOL_INITIAL_VERTICES (64 * 1024)
+#define GEOMETRY_POOL_INITIAL_INDICES  (256 * 1024) // In 4 byte slots
+
+#define GEOMETRY_VERTEX_BINDING 0
+#define INSTANCE_VERTEX_BINDING 1
+
+struct VertexBufferAttribute
+{
+    u8     location;
+    u8     componentCount;
+    u8     offset;
+    GLenum type = GL_FLOAT;
+    bool   normalized = false; // Integer types read as [0, 1] or [-1, 1]
+};
+
+struct VertexBufferLayout
+{
+    std::vector<VertexBufferAttribute> attributes;
+    u8                                 stride;
+};
+
+struct Vao
+{
+    GLuint handle;
+    GLuint programHandle;
+    GLint  baseVertex;    // Base vertex of the submesh it was looked up for
+};
+
+struct FreeRange
+{
+    u32 offset;
+    u32 size;
+};
+
+// First fit allocator over [0, capacity), free ranges sorted by offset and coalesced
+struct FreeListAllocator
+{
+    u32                    capacity;
+    u32                    used;
+    std::vector<FreeRange> freeRanges;
+};
+
+struct VertexPool
+{
+    VertexBufferLayout layout;
+    GLuint             bufferHandle;
+    FreeListAllocator  allocator; // In vertices
+    std::vector<Vao>   vaos;      // One per program
+};
+
+struct GeometryPool
+{
+    std::vector<VertexPool> vertexPools;
+    GLuint                  indexBufferHandle;
+    FreeListAllocator       indexAllocator; // In 4 byte slots
+    u32                     growCount;
+    u32                     compactCount;
+};
+
+// Where the geometry of a submesh lives in the pool
+struct GeometryAllocation
+{
+    u32 poolIdx;
+    u32 baseVertex;
+    u32 vertexCount;
+    u32 firstIndex;     // In indices of indexType, as the draws take it
+    u32 indexCount;
+    GLenum indexType;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    u32 indexSlot;      // First 4 byte slot of the indices in the index buffer
+    u32 indexSlotCount;
+    u32 uploadTicket; // Not drawable until the upload queue completes it
+};
+
+bool SameVertexBufferLayout(const VertexBufferLayout& a, const VertexBufferLayout& b);
+
+void InitFreeList(FreeListAllocator& allocator, u32 capacity);
+
+/**
+ * Returns the offset of the allocated range, or UINT32_MAX if there is no free range
+ * big enough.
+ */
+u32 AllocateRange(FreeListAllocator& allocator, u32 size);
+
+void ReleaseRange(FreeListAllocator& allocator, u32 offset, u32 size);
+
+void InitGeometryPool(GeometryPool& pool);
+
+/**
+ * Allocates the vertices and indices of a submesh in the pool of its layout (created on
+ * first use) and queues their upload, so the data has to stay alive until the upload
+ * completes. Full buffers are grown, and the VAOs of the pool are pointed to the new
+ * buffers. Indices are relative to the first vertex of the submesh.
+ */
+GeometryAllocation AllocateGeometry(App* app, const VertexBufferLayout& layout, const void* vertices, u32 vertexCount, const void* indices, u32 indexCount, GLenum indexType);
+
+void FreeGeometry(App* app, GeometryAllocation& allocation);
+
+/**
+ * Frees the geometry of all the submeshes of a mesh. The mesh is left without submeshes,
+ * so the indices of the other meshes stay valid.
+ */
+void RemoveMeshGeometry(App* app, u32 meshIdx);
+
+/**
+ * Moves the live ranges of every buffer to the front, removing the holes left by the
+ * removed meshes, and updates the allocations of the submeshes.
+ */
+void CompactGeometryPool(App* app);
+
+/**
+ * Returns the VAO of the pool of the submesh for the given program (created on first
+ * use), with the base vertex of the submesh.
+ */
+Vao FindVAO(App* app, Mesh& mesh, u32 submeshIndex, const Program& program);
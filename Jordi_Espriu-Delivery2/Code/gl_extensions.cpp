@@ -0,0 +1,39 @@
+#include "gl_extensions.h"
+#include "platform.h"
+
+GLExtensions           GLExt = {};
+PFNGLBUFFERSTORAGEPROC glBufferStorage = NULL;
+
+static bool HasExtension(const char* name)
+{
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool HasVersion(int major, int minor)
+{
+    return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+void LoadGLExtensions(GLADloadproc loader)
+{
+    if (HasVersion(4, 4) || HasExtension("GL_ARB_buffer_storage"))
+    {
+        glBufferStorage = (PFNGLBUFFERSTORAGEPROC)loader("glBufferStorage");
+        GLExt.bufferStorage = glBufferStorage != NULL;
+    }
+
+    GLExt.textureCompressionS3TC = HasExtension("GL_EXT_texture_compression_s3tc");
+    GLExt.gpuMemoryInfo = HasExtension("GL_NVX_gpu_memory_info");
+
+    ILOG("GL extensions: buffer storage %s", GLExt.bufferStorage ? "available" : "not available");
+    ILOG("GL extensions: S3TC texture compression %s", GLExt.textureCompressionS3TC ? "available" : "not available");
+    ILOG("GL extensions: GPU memory info %s", GLExt.gpuMemoryInfo ? "available" : "not available");
+}
@@ -0,0 +1,49 @@
+//
+// gl_extensions.h: OpenGL entry points and enums newer than the 4.3 core profile
+// our glad loader was generated for. They are loaded at startup and must only be
+// used when the corresponding flag in GLExtensions is set.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT  0x0040
+#define GL_MAP_COHERENT_BIT    0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT  0x0200
+#endif
+
+// EXT_texture_compression_s3tc (BC1 to BC3), not core but available on every desktop GPU
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// NVX_gpu_memory_info, in KB
+#ifndef GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX
+#define GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX   0x9048
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+struct GLExtensions
+{
+    bool bufferStorage;
+    bool textureCompressionS3TC;
+    bool gpuMemoryInfo;
+};
+
+extern GLExtensions           GLExt;
+extern PFNGLBUFFERSTORAGEPROC glBufferStorage;
+
+/**
+ * Loads the entry points above using the platform loader. Must be called once
+ * the OpenGL context is current and glad has been initialized.
+ */
+void LoadGLExtensions(GLADloadproc loader);
@@ -0,0 +1,946 @@
+#include "gltf_loader.h"
+#include "engine.h"
+#include "file_cache.h"
+#include "job_system.h"
+#include "mesh_kernels.h"
+
+#include <glm/gtc/matrix_inverse.hpp>
+#include <stdlib.h>
+
+#define GLB_MAGIC      0x46546C67 // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A // "JSON"
+#define GLB_CHUNK_BIN  0x004E4942 // "BIN\0"
+
+#define GLTF_MODE_TRIANGLES 4
+
+enum JsonType : u8
+{
+    JSON_NULL,
+    JSON_FALSE,
+    JSON_TRUE,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+};
+
+struct JsonValue
+{
+    JsonType                 type = JSON_NULL;
+    f64                      number = 0.0;
+    std::string              string;
+    std::vector<std::string> keys;   // Of the members of objects
+    std::vector<JsonValue>   values; // Elements of arrays, members of objects
+};
+
+struct JsonParser
+{
+    const char* p;
+    const char* end;
+};
+
+struct GltfBuffer
+{
+    const u8*         data;
+    u64               size;
+    const MappedFile* file;    // Mapped .bin, or the .glb itself
+    std::vector<u8>   decoded; // Of data: URIs
+};
+
+struct GltfFile
+{
+    JsonValue               json;
+    std::vector<GltfBuffer> buffers;
+    std::string             filename;
+    std::string             directory;
+};
+
+// Typed view of the elements of an accessor in its buffer
+struct GltfAccessor
+{
+    const u8* data;
+    u32       count;
+    u32       stride;
+    u32       componentType; // The GL enum
+    u32       componentCount;
+    bool      normalized;
+};
+
+// A primitive to read into a mesh, with the transform to bake in (identity with hierarchy)
+struct GltfPrimitiveJob
+{
+    const JsonValue* primitive;
+    glm::mat4        transform;
+    u32              materialIdx;
+    bool             converted;
+};
+
+struct GltfConvertData
+{
+    const GltfFile*   file;
+    GltfPrimitiveJob* jobs;
+    ImportedMesh*     meshes;
+};
+
+static const JsonValue NullJsonValue;
+
+static void SkipJsonWhitespace(JsonParser& parser)
+{
+    while (parser.p < parser.end && (*parser.p == ' ' || *parser.p == '\t' || *parser.p == '\n' || *parser.p == '\r'))
+        parser.p++;
+}
+
+static void AppendUtf8(std::string& string, u32 codepoint)
+{
+    if (codepoint < 0x80)
+    {
+        string += (char)codepoint;
+    }
+    else if (codepoint < 0x800)
+    {
+        string += (char)(0xC0 | (codepoint >> 6));
+        string += (char)(0x80 | (codepoint & 0x3F));
+    }
+    else
+    {
+        string += (char)(0xE0 | (codepoint >> 12));
+        string += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        string += (char)(0x80 | (codepoint & 0x3F));
+    }
+}
+
+static bool ParseJsonString(JsonParser& parser, std::string& string)
+{
+    if (parser.p == parser.end || *parser.p != '"')
+        return false;
+    parser.p++;
+
+    while (parser.p < parser.end && *parser.p != '"')
+    {
+        char c = *parser.p++;
+        if (c != '\\')
+        {
+            string += c;
+            continue;
+        }
+        if (parser.p == parser.end)
+            return false;
+
+        c = *parser.p++;
+        switch (c)
+        {
+            case 'b': string += '\b'; break;
+            case 'f': string += '\f'; break;
+            case 'n': string += '\n'; break;
+            case 'r': string += '\r'; break;
+            case 't': string += '\t'; break;
+            case 'u':
+            {
+                // Surrogate pairs only appear outside of the names and URIs this loader reads
+                if (parser.end - parser.p < 4)
+                    return false;
+                char hex[5] = { parser.p[0], parser.p[1], parser.p[2], parser.p[3], 0 };
+                AppendUtf8(string, (u32)strtoul(hex, NULL, 16));
+                parser.p += 4;
+                break;
+            }
+            default: string += c; break;
+        }
+    }
+
+    if (parser.p == parser.end)
+        return false;
+    parser.p++;
+    return true;
+}
+
+static bool ParseJsonValue(JsonParser& parser, JsonValue& value, u32 depth)
+{
+    SkipJsonWhitespace(parser);
+    if (parser.p == parser.end || depth > 256)
+        return false;
+
+    const char c = *parser.p;
+    if (c == '{' || c == '[')
+    {
+        const bool object = c == '{';
+        const char closing = object ? '}' : ']';
+        value.type = object ? JSON_OBJECT : JSON_ARRAY;
+        parser.p++;
+
+        SkipJsonWhitespace(parser);
+        if (parser.p < parser.end && *parser.p == closing)
+        {
+            parser.p++;
+            return true;
+        }
+
+        for (;;)
+        {
+            if (object)
+            {
+                SkipJsonWhitespace(parser);
+                value.keys.emplace_back();
+                if (!ParseJsonString(parser, value.keys.back()))
+                    return false;
+                SkipJsonWhitespace(parser);
+                if (parser.p == parser.end || *parser.p != ':')
+                    return false;
+                parser.p++;
+            }
+
+            value.values.emplace_back();
+            if (!ParseJsonValue(parser, value.values.back(), depth + 1))
+                return false;
+
+            SkipJsonWhitespace(parser);
+            if (parser.p == parser.end)
+                return false;
+            if (*parser.p == ',')
+            {
+                parser.p++;
+                continue;
+            }
+            if (*parser.p != closing)
+                return false;
+            parser.p++;
+            return true;
+        }
+    }
+    if (c == '"')
+    {
+        value.type = JSON_STRING;
+        return ParseJsonString(parser, value.string);
+    }
+    if (parser.end - parser.p >= 4 && strncmp(parser.p, "true", 4) == 0)
+    {
+        value.type = JSON_TRUE;
+        parser.p += 4;
+        return true;
+    }
+    if (parser.end - parser.p >= 5 && strncmp(parser.p, "false", 5) == 0)
+    {
+        value.type = JSON_FALSE;
+        parser.p += 5;
+        return true;
+    }
+    if (parser.end - parser.p >= 4 && strncmp(parser.p, "null", 4) == 0)
+    {
+        parser.p += 4;
+        return true;
+    }
+
+    // The JSON text is a null terminated copy, so strtod can't read past it
+    char* numberEnd;
+    value.type = JSON_NUMBER;
+    value.number = strtod(parser.p, &numberEnd);
+    if (numberEnd == parser.p)
+        return false;
+    parser.p = numberEnd;
+    return true;
+}
+
+static const JsonValue& GetMember(const JsonValue& object, const char* key)
+{
+    for (u32 i = 0; i < object.keys.size(); ++i)
+        if (object.keys[i] == key)
+            return object.values[i];
+    return NullJsonValue;
+}
+
+static const JsonValue& GetElement(const JsonValue& array, u32 idx)
+{
+    return array.type == JSON_ARRAY && idx < array.values.size() ? array.values[idx] : NullJsonValue;
+}
+
+static u32 GetCount(const JsonValue& array)
+{
+    return array.type == JSON_ARRAY ? (u32)array.values.size() : 0;
+}
+
+static f64 GetNumber(const JsonValue& object, const char* key, f64 defaultValue)
+{
+    const JsonValue& member = GetMember(object, key);
+    return member.type == JSON_NUMBER ? member.number : defaultValue;
+}
+
+// Indices of other objects of the file, UINT32_MAX when missing
+static u32 GetIndex(const JsonValue& object, const char* key)
+{
+    const JsonValue& member = GetMember(object, key);
+    return member.type == JSON_NUMBER && member.number >= 0.0 ? (u32)member.number : UINT32_MAX;
+}
+
+static void GetNumbers(const JsonValue& object, const char* key, f32* values, u32 count)
+{
+    const JsonValue& member = GetMember(object, key);
+    for (u32 i = 0; i < count && i < GetCount(member); ++i)
+        values[i] = (f32)member.values[i].number;
+}
+
+static bool DecodeBase64(const char* p, const char* end, std::vector<u8>& bytes)
+{
+    u32 bits = 0;
+    u32 bitCount = 0;
+    for (; p < end && *p != '='; ++p)
+    {
+        const char c = *p;
+        u32 value;
+        if (c >= 'A' && c <= 'Z')      value = c - 'A';
+        else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') value = c - '0' + 52;
+        else if (c == '+')             value = 62;
+        else if (c == '/')             value = 63;
+        else                           return false;
+
+        bits = (bits << 6) | value;
+        bitCount += 6;
+        if (bitCount >= 8)
+        {
+            bitCount -= 8;
+            bytes.push_back((u8)(bits >> bitCount));
+        }
+    }
+    return true;
+}
+
+// URIs can escape characters as %XX
+static std::string DecodeUri(const std::string& uri)
+{
+    std::string path;
+    for (size_t i = 0; i < uri.size(); ++i)
+    {
+        if (uri[i] == '%' && i + 2 < uri.size())
+        {
+            char hex[3] = { uri[i + 1], uri[i + 2], 0 };
+            path += (char)strtoul(hex, NULL, 16);
+            i += 2;
+        }
+        else
+        {
+            path += uri[i];
+        }
+    }
+    return path;
+}
+
+static bool IsDataUri(const std::string& uri)
+{
+    return uri.compare(0, 5, "data:") == 0;
+}
+
+static bool LoadGltfBuffers(GltfFile& file, const u8* glbBinary, u64 glbBinarySize)
+{
+    const JsonValue& buffers = GetMember(file.json, "buffers");
+    file.buffers.resize(GetCount(buffers));
+    for (u32 i = 0; i < file.buffers.size(); ++i)
+    {
+        const JsonValue& bufferJson = buffers.values[i];
+        const JsonValue& uriJson = GetMember(bufferJson, "uri");
+        GltfBuffer& buffer = file.buffers[i];
+        const u64 byteLength = (u64)GetNumber(bufferJson, "byteLength", 0.0);
+
+        if (uriJson.type != JSON_STRING)
+        {
+            // The binary chunk of the .glb
+            if (!glbBinary || glbBinarySize < byteLength)
+            {
+                ELOG("Error loading mesh %s: buffer %u has no data", file.filename.c_str(), i);
+                return false;
+            }
+            // A reference of its own, the one of the parsing is released before the buffers
+            buffer.file = AcquireFile(file.filename.c_str());
+            buffer.data = glbBinary;
+        }
+        else if (IsDataUri(uriJson.string))
+        {
+            size_t comma = uriJson.string.find(',');
+            if (comma == std::string::npos || !DecodeBase64(uriJson.string.c_str() + comma + 1, uriJson.string.c_str() + uriJson.string.size(), buffer.decoded))
+            {
+                ELOG("Error loading mesh %s: buffer %u has an invalid data URI", file.filename.c_str(), i);
+                return false;
+            }
+            buffer.data = buffer.decoded.data();
+        }
+        else
+        {
+            std::string path = file.directory + "/" + DecodeUri(uriJson.string);
+            buffer.file = AcquireFile(path.c_str());
+            if (!buffer.file)
+            {
+                ELOG("Error loading mesh %s: could not open buffer %s", file.filename.c_str(), path.c_str());
+                return false;
+            }
+            buffer.data = buffer.file->data;
+        }
+
+        buffer.size = buffer.file && !buffer.decoded.size() ? (buffer.data == glbBinary ? glbBinarySize : buffer.file->size) : buffer.decoded.size();
+        if (buffer.size < byteLength)
+        {
+            ELOG("Error loading mesh %s: buffer %u is shorter than its byteLength", file.filename.c_str(), i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void ReleaseGltfBuffers(GltfFile& file)
+{
+    for (GltfBuffer& buffer : file.buffers)
+        if (buffer.file)
+            ReleaseFile(buffer.file);
+    file.buffers.clear();
+}
+
+static u32 GetComponentSize(u32 componentType)
+{
+    switch (componentType)
+    {
+        case GL_BYTE: case GL_UNSIGNED_BYTE:   return 1;
+        case GL_SHORT: case GL_UNSIGNED_SHORT: return 2;
+        case GL_UNSIGNED_INT: case GL_FLOAT:   return 4;
+        default:                               return 0;
+    }
+}
+
+static u32 GetComponentCount(const std::string& type)
+{
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2")   return 2;
+    if (type == "VEC3")   return 3;
+    if (type == "VEC4")   return 4;
+    if (type == "MAT4")   return 16;
+    return 0;
+}
+
+static bool GetAccessor(const GltfFile& file, u32 accessorIdx, GltfAccessor& accessor)
+{
+    const JsonValue& accessorJson = GetElement(GetMember(file.json, "accessors"), accessorIdx);
+    const JsonValue& viewJson = GetElement(GetMember(file.json, "bufferViews"), GetIndex(accessorJson, "bufferView"));
+    if (accessorJson.type != JSON_OBJECT || viewJson.type != JSON_OBJECT || GetMember(accessorJson, "sparse").type != JSON_NULL)
+    {
+        ELOG("Error loading mesh %s: accessor %u has no buffer view, or is sparse", file.filename.c_str(), accessorIdx);
+        return false;
+    }
+
+    const u32 bufferIdx = GetIndex(viewJson, "buffer");
+    if (bufferIdx >= file.buffers.size())
+        return false;
+    const GltfBuffer& buffer = file.buffers[bufferIdx];
+
+    accessor.count = (u32)GetNumber(accessorJson, "count", 0.0);
+    accessor.componentType = (u32)GetNumber(accessorJson, "componentType", 0.0);
+    accessor.componentCount = GetComponentCount(GetMember(accessorJson, "type").string);
+    accessor.normalized = GetMember(accessorJson, "normalized").type == JSON_TRUE;
+
+    const u32 elementSize = GetComponentSize(accessor.componentType) * accessor.componentCount;
+    accessor.stride = (u32)GetNumber(viewJson, "byteStride", elementSize);
+    const u64 viewOffset = (u64)GetNumber(viewJson, "byteOffset", 0.0);
+    const u64 viewLength = (u64)GetNumber(viewJson, "byteLength", 0.0);
+    const u64 offset = (u64)GetNumber(accessorJson, "byteOffset", 0.0);
+
+    // Every element within the view, and the view within the buffer
+    const u64 accessorLength = accessor.count > 0 ? offset + (u64)accessor.stride * (accessor.count - 1) + elementSize : 0;
+    if (elementSize == 0 || viewOffset + viewLength > buffer.size || accessorLength > viewLength)
+    {
+        ELOG("Error loading mesh %s: accessor %u is out of its buffer", file.filename.c_str(), accessorIdx);
+        return false;
+    }
+
+    accessor.data = buffer.data + viewOffset + offset;
+    return true;
+}
+
+static f32 ReadComponent(const u8* p, u32 componentType, bool normalized)
+{
+    switch (componentType)
+    {
+        case GL_FLOAT:          { f32 v; memcpy(&v, p, 4); return v; }
+        case GL_UNSIGNED_BYTE:  return normalized ? *p / 255.0f : (f32)*p;
+        case GL_BYTE:           return normalized ? glm::max(*(const i8*)p / 127.0f, -1.0f) : (f32)*(const i8*)p;
+        case GL_UNSIGNED_SHORT: { u16 v; memcpy(&v, p, 2); return normalized ? v / 65535.0f : (f32)v; }
+        case GL_SHORT:          { i16 v; memcpy(&v, p, 2); return normalized ? glm::max(v / 32767.0f, -1.0f) : (f32)v; }
+        case GL_UNSIGNED_INT:   { u32 v; memcpy(&v, p, 4); return (f32)v; }
+        default:                return 0.0f;
+    }
+}
+
+// Reads 'components' floats per element into the vertices, at 'offset' of every one of them
+static void ReadAccessorFloats(const GltfAccessor& accessor, float* vertices, u32 strideInFloats, u32 offset, u32 components)
+{
+    const u32 readComponents = glm::min(components, accessor.componentCount);
+    if (accessor.componentType == GL_FLOAT)
+    {
+        for (u32 i = 0; i < accessor.count; ++i)
+            memcpy(vertices + i * strideInFloats + offset, accessor.data + i * accessor.stride, readComponents * sizeof(float));
+        return;
+    }
+
+    const u32 componentSize = GetComponentSize(accessor.componentType);
+    for (u32 i = 0; i < accessor.count; ++i)
+        for (u32 c = 0; c < readComponents; ++c)
+            vertices[i * strideInFloats + offset + c] = ReadComponent(accessor.data + i * accessor.stride + c * componentSize, accessor.componentType, accessor.normalized);
+}
+
+static void ReadAccessorIndices(const GltfAccessor& accessor, u32* indices)
+{
+    for (u32 i = 0; i < accessor.count; ++i)
+    {
+        const u8* p = accessor.data + i * accessor.stride;
+        switch (accessor.componentType)
+        {
+            case GL_UNSIGNED_BYTE:  indices[i] = *p; break;
+            case GL_UNSIGNED_SHORT: { u16 v; memcpy(&v, p, 2); indices[i] = v; break; }
+            default:                memcpy(&indices[i], p, 4); break; // GL_UNSIGNED_INT
+        }
+    }
+}
+
+// Whether the attributes are interleaved in one buffer view exactly as the model layout
+// lays them out, so all the vertices can be copied as a block
+static bool MatchesModelLayout(const GltfAccessor* accessors, const VertexBufferLayout& layout)
+{
+    const u8* base = accessors[0].data;
+    for (u32 i = 0; i < layout.attributes.size(); ++i)
+    {
+        const GltfAccessor& accessor = accessors[i];
+        const VertexBufferAttribute& attribute = layout.attributes[i];
+        if (accessor.stride != layout.stride || accessor.count != accessors[0].count ||
+            accessor.componentType != attribute.type || accessor.componentCount != attribute.componentCount ||
+            accessor.data != base + attribute.offset)
+            return false;
+    }
+    return true;
+}
+
+static glm::mat4 GetNodeTransform(const JsonValue& node)
+{
+    const JsonValue& matrix = GetMember(node, "matrix");
+    if (GetCount(matrix) == 16)
+    {
+        // Column major, as glm
+        f32 values[16];
+        GetNumbers(node, "matrix", values, 16);
+        return glm::make_mat4(values);
+    }
+
+    f32 translation[3] = { 0.0f, 0.0f, 0.0f };
+    f32 rotation[4] = { 0.0f, 0.0f, 0.0f, 1.0f }; // x, y, z, w
+    f32 scale[3] = { 1.0f, 1.0f, 1.0f };
+    GetNumbers(node, "translation", translation, 3);
+    GetNumbers(node, "rotation", rotation, 4);
+    GetNumbers(node, "scale", scale, 3);
+    return glm::translate(glm::make_vec3(translation)) *
+           glm::toMat4(glm::quat(rotation[3], rotation[0], rotation[1], rotation[2])) *
+           glm::scale(glm::make_vec3(scale));
+}
+
+// Collects the nodes with a mesh under a node, with their transforms from the root
+static void CollectGltfNodes(const JsonValue& nodes, u32 nodeIdx, const glm::mat4& parentTransform, u32 depth, std::vector<ModelNode>& meshNodes)
+{
+    const JsonValue& node = GetElement(nodes, nodeIdx);
+    if (node.type != JSON_OBJECT || depth > GLTF_MAX_NODE_DEPTH)
+        return;
+
+    const glm::mat4 transform = parentTransform * GetNodeTransform(node);
+    const u32 meshIdx = GetIndex(node, "mesh");
+    if (meshIdx != UINT32_MAX)
+        meshNodes.push_back(ModelNode{ meshIdx, transform });
+
+    const JsonValue& children = GetMember(node, "children");
+    for (u32 i = 0; i < GetCount(children); ++i)
+        CollectGltfNodes(nodes, (u32)children.values[i].number, transform, depth + 1, meshNodes);
+}
+
+static bool ConvertGltfPrimitive(const GltfFile& file, const GltfPrimitiveJob& job, ImportedMesh& mesh)
+{
+    const JsonValue& attributes = GetMember(*job.primitive, "attributes");
+    const char* attributeNames[4] = { "POSITION", "NORMAL", "TEXCOORD_0", "TANGENT" };
+    GltfAccessor accessors[4] = {};
+    bool present[4] = {};
+    for (u32 i = 0; i < 4; ++i)
+    {
+        const u32 accessorIdx = GetIndex(attributes, attributeNames[i]);
+        if (accessorIdx == UINT32_MAX)
+            continue;
+        if (!GetAccessor(file, accessorIdx, accessors[i]))
+            return false;
+        present[i] = true;
+    }
+
+    const u32 vertexCount = accessors[0].count;
+    if (!present[0] || vertexCount == 0)
+        return false;
+    for (u32 i = 1; i < 4; ++i)
+        if (present[i] && accessors[i].count != vertexCount)
+            return false;
+
+    const bool hasNormals = present[1];
+    const bool hasTangents = present[3] && hasNormals && present[2];
+    mesh.hasTexCoords = present[2];
+
+    // Positions, normals and texture coordinates, as a block when they already are like that
+    const u32 strideInFloats = mesh.hasTexCoords ? MODEL_VERTEX_FLOATS : MODEL_VERTEX_TEXCOORD_OFFSET;
+    mesh.vertices.resize(vertexCount * strideInFloats);
+    float* vertices = mesh.vertices.data();
+    const VertexBufferLayout layout = MakeModelVertexLayout(mesh.hasTexCoords, mesh.hasTexCoords);
+    if (hasNormals && !mesh.hasTexCoords && MatchesModelLayout(accessors, layout))
+    {
+        memcpy(vertices, accessors[0].data, (size_t)vertexCount * layout.stride);
+    }
+    else
+    {
+        ReadAccessorFloats(accessors[0], vertices, strideInFloats, 0, 3);
+        if (hasNormals)
+            ReadAccessorFloats(accessors[1], vertices, strideInFloats, MODEL_VERTEX_NORMAL_OFFSET, 3);
+        if (mesh.hasTexCoords)
+            ReadAccessorFloats(accessors[2], vertices, strideInFloats, MODEL_VERTEX_TEXCOORD_OFFSET, 2);
+    }
+
+    // glTF puts the origin of the texture coordinates at the top left
+    if (mesh.hasTexCoords)
+        for (u32 i = 0; i < vertexCount; ++i)
+            vertices[i * strideInFloats + MODEL_VERTEX_TEXCOORD_OFFSET + 1] = 1.0f - vertices[i * strideInFloats + MODEL_VERTEX_TEXCOORD_OFFSET + 1];
+
+    // The handedness of the tangent space in its w
+    std::vector<f32> tangentSigns;
+    if (hasTangents)
+    {
+        ReadAccessorFloats(accessors[3], vertices, strideInFloats, MODEL_VERTEX_TANGENT_OFFSET, 3);
+        tangentSigns.resize(vertexCount);
+        for (u32 i = 0; i < vertexCount; ++i)
+            tangentSigns[i] = ReadComponent(accessors[3].data + i * accessors[3].stride + 3 * GetComponentSize(accessors[3].componentType), accessors[3].componentType, accessors[3].normalized) < 0.0f ? -1.0f : 1.0f;
+    }
+
+    // Non-indexed primitives draw their vertices in order
+    const u32 indicesIdx = GetIndex(*job.primitive, "indices");
+    if (indicesIdx != UINT32_MAX)
+    {
+        GltfAccessor indices;
+        if (!GetAccessor(file, indicesIdx, indices) || indices.componentCount != 1 ||
+            (indices.componentType != GL_UNSIGNED_BYTE && indices.componentType != GL_UNSIGNED_SHORT && indices.componentType != GL_UNSIGNED_INT))
+            return false;
+        mesh.indices.resize(indices.count);
+        ReadAccessorIndices(indices, mesh.indices.data());
+    }
+    else
+    {
+        mesh.indices.resize(vertexCount);
+        for (u32 i = 0; i < vertexCount; ++i)
+            mesh.indices[i] = i;
+    }
+    mesh.indices.resize(mesh.indices.size() / 3 * 3);
+    for (u32 index : mesh.indices)
+        if (index >= vertexCount)
+            return false;
+
+    // Node transform baked in, mirroring ones flip the winding and the tangent space
+    const glm::mat3 linear = glm::mat3(job.transform);
+    const f32 determinant = glm::determinant(linear);
+    if (job.transform != glm::mat4(1.0f))
+    {
+        const glm::mat3 normalMatrix = glm::inverseTranspose(linear);
+        for (u32 i = 0; i < vertexCount; ++i)
+        {
+            float* vertex = vertices + i * strideInFloats;
+            glm::vec3 position = glm::vec3(job.transform * glm::vec4(glm::make_vec3(vertex), 1.0f));
+            memcpy(vertex, &position, 3 * sizeof(float));
+            if (hasNormals)
+            {
+                glm::vec3 normal = glm::normalize(normalMatrix * glm::make_vec3(vertex + MODEL_VERTEX_NORMAL_OFFSET));
+                memcpy(vertex + MODEL_VERTEX_NORMAL_OFFSET, &normal, 3 * sizeof(float));
+            }
+            if (hasTangents)
+            {
+                glm::vec3 tangent = glm::normalize(linear * glm::make_vec3(vertex + MODEL_VERTEX_TANGENT_OFFSET));
+                memcpy(vertex + MODEL_VERTEX_TANGENT_OFFSET, &tangent, 3 * sizeof(float));
+            }
+        }
+        if (determinant < 0.0f)
+            for (u32 i = 0; i < mesh.indices.size(); i += 3)
+                std::swap(mesh.indices[i + 1], mesh.indices[i + 2]);
+    }
+
+    if (!hasNormals)
+        GenerateSmoothNormals(vertices, vertexCount, strideInFloats, mesh.indices.data(), (u32)mesh.indices.size(), &mesh.kernelTimings);
+
+    if (hasTangents)
+    {
+        // glTF's bitangent is cross(normal, tangent) * w, along -V once V is flipped
+        const f32 mirror = determinant < 0.0f ? -1.0f : 1.0f;
+        for (u32 i = 0; i < vertexCount; ++i)
+        {
+            float* vertex = vertices + i * strideInFloats;
+            glm::vec3 bitangent = -glm::cross(glm::make_vec3(vertex + MODEL_VERTEX_NORMAL_OFFSET), glm::make_vec3(vertex + MODEL_VERTEX_TANGENT_OFFSET)) * tangentSigns[i] * mirror;
+            memcpy(vertex + MODEL_VERTEX_BITANGENT_OFFSET, &bitangent, 3 * sizeof(float));
+        }
+    }
+    else if (mesh.hasTexCoords)
+    {
+        GenerateTangentSpace(mesh.vertices, mesh.indices, &mesh.kernelTimings);
+    }
+
+    return true;
+}
+
+static void ConvertGltfPrimitives(u32 begin, u32 end, void* data)
+{
+    GltfConvertData* convertData = (GltfConvertData*)data;
+    for (u32 i = begin; i < end; ++i)
+        convertData->jobs[i].converted = ConvertGltfPrimitive(*convertData->file, convertData->jobs[i], convertData->meshes[i]);
+}
+
+// Path of an image, embedded ones are written next to the file the first time
+static std::string GetGltfImagePath(const GltfFile& file, u32 imageIdx)
+{
+    const JsonValue& image = GetElement(GetMember(file.json, "images"), imageIdx);
+    const JsonValue& uri = GetMember(image, "uri");
+    if (uri.type == JSON_STRING && !IsDataUri(uri.string))
+        return file.directory + "/" + DecodeUri(uri.string);
+
+    std::vector<u8> decoded;
+    const u8* bytes = NULL;
+    u64 size = 0;
+    std::string mimeType = GetMember(image, "mimeType").string;
+    if (uri.type == JSON_STRING)
+    {
+        size_t comma = uri.string.find(',');
+        if (comma == std::string::npos || !DecodeBase64(uri.string.c_str() + comma + 1, uri.string.c_str() + uri.string.size(), decoded))
+            return "";
+        mimeType = uri.string.substr(5, uri.string.find_first_of(";,") - 5);
+        bytes = decoded.data();
+        size = decoded.size();
+    }
+    else
+    {
+        const JsonValue& view = GetElement(GetMember(file.json, "bufferViews"), GetIndex(image, "bufferView"));
+        const u32 bufferIdx = GetIndex(view, "buffer");
+        const u64 offset = (u64)GetNumber(view, "byteOffset", 0.0);
+        size = (u64)GetNumber(view, "byteLength", 0.0);
+        if (bufferIdx >= file.buffers.size() || offset + size > file.buffers[bufferIdx].size)
+            return "";
+        bytes = file.buffers[bufferIdx].data + offset;
+    }
+
+    const char* extension = mimeType == "image/png" ? "png" : "jpg";
+    char suffix[32];
+    sprintf_s(suffix, ".image%u.%s", imageIdx, extension);
+    std::string path = file.filename + suffix;
+
+    // Rewritten when the file changes, as the texture caches check the size and hash of it
+    u64 hash, existingSize;
+    if (!HashFile(path.c_str(), hash, existingSize) || existingSize != size || hash != HashBytes(bytes, size))
+    {
+        FILE* imageFile = fopen(path.c_str(), "wb");
+        if (!imageFile)
+        {
+            ELOG("fopen() failed writing embedded image %s", path.c_str());
+            return "";
+        }
+        fwrite(bytes, 1, (size_t)size, imageFile);
+        fclose(imageFile);
+    }
+    return path;
+}
+
+static void ConvertGltfMaterial(const GltfFile& file, const JsonValue& materialJson, std::vector<std::string>& imagePaths, Material& material, std::string* texturePaths)
+{
+    material.name = GetMember(materialJson, "name").string;
+
+    const JsonValue& pbr = GetMember(materialJson, "pbrMetallicRoughness");
+    f32 baseColor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    f32 emissive[3] = { 0.0f, 0.0f, 0.0f };
+    GetNumbers(pbr, "baseColorFactor", baseColor, 4);
+    GetNumbers(materialJson, "emissiveFactor", emissive, 3);
+    material.albedo = glm::make_vec3(baseColor);
+    material.emissive = glm::make_vec3(emissive);
+    material.smoothness = 1.0f - (f32)GetNumber(pbr, "roughnessFactor", 1.0);
+
+    // Same order as the material texture slots, glTF has no specular nor bump maps
+    const JsonValue* textureInfos[MATERIAL_TEXTURE_SLOTS] = {
+        &GetMember(pbr, "baseColorTexture"),
+        &GetMember(materialJson, "emissiveTexture"),
+        &NullJsonValue,
+        &GetMember(materialJson, "normalTexture"),
+        &NullJsonValue
+    };
+    for (u32 slot = 0; slot < MATERIAL_TEXTURE_SLOTS; ++slot)
+    {
+        const JsonValue& texture = GetElement(GetMember(file.json, "textures"), GetIndex(*textureInfos[slot], "index"));
+        const u32 imageIdx = GetIndex(texture, "source");
+        if (imageIdx >= imagePaths.size())
+            continue;
+        if (imagePaths[imageIdx].empty())
+            imagePaths[imageIdx] = GetGltfImagePath(file, imageIdx);
+        texturePaths[slot] = imagePaths[imageIdx];
+    }
+}
+
+static bool ParseGltfFile(const char* filename, GltfFile& file)
+{
+    file.filename = filename;
+    size_t separator = file.filename.find_last_of("/\\");
+    file.directory = separator == std::string::npos ? "." : file.filename.substr(0, separator);
+
+    const MappedFile* mapped = AcquireFile(filename);
+    if (!mapped)
+    {
+        ELOG("Could not open file %s", filename);
+        return false;
+    }
+
+    // A .glb is a header and chunks, the JSON one first and then the binary one
+    std::string jsonText;
+    const u8* binary = NULL;
+    u64 binarySize = 0;
+    u32 header[3];
+    if (mapped->size >= 12 && (memcpy(header, mapped->data, 12), header[0] == GLB_MAGIC))
+    {
+        const u64 length = glm::min((u64)header[2], mapped->size);
+        for (u64 offset = 12; offset + 8 <= length;)
+        {
+            u32 chunk[2];
+            memcpy(chunk, mapped->data + offset, 8);
+            const u64 chunkSize = glm::min((u64)chunk[0], length - offset - 8);
+            if (chunk[1] == GLB_CHUNK_JSON && jsonText.empty())
+                jsonText.assign((const char*)mapped->data + offset + 8, (size_t)chunkSize);
+            else if (chunk[1] == GLB_CHUNK_BIN && !binary)
+            {
+                binary = mapped->data + offset + 8;
+                binarySize = chunkSize;
+            }
+            offset += 8 + ((chunkSize + 3) & ~3ull);
+        }
+    }
+    else
+    {
+        jsonText.assign((const char*)mapped->data, (size_t)mapped->size);
+    }
+
+    JsonParser parser = { jsonText.c_str(), jsonText.c_str() + jsonText.size() };
+    bool parsed = ParseJsonValue(parser, file.json, 0) && file.json.type == JSON_OBJECT;
+    if (!parsed)
+        ELOG("Error loading mesh %s: invalid JSON", filename);
+
+    parsed = parsed && LoadGltfBuffers(file, binary, binarySize);
+    ReleaseFile(mapped);
+    return parsed;
+}
+
+bool ImportGltf(const char* filename, ModelData& data, std::vector<ImportedMesh>& meshes)
+{
+    GltfFile file;
+    if (!ParseGltfFile(filename, file))
+    {
+        ReleaseGltfBuffers(file);
+        return false;
+    }
+
+    // Nodes of the scene, or of every root if the file has no scenes
+    const JsonValue& nodes = GetMember(file.json, "nodes");
+    const JsonValue& scenes = GetMember(file.json, "scenes");
+    const u32 sceneIdx = GetIndex(file.json, "scene");
+    const JsonValue& scene = GetElement(scenes, sceneIdx != UINT32_MAX ? sceneIdx : 0);
+    std::vector<ModelNode> meshNodes;
+    if (scene.type == JSON_OBJECT)
+    {
+        const JsonValue& roots = GetMember(scene, "nodes");
+        for (u32 i = 0; i < GetCount(roots); ++i)
+            CollectGltfNodes(nodes, (u32)roots.values[i].number, glm::mat4(1.0f), 0, meshNodes);
+    }
+    else
+    {
+        std::vector<bool> isChild(GetCount(nodes), false);
+        for (u32 i = 0; i < GetCount(nodes); ++i)
+        {
+            const JsonValue& children = GetMember(nodes.values[i], "children");
+            for (u32 c = 0; c < GetCount(children); ++c)
+                if ((u32)children.values[c].number < isChild.size())
+                    isChild[(u32)children.values[c].number] = true;
+        }
+        for (u32 i = 0; i < GetCount(nodes); ++i)
+            if (!isChild[i])
+                CollectGltfNodes(nodes, i, glm::mat4(1.0f), 0, meshNodes);
+    }
+
+    // Materials, plus a default one for the primitives without
+    const JsonValue& materials = GetMember(file.json, "materials");
+    const u32 materialCount = GetCount(materials);
+    std::vector<std::string> imagePaths(GetCount(GetMember(file.json, "images")));
+    data.materials.resize(materialCount + 1);
+    data.texturePaths.resize((materialCount + 1) * MATERIAL_TEXTURE_SLOTS);
+    for (u32 i = 0; i < materialCount; ++i)
+        ConvertGltfMaterial(file, materials.values[i], imagePaths, data.materials[i], &data.texturePaths[i * MATERIAL_TEXTURE_SLOTS]);
+    data.materials[materialCount].name = "DefaultMaterial";
+    data.materials[materialCount].albedo = vec3(0.6f);
+
+    // The triangle primitives to read, once per mesh with hierarchy, once per node otherwise
+    const JsonValue& gltfMeshes = GetMember(file.json, "meshes");
+    std::vector<GltfPrimitiveJob> jobs;
+    std::vector<u32> meshFirstJob(GetCount(gltfMeshes) + 1, 0);
+    u32 skippedPrimitives = 0;
+    auto addPrimitiveJobs = [&](const JsonValue& gltfMesh, const glm::mat4& transform)
+    {
+        const JsonValue& primitives = GetMember(gltfMesh, "primitives");
+        for (u32 i = 0; i < GetCount(primitives); ++i)
+        {
+            const JsonValue& primitive = primitives.values[i];
+            if (GetNumber(primitive, "mode", GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES)
+            {
+                skippedPrimitives++;
+                continue;
+            }
+            const u32 materialIdx = GetIndex(primitive, "material");
+            jobs.push_back(GltfPrimitiveJob{ &primitive, transform, materialIdx < materialCount ? materialIdx : materialCount, false });
+        }
+    };
+    if (data.hierarchy)
+    {
+        for (u32 i = 0; i < GetCount(gltfMeshes); ++i)
+        {
+            meshFirstJob[i] = (u32)jobs.size();
+            addPrimitiveJobs(gltfMeshes.values[i], glm::mat4(1.0f));
+        }
+        meshFirstJob[GetCount(gltfMeshes)] = (u32)jobs.size();
+    }
+    else
+    {
+        for (const ModelNode& node : meshNodes)
+            addPrimitiveJobs(GetElement(gltfMeshes, node.submeshIdx), node.transform);
+    }
+    if (skippedPrimitives > 0)
+        ILOG("Skipped %u line and point primitives of %s", skippedPrimitives, filename);
+
+    meshes.resize(jobs.size());
+    GltfConvertData convertData = { &file, jobs.data(), meshes.data() };
+    ParallelFor((u32)jobs.size(), 1, ConvertGltfPrimitives, &convertData);
+    ReleaseGltfBuffers(file);
+
+    for (const GltfPrimitiveJob& job : jobs)
+    {
+        if (!job.converted)
+        {
+            ELOG("Error loading mesh %s: invalid primitive", filename);
+            meshes.clear();
+            return false;
+        }
+        data.materialIdx.push_back(job.materialIdx);
+    }
+
+    // Every node references the meshes of the primitives of its glTF mesh
+    if (data.hierarchy)
+    {
+        for (const ModelNode& node : meshNodes)
+        {
+            if (node.submeshIdx >= GetCount(gltfMeshes))
+            {
+                ELOG("Error loading mesh %s: a node references mesh %u, which doesn't exist", filename, node.submeshIdx);
+                continue;
+            }
+            for (u32 job = meshFirstJob[node.submeshIdx]; job < meshFirstJob[node.submeshIdx + 1]; ++job)
+                data.nodes.push_back(ModelNode{ job, node.transform });
+        }
+    }
+
+    return true;
+}
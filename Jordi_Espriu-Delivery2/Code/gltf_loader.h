@@ -0,0 +1,29 @@
+//
+// gltf_loader.h: Native loader of glTF 2.0 files (.gltf with external or embedded buffers,
+// and binary .glb), used instead of Assimp for them. The buffers are memory mapped (for .glb,
+// the binary chunk of the file itself) and the accessors read straight from them: vertices
+// whose attributes are interleaved like the model layout are copied as a block, the rest are
+// gathered attribute by attribute, converted only when they aren't floats.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct ModelData;
+struct ImportedMesh;
+
+// Nodes deeper than this are ignored, a file with a cycle in its node graph is malformed
+#define GLTF_MAX_NODE_DEPTH 64
+
+/**
+ * Parses the file and reads the triangle primitives of the meshes of its default scene
+ * (or the first one). Without hierarchy every primitive of every node is a mesh with the node
+ * transform baked in, as Assimp's PreTransformVertices does. With hierarchy every primitive
+ * is a mesh once, and the nodes of the model data reference them with their transforms.
+ * Fills the materials, texture paths and the material index of every mesh. Images embedded
+ * in the buffers are written next to the file, so they load like any other texture.
+ * Texture coordinates are flipped vertically, like Assimp does. Returns false if the file
+ * can't be parsed or a primitive reads outside of its buffers.
+ */
+bool ImportGltf(const char* filename, ModelData& data, std::vector<ImportedMesh>& meshes);
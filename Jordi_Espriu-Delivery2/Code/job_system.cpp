@@ -0,0 +1,345 @@
+#include "job_system.h"
+
+#include <thread>
+#include <deque>
+#include <chrono>
+#include <condition_variable>
+
+struct JobWorker
+{
+    std::mutex      mutex;
+    std::deque<Job> jobs;
+    std::thread     thread;
+
+    std::atomic<u32> jobsExecuted;
+    std::atomic<u32> jobsStolen;
+    std::atomic<u64> busyMicroseconds;
+    JobWorkerStats   stats;
+};
+
+struct JobSystem
+{
+    JobWorker               workers[MAX_JOB_WORKERS];
+    u32                     workerCount;
+    std::atomic<bool>       running;
+
+    // Sleeping workers wait for queuedJobs to change
+    std::atomic<u32>        queuedJobs;
+    std::mutex              sleepMutex;
+    std::condition_variable wakeUp;
+
+    std::mutex              mainThreadMutex;
+    std::deque<Job>         mainThreadJobs;
+
+    std::mutex              backgroundMutex;
+    std::deque<Job>         backgroundJobs;
+
+    std::chrono::high_resolution_clock::time_point statsTime;
+};
+
+static JobSystem GlobalJobSystem;
+static thread_local u32 CurrentWorkerIdx = 0;
+
+static void PushJob(const Job& job)
+{
+    JobSystem& js = GlobalJobSystem;
+
+    if (job.queue == JOB_QUEUE_MAIN_THREAD)
+    {
+        // Not counted in queuedJobs, the workers can't take them
+        std::lock_guard<std::mutex> lock(js.mainThreadMutex);
+        js.mainThreadJobs.push_back(job);
+        return;
+    }
+
+    // Counted before it can be popped, so the count never goes below zero
+    js.queuedJobs++;
+
+    if (job.queue == JOB_QUEUE_BACKGROUND)
+    {
+        std::lock_guard<std::mutex> lock(js.backgroundMutex);
+        js.backgroundJobs.push_back(job);
+    }
+    else
+    {
+        JobWorker& worker = js.workers[CurrentWorkerIdx];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(job);
+    }
+
+    js.wakeUp.notify_one();
+}
+
+static void FinishJob(JobCounter* counter)
+{
+    if (counter == NULL)
+        return;
+
+    // Decremented under the lock, so a waiter that sees zero can lock the mutex to know
+    // this thread is done with the counter. The released jobs are pushed after that.
+    std::vector<Job> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if (--counter->pending == 0)
+            continuations.swap(counter->continuations);
+    }
+    for (const Job& job : continuations)
+        PushJob(job);
+}
+
+static bool PopJob(Job& job)
+{
+    JobSystem& js = GlobalJobSystem;
+
+    // Newest job of our own deque
+    JobWorker& self = js.workers[CurrentWorkerIdx];
+    {
+        std::lock_guard<std::mutex> lock(self.mutex);
+        if (!self.jobs.empty())
+        {
+            job = self.jobs.back();
+            self.jobs.pop_back();
+            return true;
+        }
+    }
+
+    // Oldest job of someone else's deque
+    for (u32 i = 1; i < js.workerCount; ++i)
+    {
+        JobWorker& victim = js.workers[(CurrentWorkerIdx + i) % js.workerCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            self.jobsStolen++;
+            return true;
+        }
+    }
+
+    // Background jobs only when there is nothing else, and never on the main thread so
+    // a long one can't stall a frame
+    if (CurrentWorkerIdx != 0)
+    {
+        std::lock_guard<std::mutex> lock(js.backgroundMutex);
+        if (!js.backgroundJobs.empty())
+        {
+            job = js.backgroundJobs.front();
+            js.backgroundJobs.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool ExecuteOneJob()
+{
+    Job job;
+    if (!PopJob(job))
+        return false;
+
+    JobSystem& js = GlobalJobSystem;
+    js.queuedJobs--;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    job.function(job.data);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    JobWorker& self = js.workers[CurrentWorkerIdx];
+    self.jobsExecuted++;
+    self.busyMicroseconds += (u64)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    FinishJob(job.counter);
+    return true;
+}
+
+static void WorkerMain(u32 workerIdx)
+{
+    JobSystem& js = GlobalJobSystem;
+    CurrentWorkerIdx = workerIdx;
+
+    while (js.running)
+    {
+        if (ExecuteOneJob())
+            continue;
+
+        std::unique_lock<std::mutex> lock(js.sleepMutex);
+        js.wakeUp.wait_for(lock, std::chrono::milliseconds(2), [&js]() { return js.queuedJobs > 0 || !js.running; });
+    }
+}
+
+void InitJobSystem(u32 workerCount)
+{
+    JobSystem& js = GlobalJobSystem;
+
+    if (workerCount == 0)
+        workerCount = glm::max(std::thread::hardware_concurrency(), 1u);
+    js.workerCount = glm::min(workerCount, (u32)MAX_JOB_WORKERS);
+    js.running = true;
+    js.queuedJobs = 0;
+    js.statsTime = std::chrono::high_resolution_clock::now();
+
+    CurrentWorkerIdx = 0;
+    for (u32 i = 1; i < js.workerCount; ++i)
+        js.workers[i].thread = std::thread(WorkerMain, i);
+
+    ILOG("Job system started with %u workers", js.workerCount);
+}
+
+void ShutdownJobSystem()
+{
+    JobSystem& js = GlobalJobSystem;
+
+    js.running = false;
+    js.wakeUp.notify_all();
+    for (u32 i = 1; i < js.workerCount; ++i)
+        js.workers[i].thread.join();
+    js.workerCount = 0;
+}
+
+u32 GetJobWorkerCount()
+{
+    return GlobalJobSystem.workerCount;
+}
+
+void RunJobs(Job* jobs, u32 count, JobCounter* dependency)
+{
+    for (u32 i = 0; i < count; ++i)
+        if (jobs[i].counter)
+            jobs[i].counter->pending++;
+
+    if (dependency)
+    {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->pending > 0)
+        {
+            dependency->continuations.insert(dependency->continuations.end(), jobs, jobs + count);
+            return;
+        }
+    }
+
+    for (u32 i = 0; i < count; ++i)
+        PushJob(jobs[i]);
+}
+
+void WaitForCounter(JobCounter* counter)
+{
+    while (counter->pending > 0)
+    {
+        if (!ExecuteOneJob())
+            std::this_thread::yield();
+    }
+
+    // Wait for the thread that finished the last job to release the counter
+    std::lock_guard<std::mutex> lock(counter->mutex);
+}
+
+void RunMainThreadJobs()
+{
+    ASSERT(CurrentWorkerIdx == 0, "Main thread jobs can only run on the main thread");
+
+    JobSystem& js = GlobalJobSystem;
+    for (;;)
+    {
+        Job job;
+        {
+            std::lock_guard<std::mutex> lock(js.mainThreadMutex);
+            if (js.mainThreadJobs.empty())
+                break;
+            job = js.mainThreadJobs.front();
+            js.mainThreadJobs.pop_front();
+        }
+
+        job.function(job.data);
+        js.workers[0].jobsExecuted++;
+        FinishJob(job.counter);
+    }
+
+    // Nobody else would run the background jobs
+    if (js.workerCount <= 1)
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(js.backgroundMutex);
+                if (js.backgroundJobs.empty())
+                    break;
+                job = js.backgroundJobs.front();
+                js.backgroundJobs.pop_front();
+            }
+
+            js.queuedJobs--;
+            job.function(job.data);
+            js.workers[0].jobsExecuted++;
+            FinishJob(job.counter);
+        }
+    }
+}
+
+struct ParallelForBatch
+{
+    ParallelForFunction function;
+    void*               data;
+    u32                 begin;
+    u32                 end;
+};
+
+static void ParallelForJob(void* data)
+{
+    ParallelForBatch* batch = (ParallelForBatch*)data;
+    batch->function(batch->begin, batch->end, batch->data);
+}
+
+void ParallelFor(u32 count, u32 batchSize, ParallelForFunction function, void* data)
+{
+    if (count == 0)
+        return;
+
+    batchSize = glm::max(batchSize, 1u);
+    const u32 batchCount = (count + batchSize - 1) / batchSize;
+
+    // A single batch, or no workers to share it with
+    if (batchCount == 1 || GlobalJobSystem.workerCount <= 1)
+    {
+        function(0, count, data);
+        return;
+    }
+
+    std::vector<ParallelForBatch> batches(batchCount);
+    std::vector<Job> jobs(batchCount);
+    JobCounter counter;
+
+    for (u32 i = 0; i < batchCount; ++i)
+    {
+        batches[i] = ParallelForBatch{ function, data, i * batchSize, glm::min((i + 1) * batchSize, count) };
+        jobs[i] = Job{ ParallelForJob, &batches[i], &counter, JOB_QUEUE_DEFAULT };
+    }
+
+    RunJobs(jobs.data(), batchCount);
+    WaitForCounter(&counter);
+}
+
+void UpdateJobSystemStats()
+{
+    JobSystem& js = GlobalJobSystem;
+
+    auto now = std::chrono::high_resolution_clock::now();
+    f64 elapsedMicroseconds = (f64)std::chrono::duration_cast<std::chrono::microseconds>(now - js.statsTime).count();
+    js.statsTime = now;
+
+    for (u32 i = 0; i < js.workerCount; ++i)
+    {
+        JobWorker& worker = js.workers[i];
+        worker.stats.jobsExecuted = worker.jobsExecuted.exchange(0);
+        worker.stats.jobsStolen = worker.jobsStolen.exchange(0);
+        u64 busy = worker.busyMicroseconds.exchange(0);
+        worker.stats.utilization = elapsedMicroseconds > 0.0 ? (f32)(busy / elapsedMicroseconds) : 0.0f;
+    }
+}
+
+const JobWorkerStats& GetJobWorkerStats(u32 workerIdx)
+{
+    return GlobalJobSystem.workers[workerIdx].stats;
+}
@@ -0,0 +1,95 @@
+//
+// job_system.h: Work stealing job system. Each thread has its own deque of jobs, it
+// pops the newest ones and, when it runs out, steals the oldest ones of the others.
+// Jobs report their completion to a counter that can be waited on (the waiting thread
+// executes jobs meanwhile) or used as dependency of other jobs. Jobs that touch the GL
+// context are queued for the main thread, and long jobs (asset loading) go to a
+// background queue that only the worker threads take from.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+#include <mutex>
+
+#define MAX_JOB_WORKERS 32
+
+typedef void (*JobFunction)(void* data);
+
+struct JobCounter;
+
+enum JobQueue
+{
+    JOB_QUEUE_DEFAULT,     // Deque of the queueing thread, can be stolen by any other
+    JOB_QUEUE_MAIN_THREAD, // For jobs that need the GL context, run at the end of the frame
+    JOB_QUEUE_BACKGROUND,  // Long jobs, only taken by the workers when they have nothing else
+};
+
+struct Job
+{
+    JobFunction function;
+    void*       data;
+    JobCounter* counter; // Decremented when the job is done, can be NULL
+    JobQueue    queue;
+};
+
+struct JobCounter
+{
+    std::atomic<u32>  pending{ 0 };
+    std::mutex        mutex;
+    std::vector<Job>  continuations; // Released when pending gets to zero
+};
+
+struct JobWorkerStats
+{
+    u32 jobsExecuted;
+    u32 jobsStolen;
+    f32 utilization;  // Busy time over the time since the previous UpdateJobSystemStats
+};
+
+/**
+ * Starts workerCount - 1 worker threads (the main thread is worker 0). With 0, uses
+ * one worker per hardware thread.
+ */
+void InitJobSystem(u32 workerCount = 0);
+
+void ShutdownJobSystem();
+
+u32 GetJobWorkerCount();
+
+/**
+ * Queues the jobs in the deque of the calling thread. The counter of each job is
+ * incremented before queueing. If dependency is not NULL, the jobs are held until
+ * its pending count gets to zero.
+ */
+void RunJobs(Job* jobs, u32 count, JobCounter* dependency = NULL);
+
+/**
+ * Executes jobs (of any thread) until the counter gets to zero. The main thread
+ * doesn't execute main thread or background jobs meanwhile, so it can't wait for them.
+ */
+void WaitForCounter(JobCounter* counter);
+
+/**
+ * Executes the queued main thread jobs. Called by the main loop every frame. Without
+ * worker threads, it also executes the background jobs.
+ */
+void RunMainThreadJobs();
+
+typedef void (*ParallelForFunction)(u32 begin, u32 end, void* data);
+
+/**
+ * Splits [0, count) in batches of batchSize, runs function on them in parallel and
+ * waits for all of them.
+ */
+void ParallelFor(u32 count, u32 batchSize, ParallelForFunction function, void* data);
+
+/**
+ * Computes the per worker stats of the time elapsed since the previous call, which
+ * are then returned by GetJobWorkerStats. Called once per frame.
+ */
+void UpdateJobSystemStats();
+
+const JobWorkerStats& GetJobWorkerStats(u32 workerIdx);
@@ -0,0 +1,437 @@
+#include "mesh_cache.h"
+#include "engine.h"
+#include "buffer_management.h"
+#include "pack_file.h"
+
+#define MESH_CACHE_MAX_ATTRIBUTES 8
+#define MESH_CACHE_TEXTURE_SLOTS  5
+#define MESH_CACHE_NO_STRING      UINT32_MAX
+
+struct MeshCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u32 importFlags;
+    u32 vertexEncoding;
+    u32 dependencyCount;
+    u32 materialCount;
+    u32 submeshCount;
+    u32 nodeCount;
+    u32 stringTableSize;
+    u32 padding;
+    u64 vertexDataOffset;
+    u64 vertexDataSize;
+    u64 indexDataOffset;
+    u64 indexDataSize;
+    u64 meshletDataOffset;
+    u64 meshletCount;
+    u64 payloadHash; // Hash of everything after the header
+};
+
+// A file the import read, the cache is stale once any of them changes
+struct MeshCacheDependency
+{
+    u64 hash;
+    u64 size;
+    u32 pathOffset;
+    u32 padding;
+};
+
+struct MeshCacheMaterial
+{
+    f32 albedo[3];
+    f32 emissive[3];
+    f32 smoothness;
+    u32 nameOffset;
+    u32 texturePathOffsets[MESH_CACHE_TEXTURE_SLOTS]; // albedo, emissive, specular, normals, bump
+};
+
+struct MeshCacheAttribute
+{
+    u8  location;
+    u8  componentCount;
+    u8  offset;
+    u8  normalized;
+    u32 type;
+};
+
+struct MeshCacheSubmesh
+{
+    u32                materialIdx; // Relative to the first material of the model
+    u32                vertexOffset;
+    u32                vertexSize;
+    u32                indexOffset;
+    u32                indexCount;
+    u32                indexType;
+    u8                 stride;
+    u8                 attributeCount;
+    u8                 padding[2];
+    MeshCacheAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+    BoundingVolume     bounds;
+    u32                lodCount;
+    SubmeshLod         lods[MAX_LODS];
+    u32                meshletOffset; // In meshlets, in the meshlet data of the whole mesh
+    u32                meshletCount;
+    f32                positionOffset[3]; // VertexDecoding of the submesh
+    f32                positionScale[3];
+    u32                closed;
+};
+
+struct MeshCacheNode
+{
+    u32 submeshIdx;
+    f32 transform[16];
+};
+
+static std::string MakeCachePath(const char* filename, bool hierarchy)
+{
+    return std::string(filename) + (hierarchy ? MESH_CACHE_HIERARCHY_EXTENSION : MESH_CACHE_EXTENSION);
+}
+
+static const char* GetCacheString(const MappedFile& cache, const MeshCacheHeader& header, u32 stringTableOffset, u32 offset)
+{
+    if (offset == MESH_CACHE_NO_STRING || offset >= header.stringTableSize)
+        return NULL;
+
+    const char* str = (const char*)cache.data + stringTableOffset + offset;
+    if (memchr(str, 0, header.stringTableSize - offset) == NULL)
+        return NULL;
+
+    return str;
+}
+
+static bool AreCacheLodsValid(const MeshCacheSubmesh& cs, const Meshlet* meshlets)
+{
+    for (u32 lod = 0; lod < cs.lodCount; ++lod)
+        if ((u64)cs.lods[lod].firstIndex + cs.lods[lod].indexCount > cs.indexCount ||
+            (u64)cs.lods[lod].firstMeshlet + cs.lods[lod].meshletCount > cs.meshletCount)
+            return false;
+    for (u32 i = 0; i < cs.meshletCount; ++i)
+        if ((u64)meshlets[i].firstIndex + meshlets[i].indexCount > cs.indexCount)
+            return false;
+    return true;
+}
+
+static bool ValidateCache(const MappedFile& cache, const MeshCacheHeader& header, u32 importFlags)
+{
+    if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION)
+        return false;
+
+    if (header.importFlags != importFlags || header.vertexEncoding != MODEL_VERTEX_ENCODING || header.dependencyCount == 0)
+        return false;
+
+    const u64 tablesSize = sizeof(MeshCacheHeader) +
+                           (u64)header.dependencyCount * sizeof(MeshCacheDependency) +
+                           (u64)header.materialCount * sizeof(MeshCacheMaterial) +
+                           (u64)header.submeshCount * sizeof(MeshCacheSubmesh) +
+                           (u64)header.nodeCount * sizeof(MeshCacheNode) +
+                           header.stringTableSize;
+
+    if (tablesSize > cache.size ||
+        header.vertexDataOffset < tablesSize ||
+        header.vertexDataOffset + header.vertexDataSize > cache.size ||
+        header.indexDataOffset < header.vertexDataOffset + header.vertexDataSize ||
+        header.indexDataOffset + header.indexDataSize > cache.size ||
+        header.meshletDataOffset < header.indexDataOffset + header.indexDataSize ||
+        header.meshletDataOffset + header.meshletCount * sizeof(Meshlet) > cache.size)
+        return false;
+
+    const u8* payload = cache.data + sizeof(MeshCacheHeader);
+    return HashBytes(payload, cache.size - sizeof(MeshCacheHeader)) == header.payloadHash;
+}
+
+bool ReadModelCache(const char* filename, u32 importFlags, ModelData& data)
+{
+    std::string cachePath = MakeCachePath(filename, data.hierarchy);
+    MappedFile cache = MapAssetFile(cachePath.c_str()); // Loose, or cooked into the pack
+    if (!cache.data)
+        return false;
+
+    if (cache.size < sizeof(MeshCacheHeader))
+    {
+        UnmapAssetFile(cache);
+        return false;
+    }
+
+    MeshCacheHeader header;
+    memcpy(&header, cache.data, sizeof(header));
+
+    if (!ValidateCache(cache, header, importFlags))
+    {
+        ILOG("Mesh cache %s is stale or corrupt, reimporting %s", cachePath.c_str(), filename);
+        UnmapAssetFile(cache);
+        return false;
+    }
+
+    const MeshCacheDependency* cacheDependencies = (const MeshCacheDependency*)(cache.data + sizeof(MeshCacheHeader));
+    const MeshCacheMaterial*   cacheMaterials = (const MeshCacheMaterial*)(cacheDependencies + header.dependencyCount);
+    const MeshCacheSubmesh*    cacheSubmeshes = (const MeshCacheSubmesh*)(cacheMaterials + header.materialCount);
+    const MeshCacheNode*       cacheNodes = (const MeshCacheNode*)(cacheSubmeshes + header.submeshCount);
+    const u32 stringTableOffset = (u32)((const u8*)(cacheNodes + header.nodeCount) - cache.data);
+
+    // Every file the import read (the model, its material libraries, buffers...) must be unchanged
+    data.sourceFiles.resize(header.dependencyCount);
+    for (u32 i = 0; i < header.dependencyCount; ++i)
+    {
+        const MeshCacheDependency& cd = cacheDependencies[i];
+        const char* path = GetCacheString(cache, header, stringTableOffset, cd.pathOffset);
+        u64 hash, size;
+        if (!path || !HashFile(path, hash, size) || hash != cd.hash || size != cd.size)
+        {
+            ILOG("Mesh cache %s is stale (%s changed), reimporting %s", cachePath.c_str(), path ? path : "?", filename);
+            UnmapAssetFile(cache);
+            return false;
+        }
+        data.sourceFiles[i] = path;
+    }
+
+    const Meshlet* cacheMeshlets = (const Meshlet*)(cache.data + header.meshletDataOffset);
+
+    // Validate the submesh table before filling anything
+    for (u32 i = 0; i < header.submeshCount; ++i)
+    {
+        const MeshCacheSubmesh& cs = cacheSubmeshes[i];
+        if (cs.attributeCount > MESH_CACHE_MAX_ATTRIBUTES ||
+            cs.materialIdx >= header.materialCount ||
+            (u64)cs.vertexOffset + cs.vertexSize > header.vertexDataSize ||
+            (cs.indexType != GL_UNSIGNED_SHORT && cs.indexType != GL_UNSIGNED_INT) ||
+            (u64)cs.indexOffset + (u64)cs.indexCount * GetIndexSize(cs.indexType) > header.indexDataSize ||
+            cs.stride == 0 || cs.vertexSize % cs.stride != 0 ||
+            cs.lodCount == 0 || cs.lodCount > MAX_LODS ||
+            (u64)cs.meshletOffset + cs.meshletCount > header.meshletCount ||
+            !AreCacheLodsValid(cs, cacheMeshlets + cs.meshletOffset))
+        {
+            ILOG("Mesh cache %s has an invalid submesh table, reimporting %s", cachePath.c_str(), filename);
+            UnmapAssetFile(cache);
+            return false;
+        }
+    }
+    for (u32 i = 0; i < header.nodeCount; ++i)
+    {
+        if (cacheNodes[i].submeshIdx >= header.submeshCount)
+        {
+            ILOG("Mesh cache %s has an invalid node table, reimporting %s", cachePath.c_str(), filename);
+            UnmapAssetFile(cache);
+            return false;
+        }
+    }
+
+    // Materials
+    data.materials.resize(header.materialCount);
+    data.texturePaths.resize(header.materialCount * MATERIAL_TEXTURE_SLOTS);
+    for (u32 i = 0; i < header.materialCount; ++i)
+    {
+        const MeshCacheMaterial& cm = cacheMaterials[i];
+        const char* name = GetCacheString(cache, header, stringTableOffset, cm.nameOffset);
+
+        Material& material = data.materials[i];
+        material.name = name ? name : "";
+        material.albedo = vec3(cm.albedo[0], cm.albedo[1], cm.albedo[2]);
+        material.emissive = vec3(cm.emissive[0], cm.emissive[1], cm.emissive[2]);
+        material.smoothness = cm.smoothness;
+
+        for (u32 slot = 0; slot < MESH_CACHE_TEXTURE_SLOTS; ++slot)
+        {
+            const char* texturePath = GetCacheString(cache, header, stringTableOffset, cm.texturePathOffsets[slot]);
+            if (texturePath)
+                data.texturePaths[i * MATERIAL_TEXTURE_SLOTS + slot] = texturePath;
+        }
+    }
+
+
+    // Submeshes
+    const u8* vertexData = cache.data + header.vertexDataOffset;
+    const u8* indexData = cache.data + header.indexDataOffset;
+
+    data.submeshes.resize(header.submeshCount);
+    data.materialIdx.resize(header.submeshCount);
+    data.vertexDecodings.resize(header.submeshCount);
+    for (u32 i = 0; i < header.submeshCount; ++i)
+    {
+        const MeshCacheSubmesh& cs = cacheSubmeshes[i];
+        Submesh& submesh = data.submeshes[i];
+
+        submesh.vertexBufferLayout.stride = cs.stride;
+        for (u32 j = 0; j < cs.attributeCount; ++j)
+        {
+            const MeshCacheAttribute& ca = cs.attributes[j];
+            submesh.vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ ca.location, ca.componentCount, ca.offset, ca.type, ca.normalized != 0 });
+        }
+
+        const u8* vertices = vertexData + cs.vertexOffset;
+        const u8* indices = indexData + cs.indexOffset;
+        submesh.vertices.assign(vertices, vertices + cs.vertexSize);
+        submesh.indices.assign(indices, indices + cs.indexCount * GetIndexSize(cs.indexType));
+        submesh.vertexCount = cs.vertexSize / cs.stride;
+        submesh.indexCount = cs.indexCount;
+        submesh.indexType = cs.indexType;
+        submesh.vertexOffset = cs.vertexOffset;
+        submesh.indexOffset = cs.indexOffset;
+        submesh.bounds = cs.bounds;
+        submesh.lodCount = cs.lodCount;
+        memcpy(submesh.lods, cs.lods, sizeof(submesh.lods));
+        submesh.meshlets.assign(cacheMeshlets + cs.meshletOffset, cacheMeshlets + cs.meshletOffset + cs.meshletCount);
+        submesh.closed = cs.closed != 0;
+
+        data.vertexDecodings[i].positionOffset = glm::vec4(glm::make_vec3(cs.positionOffset), 0.0f);
+        data.vertexDecodings[i].positionScale = glm::vec4(glm::make_vec3(cs.positionScale), (f32)header.vertexEncoding);
+
+        data.materialIdx[i] = cs.materialIdx;
+    }
+
+    // Nodes instancing the submeshes, only in hierarchy imports
+    data.nodes.resize(header.nodeCount);
+    for (u32 i = 0; i < header.nodeCount; ++i)
+    {
+        data.nodes[i].submeshIdx = cacheNodes[i].submeshIdx;
+        data.nodes[i].transform = glm::make_mat4(cacheNodes[i].transform);
+    }
+
+    UnmapAssetFile(cache);
+
+    return true;
+}
+
+static u32 PushCacheString(std::vector<char>& stringTable, const std::string& str)
+{
+    u32 offset = (u32)stringTable.size();
+    stringTable.insert(stringTable.end(), str.begin(), str.end());
+    stringTable.push_back('\0');
+    return offset;
+}
+
+template <typename T>
+static void AppendBytes(std::vector<u8>& bytes, const T* data, u64 count)
+{
+    const u8* begin = (const u8*)data;
+    bytes.insert(bytes.end(), begin, begin + count * sizeof(T));
+}
+
+static u32 PushCacheTexturePath(std::vector<char>& stringTable, const std::string& texturePath)
+{
+    // Slots left to the placeholders
+    if (texturePath.empty())
+        return MESH_CACHE_NO_STRING;
+
+    return PushCacheString(stringTable, texturePath);
+}
+
+void SaveModelCache(const char* filename, u32 importFlags, const ModelData& data)
+{
+    MeshCacheHeader header = {};
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.importFlags = importFlags;
+    header.vertexEncoding = MODEL_VERTEX_ENCODING;
+
+    std::vector<char> stringTable;
+    header.dependencyCount = (u32)data.sourceFiles.size();
+    std::vector<MeshCacheDependency> cacheDependencies(header.dependencyCount);
+    for (u32 i = 0; i < header.dependencyCount; ++i)
+    {
+        MeshCacheDependency& cd = cacheDependencies[i];
+        if (!HashFile(data.sourceFiles[i].c_str(), cd.hash, cd.size))
+            return;
+        cd.pathOffset = PushCacheString(stringTable, data.sourceFiles[i]);
+    }
+    if (header.dependencyCount == 0)
+        return;
+
+    header.materialCount = (u32)data.materials.size();
+    std::vector<MeshCacheMaterial> cacheMaterials(header.materialCount);
+    for (u32 i = 0; i < header.materialCount; ++i)
+    {
+        const Material& material = data.materials[i];
+        const std::string* texturePaths = &data.texturePaths[i * MATERIAL_TEXTURE_SLOTS];
+        MeshCacheMaterial& cm = cacheMaterials[i];
+        memcpy(cm.albedo, glm::value_ptr(material.albedo), sizeof(cm.albedo));
+        memcpy(cm.emissive, glm::value_ptr(material.emissive), sizeof(cm.emissive));
+        cm.smoothness = material.smoothness;
+        cm.nameOffset = PushCacheString(stringTable, material.name);
+        for (u32 slot = 0; slot < MESH_CACHE_TEXTURE_SLOTS; ++slot)
+            cm.texturePathOffsets[slot] = PushCacheTexturePath(stringTable, texturePaths[slot]);
+    }
+
+    header.submeshCount = (u32)data.submeshes.size();
+    std::vector<MeshCacheSubmesh> cacheSubmeshes(header.submeshCount);
+    for (u32 i = 0; i < header.submeshCount; ++i)
+    {
+        const Submesh& submesh = data.submeshes[i];
+        MeshCacheSubmesh& cs = cacheSubmeshes[i];
+
+        ASSERT(submesh.vertexBufferLayout.attributes.size() <= MESH_CACHE_MAX_ATTRIBUTES, "Too many vertex attributes for the mesh cache");
+
+        cs.materialIdx = data.materialIdx[i];
+        cs.vertexOffset = submesh.vertexOffset;
+        cs.vertexSize = (u32)submesh.vertices.size();
+        cs.indexOffset = submesh.indexOffset;
+        cs.indexCount = submesh.indexCount;
+        cs.indexType = submesh.indexType;
+        cs.stride = submesh.vertexBufferLayout.stride;
+        cs.bounds = submesh.bounds;
+        cs.lodCount = submesh.lodCount;
+        memcpy(cs.lods, submesh.lods, sizeof(cs.lods));
+        cs.meshletOffset = (u32)header.meshletCount;
+        cs.meshletCount = (u32)submesh.meshlets.size();
+        cs.closed = submesh.closed ? 1 : 0;
+        memcpy(cs.positionOffset, glm::value_ptr(data.vertexDecodings[i].positionOffset), sizeof(cs.positionOffset));
+        memcpy(cs.positionScale, glm::value_ptr(data.vertexDecodings[i].positionScale), sizeof(cs.positionScale));
+        cs.attributeCount = (u8)submesh.vertexBufferLayout.attributes.size();
+        for (u32 j = 0; j < cs.attributeCount; ++j)
+        {
+            const VertexBufferAttribute& attribute = submesh.vertexBufferLayout.attributes[j];
+            cs.attributes[j] = MeshCacheAttribute{ attribute.location, attribute.componentCount, attribute.offset, (u8)attribute.normalized, attribute.type };
+        }
+
+        header.vertexDataSize += cs.vertexSize;
+        header.indexDataSize += submesh.indices.size();
+        header.meshletCount += submesh.meshlets.size();
+    }
+
+    header.nodeCount = (u32)data.nodes.size();
+    std::vector<MeshCacheNode> cacheNodes(header.nodeCount);
+    for (u32 i = 0; i < header.nodeCount; ++i)
+    {
+        cacheNodes[i].submeshIdx = data.nodes[i].submeshIdx;
+        memcpy(cacheNodes[i].transform, glm::value_ptr(data.nodes[i].transform), sizeof(cacheNodes[i].transform));
+    }
+
+    header.stringTableSize = (u32)stringTable.size();
+
+    std::vector<u8> bytes;
+    bytes.resize(sizeof(MeshCacheHeader));
+    AppendBytes(bytes, cacheDependencies.data(), cacheDependencies.size());
+    AppendBytes(bytes, cacheMaterials.data(), cacheMaterials.size());
+    AppendBytes(bytes, cacheSubmeshes.data(), cacheSubmeshes.size());
+    AppendBytes(bytes, cacheNodes.data(), cacheNodes.size());
+    AppendBytes(bytes, stringTable.data(), stringTable.size());
+    bytes.resize(Align((u32)bytes.size(), 16), 0);
+
+    // Vertex, index and meshlet blobs of the submeshes, one after the other
+    header.vertexDataOffset = bytes.size();
+    for (const Submesh& submesh : data.submeshes)
+        AppendBytes(bytes, submesh.vertices.data(), submesh.vertices.size());
+
+    header.indexDataOffset = bytes.size();
+    for (const Submesh& submesh : data.submeshes)
+        AppendBytes(bytes, submesh.indices.data(), submesh.indices.size());
+    bytes.resize(Align((u32)bytes.size(), 16), 0);
+
+    header.meshletDataOffset = bytes.size();
+    for (const Submesh& submesh : data.submeshes)
+        AppendBytes(bytes, submesh.meshlets.data(), submesh.meshlets.size());
+
+    header.payloadHash = HashBytes(bytes.data() + sizeof(MeshCacheHeader), bytes.size() - sizeof(MeshCacheHeader));
+    memcpy(bytes.data(), &header, sizeof(header));
+
+    std::string cachePath = MakeCachePath(filename, data.hierarchy);
+    FILE* file = fopen(cachePath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing mesh cache %s", cachePath.c_str());
+        return;
+    }
+
+    fwrite(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+}
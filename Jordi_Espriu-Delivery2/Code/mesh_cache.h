@@ -0,0 +1,33 @@
+//
+// mesh_cache.h: Binary on-disk cache of already processed models, so warm starts
+// can skip the whole Assimp import and post-process stack.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct ModelData;
+
+#define MESH_CACHE_MAGIC   0x4843534d // 'MSCH'
+#define MESH_CACHE_VERSION 8
+#define MESH_CACHE_EXTENSION ".mcache"
+#define MESH_CACHE_HIERARCHY_EXTENSION ".hierarchy.mcache"
+
+/**
+ * Reads a model from the cache file next to 'filename' (a different one when
+ * data.hierarchy is set). The cache is only used if it was generated with the same import
+ * flags, and every file the import read (data.sourceFiles, the model and e.g. its material
+ * libraries) still has the same content hash and size. It only fills 'data', so it can run
+ * on the job system. Returns false if the cache
+ * is missing, stale or corrupt (in which case the caller should import the model
+ * normally).
+ */
+bool ReadModelCache(const char* filename, u32 importFlags, ModelData& data);
+
+/**
+ * Writes an imported model to the cache, before its geometry is handed to the GPU, with
+ * the hashes of data.sourceFiles to validate it. Only reads 'data', so it can run on the
+ * job system.
+ */
+void SaveModelCache(const char* filename, u32 importFlags, const ModelData& data);
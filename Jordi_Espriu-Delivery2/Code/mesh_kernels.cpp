@@ -0,0 +1,494 @@
+#include "mesh_kernels.h"
+#include "job_system.h"
+
+#include <atomic>
+#include <chrono>
+#include <immintrin.h>
+
+// The same 3D vector of four triangles, one per lane
+struct Vec3x4
+{
+    __m128 x, y, z;
+};
+
+struct FaceNormalsData
+{
+    const float* vertices;
+    u32          strideInFloats;
+    const u32*   indices;
+    u32          triangleCount;
+    glm::vec3*   faceNormals; // Not normalized, so they weight by area
+};
+
+struct FaceTangentsData
+{
+    const float* vertices;
+    const u32*   indices;
+    u32          triangleCount;
+    glm::vec3*   faceTangents; // Normalized, along +U
+    u8*          faceSigns;    // 1 if the texture coordinates keep the orientation of the triangle, 2 if they mirror it, 0 if degenerate
+};
+
+struct CornerTangentsData
+{
+    const float*     vertices;
+    const u32*       indices;
+    const glm::vec3* faceTangents;
+    const u8*        faceSigns;
+    glm::vec3*       cornerTangents; // In the tangent plane of the corner, weighted by its angle
+};
+
+// The corners of each vertex (or each group of vertices) in compressed rows
+struct VertexCorners
+{
+    std::vector<u32> offsets; // Per vertex, and one past the last
+    std::vector<u32> corners;
+};
+
+struct VertexNormalsData
+{
+    float*               vertices;
+    u32                  strideInFloats;
+    const u32*           remap; // First vertex with the same position
+    const glm::vec3*     faceNormals;
+    const VertexCorners* vertexCorners;
+};
+
+struct VertexTangentsData
+{
+    float*               vertices;
+    const glm::vec3*     cornerTangents;
+    const f32*           handedness;
+    const VertexCorners* vertexCorners;
+};
+
+// Open addressing table of vertex indices plus one (0 is empty), filled by several jobs at once
+struct VertexRemapData
+{
+    const float*      vertices;
+    u32               strideInFloats;
+    u32               compareFloats;
+    std::atomic<u32>* table;
+    u32               tableMask;
+    u32*              remap;
+};
+
+struct RemapIndicesData
+{
+    u32*       indices;
+    const u32* newIndices;
+};
+
+static f32 MillisecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<f32, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// One float of the vertex of the same corner of four consecutive triangles
+static __m128 GatherFloat4(const float* vertices, u32 strideInFloats, const u32* corners, u32 offset)
+{
+    return _mm_set_ps(vertices[corners[9] * strideInFloats + offset], vertices[corners[6] * strideInFloats + offset],
+                      vertices[corners[3] * strideInFloats + offset], vertices[corners[0] * strideInFloats + offset]);
+}
+
+static Vec3x4 GatherVec3x4(const float* vertices, u32 strideInFloats, const u32* corners, u32 offset)
+{
+    return Vec3x4{ GatherFloat4(vertices, strideInFloats, corners, offset),
+                   GatherFloat4(vertices, strideInFloats, corners, offset + 1),
+                   GatherFloat4(vertices, strideInFloats, corners, offset + 2) };
+}
+
+static Vec3x4 Sub(const Vec3x4& a, const Vec3x4& b)
+{
+    return Vec3x4{ _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+}
+
+static Vec3x4 Cross(const Vec3x4& a, const Vec3x4& b)
+{
+    return Vec3x4{ _mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+                   _mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+                   _mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x)) };
+}
+
+// a * s - b * t
+static Vec3x4 ScaleSub(const Vec3x4& a, __m128 s, const Vec3x4& b, __m128 t)
+{
+    return Vec3x4{ _mm_sub_ps(_mm_mul_ps(a.x, s), _mm_mul_ps(b.x, t)),
+                   _mm_sub_ps(_mm_mul_ps(a.y, s), _mm_mul_ps(b.y, t)),
+                   _mm_sub_ps(_mm_mul_ps(a.z, s), _mm_mul_ps(b.z, t)) };
+}
+
+static void StoreVec3x4(const Vec3x4& v, glm::vec3* out, u32 count)
+{
+    alignas(16) f32 x[4], y[4], z[4];
+    _mm_store_ps(x, v.x);
+    _mm_store_ps(y, v.y);
+    _mm_store_ps(z, v.z);
+    for (u32 i = 0; i < count; ++i)
+        out[i] = glm::vec3(x[i], y[i], z[i]);
+}
+
+// The indices of four triangles starting at 'triangle', the last one repeated past the end of the mesh
+static const u32* GetTriangles4(const u32* indices, u32 triangle, u32 triangleCount, u32* padded, u32& count)
+{
+    count = glm::min(4u, triangleCount - triangle);
+    if (count == 4)
+        return indices + triangle * 3;
+
+    for (u32 i = 0; i < 12; ++i)
+        padded[i] = indices[(triangle + glm::min(i / 3, count - 1)) * 3 + i % 3];
+    return padded;
+}
+
+static void ComputeFaceNormals(u32 begin, u32 end, void* data)
+{
+    FaceNormalsData* normalsData = (FaceNormalsData*)data;
+    for (u32 triangle = begin; triangle < end; triangle += 4)
+    {
+        u32 padded[12], count;
+        const u32* corners = GetTriangles4(normalsData->indices, triangle, normalsData->triangleCount, padded, count);
+        Vec3x4 p0 = GatherVec3x4(normalsData->vertices, normalsData->strideInFloats, corners, 0);
+        Vec3x4 p1 = GatherVec3x4(normalsData->vertices, normalsData->strideInFloats, corners + 1, 0);
+        Vec3x4 p2 = GatherVec3x4(normalsData->vertices, normalsData->strideInFloats, corners + 2, 0);
+        StoreVec3x4(Cross(Sub(p1, p0), Sub(p2, p0)), normalsData->faceNormals + triangle, count);
+    }
+}
+
+static void ComputeFaceTangents(u32 begin, u32 end, void* data)
+{
+    FaceTangentsData* tangentsData = (FaceTangentsData*)data;
+    const float* vertices = tangentsData->vertices;
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (u32 triangle = begin; triangle < end; triangle += 4)
+    {
+        u32 padded[12], count;
+        const u32* corners = GetTriangles4(tangentsData->indices, triangle, tangentsData->triangleCount, padded, count);
+        Vec3x4 p0 = GatherVec3x4(vertices, MODEL_VERTEX_FLOATS, corners, 0);
+        Vec3x4 dp1 = Sub(GatherVec3x4(vertices, MODEL_VERTEX_FLOATS, corners + 1, 0), p0);
+        Vec3x4 dp2 = Sub(GatherVec3x4(vertices, MODEL_VERTEX_FLOATS, corners + 2, 0), p0);
+        __m128 u0 = GatherFloat4(vertices, MODEL_VERTEX_FLOATS, corners, MODEL_VERTEX_TEXCOORD_OFFSET);
+        __m128 v0 = GatherFloat4(vertices, MODEL_VERTEX_FLOATS, corners, MODEL_VERTEX_TEXCOORD_OFFSET + 1);
+        __m128 du1 = _mm_sub_ps(GatherFloat4(vertices, MODEL_VERTEX_FLOATS, corners + 1, MODEL_VERTEX_TEXCOORD_OFFSET), u0);
+        __m128 dv1 = _mm_sub_ps(GatherFloat4(vertices, MODEL_VERTEX_FLOATS, corners + 1, MODEL_VERTEX_TEXCOORD_OFFSET + 1), v0);
+        __m128 du2 = _mm_sub_ps(GatherFloat4(vertices, MODEL_VERTEX_FLOATS, corners + 2, MODEL_VERTEX_TEXCOORD_OFFSET), u0);
+        __m128 dv2 = _mm_sub_ps(GatherFloat4(vertices, MODEL_VERTEX_FLOATS, corners + 2, MODEL_VERTEX_TEXCOORD_OFFSET + 1), v0);
+
+        // Twice the signed area in texture space, and the tangent times it
+        __m128 determinant = _mm_sub_ps(_mm_mul_ps(du1, dv2), _mm_mul_ps(du2, dv1));
+        Vec3x4 tangent = ScaleSub(dp1, dv2, dp2, dv1);
+        __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tangent.x, tangent.x), _mm_mul_ps(tangent.y, tangent.y)), _mm_mul_ps(tangent.z, tangent.z));
+        __m128 valid = _mm_and_ps(_mm_cmpgt_ps(_mm_andnot_ps(signMask, determinant), _mm_set1_ps(1e-20f)), _mm_cmpgt_ps(lengthSq, _mm_set1_ps(1e-30f)));
+
+        // Normalized and pointing along +U whatever the sign of the area, zero if degenerate
+        __m128 scale = _mm_div_ps(_mm_or_ps(_mm_and_ps(determinant, signMask), _mm_set1_ps(1.0f)), _mm_sqrt_ps(lengthSq));
+        scale = _mm_and_ps(scale, valid);
+        tangent = Vec3x4{ _mm_mul_ps(tangent.x, scale), _mm_mul_ps(tangent.y, scale), _mm_mul_ps(tangent.z, scale) };
+        StoreVec3x4(tangent, tangentsData->faceTangents + triangle, count);
+
+        const int validMask = _mm_movemask_ps(valid);
+        const int positiveMask = _mm_movemask_ps(_mm_cmpgt_ps(determinant, _mm_setzero_ps()));
+        for (u32 i = 0; i < count; ++i)
+            tangentsData->faceSigns[triangle + i] = (validMask >> i) & 1 ? ((positiveMask >> i) & 1 ? 1 : 2) : 0;
+    }
+}
+
+static glm::vec3 ProjectNormalized(const glm::vec3& v, const glm::vec3& normal)
+{
+    glm::vec3 projected = v - normal * glm::dot(normal, v);
+    f32 length = glm::length(projected);
+    return length > 0.0f ? projected / length : glm::vec3(0.0f);
+}
+
+static void ComputeCornerTangents(u32 begin, u32 end, void* data)
+{
+    CornerTangentsData* cornersData = (CornerTangentsData*)data;
+    for (u32 triangle = begin; triangle < end; ++triangle)
+    {
+        const u32* corners = cornersData->indices + triangle * 3;
+        for (u32 k = 0; k < 3; ++k)
+        {
+            glm::vec3& cornerTangent = cornersData->cornerTangents[triangle * 3 + k];
+            if (cornersData->faceSigns[triangle] == 0)
+            {
+                cornerTangent = glm::vec3(0.0f);
+                continue;
+            }
+
+            const float* vertex = cornersData->vertices + corners[k] * MODEL_VERTEX_FLOATS;
+            const glm::vec3 position = glm::make_vec3(vertex);
+            const glm::vec3 normal = glm::make_vec3(vertex + MODEL_VERTEX_NORMAL_OFFSET);
+            glm::vec3 edge1 = ProjectNormalized(glm::make_vec3(cornersData->vertices + corners[(k + 1) % 3] * MODEL_VERTEX_FLOATS) - position, normal);
+            glm::vec3 edge2 = ProjectNormalized(glm::make_vec3(cornersData->vertices + corners[(k + 2) % 3] * MODEL_VERTEX_FLOATS) - position, normal);
+            f32 angle = acosf(glm::clamp(glm::dot(edge1, edge2), -1.0f, 1.0f));
+            cornerTangent = ProjectNormalized(cornersData->faceTangents[triangle], normal) * angle;
+        }
+    }
+}
+
+static void BuildVertexCorners(const u32* indices, u32 indexCount, const u32* remap, u32 vertexCount, VertexCorners& vertexCorners)
+{
+    vertexCorners.offsets.assign(vertexCount + 1, 0);
+    for (u32 i = 0; i < indexCount; ++i)
+        vertexCorners.offsets[(remap ? remap[indices[i]] : indices[i]) + 1]++;
+    for (u32 i = 0; i < vertexCount; ++i)
+        vertexCorners.offsets[i + 1] += vertexCorners.offsets[i];
+
+    std::vector<u32> cursors(vertexCorners.offsets.begin(), vertexCorners.offsets.end() - 1);
+    vertexCorners.corners.resize(indexCount);
+    for (u32 i = 0; i < indexCount; ++i)
+        vertexCorners.corners[cursors[remap ? remap[indices[i]] : indices[i]]++] = i;
+}
+
+static void AccumulateVertexNormals(u32 begin, u32 end, void* data)
+{
+    VertexNormalsData* normalsData = (VertexNormalsData*)data;
+    const VertexCorners& vertexCorners = *normalsData->vertexCorners;
+    for (u32 i = begin; i < end; ++i)
+    {
+        if (normalsData->remap[i] != i)
+            continue;
+
+        glm::vec3 normal = glm::vec3(0.0f);
+        for (u32 c = vertexCorners.offsets[i]; c < vertexCorners.offsets[i + 1]; ++c)
+            normal += normalsData->faceNormals[vertexCorners.corners[c] / 3];
+        f32 length = glm::length(normal);
+        normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        memcpy(normalsData->vertices + i * normalsData->strideInFloats + MODEL_VERTEX_NORMAL_OFFSET, &normal, 3 * sizeof(float));
+    }
+}
+
+static void CopyVertexNormals(u32 begin, u32 end, void* data)
+{
+    VertexNormalsData* normalsData = (VertexNormalsData*)data;
+    const u32 stride = normalsData->strideInFloats;
+    for (u32 i = begin; i < end; ++i)
+        if (normalsData->remap[i] != i)
+            memcpy(normalsData->vertices + i * stride + MODEL_VERTEX_NORMAL_OFFSET, normalsData->vertices + normalsData->remap[i] * stride + MODEL_VERTEX_NORMAL_OFFSET, 3 * sizeof(float));
+}
+
+static void AccumulateVertexTangents(u32 begin, u32 end, void* data)
+{
+    VertexTangentsData* tangentsData = (VertexTangentsData*)data;
+    const VertexCorners& vertexCorners = *tangentsData->vertexCorners;
+    for (u32 i = begin; i < end; ++i)
+    {
+        float* vertex = tangentsData->vertices + i * MODEL_VERTEX_FLOATS;
+        glm::vec3 normal = glm::make_vec3(vertex + MODEL_VERTEX_NORMAL_OFFSET);
+
+        glm::vec3 sum = glm::vec3(0.0f);
+        for (u32 c = vertexCorners.offsets[i]; c < vertexCorners.offsets[i + 1]; ++c)
+            sum += tangentsData->cornerTangents[vertexCorners.corners[c]];
+
+        // Orthogonal to the normal, any basis if the texture coordinates give none
+        glm::vec3 tangent = sum - normal * glm::dot(normal, sum);
+        if (glm::length(tangent) < 1e-6f)
+            tangent = glm::cross(normal, glm::abs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f));
+        tangent = glm::normalize(tangent);
+        glm::vec3 bitangent = glm::cross(normal, tangent) * tangentsData->handedness[i];
+
+        memcpy(vertex + MODEL_VERTEX_TANGENT_OFFSET, &tangent, 3 * sizeof(float));
+        memcpy(vertex + MODEL_VERTEX_BITANGENT_OFFSET, &bitangent, 3 * sizeof(float));
+    }
+}
+
+void GenerateTangentSpace(std::vector<float>& vertices, std::vector<u32>& indices, MeshKernelTimings* timings)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    const u32 triangleCount = (u32)indices.size() / 3;
+    u32 vertexCount = (u32)vertices.size() / MODEL_VERTEX_FLOATS;
+    if (vertexCount == 0)
+        return;
+
+    std::vector<glm::vec3> faceTangents(triangleCount);
+    std::vector<u8> faceSigns(triangleCount);
+    FaceTangentsData faceData = { vertices.data(), indices.data(), triangleCount, faceTangents.data(), faceSigns.data() };
+    ParallelFor(triangleCount, MESH_KERNEL_BATCH_SIZE, ComputeFaceTangents, &faceData);
+
+    // Vertices used by triangles of both handedness are split, the copy takes the mirrored ones
+    std::vector<u8> vertexSigns(vertexCount, 0);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+        vertexSigns[indices[i]] |= faceSigns[i / 3];
+
+    std::vector<u32> splitVertices;
+    std::vector<u32> splitIdx(vertexCount, UINT32_MAX);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+    {
+        const u32 vertexIdx = indices[i];
+        if (vertexSigns[vertexIdx] != 3 || faceSigns[i / 3] != 2)
+            continue;
+        if (splitIdx[vertexIdx] == UINT32_MAX)
+        {
+            splitIdx[vertexIdx] = vertexCount + (u32)splitVertices.size();
+            splitVertices.push_back(vertexIdx);
+        }
+        indices[i] = splitIdx[vertexIdx];
+    }
+
+    vertices.resize((vertexCount + splitVertices.size()) * MODEL_VERTEX_FLOATS);
+    std::vector<f32> handedness(vertexCount + splitVertices.size(), -1.0f);
+    for (u32 i = 0; i < vertexCount; ++i)
+        handedness[i] = vertexSigns[i] == 2 ? -1.0f : 1.0f;
+    for (u32 i = 0; i < splitVertices.size(); ++i)
+        memcpy(&vertices[(vertexCount + i) * MODEL_VERTEX_FLOATS], &vertices[splitVertices[i] * MODEL_VERTEX_FLOATS], MODEL_VERTEX_FLOATS * sizeof(float));
+    vertexCount += (u32)splitVertices.size();
+
+    std::vector<glm::vec3> cornerTangents(triangleCount * 3);
+    CornerTangentsData cornersData = { vertices.data(), indices.data(), faceTangents.data(), faceSigns.data(), cornerTangents.data() };
+    ParallelFor(triangleCount, MESH_KERNEL_BATCH_SIZE, ComputeCornerTangents, &cornersData);
+
+    VertexCorners vertexCorners;
+    BuildVertexCorners(indices.data(), triangleCount * 3, NULL, vertexCount, vertexCorners);
+    VertexTangentsData vertexData = { vertices.data(), cornerTangents.data(), handedness.data(), &vertexCorners };
+    ParallelFor(vertexCount, MESH_KERNEL_BATCH_SIZE, AccumulateVertexTangents, &vertexData);
+
+    if (timings)
+        timings->tangents += MillisecondsSince(start);
+}
+
+static u32 HashVertex(const float* vertex, u32 floatCount)
+{
+    u32 hash = 2166136261u;
+    for (u32 i = 0; i < floatCount; ++i)
+    {
+        u32 bits;
+        memcpy(&bits, vertex + i, sizeof(bits));
+        bits = bits == 0x80000000u ? 0 : bits; // -0 == 0
+        hash = (hash ^ bits) * 16777619u;
+    }
+    return hash ^ (hash >> 16);
+}
+
+static bool VerticesEqual(const float* a, const float* b, u32 floatCount)
+{
+    for (u32 i = 0; i < floatCount; ++i)
+        if (a[i] != b[i])
+            return false;
+    return true;
+}
+
+// Every vertex ends up in the slot of its equals, which keeps the smallest of their indices
+static void InsertVertices(u32 begin, u32 end, void* data)
+{
+    VertexRemapData* remapData = (VertexRemapData*)data;
+    for (u32 i = begin; i < end; ++i)
+    {
+        const float* vertex = remapData->vertices + i * remapData->strideInFloats;
+        u32 slot = HashVertex(vertex, remapData->compareFloats) & remapData->tableMask;
+        for (;;)
+        {
+            u32 current = remapData->table[slot].load(std::memory_order_acquire);
+            if (current == 0)
+            {
+                if (remapData->table[slot].compare_exchange_strong(current, i + 1, std::memory_order_acq_rel))
+                    break;
+                continue; // Taken meanwhile, maybe by an equal vertex
+            }
+            if (VerticesEqual(remapData->vertices + (current - 1) * remapData->strideInFloats, vertex, remapData->compareFloats))
+            {
+                while (i + 1 < current && !remapData->table[slot].compare_exchange_weak(current, i + 1, std::memory_order_acq_rel)) {}
+                break;
+            }
+            slot = (slot + 1) & remapData->tableMask;
+        }
+    }
+}
+
+static void LookUpVertices(u32 begin, u32 end, void* data)
+{
+    VertexRemapData* remapData = (VertexRemapData*)data;
+    for (u32 i = begin; i < end; ++i)
+    {
+        const float* vertex = remapData->vertices + i * remapData->strideInFloats;
+        u32 slot = HashVertex(vertex, remapData->compareFloats) & remapData->tableMask;
+        for (;;)
+        {
+            const u32 first = remapData->table[slot].load(std::memory_order_relaxed) - 1;
+            if (first == i || VerticesEqual(remapData->vertices + first * remapData->strideInFloats, vertex, remapData->compareFloats))
+            {
+                remapData->remap[i] = first;
+                break;
+            }
+            slot = (slot + 1) & remapData->tableMask;
+        }
+    }
+}
+
+// remap[i] is the first vertex whose first 'compareFloats' floats equal those of vertex i
+static void BuildVertexRemap(const float* vertices, u32 vertexCount, u32 strideInFloats, u32 compareFloats, std::vector<u32>& remap)
+{
+    // At most half full
+    u32 tableSize = 16;
+    while (tableSize < vertexCount * 2)
+        tableSize *= 2;
+    std::vector<std::atomic<u32>> table(tableSize);
+    for (std::atomic<u32>& slot : table)
+        slot.store(0, std::memory_order_relaxed);
+
+    remap.resize(vertexCount);
+    VertexRemapData remapData = { vertices, strideInFloats, compareFloats, table.data(), tableSize - 1, remap.data() };
+    ParallelFor(vertexCount, MESH_KERNEL_BATCH_SIZE, InsertVertices, &remapData);
+    ParallelFor(vertexCount, MESH_KERNEL_BATCH_SIZE, LookUpVertices, &remapData);
+}
+
+void GenerateSmoothNormals(float* vertices, u32 vertexCount, u32 strideInFloats, const u32* indices, u32 indexCount, MeshKernelTimings* timings)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    const u32 triangleCount = indexCount / 3;
+
+    std::vector<u32> positionRemap;
+    BuildVertexRemap(vertices, vertexCount, strideInFloats, 3, positionRemap);
+
+    std::vector<glm::vec3> faceNormals(triangleCount);
+    FaceNormalsData faceData = { vertices, strideInFloats, indices, triangleCount, faceNormals.data() };
+    ParallelFor(triangleCount, MESH_KERNEL_BATCH_SIZE, ComputeFaceNormals, &faceData);
+
+    // The corners of every position go to the first vertex with it, the others copy its normal
+    VertexCorners vertexCorners;
+    BuildVertexCorners(indices, triangleCount * 3, positionRemap.data(), vertexCount, vertexCorners);
+    VertexNormalsData vertexData = { vertices, strideInFloats, positionRemap.data(), faceNormals.data(), &vertexCorners };
+    ParallelFor(vertexCount, MESH_KERNEL_BATCH_SIZE, AccumulateVertexNormals, &vertexData);
+    ParallelFor(vertexCount, MESH_KERNEL_BATCH_SIZE, CopyVertexNormals, &vertexData);
+
+    if (timings)
+        timings->normals += MillisecondsSince(start);
+}
+
+static void RemapIndices(u32 begin, u32 end, void* data)
+{
+    RemapIndicesData* remapData = (RemapIndicesData*)data;
+    for (u32 i = begin; i < end; ++i)
+        remapData->indices[i] = remapData->newIndices[remapData->indices[i]];
+}
+
+u32 WeldVertices(std::vector<float>& vertices, u32 strideInFloats, std::vector<u32>& indices, MeshKernelTimings* timings)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    const u32 vertexCount = (u32)vertices.size() / strideInFloats;
+
+    std::vector<u32> remap;
+    BuildVertexRemap(vertices.data(), vertexCount, strideInFloats, strideInFloats, remap);
+
+    // The first copy of every vertex moves down to its new index, which is never after the old one
+    std::vector<u32> newIndices(vertexCount);
+    u32 newVertexCount = 0;
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        if (remap[i] != i)
+        {
+            newIndices[i] = newIndices[remap[i]];
+            continue;
+        }
+        newIndices[i] = newVertexCount;
+        if (newVertexCount != i)
+            memcpy(&vertices[newVertexCount * strideInFloats], &vertices[i * strideInFloats], strideInFloats * sizeof(float));
+        newVertexCount++;
+    }
+    vertices.resize(newVertexCount * strideInFloats);
+
+    RemapIndicesData remapData = { indices.data(), newIndices.data() };
+    ParallelFor((u32)indices.size(), MESH_KERNEL_BATCH_SIZE, RemapIndices, &remapData);
+
+    if (timings)
+        timings->welding += MillisecondsSince(start);
+    return newVertexCount;
+}
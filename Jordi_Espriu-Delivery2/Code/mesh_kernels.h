@@ -0,0 +1,56 @@
+//
+// mesh_kernels.h: Generation of the vertex attributes the imported meshes don't bring, and
+// welding of their identical vertices, done by the engine instead of Assimp's post processing
+// steps. They work in place on the float vertices of the model layout (see MakeModelVertexLayout):
+// position, normal, texture coordinates, tangent, bitangent. The per triangle work is done four
+// triangles at a time with SSE, and both the triangle and the vertex passes are split in jobs.
+//
+
+#pragma once
+
+#include "platform.h"
+
+// Floats per vertex of the model layout with all the attributes, and where each one starts
+#define MODEL_VERTEX_FLOATS          14
+#define MODEL_VERTEX_NORMAL_OFFSET    3
+#define MODEL_VERTEX_TEXCOORD_OFFSET  6
+#define MODEL_VERTEX_TANGENT_OFFSET   8
+#define MODEL_VERTEX_BITANGENT_OFFSET 11
+
+// Triangles and vertices per job of the kernels
+#define MESH_KERNEL_BATCH_SIZE 4096
+
+// Milliseconds spent in each kernel, summed over the meshes of an import (so with meshes
+// processed in parallel, it can be more than the import time)
+struct MeshKernelTimings
+{
+    f32 normals = 0.0f;
+    f32 tangents = 0.0f;
+    f32 welding = 0.0f;
+};
+
+/**
+ * Computes the tangent and bitangent of every vertex, following MikkTSpace: the tangent of
+ * each triangle along its texture coordinates is projected in the tangent plane of each corner,
+ * weighted by the corner angle and averaged per vertex, and the bitangent is the cross product
+ * of the normal and the tangent times the handedness of the triangles. The bitangent so points
+ * along +V, which is what ProcessAssimpMesh got from Assimp by flipping the one it gives. Vertices
+ * shared by triangles of both handedness (mirrored texture coordinates) are split in two, so
+ * 'vertices' can grow and 'indices' change. Vertices whose triangles have degenerate texture
+ * coordinates get any basis around the normal. 'timings' can be NULL.
+ */
+void GenerateTangentSpace(std::vector<float>& vertices, std::vector<u32>& indices, MeshKernelTimings* timings = NULL);
+
+/**
+ * Computes the normal of every vertex as the average of the normals of the triangles around
+ * its position, weighted by their area. Copies of a position (at texture seams, or every corner
+ * of an unindexed mesh) get the same normal. 'timings' can be NULL.
+ */
+void GenerateSmoothNormals(float* vertices, u32 vertexCount, u32 strideInFloats, const u32* indices, u32 indexCount, MeshKernelTimings* timings = NULL);
+
+/**
+ * Merges the vertices that are identical (all their floats equal) and remaps the indices to
+ * them. The vertices keep the order of their first copy. Returns the new vertex count, the
+ * vertices are resized to it. 'timings' can be NULL.
+ */
+u32 WeldVertices(std::vector<float>& vertices, u32 strideInFloats, std::vector<u32>& indices, MeshKernelTimings* timings = NULL);
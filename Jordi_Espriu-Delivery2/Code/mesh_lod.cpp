@@ -0,0 +1,96 @@
+#include "mesh_lod.h"
+#include "engine.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+void BuildLodChain(const std::vector<float>& vertices, u32 strideInFloats, std::vector<u32>& indices, SubmeshLod* lods, u32& lodCount)
+{
+    const u32 vertexCount = (u32)(vertices.size() / strideInFloats);
+    lods[0] = SubmeshLod{ 0, (u32)indices.size(), 0.0f, 0, 0 };
+    lodCount = 1;
+
+    std::vector<u32> simplified;
+    while (lodCount < MAX_LODS)
+    {
+        const SubmeshLod& previous = lods[lodCount - 1];
+        const u32 targetIndexCount = (u32)(previous.indexCount / 3 * LOD_REDUCTION) * 3;
+        if (targetIndexCount < LOD_MIN_TRIANGLES * 3)
+            break;
+
+        f32 error = SimplifyMesh(indices.data() + previous.firstIndex, previous.indexCount, vertices.data(), vertexCount, strideInFloats, targetIndexCount, simplified);
+        if (simplified.size() > previous.indexCount * LOD_MIN_REDUCTION)
+            break;
+
+        // The vertices keep the order of the full resolution level, only the triangles are reordered
+        OptimizeVertexCache(simplified.data(), (u32)simplified.size(), vertexCount, nullptr);
+
+        // Errors add up, each level is simplified from the previous one
+        lods[lodCount] = SubmeshLod{ (u32)indices.size(), (u32)simplified.size(), previous.error + error, 0, 0 };
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        lodCount++;
+    }
+}
+
+void ComputeMeshLods(Mesh& mesh)
+{
+    mesh.lodCount = 0;
+    for (const Submesh& submesh : mesh.submeshes)
+        mesh.lodCount = glm::max(mesh.lodCount, submesh.lodCount);
+
+    for (u32 lod = 0; lod < mesh.lodCount; ++lod)
+    {
+        mesh.lodErrors[lod] = 0.0f;
+        for (const Submesh& submesh : mesh.submeshes)
+            mesh.lodErrors[lod] = glm::max(mesh.lodErrors[lod], GetSubmeshLod(submesh, lod).error);
+    }
+}
+
+const SubmeshLod& GetSubmeshLod(const Submesh& submesh, u32 lod)
+{
+    return submesh.lods[glm::min(lod, submesh.lodCount - 1)];
+}
+
+void SelectEntityLods(App* app, const glm::mat4* worldMatrices)
+{
+    const Camera& camera = app->camera;
+    LodStats& stats = app->lodStats;
+    stats = {};
+
+    // Size in pixels of a unit long object one unit away from the camera
+    const f32 pixelsPerUnit = app->displaySize.y / (2.0f * tanf(glm::radians(camera.fov) * 0.5f));
+    const f32 threshold = app->lodErrorPixels;
+
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        Entity& entity = app->entities[i];
+        if (!entity.visible)
+            continue;
+
+        const Mesh& mesh = app->meshes[app->models[entity.modelId].meshIdx];
+        u32 lod = 0;
+        if (app->meshLods && mesh.lodCount > 1)
+        {
+            const glm::mat4& world = worldMatrices[i];
+            f32 scale = sqrtf(glm::max(glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+                              glm::max(glm::dot(glm::vec3(world[1]), glm::vec3(world[1])),
+                                       glm::dot(glm::vec3(world[2]), glm::vec3(world[2])))));
+            glm::vec3 center = glm::vec3(world * glm::vec4(mesh.bounds.sphereCenter, 1.0f));
+
+            // From the closest point of the bounding sphere, the camera could be inside
+            f32 distance = glm::length(center - camera.cameraPos) - mesh.bounds.sphereRadius * scale;
+            if (distance > camera.nearPlane)
+            {
+                const f32 pixelsPerError = scale * pixelsPerUnit / distance;
+                for (lod = mesh.lodCount - 1; lod > 0; --lod)
+                {
+                    f32 allowed = lod > entity.lod ? threshold * (1.0f - LOD_HYSTERESIS) : threshold;
+                    if (mesh.lodErrors[lod] * pixelsPerError <= allowed)
+                        break;
+                }
+            }
+        }
+
+        entity.lod = (u8)lod;
+        stats.entities[lod]++;
+    }
+}
@@ -0,0 +1,69 @@
+//
+// mesh_lod.h: Levels of detail of the imported meshes. Each triangle submesh gets a chain
+// of simplified index ranges (after the full resolution one, in the same index data and
+// over the same vertices), and every frame each entity picks the coarsest level whose
+// error, projected on the screen, stays under a pixel threshold.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct App;
+struct Mesh;
+struct Submesh;
+
+#define MAX_LODS 4
+
+// Triangles of each level as a ratio of the previous one
+#define LOD_REDUCTION 0.5f
+
+// The chain ends when a level can't get below this ratio of the previous one (seams and
+// borders can't be simplified away), or would have fewer triangles than LOD_MIN_TRIANGLES
+#define LOD_MIN_REDUCTION 0.85f
+#define LOD_MIN_TRIANGLES 64
+
+// Screen space error allowed when picking a level
+#define LOD_ERROR_PIXELS 1.0f
+
+// A coarser level is only picked when its error is this much under the threshold, and
+// kept until it goes over it, so entities around the switch distance don't pop back and forth
+#define LOD_HYSTERESIS 0.25f
+
+struct SubmeshLod
+{
+    u32 firstIndex;   // Relative to the first index of the submesh
+    u32 indexCount;
+    f32 error;        // Against the full resolution level, in object space
+    u32 firstMeshlet; // In Submesh::meshlets
+    u32 meshletCount;
+};
+
+struct LodStats
+{
+    u32 entities[MAX_LODS]; // Visible entities drawn at every level
+};
+
+/**
+ * Appends the simplified levels of a triangle list to 'indices', each one simplified
+ * from the previous and ordered for the vertex cache. lods[0] is the whole range of
+ * indices given, and lodCount is at least 1. Positions are the first 3 floats of each vertex.
+ */
+void BuildLodChain(const std::vector<float>& vertices, u32 strideInFloats, std::vector<u32>& indices, SubmeshLod* lods, u32& lodCount);
+
+/**
+ * Computes the levels and their errors of a mesh from its submeshes. A level of the mesh
+ * draws every submesh at that level, or at its coarsest one if it has less.
+ */
+void ComputeMeshLods(Mesh& mesh);
+
+/**
+ * The level of a submesh drawn for a level of its mesh.
+ */
+const SubmeshLod& GetSubmeshLod(const Submesh& submesh, u32 lod);
+
+/**
+ * Picks the level of every visible entity (Entity::lod) from the world matrices, with
+ * hysteresis against its level of the last frame. Counters go into App::lodStats.
+ */
+void SelectEntityLods(App* app, const glm::mat4* worldMatrices);
@@ -0,0 +1,432 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#define VERTEX_FETCH_CACHE_LINE_SIZE 64
+#define VERTEX_FETCH_CACHE_LINES     64 // FIFO, like the post-transform cache
+
+#define OVERDRAW_VIEWPORT_SIZE 256
+
+// FIFO cache simulated with the time every entry got in, the time only advances on misses
+struct FifoCache
+{
+    std::vector<u32> insertTime;
+    u32              time;
+    u32              size;
+};
+
+static void InitFifoCache(FifoCache& cache, u32 entryCount, u32 size)
+{
+    cache.insertTime.assign(entryCount, 0);
+    cache.size = size;
+    cache.time = size + 1;
+}
+
+// Returns true on a miss
+static bool AccessFifoCache(FifoCache& cache, u32 entry)
+{
+    if (cache.time - cache.insertTime[entry] <= cache.size)
+        return false;
+    cache.insertTime[entry] = cache.time++;
+    return true;
+}
+
+static void FlushFifoCache(FifoCache& cache)
+{
+    cache.time += cache.size + 1;
+}
+
+static glm::vec3 GetPosition(const float* vertices, u32 strideInFloats, u32 vertexIdx)
+{
+    const float* p = vertices + vertexIdx * strideInFloats;
+    return glm::vec3(p[0], p[1], p[2]);
+}
+
+// Next vertex to fan around when none of the last triangle's can be: the most recently
+// used ones with triangles left first, then the first one in index order
+static u32 SkipDeadEnd(std::vector<u32>& deadEnds, const std::vector<u32>& liveTriangles, u32& cursor)
+{
+    while (!deadEnds.empty())
+    {
+        const u32 vertexIdx = deadEnds.back();
+        deadEnds.pop_back();
+        if (liveTriangles[vertexIdx] > 0)
+            return vertexIdx;
+    }
+
+    for (; cursor < liveTriangles.size(); ++cursor)
+        if (liveTriangles[cursor] > 0)
+            return cursor;
+
+    return UINT32_MAX;
+}
+
+void OptimizeVertexCache(u32* indices, u32 indexCount, u32 vertexCount, std::vector<u32>* clusters)
+{
+    const u32 triangleCount = indexCount / 3;
+    if (clusters)
+        clusters->clear();
+    if (triangleCount == 0)
+        return;
+
+    // Triangles using every vertex, packed
+    std::vector<u32> liveTriangles(vertexCount, 0);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+        liveTriangles[indices[i]]++;
+
+    std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+    for (u32 v = 0; v < vertexCount; ++v)
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+    std::vector<u32> adjacency(triangleCount * 3);
+    std::vector<u32> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (u32 t = 0; t < triangleCount; ++t)
+        for (u32 k = 0; k < 3; ++k)
+            adjacency[adjacencyFill[indices[t * 3 + k]]++] = t;
+
+    FifoCache cache;
+    InitFifoCache(cache, vertexCount, VERTEX_CACHE_SIZE);
+
+    std::vector<u8>  emitted(triangleCount, 0);
+    std::vector<u32> deadEnds;
+    std::vector<u32> candidates;
+    std::vector<u32> output;
+    deadEnds.reserve(triangleCount * 3);
+    output.reserve(triangleCount * 3);
+
+    u32 cursor = 0;
+    u32 fanningVertex = SkipDeadEnd(deadEnds, liveTriangles, cursor);
+    bool fromDeadEnd = true;
+    while (fanningVertex != UINT32_MAX)
+    {
+        if (clusters && fromDeadEnd)
+            clusters->push_back((u32)output.size());
+
+        // Every triangle left around the fanning vertex
+        candidates.clear();
+        for (u32 a = adjacencyOffsets[fanningVertex]; a < adjacencyOffsets[fanningVertex + 1]; ++a)
+        {
+            const u32 t = adjacency[a];
+            if (emitted[t])
+                continue;
+
+            for (u32 k = 0; k < 3; ++k)
+            {
+                const u32 v = indices[t * 3 + k];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                AccessFifoCache(cache, v);
+            }
+            emitted[t] = 1;
+        }
+
+        // The oldest candidate that will still be in the cache after fanning around it
+        u32 nextVertex = UINT32_MAX;
+        i32 bestPriority = -1;
+        for (u32 v : candidates)
+        {
+            if (liveTriangles[v] == 0)
+                continue;
+
+            const u32 age = cache.time - cache.insertTime[v];
+            const i32 priority = age + 2 * liveTriangles[v] <= VERTEX_CACHE_SIZE ? (i32)age : 0;
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                nextVertex = v;
+            }
+        }
+
+        fromDeadEnd = nextVertex == UINT32_MAX;
+        fanningVertex = fromDeadEnd ? SkipDeadEnd(deadEnds, liveTriangles, cursor) : nextVertex;
+    }
+
+    memcpy(indices, output.data(), output.size() * sizeof(u32));
+}
+
+struct OverdrawCluster
+{
+    u32 firstTriangle;
+    u32 triangleCount;
+    f32 sortKey;
+};
+
+void OptimizeOverdraw(u32* indices, u32 indexCount, const float* vertices, u32 vertexCount, u32 strideInFloats,
+                      const std::vector<u32>& clusters, f32 threshold)
+{
+    const u32 triangleCount = indexCount / 3;
+    if (triangleCount == 0 || clusters.empty())
+        return;
+
+    // Split every cluster where the cache misses so far are already as good as the whole
+    // cluster's (within the threshold), as starting from there costs about the same
+    FifoCache cache;
+    InitFifoCache(cache, vertexCount, VERTEX_CACHE_SIZE);
+
+    std::vector<u32> splits;
+    for (u32 c = 0; c < clusters.size(); ++c)
+    {
+        const u32 begin = clusters[c] / 3;
+        const u32 end = c + 1 < clusters.size() ? clusters[c + 1] / 3 : triangleCount;
+
+        FlushFifoCache(cache);
+        u32 clusterMisses = 0;
+        for (u32 t = begin; t < end; ++t)
+            for (u32 k = 0; k < 3; ++k)
+                clusterMisses += AccessFifoCache(cache, indices[t * 3 + k]);
+        const f32 clusterThreshold = threshold * clusterMisses / (end - begin);
+
+        FlushFifoCache(cache);
+        u32 splitBegin = begin, misses = 0;
+        for (u32 t = begin; t < end; ++t)
+        {
+            for (u32 k = 0; k < 3; ++k)
+                misses += AccessFifoCache(cache, indices[t * 3 + k]);
+
+            if ((f32)misses / (t + 1 - splitBegin) <= clusterThreshold)
+            {
+                splits.push_back(splitBegin);
+                splitBegin = t + 1;
+                misses = 0;
+                FlushFifoCache(cache);
+            }
+        }
+        if (splitBegin != end)
+            splits.push_back(splitBegin);
+    }
+
+    // Area weighted centroid of the mesh and centroid and normal of every cluster
+    std::vector<OverdrawCluster> sorted(splits.size());
+    std::vector<glm::vec3> centroids(splits.size()), normals(splits.size());
+    glm::vec3 meshCentroid = glm::vec3(0.0f);
+    f32 meshArea = 0.0f;
+    for (u32 c = 0; c < splits.size(); ++c)
+    {
+        OverdrawCluster& cluster = sorted[c];
+        cluster.firstTriangle = splits[c];
+        cluster.triangleCount = (c + 1 < splits.size() ? splits[c + 1] : triangleCount) - splits[c];
+
+        glm::vec3 centroid = glm::vec3(0.0f), normal = glm::vec3(0.0f), average = glm::vec3(0.0f);
+        f32 area = 0.0f;
+        for (u32 t = cluster.firstTriangle; t < cluster.firstTriangle + cluster.triangleCount; ++t)
+        {
+            const glm::vec3 p0 = GetPosition(vertices, strideInFloats, indices[t * 3 + 0]);
+            const glm::vec3 p1 = GetPosition(vertices, strideInFloats, indices[t * 3 + 1]);
+            const glm::vec3 p2 = GetPosition(vertices, strideInFloats, indices[t * 3 + 2]);
+            const glm::vec3 triangleNormal = glm::cross(p1 - p0, p2 - p0);
+            const f32 triangleArea = glm::length(triangleNormal);
+
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            average += (p0 + p1 + p2) / 3.0f;
+            normal += triangleNormal;
+            area += triangleArea;
+        }
+
+        meshCentroid += centroid;
+        meshArea += area;
+        centroids[c] = area > 0.0f ? centroid / area : average / (f32)cluster.triangleCount;
+        normals[c] = normal;
+    }
+    meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : glm::vec3(0.0f);
+
+    // The more a cluster faces away from the center, the more it occludes the rest
+    for (u32 c = 0; c < sorted.size(); ++c)
+    {
+        const f32 normalLength = glm::length(normals[c]);
+        sorted[c].sortKey = normalLength > 0.0f ? glm::dot(centroids[c] - meshCentroid, normals[c] / normalLength) : 0.0f;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const OverdrawCluster& a, const OverdrawCluster& b) {
+        return a.sortKey > b.sortKey;
+    });
+
+    std::vector<u32> output;
+    output.reserve(triangleCount * 3);
+    for (const OverdrawCluster& cluster : sorted)
+        output.insert(output.end(), indices + cluster.firstTriangle * 3, indices + (cluster.firstTriangle + cluster.triangleCount) * 3);
+    memcpy(indices, output.data(), output.size() * sizeof(u32));
+}
+
+u32 OptimizeVertexFetchRemap(const u32* indices, u32 indexCount, u32 vertexCount, std::vector<u32>& remap)
+{
+    remap.assign(vertexCount, UINT32_MAX);
+    u32 nextVertex = 0;
+    for (u32 i = 0; i < indexCount; ++i)
+        if (remap[indices[i]] == UINT32_MAX)
+            remap[indices[i]] = nextVertex++;
+    return nextVertex;
+}
+
+void RemapVertices(std::vector<float>& vertices, u32 strideInFloats, const std::vector<u32>& remap, u32 newVertexCount)
+{
+    std::vector<float> remapped(newVertexCount * strideInFloats);
+    for (u32 v = 0; v < remap.size(); ++v)
+        if (remap[v] != UINT32_MAX)
+            memcpy(&remapped[remap[v] * strideInFloats], &vertices[v * strideInFloats], strideInFloats * sizeof(float));
+    vertices.swap(remapped);
+}
+
+void RemapIndices(u32* indices, u32 indexCount, const std::vector<u32>& remap)
+{
+    for (u32 i = 0; i < indexCount; ++i)
+        indices[i] = remap[indices[i]];
+}
+
+void OptimizeMesh(std::vector<float>& vertices, std::vector<u32>& indices, u32 strideInFloats)
+{
+    const u32 vertexCount = (u32)(vertices.size() / strideInFloats);
+    const u32 indexCount = (u32)indices.size();
+
+    std::vector<u32> clusters;
+    OptimizeVertexCache(indices.data(), indexCount, vertexCount, &clusters);
+    OptimizeOverdraw(indices.data(), indexCount, vertices.data(), vertexCount, strideInFloats, clusters, OVERDRAW_CLUSTER_THRESHOLD);
+
+    std::vector<u32> remap;
+    const u32 usedVertexCount = OptimizeVertexFetchRemap(indices.data(), indexCount, vertexCount, remap);
+    RemapVertices(vertices, strideInFloats, remap, usedVertexCount);
+    RemapIndices(indices.data(), indexCount, remap);
+}
+
+VertexCacheStats AnalyzeVertexCache(const u32* indices, u32 indexCount, u32 vertexCount, u32 cacheSize)
+{
+    FifoCache cache;
+    InitFifoCache(cache, vertexCount, cacheSize);
+
+    std::vector<u8> used(vertexCount, 0);
+    u32 usedVertexCount = 0;
+
+    VertexCacheStats stats = {};
+    for (u32 i = 0; i < indexCount; ++i)
+    {
+        stats.vertexTransforms += AccessFifoCache(cache, indices[i]);
+        usedVertexCount += used[indices[i]] == 0;
+        used[indices[i]] = 1;
+    }
+
+    stats.acmr = indexCount > 0 ? stats.vertexTransforms / (indexCount / 3.0f) : 0.0f;
+    stats.atvr = usedVertexCount > 0 ? stats.vertexTransforms / (f32)usedVertexCount : 0.0f;
+    return stats;
+}
+
+VertexFetchStats AnalyzeVertexFetch(const u32* indices, u32 indexCount, u32 vertexCount, u32 vertexSize)
+{
+    const u32 lineCount = (vertexCount * vertexSize + VERTEX_FETCH_CACHE_LINE_SIZE - 1) / VERTEX_FETCH_CACHE_LINE_SIZE;
+    FifoCache cache;
+    InitFifoCache(cache, lineCount, VERTEX_FETCH_CACHE_LINES);
+
+    std::vector<u8> used(vertexCount, 0);
+    u32 usedVertexCount = 0;
+
+    VertexFetchStats stats = {};
+    for (u32 i = 0; i < indexCount; ++i)
+    {
+        const u32 v = indices[i];
+        usedVertexCount += used[v] == 0;
+        used[v] = 1;
+
+        const u32 firstLine = v * vertexSize / VERTEX_FETCH_CACHE_LINE_SIZE;
+        const u32 lastLine = ((v + 1) * vertexSize - 1) / VERTEX_FETCH_CACHE_LINE_SIZE;
+        for (u32 line = firstLine; line <= lastLine; ++line)
+            stats.bytesFetched += AccessFifoCache(cache, line) ? VERTEX_FETCH_CACHE_LINE_SIZE : 0;
+    }
+
+    stats.overfetch = usedVertexCount > 0 ? stats.bytesFetched / (f32)(usedVertexCount * vertexSize) : 0.0f;
+    return stats;
+}
+
+// Edge function, twice the signed area of (a, b, p) in XY
+static f32 EdgeFunction(const glm::vec3& a, const glm::vec3& b, const glm::vec3& p)
+{
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+static void RasterizeTriangle(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, f32* depth, OverdrawStats& stats)
+{
+    f32 area = EdgeFunction(p0, p1, p2);
+    if (area == 0.0f)
+        return;
+    if (area < 0.0f)
+    {
+        std::swap(p1, p2);
+        area = -area;
+    }
+
+    const i32 minX = glm::max((i32)floorf(glm::min(p0.x, glm::min(p1.x, p2.x))), 0);
+    const i32 minY = glm::max((i32)floorf(glm::min(p0.y, glm::min(p1.y, p2.y))), 0);
+    const i32 maxX = glm::min((i32)ceilf(glm::max(p0.x, glm::max(p1.x, p2.x))), OVERDRAW_VIEWPORT_SIZE - 1);
+    const i32 maxY = glm::min((i32)ceilf(glm::max(p0.y, glm::max(p1.y, p2.y))), OVERDRAW_VIEWPORT_SIZE - 1);
+
+    for (i32 y = minY; y <= maxY; ++y)
+    {
+        for (i32 x = minX; x <= maxX; ++x)
+        {
+            const glm::vec3 p = glm::vec3(x + 0.5f, y + 0.5f, 0.0f);
+            const f32 w0 = EdgeFunction(p1, p2, p);
+            const f32 w1 = EdgeFunction(p2, p0, p);
+            const f32 w2 = EdgeFunction(p0, p1, p);
+            if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                continue;
+
+            const f32 z = (w0 * p0.z + w1 * p1.z + w2 * p2.z) / area;
+            f32& pixelDepth = depth[y * OVERDRAW_VIEWPORT_SIZE + x];
+            if (z < pixelDepth)
+            {
+                stats.pixelsCovered += pixelDepth == FLT_MAX;
+                stats.pixelsShaded++;
+                pixelDepth = z;
+            }
+        }
+    }
+}
+
+OverdrawStats AnalyzeOverdraw(const u32* indices, u32 indexCount, const float* vertices, u32 vertexCount, u32 strideInFloats)
+{
+    OverdrawStats stats = {};
+    if (indexCount == 0)
+        return stats;
+
+    glm::vec3 aabbMin = glm::vec3(FLT_MAX), aabbMax = glm::vec3(-FLT_MAX);
+    for (u32 v = 0; v < vertexCount; ++v)
+    {
+        aabbMin = glm::min(aabbMin, GetPosition(vertices, strideInFloats, v));
+        aabbMax = glm::max(aabbMax, GetPosition(vertices, strideInFloats, v));
+    }
+    const glm::vec3 extent = aabbMax - aabbMin;
+    const f32 scale = OVERDRAW_VIEWPORT_SIZE / glm::max(glm::max(extent.x, glm::max(extent.y, extent.z)), 1e-6f);
+
+    std::vector<f32> depth(OVERDRAW_VIEWPORT_SIZE * OVERDRAW_VIEWPORT_SIZE);
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        for (f32 direction = -1.0f; direction <= 1.0f; direction += 2.0f)
+        {
+            std::fill(depth.begin(), depth.end(), FLT_MAX);
+            for (u32 i = 0; i + 2 < indexCount; i += 3)
+            {
+                glm::vec3 projected[3];
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    const glm::vec3 p = (GetPosition(vertices, strideInFloats, indices[i + k]) - aabbMin) * scale;
+                    projected[k] = glm::vec3(p[(axis + 1) % 3], p[(axis + 2) % 3], p[axis] * direction);
+                }
+                RasterizeTriangle(projected[0], projected[1], projected[2], depth.data(), stats);
+            }
+        }
+    }
+
+    stats.overdraw = stats.pixelsCovered > 0 ? stats.pixelsShaded / (f32)stats.pixelsCovered : 0.0f;
+    return stats;
+}
+
+MeshAnalysis AnalyzeMesh(const std::vector<float>& vertices, const std::vector<u32>& indices, u32 strideInFloats)
+{
+    const u32 vertexCount = (u32)(vertices.size() / strideInFloats);
+    const u32 indexCount = (u32)indices.size();
+
+    MeshAnalysis analysis;
+    analysis.vertexCache = AnalyzeVertexCache(indices.data(), indexCount, vertexCount, VERTEX_CACHE_SIZE);
+    analysis.vertexFetch = AnalyzeVertexFetch(indices.data(), indexCount, vertexCount, strideInFloats * sizeof(float));
+    analysis.overdraw = AnalyzeOverdraw(indices.data(), indexCount, vertices.data(), vertexCount, strideInFloats);
+    return analysis;
+}
@@ -0,0 +1,90 @@
+//
+// mesh_optimizer.h: Triangle and vertex reordering of the imported meshes, so they are
+// cheaper to draw. Triangles are ordered for the post-transform vertex cache (Tipsify),
+// then clusters of them are sorted so the outer ones are drawn first (less overdraw),
+// and the vertices are ordered as the triangles first use them (vertex fetch locality).
+// Also the analysis of an index buffer under those three criteria.
+//
+
+#pragma once
+
+#include "platform.h"
+
+// FIFO post-transform cache size the triangles are ordered (and analysed) for
+#define VERTEX_CACHE_SIZE 16
+
+// Cache misses per triangle a cluster can lose over the vertex cache order, as a ratio
+#define OVERDRAW_CLUSTER_THRESHOLD 1.05f
+
+// Logs the analysis of every submesh before and after optimizing it, when imported
+#define MESH_OPTIMIZATION_REPORT 0
+
+struct VertexCacheStats
+{
+    u32 vertexTransforms; // Cache misses
+    f32 acmr;             // Average cache miss ratio, transforms per triangle (0.5 is ideal)
+    f32 atvr;             // Average transform to vertex ratio (1.0 is ideal)
+};
+
+struct VertexFetchStats
+{
+    u32 bytesFetched; // In whole cache lines
+    f32 overfetch;    // Bytes fetched per byte of the vertices used (1.0 is ideal)
+};
+
+struct OverdrawStats
+{
+    u32 pixelsCovered;
+    u32 pixelsShaded;
+    f32 overdraw;     // Shaded per covered (1.0 is ideal)
+};
+
+struct MeshAnalysis
+{
+    VertexCacheStats vertexCache;
+    VertexFetchStats vertexFetch;
+    OverdrawStats    overdraw;
+};
+
+/**
+ * Reorders the triangles for the vertex cache with Tipsify. If 'clusters' is not null,
+ * it gets the first index of every run of triangles that starts from a dead end (the
+ * cache is cold there), which is where OptimizeOverdraw can move things around.
+ */
+void OptimizeVertexCache(u32* indices, u32 indexCount, u32 vertexCount, std::vector<u32>* clusters);
+
+/**
+ * Splits the clusters from OptimizeVertexCache further (while keeping the cache misses
+ * within 'threshold' of theirs) and sorts them so the ones facing outwards from the
+ * center of the mesh are drawn first. Positions are the first 3 floats of each vertex.
+ */
+void OptimizeOverdraw(u32* indices, u32 indexCount, const float* vertices, u32 vertexCount, u32 strideInFloats,
+                      const std::vector<u32>& clusters, f32 threshold);
+
+/**
+ * Fills 'remap' with the new index of every vertex, in the order they are first used by
+ * the triangles (UINT32_MAX for unused ones). Returns the count of used vertices.
+ */
+u32 OptimizeVertexFetchRemap(const u32* indices, u32 indexCount, u32 vertexCount, std::vector<u32>& remap);
+
+/**
+ * Apply a remap table to the vertices (in place, dropping the unused ones) and indices.
+ */
+void RemapVertices(std::vector<float>& vertices, u32 strideInFloats, const std::vector<u32>& remap, u32 newVertexCount);
+void RemapIndices(u32* indices, u32 indexCount, const std::vector<u32>& remap);
+
+/**
+ * All the passes above, in order.
+ */
+void OptimizeMesh(std::vector<float>& vertices, std::vector<u32>& indices, u32 strideInFloats);
+
+VertexCacheStats AnalyzeVertexCache(const u32* indices, u32 indexCount, u32 vertexCount, u32 cacheSize);
+VertexFetchStats AnalyzeVertexFetch(const u32* indices, u32 indexCount, u32 vertexCount, u32 vertexSize);
+
+/**
+ * Rasterizes the mesh (without culling) along the 6 axis directions and counts how
+ * many times every covered pixel passes the depth test.
+ */
+OverdrawStats AnalyzeOverdraw(const u32* indices, u32 indexCount, const float* vertices, u32 vertexCount, u32 strideInFloats);
+
+MeshAnalysis AnalyzeMesh(const std::vector<float>& vertices, const std::vector<u32>& indices, u32 strideInFloats);
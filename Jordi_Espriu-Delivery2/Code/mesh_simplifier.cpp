@@ -0,0 +1,299 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <numeric>
+#include <unordered_map>
+
+// Symmetric 4x4 matrix of the squared distance to a set of planes, in the unit cube of the mesh
+struct Quadric
+{
+    f32 a00, a11, a22, a01, a02, a12;
+    f32 b0, b1, b2;
+    f32 c;
+    f32 weight; // Area of the triangles summed, so the error can be normalized
+};
+
+struct EdgeCollapse
+{
+    u32 from;
+    u32 to;
+    f32 cost;
+};
+
+static void AddPlane(Quadric& q, const glm::vec3& n, f32 d, f32 weight)
+{
+    q.a00 += weight * n.x * n.x;
+    q.a11 += weight * n.y * n.y;
+    q.a22 += weight * n.z * n.z;
+    q.a01 += weight * n.x * n.y;
+    q.a02 += weight * n.x * n.z;
+    q.a12 += weight * n.y * n.z;
+    q.b0 += weight * n.x * d;
+    q.b1 += weight * n.y * d;
+    q.b2 += weight * n.z * d;
+    q.c += weight * d * d;
+    q.weight += weight;
+}
+
+static void AddQuadric(Quadric& q, const Quadric& other)
+{
+    q.a00 += other.a00; q.a11 += other.a11; q.a22 += other.a22;
+    q.a01 += other.a01; q.a02 += other.a02; q.a12 += other.a12;
+    q.b0 += other.b0; q.b1 += other.b1; q.b2 += other.b2;
+    q.c += other.c;
+    q.weight += other.weight;
+}
+
+// Weighted sum of the squared distances of p to the planes
+static f32 EvaluateQuadric(const Quadric& q, const glm::vec3& p)
+{
+    f32 rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z + 2.0f * q.b0;
+    f32 ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z + 2.0f * q.b1;
+    f32 rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z + 2.0f * q.b2;
+    return glm::max(rx * p.x + ry * p.y + rz * p.z + q.c, 0.0f);
+}
+
+// Squared distance of collapsing u onto v, averaged over the area of both
+static f32 GetCollapseCost(const Quadric& u, const Quadric& v, const glm::vec3& p)
+{
+    f32 weight = u.weight + v.weight;
+    return weight > 0.0f ? (EvaluateQuadric(u, p) + EvaluateQuadric(v, p)) / weight : 0.0f;
+}
+
+// Triangles around every vertex (by position), as offsets into a single array
+struct TriangleAdjacency
+{
+    std::vector<u32> offsets;
+    std::vector<u32> triangles;
+};
+
+static void BuildAdjacency(TriangleAdjacency& adjacency, const std::vector<u32>& indices, const std::vector<u32>& canonical)
+{
+    const u32 vertexCount = (u32)canonical.size();
+    adjacency.offsets.assign(vertexCount + 1, 0);
+    for (u32 index : indices)
+        adjacency.offsets[canonical[index] + 1]++;
+    for (u32 i = 0; i < vertexCount; ++i)
+        adjacency.offsets[i + 1] += adjacency.offsets[i];
+
+    adjacency.triangles.resize(indices.size());
+    std::vector<u32> cursor(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+    for (u32 i = 0; i < indices.size(); ++i)
+        adjacency.triangles[cursor[canonical[indices[i]]]++] = i / 3;
+}
+
+// The vertices around both ends of the edge, other than themselves, must be the two
+// opposite to it (the link condition), or the collapse would pinch the surface
+static bool IsLinkConditionMet(const TriangleAdjacency& adjacency, const std::vector<u32>& indices, const std::vector<u32>& canonical,
+                               u32 u, u32 v, std::vector<u32>& marks, u32& stamp)
+{
+    const u32 neighbour = ++stamp;
+    for (u32 i = adjacency.offsets[u]; i < adjacency.offsets[u + 1]; ++i)
+        for (u32 k = 0; k < 3; ++k)
+            marks[canonical[indices[adjacency.triangles[i] * 3 + k]]] = neighbour;
+
+    const u32 shared = ++stamp;
+    u32 sharedCount = 0;
+    for (u32 i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; ++i)
+    {
+        for (u32 k = 0; k < 3; ++k)
+        {
+            u32 w = canonical[indices[adjacency.triangles[i] * 3 + k]];
+            if (w != u && w != v && marks[w] == neighbour)
+            {
+                marks[w] = shared;
+                sharedCount++;
+            }
+        }
+    }
+
+    return sharedCount == 2;
+}
+
+// Moving u to v must not turn any of the triangles around u that remain upside down
+static bool HasTriangleFlips(const TriangleAdjacency& adjacency, const std::vector<u32>& indices, const std::vector<u32>& canonical,
+                             const std::vector<glm::vec3>& positions, u32 u, u32 v)
+{
+    for (u32 i = adjacency.offsets[u]; i < adjacency.offsets[u + 1]; ++i)
+    {
+        const u32* triangle = &indices[adjacency.triangles[i] * 3];
+        const u32 c0 = canonical[triangle[0]], c1 = canonical[triangle[1]], c2 = canonical[triangle[2]];
+        if (c0 == v || c1 == v || c2 == v)
+            continue; // Collapses with the edge
+
+        const glm::vec3 p0 = positions[c0], p1 = positions[c1], p2 = positions[c2];
+        const glm::vec3 q0 = c0 == u ? positions[v] : p0;
+        const glm::vec3 q1 = c1 == u ? positions[v] : p1;
+        const glm::vec3 q2 = c2 == u ? positions[v] : p2;
+        if (glm::dot(glm::cross(p1 - p0, p2 - p0), glm::cross(q1 - q0, q2 - q0)) <= 0.0f)
+            return true;
+    }
+
+    return false;
+}
+
+f32 SimplifyMesh(const u32* indices, u32 indexCount, const float* vertices, u32 vertexCount, u32 strideInFloats,
+                 u32 targetIndexCount, std::vector<u32>& result)
+{
+    result.assign(indices, indices + indexCount);
+    if (indexCount <= targetIndexCount || vertexCount == 0)
+        return 0.0f;
+
+    // Positions in the unit cube of the mesh, so the quadrics keep their precision as floats
+    glm::vec3 aabbMin = glm::vec3(FLT_MAX), aabbMax = glm::vec3(-FLT_MAX);
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        glm::vec3 p = glm::make_vec3(vertices + i * strideInFloats);
+        aabbMin = glm::min(aabbMin, p);
+        aabbMax = glm::max(aabbMax, p);
+    }
+    glm::vec3 size = aabbMax - aabbMin;
+    const f32 extent = glm::max(glm::max(size.x, size.y), glm::max(size.z, FLT_MIN));
+
+    std::vector<glm::vec3> positions(vertexCount);
+    for (u32 i = 0; i < vertexCount; ++i)
+        positions[i] = (glm::make_vec3(vertices + i * strideInFloats) - aabbMin) / extent;
+
+    // Vertices with the same position (split by other attributes) are a single one for the topology
+    std::vector<u32> order(vertexCount);
+    std::iota(order.begin(), order.end(), 0u);
+    auto lessPosition = [vertices, strideInFloats](u32 a, u32 b) {
+        const float* pa = vertices + a * strideInFloats;
+        const float* pb = vertices + b * strideInFloats;
+        return std::lexicographical_compare(pa, pa + 3, pb, pb + 3);
+    };
+    std::sort(order.begin(), order.end(), lessPosition);
+
+    std::vector<u32> canonical(vertexCount);
+    std::vector<u8> locked(vertexCount, 0);
+    for (u32 groupBegin = 0; groupBegin < vertexCount; )
+    {
+        u32 groupEnd = groupBegin + 1;
+        while (groupEnd < vertexCount && !lessPosition(order[groupBegin], order[groupEnd]))
+            groupEnd++;
+
+        const u32 first = order[groupBegin];
+        for (u32 i = groupBegin; i < groupEnd; ++i)
+            canonical[order[i]] = first;
+        locked[first] = groupEnd - groupBegin > 1; // Seam, collapsing it would tear the attributes apart
+
+        groupBegin = groupEnd;
+    }
+
+    // Edges not shared by exactly two triangles are borders (or worse), their vertices stay too
+    std::unordered_map<u64, u32> edgeTriangles;
+    edgeTriangles.reserve(indexCount);
+    for (u32 i = 0; i < indexCount; ++i)
+    {
+        u32 a = canonical[result[i]];
+        u32 b = canonical[result[i - i % 3 + (i + 1) % 3]];
+        edgeTriangles[((u64)glm::min(a, b) << 32) | glm::max(a, b)]++;
+    }
+    for (const auto& edge : edgeTriangles)
+    {
+        if (edge.second != 2)
+        {
+            locked[(u32)(edge.first >> 32)] = 1;
+            locked[(u32)edge.first] = 1;
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount, Quadric{});
+    for (u32 i = 0; i + 2 < indexCount; i += 3)
+    {
+        const u32 c0 = canonical[result[i]], c1 = canonical[result[i + 1]], c2 = canonical[result[i + 2]];
+        glm::vec3 normal = glm::cross(positions[c1] - positions[c0], positions[c2] - positions[c0]);
+        f32 doubleArea = glm::length(normal);
+        if (doubleArea == 0.0f)
+            continue;
+
+        normal /= doubleArea;
+        f32 d = -glm::dot(normal, positions[c0]);
+        AddPlane(quadrics[c0], normal, d, doubleArea * 0.5f);
+        AddPlane(quadrics[c1], normal, d, doubleArea * 0.5f);
+        AddPlane(quadrics[c2], normal, d, doubleArea * 0.5f);
+    }
+
+    TriangleAdjacency adjacency;
+    std::vector<EdgeCollapse> collapses;
+    std::vector<u32> collapseTarget(vertexCount);
+    std::vector<u8> touched(vertexCount);
+    std::vector<u32> marks(vertexCount, 0);
+    u32 stamp = 0;
+    f32 maxCost = 0.0f;
+
+    // Every pass collapses the cheapest edges whose surroundings no other collapse of the pass touched
+    while (result.size() > targetIndexCount)
+    {
+        BuildAdjacency(adjacency, result, canonical);
+
+        collapses.clear();
+        for (u32 i = 0; i < result.size(); ++i)
+        {
+            const u32 a = result[i];
+            const u32 b = result[i - i % 3 + (i + 1) % 3];
+            const u32 ca = canonical[a], cb = canonical[b];
+            if (ca == cb)
+                continue;
+            if (!locked[ca])
+                collapses.push_back(EdgeCollapse{ a, b, GetCollapseCost(quadrics[ca], quadrics[cb], positions[cb]) });
+            if (!locked[cb])
+                collapses.push_back(EdgeCollapse{ b, a, GetCollapseCost(quadrics[cb], quadrics[ca], positions[ca]) });
+        }
+        if (collapses.empty())
+            break;
+
+        std::sort(collapses.begin(), collapses.end(), [](const EdgeCollapse& a, const EdgeCollapse& b) { return a.cost < b.cost; });
+
+        // A collapse removes two triangles, don't go much further than the target
+        const u32 maxCollapses = glm::max((u32)(result.size() - targetIndexCount) / 6, 1u);
+        u32 collapseCount = 0;
+        std::iota(collapseTarget.begin(), collapseTarget.end(), 0u);
+        std::fill(touched.begin(), touched.end(), 0);
+
+        for (const EdgeCollapse& collapse : collapses)
+        {
+            if (collapseCount >= maxCollapses)
+                break;
+
+            // Unlocked vertices are not on seams, so the vertex is its own canonical one
+            const u32 u = collapse.from;
+            const u32 v = canonical[collapse.to];
+            if (touched[u] || touched[v])
+                continue;
+            if (!IsLinkConditionMet(adjacency, result, canonical, u, v, marks, stamp) ||
+                HasTriangleFlips(adjacency, result, canonical, positions, u, v))
+                continue;
+
+            collapseTarget[u] = collapse.to;
+            AddQuadric(quadrics[v], quadrics[u]);
+            maxCost = glm::max(maxCost, collapse.cost);
+            collapseCount++;
+
+            for (u32 i = adjacency.offsets[u]; i < adjacency.offsets[u + 1]; ++i)
+                for (u32 k = 0; k < 3; ++k)
+                    touched[canonical[result[adjacency.triangles[i] * 3 + k]]] = 1;
+        }
+
+        if (collapseCount == 0)
+            break;
+
+        // Apply the collapses, dropping the triangles that lost an edge
+        u32 writeIdx = 0;
+        for (u32 i = 0; i + 2 < result.size(); i += 3)
+        {
+            const u32 i0 = collapseTarget[result[i]], i1 = collapseTarget[result[i + 1]], i2 = collapseTarget[result[i + 2]];
+            const u32 c0 = canonical[i0], c1 = canonical[i1], c2 = canonical[i2];
+            if (c0 == c1 || c1 == c2 || c0 == c2)
+                continue;
+
+            result[writeIdx++] = i0;
+            result[writeIdx++] = i1;
+            result[writeIdx++] = i2;
+        }
+        result.resize(writeIdx);
+    }
+
+    return sqrtf(maxCost) * extent;
+}
@@ -0,0 +1,21 @@
+//
+// mesh_simplifier.h: Triangle reduction with the quadric error metric (Garland-Heckbert).
+// Edges are collapsed onto one of their existing vertices, so the simplified indices
+// still address the original vertex buffer and the LODs of a submesh can share it.
+//
+
+#pragma once
+
+#include "platform.h"
+
+/**
+ * Collapses the cheapest edges (by the sum of the area weighted plane quadrics of their
+ * vertices) until at most targetIndexCount indices are left or no edge can collapse.
+ * Vertices on attribute seams (several vertices with the same position) and on open or
+ * non-manifold edges stay in place, and collapses that would flip a triangle or make
+ * the mesh non-manifold are skipped. Positions are the first 3 floats of each vertex.
+ * Returns the error of the result, roughly the largest distance (in the units of the
+ * positions) of the removed geometry to the simplified surface.
+ */
+f32 SimplifyMesh(const u32* indices, u32 indexCount, const float* vertices, u32 vertexCount, u32 strideInFloats,
+                 u32 targetIndexCount, std::vector<u32>& result);
@@ -0,0 +1,216 @@
+#include "meshlets.h"
+#include "culling.h"
+
+#include <algorithm>
+#include <cfloat>
+
+// Triangles spread more than this (as the cosine to the average normal) can't be culled as a cone
+#define MESHLET_MIN_CONE_SPREAD 0.1f
+
+static glm::vec3 GetPosition(const float* vertices, u32 strideInFloats, u32 vertexIdx)
+{
+    return glm::make_vec3(vertices + vertexIdx * strideInFloats);
+}
+
+static Meshlet MakeMeshlet(const u32* indices, u32 indexCount, u32 firstIndex, u32 vertexCount, const float* vertices, u32 strideInFloats)
+{
+    Meshlet meshlet = {};
+    meshlet.firstIndex = firstIndex;
+    meshlet.indexCount = indexCount;
+    meshlet.vertexCount = vertexCount;
+    meshlet.coneCutoff = 1.0f;
+
+    // Sphere around the AABB center, tight enough for clusters this small
+    glm::vec3 aabbMin = glm::vec3(FLT_MAX), aabbMax = glm::vec3(-FLT_MAX);
+    for (u32 i = 0; i < indexCount; ++i)
+    {
+        glm::vec3 p = GetPosition(vertices, strideInFloats, indices[i]);
+        aabbMin = glm::min(aabbMin, p);
+        aabbMax = glm::max(aabbMax, p);
+    }
+    meshlet.center = (aabbMin + aabbMax) * 0.5f;
+    for (u32 i = 0; i < indexCount; ++i)
+        meshlet.radius = glm::max(meshlet.radius, glm::length(GetPosition(vertices, strideInFloats, indices[i]) - meshlet.center));
+
+    // Cone axis: the average of the triangle normals
+    glm::vec3 normals[MESHLET_MAX_TRIANGLES];
+    glm::vec3 corners[MESHLET_MAX_TRIANGLES];
+    u32 triangleCount = 0;
+    glm::vec3 axis = glm::vec3(0.0f);
+    for (u32 i = 0; i + 2 < indexCount; i += 3)
+    {
+        glm::vec3 p0 = GetPosition(vertices, strideInFloats, indices[i]);
+        glm::vec3 p1 = GetPosition(vertices, strideInFloats, indices[i + 1]);
+        glm::vec3 p2 = GetPosition(vertices, strideInFloats, indices[i + 2]);
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        f32 length = glm::length(normal);
+        if (length == 0.0f)
+            continue;
+
+        normals[triangleCount] = normal / length;
+        corners[triangleCount] = p0;
+        axis += normals[triangleCount];
+        triangleCount++;
+    }
+
+    f32 axisLength = glm::length(axis);
+    if (triangleCount == 0 || axisLength < 1e-4f)
+        return meshlet;
+    axis /= axisLength;
+
+    f32 minDot = 1.0f;
+    for (u32 i = 0; i < triangleCount; ++i)
+        minDot = glm::min(minDot, glm::dot(normals[i], axis));
+    if (minDot <= MESHLET_MIN_CONE_SPREAD)
+        return meshlet;
+
+    // Apex: the point along the axis (behind the center) in the negative half space of every triangle
+    f32 maxT = 0.0f;
+    for (u32 i = 0; i < triangleCount; ++i)
+        maxT = glm::max(maxT, glm::dot(meshlet.center - corners[i], normals[i]) / glm::dot(axis, normals[i]));
+
+    meshlet.coneApex = meshlet.center - axis * maxT;
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+    return meshlet;
+}
+
+void BuildMeshlets(const u32* indices, u32 indexCount, u32 firstIndex, const float* vertices, u32 strideInFloats, std::vector<Meshlet>& meshlets)
+{
+    u32 vertexCount = 0;
+    for (u32 i = 0; i < indexCount; ++i)
+        vertexCount = glm::max(vertexCount, indices[i] + 1);
+
+    // Cluster each vertex was last counted in, to count the unique vertices of the current one
+    std::vector<u32> vertexMeshlet(vertexCount, UINT32_MAX);
+    u32 meshletIdx = 0;
+    u32 meshletBegin = 0;
+    u32 meshletVertexCount = 0;
+
+    for (u32 i = 0; i + 2 < indexCount; i += 3)
+    {
+        const u32 i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+        u32 newVertices = (vertexMeshlet[i0] != meshletIdx) +
+                          (vertexMeshlet[i1] != meshletIdx && i1 != i0) +
+                          (vertexMeshlet[i2] != meshletIdx && i2 != i0 && i2 != i1);
+
+        if (meshletVertexCount + newVertices > MESHLET_MAX_VERTICES || (i - meshletBegin) / 3 >= MESHLET_MAX_TRIANGLES)
+        {
+            meshlets.push_back(MakeMeshlet(indices + meshletBegin, i - meshletBegin, firstIndex + meshletBegin, meshletVertexCount, vertices, strideInFloats));
+            meshletIdx++;
+            meshletBegin = i;
+            meshletVertexCount = 0;
+            newVertices = 1 + (i1 != i0) + (i2 != i0 && i2 != i1);
+        }
+
+        vertexMeshlet[i0] = vertexMeshlet[i1] = vertexMeshlet[i2] = meshletIdx;
+        meshletVertexCount += newVertices;
+    }
+
+    const u32 lastIndexCount = indexCount / 3 * 3 - meshletBegin;
+    if (lastIndexCount > 0)
+        meshlets.push_back(MakeMeshlet(indices + meshletBegin, lastIndexCount, firstIndex + meshletBegin, meshletVertexCount, vertices, strideInFloats));
+}
+
+bool IsClosedMesh(const u32* indices, u32 indexCount, const float* vertices, u32 vertexCount, u32 strideInFloats)
+{
+    // Vertices split by their normals or texture coordinates are the same point for the edges
+    std::vector<u32> sorted(vertexCount);
+    for (u32 i = 0; i < vertexCount; ++i)
+        sorted[i] = i;
+    auto lessPosition = [&](u32 a, u32 b)
+    {
+        const float* pa = vertices + a * strideInFloats;
+        const float* pb = vertices + b * strideInFloats;
+        return pa[0] != pb[0] ? pa[0] < pb[0] : pa[1] != pb[1] ? pa[1] < pb[1] : pa[2] < pb[2];
+    };
+    std::sort(sorted.begin(), sorted.end(), lessPosition);
+
+    std::vector<u32> weld(vertexCount);
+    for (u32 i = 0; i < vertexCount; ++i)
+        weld[sorted[i]] = (i > 0 && !lessPosition(sorted[i - 1], sorted[i])) ? weld[sorted[i - 1]] : sorted[i];
+
+    // Directed edges, a closed surface with consistent winding has each of them once and its opposite once
+    std::vector<u64> edges;
+    edges.reserve(indexCount);
+    for (u32 i = 0; i + 2 < indexCount; i += 3)
+    {
+        const u32 v[3] = { weld[indices[i]], weld[indices[i + 1]], weld[indices[i + 2]] };
+        if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0])
+            continue;
+        for (u32 e = 0; e < 3; ++e)
+            edges.push_back((u64)v[e] << 32 | v[(e + 1) % 3]);
+    }
+    if (edges.empty())
+        return false;
+
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        if (i > 0 && edges[i] == edges[i - 1])
+            return false;
+        const u64 opposite = edges[i] << 32 | edges[i] >> 32;
+        if (!std::binary_search(edges.begin(), edges.end(), opposite))
+            return false;
+    }
+    return true;
+}
+
+u32 CullMeshlets(const Meshlet* meshlets, u32 meshletCount, const glm::mat4& world, const Frustum& frustum,
+                 const glm::vec3& cameraPosition, const BoundingVolume* closedBounds, MeshletCullingScratch& scratch, ClusterCullingStats& stats)
+{
+    scratch.x.resize(meshletCount);
+    scratch.y.resize(meshletCount);
+    scratch.z.resize(meshletCount);
+    scratch.radius.resize(meshletCount);
+    scratch.visible.resize(meshletCount);
+    for (u32 i = 0; i < meshletCount; ++i)
+    {
+        scratch.x[i] = meshlets[i].center.x;
+        scratch.y[i] = meshlets[i].center.y;
+        scratch.z[i] = meshlets[i].center.z;
+        scratch.radius[i] = meshlets[i].radius;
+    }
+
+    // The frustum planes in object space, divided by the largest scale so the distances
+    // to them are a bound of the world space ones for the object space radii
+    glm::vec3 scales = glm::vec3(glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2])));
+    f32 maxScale = glm::max(scales.x, glm::max(scales.y, scales.z));
+    f32 minScale = glm::min(scales.x, glm::min(scales.y, scales.z));
+    glm::mat4 worldTransposed = glm::transpose(world);
+
+    Frustum objectFrustum;
+    for (u32 p = 0; p < 6; ++p)
+        objectFrustum.planes[p] = worldTransposed * frustum.planes[p] / maxScale;
+
+    CullSpheres(objectFrustum, scratch.x.data(), scratch.y.data(), scratch.z.data(), scratch.radius.data(), meshletCount, scratch.visible.data());
+
+    // Angles are only kept by rotations and uniform scales. From inside a closed surface its
+    // back faces are the ones seen, so the cones are not tested anywhere in its box.
+    const glm::vec3 objectCamera = glm::vec3(glm::inverse(world) * glm::vec4(cameraPosition, 1.0f));
+    const bool coneTest = closedBounds != nullptr && maxScale <= minScale * 1.01f && glm::determinant(glm::mat3(world)) > 0.0f &&
+                          (glm::any(glm::lessThan(objectCamera, closedBounds->aabbMin)) || glm::any(glm::greaterThan(objectCamera, closedBounds->aabbMax)));
+
+    u32 visibleCount = 0;
+    for (u32 i = 0; i < meshletCount; ++i)
+    {
+        if (!scratch.visible[i])
+        {
+            stats.frustumCulled++;
+            continue;
+        }
+
+        const Meshlet& meshlet = meshlets[i];
+        if (coneTest && glm::dot(glm::normalize(meshlet.coneApex - objectCamera), meshlet.coneAxis) >= meshlet.coneCutoff)
+        {
+            scratch.visible[i] = 0;
+            stats.backfaceCulled++;
+            continue;
+        }
+
+        visibleCount++;
+    }
+
+    stats.clustersTested += meshletCount;
+    return visibleCount;
+}
@@ -0,0 +1,69 @@
+//
+// meshlets.h: Clusters of triangles of the imported meshes, with the bounds to cull them
+// one by one. Every level of detail of a submesh is split in runs of consecutive
+// triangles (already in vertex cache order, so they are compact), each with a bounding
+// sphere and a cone bounding its normals, and the clusters of the instances drawn are
+// culled against the frustum and by facing before building the indirect draws.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct Frustum;
+struct BoundingVolume;
+
+// Limits of a cluster, as recommended for mesh shaders
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet
+{
+    glm::vec3 center;     // Bounding sphere, object space
+    f32       radius;
+    glm::vec3 coneApex;   // Backfacing seen from any point p where dot(normalize(coneApex - p), coneAxis) >= coneCutoff
+    f32       coneCutoff;
+    glm::vec3 coneAxis;   // Zero, and cutoff 1, when the triangles face too many ways to ever cull them
+    u32       firstIndex; // Relative to the first index of the submesh
+    u32       indexCount;
+    u32       vertexCount;
+};
+
+struct ClusterCullingStats
+{
+    u32 clustersTested;
+    u32 frustumCulled;
+    u32 backfaceCulled;
+};
+
+// Reused by CullMeshlets between calls, one per thread
+struct MeshletCullingScratch
+{
+    std::vector<f32> x, y, z, radius;
+    std::vector<u8>  visible;
+};
+
+/**
+ * Appends the clusters of a triangle list to 'meshlets'. The triangles keep their order,
+ * a cluster ends when the next one would go over the limits. firstIndex is the offset
+ * of the list in the indices of the submesh. Positions are the first 3 floats of each vertex.
+ */
+void BuildMeshlets(const u32* indices, u32 indexCount, u32 firstIndex, const float* vertices, u32 strideInFloats, std::vector<Meshlet>& meshlets);
+
+/**
+ * Whether a triangle list is a closed surface with consistent winding: once the vertices
+ * are welded by position, every edge is shared by exactly two triangles that run it in
+ * opposite directions. Seen from outside, the back faces of such a surface are always
+ * behind front ones, so dropping them can't change the image.
+ */
+bool IsClosedMesh(const u32* indices, u32 indexCount, const float* vertices, u32 vertexCount, u32 strideInFloats);
+
+/**
+ * Culls the clusters of an instance. 'frustum' and 'cameraPosition' are in world space.
+ * The cone test is only done for closed submeshes (IsClosedMesh), given by their object
+ * space bounds in 'closedBounds' (null otherwise), and skipped with the camera inside
+ * them and for instances with a non-uniform scale or mirrored. Leaves scratch.visible[i]
+ * at 1 for the visible clusters and returns their count.
+ */
+u32 CullMeshlets(const Meshlet* meshlets, u32 meshletCount, const glm::mat4& world, const Frustum& frustum,
+                 const glm::vec3& cameraPosition, const BoundingVolume* closedBounds, MeshletCullingScratch& scratch, ClusterCullingStats& stats);
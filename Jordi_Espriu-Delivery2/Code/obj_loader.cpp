@@ -0,0 +1,726 @@
+#include "obj_loader.h"
+#include "engine.h"
+#include "file_cache.h"
+#include "job_system.h"
+#include "mesh_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+#include <unordered_map>
+
+// Indices of a face corner, -1 when not given
+struct ObjCorner
+{
+    i32 position;
+    i32 texCoord;
+    i32 normal;
+};
+
+struct ObjMaterialSwitch
+{
+    u32         firstTriangle; // Of the chunk
+    std::string material;
+};
+
+struct ObjChunk
+{
+    const char*                    begin;
+    const char*                    end;
+
+    std::vector<f32>               positions; // 3 per position
+    std::vector<f32>               texCoords; // 2 per texture coordinate
+    std::vector<f32>               normals;   // 3 per normal
+    std::vector<ObjCorner>         corners;   // 3 per triangle
+
+    // Components (corner * 3 + component) given as negative indices, relative to the end of
+    // the chunk's own elements until the counts of the previous chunks are known
+    std::vector<u32>               relativeComponents;
+    std::vector<ObjMaterialSwitch> materialSwitches;
+    std::vector<std::string>       materialLibraries;
+
+    u32                            positionBase;
+    u32                            texCoordBase;
+    u32                            normalBase;
+    u32                            ignoredElements; // Lines and points
+    bool                           missingNormals;
+    bool                           invalidIndices;
+};
+
+struct ObjMaterial
+{
+    Material    material;
+    std::string texturePaths[MATERIAL_TEXTURE_SLOTS];
+};
+
+// Consecutive triangles of a chunk with the same material
+struct ObjTriangleRange
+{
+    u32 chunkIdx;
+    u32 firstTriangle;
+    u32 triangleCount;
+};
+
+struct ObjParseData
+{
+    ObjChunk*                                   chunks;
+    const std::vector<f32>*                     positions;
+    const std::vector<f32>*                     texCoords;
+    const std::vector<f32>*                     normals;
+    const std::vector<glm::vec3>*               positionNormals; // Generated ones, for the corners without normal
+    const std::vector<std::vector<ObjTriangleRange>>* meshRanges;
+    ImportedMesh*                                    meshes;
+};
+
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static const char* SkipSpaces(const char* p, const char* end)
+{
+    while (p < end && IsSpace(*p))
+        ++p;
+    return p;
+}
+
+// Lines are scanned 16 bytes at a time
+static const char* FindLineEnd(const char* p, const char* end)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (p + 16 <= end)
+    {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+        if (mask != 0)
+        {
+            while ((mask & 1) == 0)
+            {
+                mask >>= 1;
+                ++p;
+            }
+            return p;
+        }
+        p += 16;
+    }
+
+    while (p < end && *p != '\n')
+        ++p;
+    return p;
+}
+
+static char ToLower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// The line starts with the keyword followed by a space (or ends there)
+static bool MatchKeyword(const char* p, const char* end, const char* keyword, const char*& rest, bool ignoreCase = false)
+{
+    while (*keyword)
+    {
+        if (p == end || (ignoreCase ? ToLower(*p) != ToLower(*keyword) : *p != *keyword))
+            return false;
+        ++p;
+        ++keyword;
+    }
+    if (p != end && !IsSpace(*p))
+        return false;
+
+    rest = SkipSpaces(p, end);
+    return true;
+}
+
+static std::string GetRestOfLine(const char* p, const char* end)
+{
+    p = SkipSpaces(p, end);
+    while (end > p && IsSpace(end[-1]))
+        --end;
+    return std::string(p, end);
+}
+
+// Texture statements can have options before the file name, which is the last token
+static std::string GetLastToken(const char* p, const char* end)
+{
+    while (end > p && IsSpace(end[-1]))
+        --end;
+    const char* begin = end;
+    while (begin > p && !IsSpace(begin[-1]))
+        --begin;
+    return std::string(begin, end);
+}
+
+static const char* ParseInt(const char* p, const char* end, i32& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+
+    i32 result = 0;
+    while (p < end && IsDigit(*p))
+    {
+        result = result * 10 + (*p - '0');
+        ++p;
+    }
+
+    value = negative ? -result : result;
+    return p;
+}
+
+// Decimal float parsing without strtof (locale lookups, and it needs a terminated string)
+static const char* ParseFloat(const char* p, const char* end, f32& value)
+{
+    static const f64 powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+
+    // 19 significant digits fit in the mantissa, the rest only move the exponent
+    u64 mantissa = 0;
+    i32 exponent = 0;
+    u32 digits = 0;
+    while (p < end && IsDigit(*p))
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+        }
+        ++p;
+    }
+    if (p < end && *p == '.')
+    {
+        ++p;
+        while (p < end && IsDigit(*p))
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+            ++p;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        i32 exponentValue;
+        p = ParseInt(p + 1, end, exponentValue);
+        exponent += exponentValue;
+    }
+
+    f64 result = (f64)mantissa;
+    if (exponent < 0)
+        result = -exponent < (i32)ARRAY_COUNT(powersOf10) ? result / powersOf10[-exponent] : result * pow(10.0, exponent);
+    else if (exponent > 0)
+        result = exponent < (i32)ARRAY_COUNT(powersOf10) ? result * powersOf10[exponent] : result * pow(10.0, exponent);
+
+    value = (f32)(negative ? -result : result);
+    return p;
+}
+
+// Missing values are left at 0
+static void ParseFloats(const char* p, const char* end, f32* values, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        p = SkipSpaces(p, end);
+        values[i] = 0.0f;
+        if (p < end)
+            p = ParseFloat(p, end, values[i]);
+    }
+}
+
+// OBJ indices start at 1, and negative ones count back from the last element so far
+static i32 ResolveIndex(i32 index, u32 count, bool& relative)
+{
+    relative = index < 0;
+    if (index > 0)
+        return index - 1;
+    if (index < 0)
+        return (i32)count + index;
+    return -1;
+}
+
+static void ParseFace(ObjChunk& chunk, const char* p, const char* end, std::vector<ObjCorner>& polygon, std::vector<u8>& polygonRelative)
+{
+    const u32 counts[3] = { (u32)chunk.positions.size() / 3, (u32)chunk.texCoords.size() / 2, (u32)chunk.normals.size() / 3 };
+
+    polygon.clear();
+    polygonRelative.clear();
+    while (p < end)
+    {
+        // v, v/vt, v//vn or v/vt/vn
+        i32 components[3] = { -1, -1, -1 };
+        u8 relativeMask = 0;
+        for (u32 c = 0; c < 3 && p < end && !IsSpace(*p); ++c)
+        {
+            if (*p != '/')
+            {
+                i32 index;
+                const char* next = ParseInt(p, end, index);
+                if (next == p)
+                    break;
+                p = next;
+
+                bool relative;
+                components[c] = ResolveIndex(index, counts[c], relative);
+                relativeMask |= relative << c;
+            }
+            if (p < end && *p == '/')
+                ++p;
+        }
+
+        // Whatever else is in the token
+        while (p < end && !IsSpace(*p))
+            ++p;
+        p = SkipSpaces(p, end);
+
+        polygon.push_back(ObjCorner{ components[0], components[1], components[2] });
+        polygonRelative.push_back(relativeMask);
+        chunk.missingNormals |= components[2] == -1;
+    }
+
+    // As a fan, OBJ polygons are convex
+    for (u32 i = 1; i + 1 < polygon.size(); ++i)
+    {
+        const u32 triangle[3] = { 0, i, i + 1 };
+        for (u32 corner : triangle)
+        {
+            for (u32 c = 0; c < 3; ++c)
+                if (polygonRelative[corner] & (1 << c))
+                    chunk.relativeComponents.push_back((u32)chunk.corners.size() * 3 + c);
+            chunk.corners.push_back(polygon[corner]);
+        }
+    }
+}
+
+static void ParseObjLine(ObjChunk& chunk, const char* p, const char* end, std::vector<ObjCorner>& polygon, std::vector<u8>& polygonRelative)
+{
+    const char* rest;
+    f32 values[3];
+    switch (*p)
+    {
+        case 'v':
+            if (MatchKeyword(p, end, "v", rest))
+            {
+                ParseFloats(rest, end, values, 3);
+                chunk.positions.insert(chunk.positions.end(), values, values + 3);
+            }
+            else if (MatchKeyword(p, end, "vt", rest))
+            {
+                ParseFloats(rest, end, values, 2);
+                chunk.texCoords.insert(chunk.texCoords.end(), values, values + 2);
+            }
+            else if (MatchKeyword(p, end, "vn", rest))
+            {
+                ParseFloats(rest, end, values, 3);
+                chunk.normals.insert(chunk.normals.end(), values, values + 3);
+            }
+            break;
+        case 'f':
+            if (MatchKeyword(p, end, "f", rest))
+                ParseFace(chunk, rest, end, polygon, polygonRelative);
+            break;
+        case 'u':
+            if (MatchKeyword(p, end, "usemtl", rest))
+                chunk.materialSwitches.push_back(ObjMaterialSwitch{ (u32)chunk.corners.size() / 3, GetRestOfLine(rest, end) });
+            break;
+        case 'm':
+            if (MatchKeyword(p, end, "mtllib", rest))
+                chunk.materialLibraries.push_back(GetRestOfLine(rest, end));
+            break;
+        case 'l':
+        case 'p':
+            if (MatchKeyword(p, end, "l", rest) || MatchKeyword(p, end, "p", rest))
+                chunk.ignoredElements++;
+            break;
+        default:
+            // Comments, objects, groups and smoothing groups
+            break;
+    }
+}
+
+static void ParseObjChunks(u32 begin, u32 end, void* data)
+{
+    ObjParseData* parseData = (ObjParseData*)data;
+    std::vector<ObjCorner> polygon;
+    std::vector<u8> polygonRelative;
+
+    for (u32 i = begin; i < end; ++i)
+    {
+        ObjChunk& chunk = parseData->chunks[i];
+        const char* p = chunk.begin;
+        while (p < chunk.end)
+        {
+            const char* lineEnd = FindLineEnd(p, chunk.end);
+            const char* lineBegin = SkipSpaces(p, lineEnd);
+            if (lineBegin < lineEnd)
+                ParseObjLine(chunk, lineBegin, lineEnd, polygon, polygonRelative);
+            p = lineEnd + 1;
+        }
+    }
+}
+
+// Makes the relative indices absolute, and drops the out of range texture coordinates and normals
+static void ResolveObjChunks(u32 begin, u32 end, void* data)
+{
+    ObjParseData* parseData = (ObjParseData*)data;
+    const i32 counts[3] = { (i32)parseData->positions->size() / 3, (i32)parseData->texCoords->size() / 2, (i32)parseData->normals->size() / 3 };
+
+    for (u32 i = begin; i < end; ++i)
+    {
+        ObjChunk& chunk = parseData->chunks[i];
+        const i32 bases[3] = { (i32)chunk.positionBase, (i32)chunk.texCoordBase, (i32)chunk.normalBase };
+        i32* components = (i32*)chunk.corners.data();
+        for (u32 component : chunk.relativeComponents)
+            components[component] += bases[component % 3];
+
+        for (ObjCorner& corner : chunk.corners)
+        {
+            if (corner.position < 0 || corner.position >= counts[0])
+                chunk.invalidIndices = true;
+            if (corner.texCoord < 0 || corner.texCoord >= counts[1])
+                corner.texCoord = -1;
+            if (corner.normal < 0 || corner.normal >= counts[2])
+            {
+                corner.normal = -1;
+                chunk.missingNormals = true;
+            }
+        }
+    }
+}
+
+static u32 HashCorner(const ObjCorner& corner)
+{
+    u32 hash = (u32)corner.position * 0x9e3779b1u;
+    hash ^= (u32)corner.texCoord * 0x85ebca77u;
+    hash ^= (u32)corner.normal * 0xc2b2ae3du;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+static bool operator==(const ObjCorner& a, const ObjCorner& b)
+{
+    return a.position == b.position && a.texCoord == b.texCoord && a.normal == b.normal;
+}
+
+// Vertices of the corners of a material, deduplicated, with their tangent space
+static void AssembleImportedMeshes(u32 begin, u32 end, void* data)
+{
+    ObjParseData* parseData = (ObjParseData*)data;
+    const f32* positions = parseData->positions->data();
+    const f32* texCoords = parseData->texCoords->data();
+    const f32* normals = parseData->normals->data();
+
+    for (u32 meshIdx = begin; meshIdx < end; ++meshIdx)
+    {
+        const std::vector<ObjTriangleRange>& ranges = (*parseData->meshRanges)[meshIdx];
+        ImportedMesh& mesh = parseData->meshes[meshIdx];
+
+        u32 cornerCount = 0;
+        mesh.hasTexCoords = false;
+        for (const ObjTriangleRange& range : ranges)
+        {
+            const ObjChunk& chunk = parseData->chunks[range.chunkIdx];
+            cornerCount += range.triangleCount * 3;
+            for (u32 i = range.firstTriangle * 3; i < (range.firstTriangle + range.triangleCount) * 3; ++i)
+                mesh.hasTexCoords |= chunk.corners[i].texCoord >= 0;
+        }
+
+        // Open addressing, at most half full
+        u32 tableSize = 16;
+        while (tableSize < cornerCount * 2)
+            tableSize *= 2;
+        std::vector<u32> table(tableSize, UINT32_MAX);
+        std::vector<ObjCorner> vertexCorners;
+
+        mesh.indices.reserve(cornerCount);
+        for (const ObjTriangleRange& range : ranges)
+        {
+            const ObjChunk& chunk = parseData->chunks[range.chunkIdx];
+            for (u32 i = range.firstTriangle * 3; i < (range.firstTriangle + range.triangleCount) * 3; ++i)
+            {
+                const ObjCorner& corner = chunk.corners[i];
+                u32 slot = HashCorner(corner) & (tableSize - 1);
+                while (table[slot] != UINT32_MAX && !(vertexCorners[table[slot]] == corner))
+                    slot = (slot + 1) & (tableSize - 1);
+
+                if (table[slot] == UINT32_MAX)
+                {
+                    table[slot] = (u32)vertexCorners.size();
+                    vertexCorners.push_back(corner);
+                }
+                mesh.indices.push_back(table[slot]);
+            }
+        }
+
+        const u32 vertexCount = (u32)vertexCorners.size();
+        const u32 strideInFloats = mesh.hasTexCoords ? MODEL_VERTEX_FLOATS : MODEL_VERTEX_TEXCOORD_OFFSET;
+        mesh.vertices.resize(vertexCount * strideInFloats);
+        for (u32 i = 0; i < vertexCount; ++i)
+        {
+            const ObjCorner& corner = vertexCorners[i];
+            float* vertex = &mesh.vertices[i * strideInFloats];
+
+            glm::vec3 normal = corner.normal >= 0 ? glm::make_vec3(normals + corner.normal * 3) : (*parseData->positionNormals)[corner.position];
+            f32 normalLength = glm::length(normal);
+            normal = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f, 1.0f, 0.0f);
+
+            memcpy(vertex, positions + corner.position * 3, 3 * sizeof(float));
+            memcpy(vertex + MODEL_VERTEX_NORMAL_OFFSET, &normal, 3 * sizeof(float));
+            if (mesh.hasTexCoords)
+            {
+                vertex[MODEL_VERTEX_TEXCOORD_OFFSET] = corner.texCoord >= 0 ? texCoords[corner.texCoord * 2] : 0.0f;
+                vertex[MODEL_VERTEX_TEXCOORD_OFFSET + 1] = corner.texCoord >= 0 ? texCoords[corner.texCoord * 2 + 1] : 0.0f;
+            }
+        }
+
+        if (mesh.hasTexCoords)
+            GenerateTangentSpace(mesh.vertices, mesh.indices, &mesh.kernelTimings);
+    }
+}
+
+static void ParseMaterialLibrary(const std::string& filepath, const std::string& directory, std::vector<ObjMaterial>& materials)
+{
+    const MappedFile* file = AcquireFile(filepath.c_str());
+    if (!file)
+    {
+        ELOG("Could not open material library %s", filepath.c_str());
+        return;
+    }
+
+    // Same order as the material texture slots, matched ignoring case (exporters write map_Bump, map_KD...)
+    const char* textureKeywords[MATERIAL_TEXTURE_SLOTS][2] = {
+        { "map_Kd", NULL },
+        { "map_Ke", NULL },
+        { "map_Ks", NULL },
+        { "norm", "map_Kn" },
+        { "map_bump", "bump" }
+    };
+
+    const char* p = (const char*)file->data;
+    const char* fileEnd = p + file->size;
+    ObjMaterial* material = NULL;
+    while (p < fileEnd)
+    {
+        const char* lineEnd = FindLineEnd(p, fileEnd);
+        const char* line = SkipSpaces(p, lineEnd);
+        p = lineEnd + 1;
+
+        const char* rest;
+        if (MatchKeyword(line, lineEnd, "newmtl", rest))
+        {
+            materials.push_back(ObjMaterial{});
+            material = &materials.back();
+            material->material.name = GetRestOfLine(rest, lineEnd);
+            material->material.albedo = vec3(0.6f);
+            continue;
+        }
+        if (!material)
+            continue;
+
+        f32 values[3];
+        if (MatchKeyword(line, lineEnd, "Kd", rest))
+        {
+            ParseFloats(rest, lineEnd, values, 3);
+            material->material.albedo = glm::make_vec3(values);
+        }
+        else if (MatchKeyword(line, lineEnd, "Ke", rest))
+        {
+            ParseFloats(rest, lineEnd, values, 3);
+            material->material.emissive = glm::make_vec3(values);
+        }
+        else if (MatchKeyword(line, lineEnd, "Ns", rest))
+        {
+            ParseFloats(rest, lineEnd, values, 1);
+            material->material.smoothness = values[0] / 256.0f;
+        }
+        else
+        {
+            for (u32 slot = 0; slot < MATERIAL_TEXTURE_SLOTS; ++slot)
+                for (const char* keyword : textureKeywords[slot])
+                    if (keyword && MatchKeyword(line, lineEnd, keyword, rest, true))
+                        material->texturePaths[slot] = directory + "/" + GetLastToken(rest, lineEnd);
+        }
+    }
+
+    ReleaseFile(file);
+}
+
+bool ImportObj(const char* filename, ModelData& data, std::vector<ImportedMesh>& meshes)
+{
+    const MappedFile* file = AcquireFile(filename);
+    if (!file)
+    {
+        ELOG("Could not open file %s", filename);
+        return false;
+    }
+
+    std::string directory = filename;
+    size_t separator = directory.find_last_of("/\\");
+    directory = separator == std::string::npos ? "." : directory.substr(0, separator);
+
+    // Chunks of whole lines
+    const char* fileBegin = (const char*)file->data;
+    const char* fileEnd = fileBegin + file->size;
+    std::vector<ObjChunk> chunks;
+    for (const char* p = fileBegin; p < fileEnd;)
+    {
+        ObjChunk chunk = {};
+        chunk.begin = p;
+        chunk.end = (u64)(fileEnd - p) > OBJ_CHUNK_SIZE ? FindLineEnd(p + OBJ_CHUNK_SIZE, fileEnd) : fileEnd;
+        p = chunk.end < fileEnd ? chunk.end + 1 : fileEnd;
+        chunks.push_back(std::move(chunk));
+    }
+
+    ObjParseData parseData = {};
+    parseData.chunks = chunks.data();
+    ParallelFor((u32)chunks.size(), 1, ParseObjChunks, &parseData);
+    ReleaseFile(file);
+
+    // Elements of all the chunks, each one indexed from the ones before it
+    std::vector<f32> positions, texCoords, normals;
+    u32 ignoredElements = 0;
+    bool missingNormals = false;
+    for (ObjChunk& chunk : chunks)
+    {
+        chunk.positionBase = (u32)positions.size() / 3;
+        chunk.texCoordBase = (u32)texCoords.size() / 2;
+        chunk.normalBase = (u32)normals.size() / 3;
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+        std::vector<f32>().swap(chunk.positions);
+        std::vector<f32>().swap(chunk.texCoords);
+        std::vector<f32>().swap(chunk.normals);
+        ignoredElements += chunk.ignoredElements;
+    }
+
+    parseData.positions = &positions;
+    parseData.texCoords = &texCoords;
+    parseData.normals = &normals;
+    ParallelFor((u32)chunks.size(), 1, ResolveObjChunks, &parseData);
+
+    for (const ObjChunk& chunk : chunks)
+    {
+        if (chunk.invalidIndices)
+        {
+            ELOG("Error loading mesh %s: faces with invalid position indices", filename);
+            return false;
+        }
+        missingNormals |= chunk.missingNormals;
+    }
+    if (ignoredElements > 0)
+        ILOG("Skipped %u lines and points of %s", ignoredElements, filename);
+
+    // Materials of the libraries, in the order they are defined
+    std::vector<ObjMaterial> objMaterials;
+    std::vector<std::string> libraries;
+    for (const ObjChunk& chunk : chunks)
+        for (const std::string& library : chunk.materialLibraries)
+            if (std::find(libraries.begin(), libraries.end(), library) == libraries.end())
+            {
+                libraries.push_back(library);
+                ParseMaterialLibrary(directory + "/" + library, directory, objMaterials);
+            }
+
+    std::unordered_map<std::string, u32> materialsByName;
+    for (u32 i = 0; i < objMaterials.size(); ++i)
+        materialsByName.emplace(objMaterials[i].material.name, i);
+
+    // A mesh per material used, faces without a known material use a default one (UINT32_MAX)
+    std::unordered_map<u32, u32> meshByMaterial;
+    std::vector<u32> meshMaterials;
+    std::vector<std::vector<ObjTriangleRange>> meshRanges;
+    u32 currentMaterial = UINT32_MAX;
+    for (u32 chunkIdx = 0; chunkIdx < chunks.size(); ++chunkIdx)
+    {
+        const ObjChunk& chunk = chunks[chunkIdx];
+        const u32 triangleCount = (u32)chunk.corners.size() / 3;
+        for (u32 i = 0; i <= chunk.materialSwitches.size(); ++i)
+        {
+            const u32 firstTriangle = i == 0 ? 0 : chunk.materialSwitches[i - 1].firstTriangle;
+            const u32 endTriangle = i < chunk.materialSwitches.size() ? chunk.materialSwitches[i].firstTriangle : triangleCount;
+            if (i > 0)
+            {
+                auto it = materialsByName.find(chunk.materialSwitches[i - 1].material);
+                currentMaterial = it != materialsByName.end() ? it->second : UINT32_MAX;
+            }
+            if (endTriangle == firstTriangle)
+                continue;
+
+            auto it = meshByMaterial.find(currentMaterial);
+            if (it == meshByMaterial.end())
+            {
+                it = meshByMaterial.emplace(currentMaterial, (u32)meshMaterials.size()).first;
+                meshMaterials.push_back(currentMaterial);
+                meshRanges.push_back({});
+            }
+            meshRanges[it->second].push_back(ObjTriangleRange{ chunkIdx, firstTriangle, endTriangle - firstTriangle });
+        }
+    }
+
+    // Smooth normals of the positions, from the area weighted normals of the faces around them
+    std::vector<glm::vec3> positionNormals;
+    if (missingNormals)
+    {
+        positionNormals.resize(positions.size() / 3, glm::vec3(0.0f));
+        for (const ObjChunk& chunk : chunks)
+            for (u32 i = 0; i + 2 < chunk.corners.size(); i += 3)
+            {
+                const i32 p0 = chunk.corners[i].position, p1 = chunk.corners[i + 1].position, p2 = chunk.corners[i + 2].position;
+                glm::vec3 v0 = glm::make_vec3(&positions[p0 * 3]);
+                glm::vec3 normal = glm::cross(glm::make_vec3(&positions[p1 * 3]) - v0, glm::make_vec3(&positions[p2 * 3]) - v0);
+                positionNormals[p0] += normal;
+                positionNormals[p1] += normal;
+                positionNormals[p2] += normal;
+            }
+    }
+
+    meshes.resize(meshMaterials.size());
+    parseData.positionNormals = &positionNormals;
+    parseData.meshRanges = &meshRanges;
+    parseData.meshes = meshes.data();
+    ParallelFor((u32)meshes.size(), 1, AssembleImportedMeshes, &parseData);
+
+    // The materials used, in the order of the meshes
+    data.materials.resize(meshMaterials.size());
+    data.texturePaths.resize(meshMaterials.size() * MATERIAL_TEXTURE_SLOTS);
+    data.materialIdx.resize(meshMaterials.size());
+    for (u32 i = 0; i < meshMaterials.size(); ++i)
+    {
+        if (meshMaterials[i] != UINT32_MAX)
+        {
+            const ObjMaterial& objMaterial = objMaterials[meshMaterials[i]];
+            data.materials[i] = objMaterial.material;
+            for (u32 slot = 0; slot < MATERIAL_TEXTURE_SLOTS; ++slot)
+                data.texturePaths[i * MATERIAL_TEXTURE_SLOTS + slot] = objMaterial.texturePaths[slot];
+        }
+        else
+        {
+            data.materials[i] = Material{};
+            data.materials[i].name = "DefaultMaterial";
+            data.materials[i].albedo = vec3(0.6f);
+        }
+        data.materialIdx[i] = i;
+    }
+
+    return true;
+}
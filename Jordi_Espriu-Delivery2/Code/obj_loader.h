@@ -0,0 +1,25 @@
+//
+// obj_loader.h: Native loader of Wavefront OBJ files and their MTL libraries, used instead
+// of Assimp for .obj. The file is memory mapped and cut in chunks at line breaks that are
+// parsed in parallel, then the triangles are split by material and their corners (position,
+// texture coordinate and normal indices) deduplicated into vertices with a hash table.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct ModelData;
+struct ImportedMesh;
+
+// Bytes of the file parsed by each job, the chunks end at the first line break after that
+#define OBJ_CHUNK_SIZE KB(256)
+
+/**
+ * Parses the file and its material libraries. Fills the materials and texture paths of
+ * the model data, and a mesh and a material index per material used, in the order they are
+ * first used. Missing normals are generated (smooth, from the faces around each position)
+ * and polygons triangulated as fans. Lines and points are skipped. Returns false if the
+ * file can't be read or has faces with invalid indices.
+ */
+bool ImportObj(const char* filename, ModelData& data, std::vector<ImportedMesh>& meshes);
@@ -0,0 +1,441 @@
+#include "pack_file.h"
+#include "job_system.h"
+
+#include <atomic>
+#include <string>
+
+// LZ4 block format: sequences of a token (literal length, match length - 4), the literals
+// and a match (16 bit offset back in the output), the last one with literals only
+#define LZ4_HASH_BITS           12
+#define LZ4_MIN_MATCH           4
+#define LZ4_LAST_LITERALS       5  // The last bytes of a block are always literals
+#define LZ4_MATCH_SAFE_DISTANCE 12 // And the last match starts at least this far from the end
+#define LZ4_MAX_OFFSET          65535
+
+static Pack GlobalPack;
+
+std::string NormalizePackPath(const char* path)
+{
+    while (path[0] == '.' && (path[1] == '/' || path[1] == '\\'))
+        path += 2;
+
+    std::string normalized = path;
+    for (char& c : normalized)
+    {
+        if (c == '\\')
+            c = '/';
+    }
+    return normalized;
+}
+
+u64 HashPackPath(const char* path)
+{
+    std::string normalized = NormalizePackPath(path);
+    return HashBytes(normalized.data(), normalized.size());
+}
+
+bool OpenPack(const char* filename, Pack& pack)
+{
+    pack = Pack{};
+    pack.file = MapFile(filename);
+    if (!pack.file.data)
+        return false;
+
+    const u8* data = pack.file.data;
+    u64 fileSize = pack.file.size;
+
+    PackHeader header;
+    bool valid = fileSize >= sizeof(header);
+    if (valid)
+    {
+        memcpy(&header, data, sizeof(header));
+        valid = header.magic == PACK_MAGIC && header.version == PACK_VERSION && header.tocOffset % 8 == 0;
+    }
+
+    u64 tocSize = 0;
+    if (valid)
+    {
+        tocSize = (u64)header.entryCount * sizeof(PackEntry) + (u64)header.dependencyCount * sizeof(u32) + header.stringTableSize;
+        valid = header.tocOffset <= fileSize && tocSize <= fileSize - header.tocOffset && header.stringTableSize > 0 &&
+                HashBytes(data + header.tocOffset, tocSize) == header.tocHash;
+    }
+    if (valid)
+    {
+        pack.entries = (const PackEntry*)(data + header.tocOffset);
+        pack.dependencies = (const u32*)(pack.entries + header.entryCount);
+        pack.strings = (const char*)(pack.dependencies + header.dependencyCount);
+        pack.entryCount = header.entryCount;
+        valid = pack.strings[header.stringTableSize - 1] == '\0';
+    }
+
+    for (u32 i = 0; valid && i < pack.entryCount; ++i)
+    {
+        const PackEntry& entry = pack.entries[i];
+        valid = entry.pathOffset < header.stringTableSize &&
+                entry.blobOffset <= header.tocOffset && entry.blobSize <= header.tocOffset - entry.blobOffset &&
+                entry.firstDependency <= header.dependencyCount && entry.dependencyCount <= header.dependencyCount - entry.firstDependency;
+        for (u32 j = 0; valid && j < entry.dependencyCount; ++j)
+            valid = pack.dependencies[entry.firstDependency + j] < pack.entryCount;
+
+        if (valid)
+            pack.byPath[entry.pathHash] = i;
+    }
+
+    if (!valid)
+    {
+        ELOG("Pack file %s is corrupt or of another version", filename);
+        ClosePack(pack);
+        return false;
+    }
+
+    return true;
+}
+
+void ClosePack(Pack& pack)
+{
+    if (pack.file.data)
+        UnmapFile(pack.file);
+    pack = Pack{};
+}
+
+const PackEntry* FindPackEntry(const Pack& pack, const char* path)
+{
+    auto it = pack.byPath.find(HashPackPath(path));
+    if (it == pack.byPath.end())
+        return NULL;
+
+    return &pack.entries[it->second];
+}
+
+const char* GetPackEntryPath(const Pack& pack, const PackEntry& entry)
+{
+    return pack.strings + entry.pathOffset;
+}
+
+struct PackChunksData
+{
+    const u8*         chunks;
+    const u32*        chunkSizes;
+    const u64*        chunkOffsets; // From 'chunks'
+    u8*               destination;
+    u64               size;
+    std::atomic<bool> failed;
+};
+
+static void DecompressPackChunks(u32 begin, u32 end, void* data)
+{
+    PackChunksData& chunks = *(PackChunksData*)data;
+    for (u32 i = begin; i < end; ++i)
+    {
+        u64 offset = (u64)i * PACK_CHUNK_SIZE;
+        u32 size = (u32)glm::min<u64>(PACK_CHUNK_SIZE, chunks.size - offset);
+        u32 storedSize = chunks.chunkSizes[i] & ~PACK_CHUNK_STORED;
+        const u8* source = chunks.chunks + chunks.chunkOffsets[i];
+
+        bool ok;
+        if (chunks.chunkSizes[i] & PACK_CHUNK_STORED)
+        {
+            ok = storedSize == size;
+            if (ok)
+                memcpy(chunks.destination + offset, source, size);
+        }
+        else
+        {
+            ok = DecompressPackChunk(source, storedSize, chunks.destination + offset, size);
+        }
+
+        if (!ok)
+            chunks.failed = true;
+    }
+}
+
+bool ReadPackEntry(const Pack& pack, const PackEntry& entry, u8* destination)
+{
+    if (!entry.hasData)
+        return false;
+
+    const u8* blob = pack.file.data + entry.blobOffset;
+    if (entry.compression == PACK_COMPRESSION_NONE)
+    {
+        if (entry.blobSize != entry.size)
+            return false;
+
+        memcpy(destination, blob, entry.size);
+        return true;
+    }
+    if (entry.compression != PACK_COMPRESSION_LZ4)
+        return false;
+
+    u64 chunkCount = (entry.size + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE;
+    if (chunkCount * sizeof(u32) > entry.blobSize)
+        return false;
+
+    std::vector<u32> chunkSizes(chunkCount);
+    std::vector<u64> chunkOffsets(chunkCount);
+    memcpy(chunkSizes.data(), blob, chunkCount * sizeof(u32));
+    u64 offset = 0;
+    for (u64 i = 0; i < chunkCount; ++i)
+    {
+        chunkOffsets[i] = offset;
+        offset += chunkSizes[i] & ~PACK_CHUNK_STORED;
+    }
+    if (offset > entry.blobSize - chunkCount * sizeof(u32))
+        return false;
+
+    PackChunksData chunks;
+    chunks.chunks = blob + chunkCount * sizeof(u32);
+    chunks.chunkSizes = chunkSizes.data();
+    chunks.chunkOffsets = chunkOffsets.data();
+    chunks.destination = destination;
+    chunks.size = entry.size;
+    chunks.failed = false;
+    ParallelFor((u32)chunkCount, 1, DecompressPackChunks, &chunks);
+    return !chunks.failed;
+}
+
+bool MountPack(const char* filename)
+{
+    UnmountPack();
+    if (!OpenPack(filename, GlobalPack))
+        return false;
+
+    ILOG("Mounted pack %s (%u entries)", filename, GlobalPack.entryCount);
+    return true;
+}
+
+void UnmountPack()
+{
+    ClosePack(GlobalPack);
+}
+
+bool FindPackedFileHash(const char* filepath, u64& hash, u64& size)
+{
+    if (!GlobalPack.file.data)
+        return false;
+
+    const PackEntry* entry = FindPackEntry(GlobalPack, filepath);
+    if (!entry)
+        return false;
+
+    hash = entry->contentHash;
+    size = entry->size;
+    return true;
+}
+
+MappedFile MapAssetFile(const char* filepath)
+{
+    MappedFile file = MapFile(filepath);
+    if (file.data || !GlobalPack.file.data)
+        return file;
+
+    const PackEntry* entry = FindPackEntry(GlobalPack, filepath);
+    if (!entry || !entry->hasData || entry->size == 0)
+        return file;
+
+    // Stored files are used right from the pack mapping, the rest decompressed once
+    if (entry->compression == PACK_COMPRESSION_NONE && entry->blobSize == entry->size)
+    {
+        file.data = GlobalPack.file.data + entry->blobOffset;
+        file.size = entry->size;
+        return file;
+    }
+
+    u8* data = (u8*)malloc(entry->size);
+    if (!ReadPackEntry(GlobalPack, *entry, data))
+    {
+        ELOG("Couldn't read %s from the pack", filepath);
+        free(data);
+        return file;
+    }
+
+    file.data = data;
+    file.size = entry->size;
+    return file;
+}
+
+void UnmapAssetFile(MappedFile& file)
+{
+    if (file.fileHandle)
+    {
+        UnmapFile(file);
+        return;
+    }
+
+    const u8* packBegin = GlobalPack.file.data;
+    const u8* packEnd = packBegin + GlobalPack.file.size;
+    if (file.data && (file.data < packBegin || file.data >= packEnd))
+        free((void*)file.data);
+    file = MappedFile{};
+}
+
+// LZ4
+
+static u32 ReadU32(const u8* bytes)
+{
+    u32 value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static u32 HashLz4Sequence(u32 sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// The extra bytes of a length that doesn't fit in its 4 bits of the token
+static u8* WriteLz4Length(u8* out, u32 length)
+{
+    for (; length >= 255; length -= 255)
+        *out++ = 255;
+    *out++ = (u8)length;
+    return out;
+}
+
+static u8* WriteLz4Sequence(u8* out, const u8* outEnd, const u8* literals, u32 literalCount, u32 offset, u32 matchLength)
+{
+    // Worst case: token, literal length, literals, offset and match length
+    u64 maxSize = 1 + literalCount / 255 + 1 + literalCount + 2 + matchLength / 255 + 1;
+    if (maxSize > (u64)(outEnd - out))
+        return NULL;
+
+    u8* token = out++;
+    *token = (u8)(glm::min(literalCount, 15u) << 4);
+    if (literalCount >= 15)
+        out = WriteLz4Length(out, literalCount - 15);
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+
+    if (matchLength == 0)
+        return out;
+
+    out[0] = (u8)(offset & 0xff);
+    out[1] = (u8)(offset >> 8);
+    out += 2;
+    u32 matchCode = matchLength - LZ4_MIN_MATCH;
+    *token |= (u8)glm::min(matchCode, 15u);
+    if (matchCode >= 15)
+        out = WriteLz4Length(out, matchCode - 15);
+    return out;
+}
+
+u32 CompressPackChunk(const u8* source, u32 sourceSize, u8* destination, u32 capacity)
+{
+    ASSERT(sourceSize <= PACK_CHUNK_SIZE, "Pack chunks are compressed one at a time");
+
+    u8* out = destination;
+    const u8* outEnd = destination + capacity;
+    const u8* end = source + sourceSize;
+    const u8* anchor = source;
+
+    // Positions + 1 of the last sequence with each hash, 0 if none
+    static thread_local u32 table[1 << LZ4_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    if (sourceSize > LZ4_MATCH_SAFE_DISTANCE)
+    {
+        const u8* matchLimit = end - LZ4_LAST_LITERALS;
+        const u8* searchLimit = end - LZ4_MATCH_SAFE_DISTANCE;
+        const u8* in = source;
+        u32 misses = 0;
+        while (in <= searchLimit)
+        {
+            u32 sequence = ReadU32(in);
+            u32& slot = table[HashLz4Sequence(sequence)];
+            const u8* match = slot ? source + slot - 1 : NULL;
+            slot = (u32)(in - source) + 1;
+
+            if (!match || in - match > LZ4_MAX_OFFSET || ReadU32(match) != sequence)
+            {
+                // Skips faster over data that doesn't compress
+                in += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            u32 length = LZ4_MIN_MATCH;
+            while (in + length < matchLimit && in[length] == match[length])
+                length++;
+
+            out = WriteLz4Sequence(out, outEnd, anchor, (u32)(in - anchor), (u32)(in - match), length);
+            if (!out)
+                return 0;
+
+            in += length;
+            anchor = in;
+        }
+    }
+
+    out = WriteLz4Sequence(out, outEnd, anchor, (u32)(end - anchor), 0, 0);
+    if (!out)
+        return 0;
+
+    return (u32)(out - destination);
+}
+
+static bool ReadLz4Length(const u8*& in, const u8* inEnd, u64& length)
+{
+    u8 byte;
+    do
+    {
+        if (in >= inEnd)
+            return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool DecompressPackChunk(const u8* source, u32 sourceSize, u8* destination, u32 destinationSize)
+{
+    const u8* in = source;
+    const u8* inEnd = source + sourceSize;
+    u8* out = destination;
+    u8* outEnd = destination + destinationSize;
+
+    for (;;)
+    {
+        if (in >= inEnd)
+            return false;
+        u32 token = *in++;
+
+        u64 literalCount = token >> 4;
+        if (literalCount == 15 && !ReadLz4Length(in, inEnd, literalCount))
+            return false;
+        if (literalCount > (u64)(inEnd - in) || literalCount > (u64)(outEnd - out))
+            return false;
+        memcpy(out, in, literalCount);
+        in += literalCount;
+        out += literalCount;
+
+        // The last sequence has no match
+        if (in == inEnd)
+            return out == outEnd;
+
+        if (inEnd - in < 2)
+            return false;
+        u32 offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (u64)(out - destination))
+            return false;
+
+        u64 matchLength = token & 15;
+        if (matchLength == 15 && !ReadLz4Length(in, inEnd, matchLength))
+            return false;
+        matchLength += LZ4_MIN_MATCH;
+        if (matchLength > (u64)(outEnd - out))
+            return false;
+
+        // Matches closer than their length repeat the bytes they are writing
+        const u8* match = out - offset;
+        if (offset >= matchLength)
+        {
+            memcpy(out, match, matchLength);
+            out += matchLength;
+        }
+        else
+        {
+            for (u64 i = 0; i < matchLength; ++i)
+                *out++ = *match++;
+        }
+    }
+}
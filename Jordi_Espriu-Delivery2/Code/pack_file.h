@@ -0,0 +1,132 @@
+//
+// pack_file.h: Single file with the cooked assets (the model and texture caches, shaders,
+// images), written offline by the cooker (cooker.cpp) and memory mapped at startup. Each
+// file is a blob aligned to 4K, split in chunks compressed with LZ4 (block format), or
+// stored as is when it doesn't compress. The table of contents at the end lists the
+// files, the hashes of the sources they were cooked from, and what each one depends on.
+//
+// Loose files take precedence: a path is only looked up in the pack when there is no such
+// file on disk, so edited sources and shaders still override what was cooked.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <unordered_map>
+
+#define PACK_MAGIC      0x4B434150 // 'PACK'
+#define PACK_VERSION    1
+#define PACK_ALIGNMENT  KB(4)
+#define PACK_CHUNK_SIZE KB(256)
+
+// Mounted at startup when it is next to the executable
+#define DEFAULT_PACK_FILENAME "assets.pack"
+
+// Chunk size entries with this bit are stored uncompressed
+#define PACK_CHUNK_STORED 0x80000000u
+
+enum PackCompression
+{
+    PACK_COMPRESSION_NONE, // The blob is the file, read in place from the mapping
+    PACK_COMPRESSION_LZ4,  // A u32 per chunk with its size, then the chunks
+};
+
+struct PackHeader
+{
+    u32 magic;
+    u32 version;
+    u32 entryCount;
+    u32 dependencyCount;
+    u32 stringTableSize;
+    u32 padding;
+    u64 tocOffset; // Entries, dependencies and strings, after the last blob
+    u64 tocHash;
+};
+
+struct PackEntry
+{
+    u64 pathHash;         // HashPackPath of the path
+    u64 contentHash;      // HashBytes of the file, as HashFile
+    u64 size;             // Of the file
+    u64 blobOffset;       // Aligned to PACK_ALIGNMENT
+    u64 blobSize;         // 0 for the sources that are only recorded (see hasData)
+    u32 pathOffset;       // In the string table
+    u32 compression;      // PackCompression
+    u32 cookFlags;        // What the cooker built it with (texture usage, model import flags)
+    u32 cookVersion;      // And the version of the cache format, both to know when to rebuild it
+    u32 hasData;          // Sources the cached files were cooked from only have their hash
+    u32 firstDependency;  // In the dependencies, entries whose content this one was cooked from
+    u32 dependencyCount;
+    u32 padding;
+};
+
+struct Pack
+{
+    MappedFile                   file;
+    const PackEntry*             entries;
+    const u32*                   dependencies;
+    const char*                  strings;
+    u32                          entryCount;
+    std::unordered_map<u64, u32> byPath; // Path hash -> entry
+};
+
+/**
+ * Path as the entries are stored and looked up: separators as '/' and no leading "./".
+ */
+std::string NormalizePackPath(const char* path);
+
+u64 HashPackPath(const char* path);
+
+/**
+ * Maps a pack and indexes its entries. Returns false if it is missing or corrupt.
+ */
+bool OpenPack(const char* filename, Pack& pack);
+
+void ClosePack(Pack& pack);
+
+const PackEntry* FindPackEntry(const Pack& pack, const char* path);
+
+const char* GetPackEntryPath(const Pack& pack, const PackEntry& entry);
+
+/**
+ * Decompresses the file of an entry (entry.size bytes) into 'destination', the chunks split
+ * among the job system workers. Returns false if the entry has no data or it is corrupt.
+ */
+bool ReadPackEntry(const Pack& pack, const PackEntry& entry, u8* destination);
+
+/**
+ * Mounts the pack the asset files are looked up in when they aren't on disk. Returns
+ * false (and keeps nothing mounted) if it can't be opened.
+ */
+bool MountPack(const char* filename);
+
+/**
+ * Called once every file taken from it has been released.
+ */
+void UnmountPack();
+
+/**
+ * Hash and size of a file recorded in the mounted pack, so the caches of sources that
+ * aren't shipped can still be validated, without reading packed files to hash them.
+ */
+bool FindPackedFileHash(const char* filepath, u64& hash, u64& size);
+
+/**
+ * MapFile for the asset files: the loose file if there is one, otherwise the file in
+ * the mounted pack, in place for the stored ones and decompressed into memory of its
+ * own for the compressed ones. Must be released with UnmapAssetFile.
+ */
+MappedFile MapAssetFile(const char* filepath);
+
+void UnmapAssetFile(MappedFile& file);
+
+/**
+ * Compresses a chunk (at most PACK_CHUNK_SIZE bytes) in the LZ4 block format. Returns the
+ * compressed size, or 0 if it doesn't fit in 'capacity' bytes.
+ */
+u32 CompressPackChunk(const u8* source, u32 sourceSize, u8* destination, u32 capacity);
+
+/**
+ * Decompresses a chunk, which must decompress to exactly 'destinationSize' bytes.
+ */
+bool DecompressPackChunk(const u8* source, u32 sourceSize, u8* destination, u32 destinationSize);
@@ -12,10 +12,16 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
 #include "engine.h"
+#include "gl_extensions.h"
+#include "job_system.h"
+#include "file_cache.h"
+#include "pack_file.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
@@ -31,6 +37,9 @@
 u8* GlobalFrameArenaMemory = NULL;
 u32 GlobalFrameArenaHead = 0;
 
+// The cooker (cooker.cpp) is built from the engine sources with its own main
+#ifndef ENGINE_COOKER
+
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
 	fprintf(stderr, "glfw failed with error %d: %s\n", errorCode, errorMessage);
@@ -161,6 +170,8 @@ int main()
         return -1;
     }
 
+    LoadGLExtensions((GLADloadproc) glfwGetProcAddress);
+
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
 
@@ -200,6 +211,15 @@ int main()
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    InitJobSystem();
+
+    // Cooked assets, used for the files that aren't on disk
+    MountPack(DEFAULT_PACK_FILENAME);
+
+    // Assets load asynchronously, so the first frame shouldn't wait for them
+    f64 initStartTime = glfwGetTime();
+    bool firstFrame = true;
+
     Init(&app);
 
     while (app.isRunning)
@@ -254,15 +274,32 @@ int main()
         // Present image on screen
         glfwSwapBuffers(window);
 
+        if (firstFrame)
+        {
+            ILOG("First frame presented %.1f ms after Init started", (glfwGetTime() - initStartTime) * 1000.0);
+            firstFrame = false;
+        }
+
         // Frame time
         f64 currentFrameTime = glfwGetTime();
         app.deltaTime = (f32)(currentFrameTime - lastFrameTime);
         lastFrameTime = currentFrameTime;
 
+        // Jobs queued for the main thread (GL work) and per frame worker stats
+        RunMainThreadJobs();
+        UpdateJobSystemStats();
+
+        // Mapped asset files not used for a frame
+        TrimFileCache();
+
         // Reset frame allocator
         GlobalFrameArenaHead = 0;
     }
 
+    ShutdownJobSystem();
+    ShutdownFileCache();
+    UnmountPack();
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -275,6 +312,8 @@ int main()
     return 0;
 }
 
+#endif // ENGINE_COOKER
+
 u32 Strlen(const char* string)
 {
     u32 len = 0;
@@ -370,7 +409,20 @@ String ReadTextFile(const char* filepath)
     }
     else
     {
-        ELOG("fopen() failed reading file %s", filepath);
+        // Not on disk, it can still be in the pack
+        MappedFile packed = MapAssetFile(filepath);
+        if (packed.data)
+        {
+            fileText.len = (u32)packed.size;
+            fileText.str = (char*)PushSize(fileText.len + 1);
+            memcpy(fileText.str, packed.data, fileText.len);
+            fileText.str[fileText.len] = '\0';
+            UnmapAssetFile(packed);
+        }
+        else
+        {
+            ELOG("fopen() failed reading file %s", filepath);
+        }
     }
 
     return fileText;
@@ -400,6 +452,128 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+MappedFile MapFile(const char* filepath)
+{
+    MappedFile file = {};
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mappingHandle)
+    {
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    void* view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    file.data = (const u8*)view;
+    file.size = (u64)fileSize.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mappingHandle = mappingHandle;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return file;
+
+    struct stat attrib;
+    if (fstat(fd, &attrib) != 0 || attrib.st_size == 0)
+    {
+        close(fd);
+        return file;
+    }
+
+    void* view = mmap(NULL, attrib.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        close(fd);
+        return file;
+    }
+
+    file.data = (const u8*)view;
+    file.size = (u64)attrib.st_size;
+    file.fileHandle = (void*)(intptr_t)fd;
+#endif
+
+    return file;
+}
+
+void UnmapFile(MappedFile& file)
+{
+    if (!file.data)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mappingHandle);
+    CloseHandle((HANDLE)file.fileHandle);
+#else
+    munmap((void*)file.data, file.size);
+    close((int)(intptr_t)file.fileHandle);
+#endif
+
+    file = {};
+}
+
+u64 HashBytes(const void* bytes, u64 byteCount, u64 seed)
+{
+    // FNV-1a style mixing, but consuming 8 bytes per step
+    const u64 prime = 0x100000001b3ull;
+    u64 hash = 0xcbf29ce484222325ull ^ seed;
+
+    const u8* ptr = (const u8*)bytes;
+    while (byteCount >= 8)
+    {
+        u64 word;
+        memcpy(&word, ptr, sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+        ptr += 8;
+        byteCount -= 8;
+    }
+    while (byteCount--)
+    {
+        hash = (hash ^ *ptr++) * prime;
+    }
+
+    hash ^= hash >> 32;
+    return hash;
+}
+
+bool HashFile(const char* filepath, u64& hash, u64& size)
+{
+    // Files that are only in the pack have the hash they were cooked with, so the caches of
+    // the sources that aren't shipped still validate
+    if (GetFileLastWriteTimestamp(filepath) == 0 && FindPackedFileHash(filepath, hash, size))
+        return true;
+
+    // Through the file cache, the file is usually read right after being hashed
+    const MappedFile* file = AcquireFile(filepath);
+    if (!file)
+        return false;
+
+    hash = HashBytes(file->data, file->size);
+    size = file->size;
+    ReleaseFile(file);
+    return true;
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
@@ -82,6 +82,34 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+struct MappedFile
+{
+    const u8* data;
+    u64       size;
+    void*     fileHandle;
+    void*     mappingHandle;
+};
+
+/**
+ * Maps a whole file into memory in read-only mode. The view stays valid until
+ * UnmapFile is called. If the file cannot be mapped, data is NULL.
+ */
+MappedFile MapFile(const char *filepath);
+
+void UnmapFile(MappedFile& file);
+
+/**
+ * Computes a fast 64-bit (non-cryptographic) hash of a block of memory.
+ * Useful to detect whether cached data is still in sync with its source.
+ */
+u64 HashBytes(const void* bytes, u64 byteCount, u64 seed = 0);
+
+/**
+ * Hashes the contents of a whole file (with HashBytes). Returns false if the file
+ * cannot be mapped.
+ */
+bool HashFile(const char* filepath, u64& hash, u64& size);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,441 @@
+#include "render_queue.h"
+#include "engine.h"
+#include "buffer_management.h"
+#include "job_system.h"
+
+#include <chrono>
+#include <algorithm>
+
+#define SORT_KEY_FIELD(value, bits) ((u64)(value) & ((1ull << (bits)) - 1ull))
+
+u64 MakeSortKey(RenderPass pass, u32 programIdx, u32 materialIdx, GLuint vao, f32 depth)
+{
+    const u32 maxDepth = (1u << SORT_KEY_DEPTH_BITS) - 1u;
+    u32 quantizedDepth = (u32)(glm::clamp(depth, 0.0f, 1.0f) * maxDepth);
+
+    u64 key = SORT_KEY_FIELD(pass, SORT_KEY_PASS_BITS);
+    key = (key << SORT_KEY_PROGRAM_BITS)  | SORT_KEY_FIELD(programIdx, SORT_KEY_PROGRAM_BITS);
+    key = (key << SORT_KEY_MATERIAL_BITS) | SORT_KEY_FIELD(materialIdx, SORT_KEY_MATERIAL_BITS);
+    key = (key << SORT_KEY_VAO_BITS)      | SORT_KEY_FIELD(vao, SORT_KEY_VAO_BITS);
+    key = (key << SORT_KEY_DEPTH_BITS)    | SORT_KEY_FIELD(quantizedDepth, SORT_KEY_DEPTH_BITS);
+    return key;
+}
+
+void BuildRenderQueue(App* app, RenderQueue& queue, RenderPass pass, u32 programIdx)
+{
+    Program& program = app->programs[programIdx];
+    const Camera& camera = app->camera;
+    Buffer& instanceBuffer = app->instanceBuffer;
+
+    queue.packets.clear();
+    queue.instanceIndices.clear();
+
+    // Visible entities grouped by model, so each group can be drawn instanced
+    queue.visibleEntities.clear();
+    for (u32 entityIdx = 0; entityIdx < app->entities.size(); ++entityIdx)
+        if (app->entities[entityIdx].visible && queue.visibleEntities.size() < MAX_INSTANCES)
+            queue.visibleEntities.push_back(entityIdx);
+
+    std::stable_sort(queue.visibleEntities.begin(), queue.visibleEntities.end(), [app](u32 a, u32 b) {
+        return app->entities[a].modelId < app->entities[b].modelId;
+    });
+
+    // World matrices, indexed by the position of the entity in visibleEntities
+    AlignHead(instanceBuffer, app->storageBlockAlignmentOffset);
+    u32 matricesOffset = instanceBuffer.head;
+    for (u32 entityIdx : queue.visibleEntities)
+        PushData(instanceBuffer, glm::value_ptr(app->entityWorldMatrices[entityIdx]), sizeof(glm::mat4));
+    u32 matricesSize = glm::max(instanceBuffer.head - matricesOffset, (u32)sizeof(glm::mat4));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, INSTANCE_MATRICES_BINDING, instanceBuffer.handle, matricesOffset, matricesSize);
+
+    // And how to decode the vertices of their meshes, same indexing
+    AlignHead(instanceBuffer, app->storageBlockAlignmentOffset);
+    u32 decodingsOffset = instanceBuffer.head;
+    for (u32 entityIdx : queue.visibleEntities)
+    {
+        const Mesh& mesh = app->meshes[app->models[app->entities[entityIdx].modelId].meshIdx];
+        PushData(instanceBuffer, &mesh.vertexDecoding, sizeof(VertexDecoding));
+    }
+    u32 decodingsSize = glm::max(instanceBuffer.head - decodingsOffset, (u32)sizeof(VertexDecoding));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, INSTANCE_DECODING_BINDING, instanceBuffer.handle, decodingsOffset, decodingsSize);
+    AlignHead(instanceBuffer, sizeof(u32));
+
+    for (u32 groupBegin = 0; groupBegin < queue.visibleEntities.size(); )
+    {
+        const u32 modelIdx = app->entities[queue.visibleEntities[groupBegin]].modelId;
+        u32 groupEnd = groupBegin + 1;
+        while (groupEnd < queue.visibleEntities.size() && app->entities[queue.visibleEntities[groupEnd]].modelId == modelIdx)
+            groupEnd++;
+
+        Model& model = app->models[modelIdx];
+        Mesh& mesh = app->meshes[model.meshIdx];
+
+        for (u32 submeshIdx = 0; submeshIdx < mesh.submeshes.size(); ++submeshIdx)
+        {
+            const Submesh& submesh = mesh.submeshes[submeshIdx];
+            if (!IsUploadComplete(app->uploadQueue, submesh.geometry.uploadTicket))
+                continue;
+
+            // Instances of the group where this submesh survived culling, a packet per level of detail they are drawn at
+            Vao vao = FindVAO(app, mesh, submeshIdx, program);
+            for (u32 lod = 0; lod < submesh.lodCount; ++lod)
+            {
+                // And the closest instance of the level for the key. Models with many submeshes can
+                // have more indices than visible entities, the instances that don't fit are dropped.
+                const u32 firstInstanceIndex = (u32)queue.instanceIndices.size();
+                const u32 capacity = (instanceBuffer.regionEnd - instanceBuffer.head) / sizeof(u32);
+                f32 minDepth = FLT_MAX;
+                for (u32 i = groupBegin; i < groupEnd && queue.instanceIndices.size() - firstInstanceIndex < capacity; ++i)
+                {
+                    const u32 entityIdx = queue.visibleEntities[i];
+                    const Entity& entity = app->entities[entityIdx];
+                    if (!app->submeshVisibility[entity.submeshVisibilityOffset + submeshIdx] || glm::min((u32)entity.lod, submesh.lodCount - 1) != lod)
+                        continue;
+
+                    glm::vec3 center = glm::vec3(app->entityWorldMatrices[entityIdx] * glm::vec4(submesh.bounds.sphereCenter, 1.0f));
+                    minDepth = glm::min(minDepth, glm::dot(center - camera.cameraPos, camera.cameraFront));
+                    queue.instanceIndices.push_back(i);
+                }
+
+                if (queue.instanceIndices.size() == firstInstanceIndex)
+                    continue;
+
+                DrawPacket packet;
+                packet.vao = vao.handle;
+                packet.baseVertex = vao.baseVertex;
+                packet.modelIdx = modelIdx;
+                packet.submeshIdx = submeshIdx;
+                packet.lod = lod;
+                packet.baseInstance = instanceBuffer.head / sizeof(u32);
+                packet.instanceCount = (u32)queue.instanceIndices.size() - firstInstanceIndex;
+                packet.firstInstanceIndex = firstInstanceIndex;
+                packet.key = MakeSortKey(pass, programIdx, model.materialIdx[submeshIdx], packet.vao, minDepth / camera.farPlane);
+                queue.packets.push_back(packet);
+
+                PushData(instanceBuffer, queue.instanceIndices.data() + firstInstanceIndex, packet.instanceCount * sizeof(u32));
+            }
+        }
+
+        groupBegin = groupEnd;
+    }
+}
+
+void SortRenderQueue(RenderQueue& queue)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    const u32 count = (u32)queue.packets.size();
+    queue.sortScratch.resize(count);
+
+    DrawPacket* src = queue.packets.data();
+    DrawPacket* dst = queue.sortScratch.data();
+
+    for (u32 shift = 0; shift < 64; shift += 8)
+    {
+        u32 histogram[256] = {};
+        for (u32 i = 0; i < count; ++i)
+            histogram[(src[i].key >> shift) & 0xff]++;
+
+        // All keys share this byte, the order would not change
+        if (count == 0 || histogram[(src[0].key >> shift) & 0xff] == count)
+            continue;
+
+        u32 offset = 0;
+        for (u32 bucket = 0; bucket < 256; ++bucket)
+        {
+            u32 bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (u32 i = 0; i < count; ++i)
+            dst[histogram[(src[i].key >> shift) & 0xff]++] = src[i];
+
+        std::swap(src, dst);
+    }
+
+    if (src != queue.packets.data())
+        queue.packets.swap(queue.sortScratch);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    queue.stats.sortTimeMs = std::chrono::duration<f32, std::milli>(end - start).count();
+}
+
+void SubmitRenderQueue(App* app, RenderQueue& queue)
+{
+    RenderQueueStats& stats = queue.stats;
+    stats.drawCalls = 0;
+    stats.draws = 0;
+    stats.instances = 0;
+    stats.programChanges = 0;
+    stats.vaoChanges = 0;
+    stats.textureChanges = 0;
+    stats.triangles = 0;
+    stats.clusters = {};
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glActiveTexture(GL_TEXTURE0);
+
+    GLuint currentProgram = 0;
+    GLuint currentVao = 0;
+    GLuint currentTexture = 0;
+
+    for (const DrawPacket& packet : queue.packets)
+    {
+        const Model& model = app->models[packet.modelIdx];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        const Submesh& submesh = mesh.submeshes[packet.submeshIdx];
+        const Material& material = app->materials[model.materialIdx[packet.submeshIdx]];
+
+        u32 programIdx = (u32)SORT_KEY_FIELD(packet.key >> (SORT_KEY_DEPTH_BITS + SORT_KEY_VAO_BITS + SORT_KEY_MATERIAL_BITS), SORT_KEY_PROGRAM_BITS);
+        GLuint program = app->programs[programIdx].handle;
+        if (program != currentProgram)
+        {
+            glUseProgram(program);
+            currentProgram = program;
+            stats.programChanges++;
+        }
+
+        if (packet.vao != currentVao)
+        {
+            glBindVertexArray(packet.vao);
+            currentVao = packet.vao;
+            stats.vaoChanges++;
+        }
+
+        GLuint texture = UseTexture(app, material.albedoTextureIdx);
+        if (texture != currentTexture)
+        {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            currentTexture = texture;
+            stats.textureChanges++;
+        }
+
+        const SubmeshLod& lod = submesh.lods[packet.lod];
+        const GLenum indexType = submesh.geometry.indexType;
+        const u64 firstIndex = (u64)submesh.geometry.firstIndex + lod.firstIndex;
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, lod.indexCount, indexType, (void*)(firstIndex * GetIndexSize(indexType)), packet.instanceCount, packet.baseVertex, packet.baseInstance);
+        stats.drawCalls++;
+        stats.draws++;
+        stats.instances += packet.instanceCount;
+        stats.triangles += lod.indexCount / 3 * packet.instanceCount;
+    }
+
+    glBindVertexArray(0);
+}
+
+// Draws the level of detail of the packet as a whole
+static DrawElementsIndirectCommand MakePacketCommand(const Submesh& submesh, const DrawPacket& packet)
+{
+    const SubmeshLod& lod = submesh.lods[packet.lod];
+
+    DrawElementsIndirectCommand command;
+    command.count = lod.indexCount;
+    command.instanceCount = packet.instanceCount;
+    command.firstIndex = submesh.geometry.firstIndex + lod.firstIndex;
+    command.baseVertex = packet.baseVertex;
+    command.baseInstance = packet.baseInstance;
+    return command;
+}
+
+struct BuildPacketCommandsData
+{
+    App*         app;
+    RenderQueue* queue;
+    Frustum      frustum;
+};
+
+// Packets of levels split in several clusters get a command per run of consecutive
+// visible clusters of every instance, the rest a single command
+static void BuildPacketCommands(u32 begin, u32 end, void* data)
+{
+    BuildPacketCommandsData* buildData = (BuildPacketCommandsData*)data;
+    App* app = buildData->app;
+    RenderQueue& queue = *buildData->queue;
+    MeshletCullingScratch scratch;
+
+    for (u32 packetIdx = begin; packetIdx < end; ++packetIdx)
+    {
+        const DrawPacket& packet = queue.packets[packetIdx];
+        const Submesh& submesh = app->meshes[app->models[packet.modelIdx].meshIdx].submeshes[packet.submeshIdx];
+        const SubmeshLod& lod = submesh.lods[packet.lod];
+        std::vector<DrawElementsIndirectCommand>& commands = queue.packetCommands[packetIdx];
+        ClusterCullingStats& clusterStats = queue.packetClusterStats[packetIdx];
+        commands.clear();
+        clusterStats = {};
+
+        if (!app->clusterCulling || lod.meshletCount <= 1)
+        {
+            commands.push_back(MakePacketCommand(submesh, packet));
+            continue;
+        }
+
+        const Meshlet* meshlets = submesh.meshlets.data() + lod.firstMeshlet;
+        const BoundingVolume* closedBounds = app->clusterBackfaceCulling && submesh.closed ? &submesh.bounds : nullptr;
+        for (u32 instance = 0; instance < packet.instanceCount; ++instance)
+        {
+            const u32 entityIdx = queue.visibleEntities[queue.instanceIndices[packet.firstInstanceIndex + instance]];
+            CullMeshlets(meshlets, lod.meshletCount, app->entityWorldMatrices[entityIdx], buildData->frustum,
+                         app->camera.cameraPos, closedBounds, scratch, clusterStats);
+
+            // The clusters of a level are consecutive in its indices, a run of visible ones is a single draw
+            for (u32 runBegin = 0; runBegin < lod.meshletCount; )
+            {
+                if (!scratch.visible[runBegin])
+                {
+                    runBegin++;
+                    continue;
+                }
+
+                u32 runEnd = runBegin + 1;
+                while (runEnd < lod.meshletCount && scratch.visible[runEnd])
+                    runEnd++;
+
+                const Meshlet& first = meshlets[runBegin];
+                const Meshlet& last = meshlets[runEnd - 1];
+
+                DrawElementsIndirectCommand command;
+                command.count = last.firstIndex + last.indexCount - first.firstIndex;
+                command.instanceCount = 1;
+                command.firstIndex = submesh.geometry.firstIndex + first.firstIndex;
+                command.baseVertex = packet.baseVertex;
+                command.baseInstance = packet.baseInstance + instance;
+                commands.push_back(command);
+
+                runBegin = runEnd;
+            }
+        }
+    }
+}
+
+void SubmitRenderQueueIndirect(App* app, RenderQueue& queue)
+{
+    RenderQueueStats& stats = queue.stats;
+    stats.drawCalls = 0;
+    stats.draws = 0;
+    stats.instances = 0;
+    stats.programChanges = 0;
+    stats.vaoChanges = 0;
+    stats.textureChanges = 0;
+    stats.triangles = 0;
+
+    stats.clusters = {};
+
+    const u32 packetCount = (u32)queue.packets.size();
+    queue.packetCommands.resize(packetCount);
+    queue.packetClusterStats.resize(packetCount);
+    queue.packetFirstCommand.resize(packetCount + 1);
+
+    BuildPacketCommandsData buildData = { app, &queue, ExtractFrustum(app->camera.GetViewMatrix(app->displaySize)) };
+    ParallelFor(packetCount, 16, BuildPacketCommands, &buildData);
+
+    Buffer& indirectBuffer = app->indirectBuffer;
+    AlignHead(indirectBuffer, sizeof(u32));
+    const u32 commandsOffset = indirectBuffer.head;
+
+    // Commands of all packets, in submission order
+    u32 commandCount = 0;
+    for (u32 packetIdx = 0; packetIdx < packetCount; ++packetIdx)
+    {
+        const DrawPacket& packet = queue.packets[packetIdx];
+        std::vector<DrawElementsIndirectCommand>& commands = queue.packetCommands[packetIdx];
+
+        // Every packet left needs at least a command, clusters that don't fit are drawn whole
+        if (commandCount + commands.size() + (packetCount - packetIdx - 1) > MAX_DRAW_COMMANDS)
+        {
+            const Submesh& submesh = app->meshes[app->models[packet.modelIdx].meshIdx].submeshes[packet.submeshIdx];
+            commands.assign(1, MakePacketCommand(submesh, packet));
+        }
+        else
+        {
+            const ClusterCullingStats& clusterStats = queue.packetClusterStats[packetIdx];
+            stats.clusters.clustersTested += clusterStats.clustersTested;
+            stats.clusters.frustumCulled += clusterStats.frustumCulled;
+            stats.clusters.backfaceCulled += clusterStats.backfaceCulled;
+        }
+
+        queue.packetFirstCommand[packetIdx] = commandCount;
+        PushData(indirectBuffer, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand));
+        commandCount += (u32)commands.size();
+
+        for (const DrawElementsIndirectCommand& command : commands)
+            stats.triangles += command.count / 3 * command.instanceCount;
+    }
+    queue.packetFirstCommand[packetCount] = commandCount;
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer.handle);
+    glActiveTexture(GL_TEXTURE0);
+
+    GLuint currentProgram = 0;
+    GLuint currentVao = 0;
+    GLuint currentTexture = 0;
+
+    for (u32 runBegin = 0; runBegin < packetCount; )
+    {
+        const DrawPacket& packet = queue.packets[runBegin];
+        const Model& model = app->models[packet.modelIdx];
+        const Material& material = app->materials[model.materialIdx[packet.submeshIdx]];
+
+        u32 programIdx = (u32)SORT_KEY_FIELD(packet.key >> (SORT_KEY_DEPTH_BITS + SORT_KEY_VAO_BITS + SORT_KEY_MATERIAL_BITS), SORT_KEY_PROGRAM_BITS);
+        GLuint program = app->programs[programIdx].handle;
+        GLuint texture = UseTexture(app, material.albedoTextureIdx);
+        GLenum indexType = app->meshes[model.meshIdx].submeshes[packet.submeshIdx].geometry.indexType;
+
+        // Packets are sorted by program, material and VAO, so the ones that can share a call are adjacent
+        u32 runEnd = runBegin + 1;
+        while (runEnd < packetCount)
+        {
+            const DrawPacket& next = queue.packets[runEnd];
+            const Model& nextModel = app->models[next.modelIdx];
+            const Material& nextMaterial = app->materials[nextModel.materialIdx[next.submeshIdx]];
+            const GLenum nextIndexType = app->meshes[nextModel.meshIdx].submeshes[next.submeshIdx].geometry.indexType;
+            u32 nextProgramIdx = (u32)SORT_KEY_FIELD(next.key >> (SORT_KEY_DEPTH_BITS + SORT_KEY_VAO_BITS + SORT_KEY_MATERIAL_BITS), SORT_KEY_PROGRAM_BITS);
+            if (next.vao != packet.vao || nextProgramIdx != programIdx || UseTexture(app, nextMaterial.albedoTextureIdx) != texture || nextIndexType != indexType)
+                break;
+            stats.instances += next.instanceCount;
+            runEnd++;
+        }
+        stats.instances += packet.instanceCount;
+
+        // Everything in the run may have been culled
+        const u32 firstCommand = queue.packetFirstCommand[runBegin];
+        const u32 runCommandCount = queue.packetFirstCommand[runEnd] - firstCommand;
+        if (runCommandCount == 0)
+        {
+            runBegin = runEnd;
+            continue;
+        }
+
+        if (program != currentProgram)
+        {
+            glUseProgram(program);
+            currentProgram = program;
+            stats.programChanges++;
+        }
+
+        if (packet.vao != currentVao)
+        {
+            glBindVertexArray(packet.vao);
+            currentVao = packet.vao;
+            stats.vaoChanges++;
+        }
+
+        if (texture != currentTexture)
+        {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            currentTexture = texture;
+            stats.textureChanges++;
+        }
+
+        const u64 runOffset = commandsOffset + firstCommand * sizeof(DrawElementsIndirectCommand);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)runOffset, runCommandCount, sizeof(DrawElementsIndirectCommand));
+        stats.drawCalls++;
+        stats.draws += runCommandCount;
+
+        runBegin = runEnd;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
@@ -0,0 +1,115 @@
+//
+// render_queue.h: Draw packets with sort keys. The visible entities are grouped by
+// model and each visible submesh of a group becomes an instanced packet. The packets
+// are sorted by key and submitted skipping the binds that would not change any state.
+//
+
+#pragma once
+
+#include "platform.h"
+#include "meshlets.h"
+
+struct App;
+typedef unsigned int GLuint;
+
+// Sort key layout, from the most to the least significant bits
+#define SORT_KEY_PASS_BITS     4
+#define SORT_KEY_PROGRAM_BITS  8
+#define SORT_KEY_MATERIAL_BITS 16
+#define SORT_KEY_VAO_BITS      12
+#define SORT_KEY_DEPTH_BITS    24
+
+enum RenderPass
+{
+    RENDER_PASS_OPAQUE,
+};
+
+#define MAX_INSTANCES             16384
+#define MAX_INSTANCE_INDICES      (8 * MAX_INSTANCES) // Per frame, one per visible submesh of every instance, the ones past it aren't drawn
+#define MAX_DRAW_COMMANDS         (4 * MAX_INSTANCES) // Per frame, indirect ones (clusters split the draws)
+#define INSTANCE_INDEX_LOCATION   5
+#define INSTANCE_MATRICES_BINDING 5
+
+struct DrawPacket
+{
+    u64    key;
+    GLuint vao;
+    i32    baseVertex;
+    u32    modelIdx;
+    u32    submeshIdx;
+    u32    lod;
+    u32    baseInstance;  // Offset (in u32s) of the instance indices in the instance buffer
+    u32    instanceCount;
+    u32    firstInstanceIndex; // Of the same instance indices, in RenderQueue::instanceIndices
+};
+
+// Layout defined by GL for glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    u32 baseInstance;
+};
+
+struct RenderQueueStats
+{
+    u32 drawCalls;
+    u32 draws;
+    u32 instances;
+    u32 triangles;
+    u32 programChanges;
+    u32 vaoChanges;
+    u32 textureChanges;
+    f32 sortTimeMs;
+    ClusterCullingStats clusters; // Only culled by the indirect submission
+};
+
+struct RenderQueue
+{
+    std::vector<DrawPacket> packets;
+    std::vector<DrawPacket> sortScratch;
+    std::vector<u32>        visibleEntities;
+    std::vector<u32>        instanceIndices;
+    std::vector<std::vector<DrawElementsIndirectCommand>> packetCommands; // Indirect submission, per packet
+    std::vector<ClusterCullingStats> packetClusterStats;
+    std::vector<u32>        packetFirstCommand;
+    RenderQueueStats        stats;
+};
+
+/**
+ * Builds the key of a packet. Depth is the view depth normalized to [0, 1], so the
+ * packets with the same state are sorted front to back.
+ */
+u64 MakeSortKey(RenderPass pass, u32 programIdx, u32 materialIdx, GLuint vao, f32 depth);
+
+/**
+ * Fills the queue with a packet per visible submesh of each model and level of detail of
+ * its instances (Entity::lod), drawn with the given program. The world matrices and vertex decodings of the visible entities are pushed to
+ * the instance buffer (bound as storage buffers), followed by the matrix indices of each
+ * packet, which the VAOs read as a per instance attribute starting at the packet's base
+ * instance.
+ */
+void BuildRenderQueue(App* app, RenderQueue& queue, RenderPass pass, u32 programIdx);
+
+/**
+ * LSD radix sort of the packets by key, a byte per pass. Passes where all the keys
+ * share the same byte are skipped.
+ */
+void SortRenderQueue(RenderQueue& queue);
+
+/**
+ * Issues the instanced draws of the queue in order. Binds the global params once, and
+ * the program, VAO and albedo texture only when they change.
+ */
+void SubmitRenderQueue(App* app, RenderQueue& queue);
+
+/**
+ * Same as SubmitRenderQueue, but writes DrawElementsIndirectCommands to the indirect
+ * buffer, and issues a single glMultiDrawElementsIndirect for each run of packets that
+ * share program, VAO, albedo texture and index type. With App::clusterCulling, the
+ * levels split in several clusters are culled per instance and cluster on the job
+ * system, and get a command per run of visible clusters; otherwise a packet is a command.
+ */
+void SubmitRenderQueueIndirect(App* app, RenderQueue& queue);
@@ -0,0 +1,835 @@
+#include "texture_compression.h"
+#include "engine.h"
+#include "gl_extensions.h"
+#include "job_system.h"
+#include "pack_file.h"
+
+#include <immintrin.h>
+#include <chrono>
+
+struct TextureCacheLevel
+{
+    u32 offset; // Relative to the end of the header
+    u32 size;
+    u32 width;
+    u32 height;
+};
+
+struct TextureCacheHeader
+{
+    u32               magic;
+    u32               version;
+    u64               sourceHash;
+    u64               sourceSize;
+    u32               usageFlags;
+    u32               format;
+    u32               width;
+    u32               height;
+    u32               levelCount;
+    u32               padding;
+    u64               decodedSize;
+    u64               payloadHash; // Hash of everything after the header
+    TextureCacheLevel levels[MAX_TEXTURE_LEVELS];
+};
+
+// The pixels of a 4x4 block split by channel (0-255), so 4 pixels fit a SSE register
+struct BlockPixels
+{
+    alignas(16) f32 channels[4][16];
+};
+
+struct Palette
+{
+    f32 colors[16][4];
+};
+
+GLenum GetCompressedFormatGL(TextureFormat format)
+{
+    switch (format)
+    {
+        case TEXTURE_FORMAT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case TEXTURE_FORMAT_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case TEXTURE_FORMAT_BC5: return GL_COMPRESSED_RG_RGTC2;
+        case TEXTURE_FORMAT_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+    return GL_NONE;
+}
+
+u32 GetBlockSize(TextureFormat format)
+{
+    return format == TEXTURE_FORMAT_BC1 ? 8 : 16;
+}
+
+const char* GetTextureFormatName(TextureFormat format)
+{
+    switch (format)
+    {
+        case TEXTURE_FORMAT_BC1: return "BC1";
+        case TEXTURE_FORMAT_BC3: return "BC3";
+        case TEXTURE_FORMAT_BC5: return "BC5";
+        case TEXTURE_FORMAT_BC7: return "BC7";
+    }
+    return "Unknown";
+}
+
+// BC5 (RGTC) and BC7 (BPTC) are core since 3.0 and 4.2, the S3TC formats are an extension
+static bool IsFormatSupported(TextureFormat format)
+{
+    if (format == TEXTURE_FORMAT_BC1 || format == TEXTURE_FORMAT_BC3)
+        return GLExt.textureCompressionS3TC;
+    return format == TEXTURE_FORMAT_BC5 || format == TEXTURE_FORMAT_BC7;
+}
+
+static bool HasAlpha(const Image& image)
+{
+    if (image.nchannels != 2 && image.nchannels != 4)
+        return false;
+
+    for (i32 y = 0; y < image.size.y; ++y)
+    {
+        const u8* row = (const u8*)image.pixels + y * image.stride;
+        for (i32 x = 0; x < image.size.x; ++x)
+            if (row[x * image.nchannels + image.nchannels - 1] != 255)
+                return true;
+    }
+    return false;
+}
+
+TextureFormat ChooseTextureFormat(const Image& image, bool normalMap)
+{
+    if (normalMap)
+        return TEXTURE_FORMAT_BC5;
+
+    if (TEXTURE_PREFER_BC7 || !GLExt.textureCompressionS3TC)
+        return TEXTURE_FORMAT_BC7;
+
+    return HasAlpha(image) ? TEXTURE_FORMAT_BC3 : TEXTURE_FORMAT_BC1;
+}
+
+static u32 GetLevelSize(TextureFormat format, u32 width, u32 height)
+{
+    return ((width + 3) / 4) * ((height + 3) / 4) * GetBlockSize(format);
+}
+
+// Mip chain
+
+static void ExpandToRGBA(const Image& image, std::vector<u8>& rgba)
+{
+    const u32 width = image.size.x;
+    const u32 height = image.size.y;
+    rgba.resize(width * height * 4);
+
+    for (u32 y = 0; y < height; ++y)
+    {
+        const u8* src = (const u8*)image.pixels + y * image.stride;
+        u8* dst = rgba.data() + y * width * 4;
+        for (u32 x = 0; x < width; ++x, src += image.nchannels, dst += 4)
+        {
+            switch (image.nchannels)
+            {
+                case 1: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+                case 2: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = src[1]; break;
+                case 3: dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255; break;
+                default: dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = src[3]; break;
+            }
+        }
+    }
+}
+
+// Block encoding
+
+static void LoadBlock(const u8* rgba, u32 width, u32 height, u32 blockX, u32 blockY, BlockPixels& block)
+{
+    for (u32 y = 0; y < 4; ++y)
+    {
+        const u32 sy = glm::min(blockY * 4 + y, height - 1);
+        for (u32 x = 0; x < 4; ++x)
+        {
+            const u32 sx = glm::min(blockX * 4 + x, width - 1);
+            const u8* pixel = rgba + (sy * width + sx) * 4;
+            for (u32 c = 0; c < 4; ++c)
+                block.channels[c][y * 4 + x] = pixel[c];
+        }
+    }
+}
+
+// Picks the closest palette entry of each pixel over channels [firstChannel, firstChannel +
+// channelCount), 4 pixels at a time. Returns the total squared error.
+static f32 SelectIndices(const BlockPixels& block, u32 firstChannel, u32 channelCount, const Palette& palette, u32 paletteSize, u8 indices[16])
+{
+    f32 error = 0.0f;
+    for (u32 i = 0; i < 16; i += 4)
+    {
+        __m128 pixels[4];
+        for (u32 c = 0; c < channelCount; ++c)
+            pixels[c] = _mm_load_ps(&block.channels[firstChannel + c][i]);
+
+        __m128 bestError = _mm_set1_ps(FLT_MAX);
+        __m128 bestIndex = _mm_setzero_ps();
+        for (u32 p = 0; p < paletteSize; ++p)
+        {
+            __m128 distance = _mm_setzero_ps();
+            for (u32 c = 0; c < channelCount; ++c)
+            {
+                __m128 d = _mm_sub_ps(pixels[c], _mm_set1_ps(palette.colors[p][firstChannel + c]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+            }
+
+            __m128 closer = _mm_cmplt_ps(distance, bestError);
+            bestError = _mm_min_ps(distance, bestError);
+            bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((f32)p)), _mm_andnot_ps(closer, bestIndex));
+        }
+
+        alignas(16) i32 index[4];
+        alignas(16) f32 pixelError[4];
+        _mm_store_si128((__m128i*)index, _mm_cvttps_epi32(bestIndex));
+        _mm_store_ps(pixelError, bestError);
+        for (u32 j = 0; j < 4; ++j)
+        {
+            indices[i + j] = (u8)index[j];
+            error += pixelError[j];
+        }
+    }
+    return error;
+}
+
+// Endpoints along the principal axis of the pixels (power iteration on their covariance)
+static void ComputePrincipalEndpoints(const BlockPixels& block, u32 channelCount, f32 e0[4], f32 e1[4])
+{
+    f32 mean[4] = {};
+    f32 minValue[4], maxValue[4];
+    for (u32 c = 0; c < channelCount; ++c)
+    {
+        minValue[c] = FLT_MAX;
+        maxValue[c] = -FLT_MAX;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            mean[c] += block.channels[c][i];
+            minValue[c] = glm::min(minValue[c], block.channels[c][i]);
+            maxValue[c] = glm::max(maxValue[c], block.channels[c][i]);
+        }
+        mean[c] /= 16.0f;
+    }
+
+    f32 covariance[4][4] = {};
+    for (u32 i = 0; i < 16; ++i)
+        for (u32 a = 0; a < channelCount; ++a)
+            for (u32 b = a; b < channelCount; ++b)
+                covariance[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+    for (u32 a = 0; a < channelCount; ++a)
+        for (u32 b = 0; b < a; ++b)
+            covariance[a][b] = covariance[b][a];
+
+    // Starting from the diagonal of the bounding box converges in a few steps
+    f32 axis[4];
+    for (u32 c = 0; c < channelCount; ++c)
+        axis[c] = maxValue[c] - minValue[c];
+
+    for (u32 iteration = 0; iteration < 8; ++iteration)
+    {
+        f32 next[4] = {};
+        f32 length = 0.0f;
+        for (u32 a = 0; a < channelCount; ++a)
+        {
+            for (u32 b = 0; b < channelCount; ++b)
+                next[a] += covariance[a][b] * axis[b];
+            length = glm::max(length, glm::abs(next[a]));
+        }
+        if (length < 1e-6f)
+            break;
+        for (u32 c = 0; c < channelCount; ++c)
+            axis[c] = next[c] / length;
+    }
+
+    f32 axisLength2 = 0.0f;
+    for (u32 c = 0; c < channelCount; ++c)
+        axisLength2 += axis[c] * axis[c];
+
+    if (axisLength2 < 1e-12f)
+    {
+        // Flat block
+        for (u32 c = 0; c < channelCount; ++c)
+            e0[c] = e1[c] = mean[c];
+        return;
+    }
+
+    f32 minT = FLT_MAX, maxT = -FLT_MAX;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        f32 t = 0.0f;
+        for (u32 c = 0; c < channelCount; ++c)
+            t += (block.channels[c][i] - mean[c]) * axis[c];
+        minT = glm::min(minT, t);
+        maxT = glm::max(maxT, t);
+    }
+
+    for (u32 c = 0; c < channelCount; ++c)
+    {
+        e0[c] = glm::clamp(mean[c] + axis[c] * minT / axisLength2, 0.0f, 255.0f);
+        e1[c] = glm::clamp(mean[c] + axis[c] * maxT / axisLength2, 0.0f, 255.0f);
+    }
+}
+
+// Least squares endpoints for the current indices, where pixel i is interpolated with
+// weights[indices[i]] of e1. Returns false if the system is degenerate.
+static bool RefineEndpoints(const BlockPixels& block, u32 channelCount, const u8 indices[16], const f32* weights, f32 e0[4], f32 e1[4])
+{
+    f32 aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    f32 ax[4] = {}, bx[4] = {};
+    for (u32 i = 0; i < 16; ++i)
+    {
+        const f32 b = weights[indices[i]];
+        const f32 a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (u32 c = 0; c < channelCount; ++c)
+        {
+            ax[c] += a * block.channels[c][i];
+            bx[c] += b * block.channels[c][i];
+        }
+    }
+
+    const f32 det = aa * bb - ab * ab;
+    if (glm::abs(det) < 1e-6f)
+        return false;
+
+    for (u32 c = 0; c < channelCount; ++c)
+    {
+        e0[c] = glm::clamp((bb * ax[c] - ab * bx[c]) / det, 0.0f, 255.0f);
+        e1[c] = glm::clamp((aa * bx[c] - ab * ax[c]) / det, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+// BC1
+
+static u16 PackRGB565(const f32 color[4])
+{
+    const u32 r = (u32)(color[0] * 31.0f / 255.0f + 0.5f);
+    const u32 g = (u32)(color[1] * 63.0f / 255.0f + 0.5f);
+    const u32 b = (u32)(color[2] * 31.0f / 255.0f + 0.5f);
+    return (u16)((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRGB565(u16 packed, f32 color[4])
+{
+    const u32 r = (packed >> 11) & 31;
+    const u32 g = (packed >> 5) & 63;
+    const u32 b = packed & 31;
+    color[0] = (f32)((r << 3) | (r >> 2));
+    color[1] = (f32)((g << 2) | (g >> 4));
+    color[2] = (f32)((b << 3) | (b >> 2));
+    color[3] = 255.0f;
+}
+
+// Index codes of a 4 colour BC1 block: c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+static const f32 BC1Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+static f32 EncodeBC1Endpoints(const BlockPixels& block, const f32 e0[4], const f32 e1[4], u16& c0, u16& c1, u8 indices[16])
+{
+    c0 = PackRGB565(e0);
+    c1 = PackRGB565(e1);
+
+    // c0 > c1 selects the 4 colour mode (BC3 always uses it)
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    Palette palette;
+    UnpackRGB565(c0, palette.colors[0]);
+    UnpackRGB565(c1, palette.colors[1]);
+    if (c0 == c1)
+        return SelectIndices(block, 0, 3, palette, 1, indices);
+
+    for (u32 c = 0; c < 3; ++c)
+    {
+        palette.colors[2][c] = (2.0f * palette.colors[0][c] + palette.colors[1][c]) / 3.0f;
+        palette.colors[3][c] = (palette.colors[0][c] + 2.0f * palette.colors[1][c]) / 3.0f;
+    }
+    return SelectIndices(block, 0, 3, palette, 4, indices);
+}
+
+static void EncodeBC1Block(const BlockPixels& block, u8* out)
+{
+    f32 e0[4], e1[4];
+    ComputePrincipalEndpoints(block, 3, e0, e1);
+
+    u16 c0, c1;
+    u8 indices[16];
+    f32 error = EncodeBC1Endpoints(block, e0, e1, c0, c1, indices);
+
+    // One least squares pass from the indices, kept only if it's better after quantizing
+    if (error > 0.0f && c0 != c1)
+    {
+        UnpackRGB565(c0, e0);
+        UnpackRGB565(c1, e1);
+        if (RefineEndpoints(block, 3, indices, BC1Weights, e0, e1))
+        {
+            u16 refinedC0, refinedC1;
+            u8 refinedIndices[16];
+            const f32 refinedError = EncodeBC1Endpoints(block, e0, e1, refinedC0, refinedC1, refinedIndices);
+            if (refinedError < error)
+            {
+                c0 = refinedC0;
+                c1 = refinedC1;
+                memcpy(indices, refinedIndices, sizeof(refinedIndices));
+            }
+        }
+    }
+
+    u32 indexBits = 0;
+    for (u32 i = 0; i < 16; ++i)
+        indexBits |= (u32)indices[i] << (i * 2);
+
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &indexBits, 4);
+}
+
+// BC4, a single channel. Always in the 8 value mode (e0 > e1).
+static void EncodeBC4Block(const BlockPixels& block, u32 channel, u8* out)
+{
+    f32 minValue = 255.0f, maxValue = 0.0f;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        minValue = glm::min(minValue, block.channels[channel][i]);
+        maxValue = glm::max(maxValue, block.channels[channel][i]);
+    }
+
+    const u8 e0 = (u8)(maxValue + 0.5f);
+    const u8 e1 = (u8)(minValue + 0.5f);
+    out[0] = e0;
+    out[1] = e1;
+    memset(out + 2, 0, 6);
+    if (e0 == e1)
+        return;
+
+    // Codes 0 and 1 are the endpoints, 2 to 7 go from e0 to e1
+    Palette palette;
+    palette.colors[0][channel] = e0;
+    palette.colors[1][channel] = e1;
+    for (u32 j = 2; j < 8; ++j)
+        palette.colors[j][channel] = ((8 - j) * e0 + (j - 1) * e1) / 7.0f;
+
+    u8 indices[16];
+    SelectIndices(block, channel, 1, palette, 8, indices);
+
+    u64 indexBits = 0;
+    for (u32 i = 0; i < 16; ++i)
+        indexBits |= (u64)indices[i] << (i * 3);
+    for (u32 i = 0; i < 6; ++i)
+        out[2 + i] = (u8)(indexBits >> (i * 8));
+}
+
+static void EncodeBC3Block(const BlockPixels& block, u8* out)
+{
+    EncodeBC4Block(block, 3, out);
+    EncodeBC1Block(block, out + 8);
+}
+
+static void EncodeBC5Block(const BlockPixels& block, u8* out)
+{
+    EncodeBC4Block(block, 0, out);
+    EncodeBC4Block(block, 1, out + 8);
+}
+
+// BC7, mode 6 only: RGBA 7 bit endpoints plus a p-bit each, 16 interpolated colours
+
+static const u32 BC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7Endpoints
+{
+    u8  values[2][4]; // 7 bit
+    u32 pbits[2];
+};
+
+struct BitWriter
+{
+    u8* out;
+    u32 position;
+};
+
+static void WriteBits(BitWriter& writer, u32 value, u32 count)
+{
+    for (u32 i = 0; i < count; ++i, ++writer.position)
+        writer.out[writer.position >> 3] |= (u8)(((value >> i) & 1) << (writer.position & 7));
+}
+
+// Picks the p-bit that gets each endpoint closer once quantized
+static void QuantizeBC7Endpoint(const f32 endpoint[4], u8 values[4], u32& pbit)
+{
+    f32 bestError = FLT_MAX;
+    for (u32 p = 0; p < 2; ++p)
+    {
+        u8 candidate[4];
+        f32 error = 0.0f;
+        for (u32 c = 0; c < 4; ++c)
+        {
+            candidate[c] = (u8)glm::clamp((i32)((endpoint[c] - p) * 0.5f + 0.5f), 0, 127);
+            const f32 d = (f32)(candidate[c] * 2 + p) - endpoint[c];
+            error += d * d;
+        }
+        if (error < bestError)
+        {
+            bestError = error;
+            memcpy(values, candidate, 4);
+            pbit = p;
+        }
+    }
+}
+
+static f32 EncodeBC7Endpoints(const BlockPixels& block, const f32 e0[4], const f32 e1[4], BC7Endpoints& endpoints, u8 indices[16])
+{
+    QuantizeBC7Endpoint(e0, endpoints.values[0], endpoints.pbits[0]);
+    QuantizeBC7Endpoint(e1, endpoints.values[1], endpoints.pbits[1]);
+
+    Palette palette;
+    for (u32 c = 0; c < 4; ++c)
+    {
+        const u32 v0 = endpoints.values[0][c] * 2 + endpoints.pbits[0];
+        const u32 v1 = endpoints.values[1][c] * 2 + endpoints.pbits[1];
+        for (u32 j = 0; j < 16; ++j)
+            palette.colors[j][c] = (f32)(((64 - BC7Weights4[j]) * v0 + BC7Weights4[j] * v1 + 32) >> 6);
+    }
+    return SelectIndices(block, 0, 4, palette, 16, indices);
+}
+
+static void EncodeBC7Block(const BlockPixels& block, u8* out)
+{
+    f32 e0[4], e1[4];
+    ComputePrincipalEndpoints(block, 4, e0, e1);
+
+    BC7Endpoints endpoints;
+    u8 indices[16];
+    f32 error = EncodeBC7Endpoints(block, e0, e1, endpoints, indices);
+
+    if (error > 0.0f)
+    {
+        f32 weights[16];
+        for (u32 j = 0; j < 16; ++j)
+            weights[j] = BC7Weights4[j] / 64.0f;
+
+        if (RefineEndpoints(block, 4, indices, weights, e0, e1))
+        {
+            BC7Endpoints refinedEndpoints;
+            u8 refinedIndices[16];
+            const f32 refinedError = EncodeBC7Endpoints(block, e0, e1, refinedEndpoints, refinedIndices);
+            if (refinedError < error)
+            {
+                endpoints = refinedEndpoints;
+                memcpy(indices, refinedIndices, sizeof(refinedIndices));
+            }
+        }
+    }
+
+    // The index of the first pixel is stored without its top bit, swap to make it 0
+    if (indices[0] & 8)
+    {
+        std::swap(endpoints.values[0], endpoints.values[1]);
+        std::swap(endpoints.pbits[0], endpoints.pbits[1]);
+        for (u32 i = 0; i < 16; ++i)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(out, 0, 16);
+    BitWriter writer = { out, 0 };
+    WriteBits(writer, 1 << 6, 7); // Mode 6
+    for (u32 c = 0; c < 4; ++c)
+    {
+        WriteBits(writer, endpoints.values[0][c], 7);
+        WriteBits(writer, endpoints.values[1][c], 7);
+    }
+    WriteBits(writer, endpoints.pbits[0], 1);
+    WriteBits(writer, endpoints.pbits[1], 1);
+    WriteBits(writer, indices[0], 3);
+    for (u32 i = 1; i < 16; ++i)
+        WriteBits(writer, indices[i], 4);
+}
+
+// Compression of a level, by rows of blocks
+
+struct CompressLevelData
+{
+    const u8*     rgba;
+    u32           width;
+    u32           height;
+    TextureFormat format;
+    u8*           out;
+};
+
+static void CompressBlockRows(u32 begin, u32 end, void* data)
+{
+    const CompressLevelData& level = *(const CompressLevelData*)data;
+    const u32 blocksX = (level.width + 3) / 4;
+    const u32 blockSize = GetBlockSize(level.format);
+
+    BlockPixels block;
+    for (u32 blockY = begin; blockY < end; ++blockY)
+    {
+        u8* out = level.out + blockY * blocksX * blockSize;
+        for (u32 blockX = 0; blockX < blocksX; ++blockX, out += blockSize)
+        {
+            LoadBlock(level.rgba, level.width, level.height, blockX, blockY, block);
+            switch (level.format)
+            {
+                case TEXTURE_FORMAT_BC1: EncodeBC1Block(block, out); break;
+                case TEXTURE_FORMAT_BC3: EncodeBC3Block(block, out); break;
+                case TEXTURE_FORMAT_BC5: EncodeBC5Block(block, out); break;
+                case TEXTURE_FORMAT_BC7: EncodeBC7Block(block, out); break;
+            }
+        }
+    }
+}
+
+void CompressImage(const Image& image, TextureFormat format, u32 usageFlags, CompressedTexture& texture)
+{
+    std::vector<u8> rgba;
+    ExpandToRGBA(image, rgba);
+
+    u32 mipFlags = 0;
+    if (usageFlags & TEXTURE_USAGE_SRGB)
+        mipFlags |= MIP_CHAIN_SRGB;
+    if (usageFlags & TEXTURE_USAGE_NORMAL_MAP)
+        mipFlags |= MIP_CHAIN_NORMAL_MAP;
+
+    MipChain chain;
+    GenerateMipChain(rgba.data(), image.size.x, image.size.y, mipFlags, DEFAULT_MIP_FILTER, chain);
+
+    texture.format = format;
+    texture.width = image.size.x;
+    texture.height = image.size.y;
+    texture.levelCount = chain.levelCount;
+    texture.decodedSize = 0;
+
+    u32 dataSize = 0;
+    for (u32 levelIdx = 0; levelIdx < chain.levelCount; ++levelIdx)
+    {
+        const MipLevel& mip = chain.levels[levelIdx];
+        CompressedTextureLevel& level = texture.levels[levelIdx];
+        level.offset = dataSize;
+        level.size = GetLevelSize(format, mip.width, mip.height);
+        level.width = mip.width;
+        level.height = mip.height;
+        dataSize += level.size;
+        texture.decodedSize += (u64)mip.width * mip.height * image.nchannels;
+    }
+    texture.data.resize(dataSize);
+
+    for (u32 levelIdx = 0; levelIdx < texture.levelCount; ++levelIdx)
+    {
+        const CompressedTextureLevel& level = texture.levels[levelIdx];
+
+        // Batches of at least 256 blocks, smaller levels go in a single one
+        CompressLevelData data = { chain.pixels.data() + chain.levels[levelIdx].offset, level.width, level.height, format, texture.data.data() + level.offset };
+        const u32 blocksX = (level.width + 3) / 4;
+        const u32 blocksY = (level.height + 3) / 4;
+        ParallelFor(blocksY, glm::max(256 / blocksX, 1u), CompressBlockRows, &data);
+    }
+}
+
+u32 GetTextureQualityMaxSize(TextureQuality quality)
+{
+    switch (quality)
+    {
+        case TEXTURE_QUALITY_LOW: return 512;
+        case TEXTURE_QUALITY_MEDIUM: return 1024;
+        case TEXTURE_QUALITY_HIGH: return 2048;
+        case TEXTURE_QUALITY_FULL: return UINT32_MAX;
+    }
+    return UINT32_MAX;
+}
+
+const char* GetTextureQualityName(TextureQuality quality)
+{
+    switch (quality)
+    {
+        case TEXTURE_QUALITY_LOW: return "Low (512)";
+        case TEXTURE_QUALITY_MEDIUM: return "Medium (1024)";
+        case TEXTURE_QUALITY_HIGH: return "High (2048)";
+        case TEXTURE_QUALITY_FULL: return "Full";
+    }
+    return "Unknown";
+}
+
+void DropTopLevels(CompressedTexture& texture, u32 maxSize)
+{
+    u32 dropped = 0;
+    while (dropped + 1 < texture.levelCount && glm::max(texture.levels[dropped].width, texture.levels[dropped].height) > maxSize)
+        dropped++;
+
+    if (dropped == 0)
+        return;
+
+    // The decoded size only counts the levels that are kept too
+    u64 texelCount = 0, keptTexelCount = 0;
+    for (u32 i = 0; i < texture.levelCount; ++i)
+    {
+        const u64 levelTexels = (u64)texture.levels[i].width * texture.levels[i].height;
+        texelCount += levelTexels;
+        if (i >= dropped)
+            keptTexelCount += levelTexels;
+    }
+    texture.decodedSize = texture.decodedSize / texelCount * keptTexelCount;
+
+    const u32 droppedBytes = texture.levels[dropped].offset;
+
+    texture.data.erase(texture.data.begin(), texture.data.begin() + droppedBytes);
+    texture.levelCount -= dropped;
+    for (u32 i = 0; i < texture.levelCount; ++i)
+    {
+        texture.levels[i] = texture.levels[i + dropped];
+        texture.levels[i].offset -= droppedBytes;
+    }
+    texture.width = texture.levels[0].width;
+    texture.height = texture.levels[0].height;
+}
+
+// Cache
+
+static std::string MakeCachePath(const char* filename)
+{
+    return std::string(filename) + TEXTURE_CACHE_EXTENSION;
+}
+
+static bool ValidateCache(const MappedFile& cache, const TextureCacheHeader& header, u32 usageFlags, u64 sourceHash, u64 sourceSize)
+{
+    if (header.magic != TEXTURE_CACHE_MAGIC || header.version != TEXTURE_CACHE_VERSION)
+        return false;
+
+    if (header.usageFlags != usageFlags || header.sourceHash != sourceHash || header.sourceSize != sourceSize)
+        return false;
+
+    if (header.format > TEXTURE_FORMAT_BC7 || header.levelCount == 0 || header.levelCount > MAX_TEXTURE_LEVELS)
+        return false;
+
+    // Levels are stored one after the other, the upload queue streams them in order
+    const TextureFormat format = (TextureFormat)header.format;
+    const u64 payloadSize = cache.size - sizeof(TextureCacheHeader);
+    u64 levelOffset = 0;
+    for (u32 i = 0; i < header.levelCount; ++i)
+    {
+        const TextureCacheLevel& level = header.levels[i];
+        if (level.width != glm::max(header.width >> i, 1u) ||
+            level.height != glm::max(header.height >> i, 1u) ||
+            level.size != GetLevelSize(format, level.width, level.height) ||
+            level.offset != levelOffset)
+            return false;
+        levelOffset += level.size;
+    }
+    if (levelOffset != payloadSize)
+        return false;
+
+    const u8* payload = cache.data + sizeof(TextureCacheHeader);
+    return HashBytes(payload, payloadSize) == header.payloadHash;
+}
+
+bool ReadTextureCache(const char* filename, u32 usageFlags, CompressedTexture& texture)
+{
+    u64 sourceHash, sourceSize;
+    if (!HashFile(filename, sourceHash, sourceSize))
+        return false;
+
+    std::string cachePath = MakeCachePath(filename);
+    MappedFile cache = MapAssetFile(cachePath.c_str()); // Loose, or cooked into the pack
+    if (!cache.data)
+        return false;
+
+    if (cache.size < sizeof(TextureCacheHeader))
+    {
+        UnmapAssetFile(cache);
+        return false;
+    }
+
+    TextureCacheHeader header;
+    memcpy(&header, cache.data, sizeof(header));
+
+    if (!ValidateCache(cache, header, usageFlags, sourceHash, sourceSize))
+    {
+        ILOG("Texture cache %s is stale or corrupt, compressing %s again", cachePath.c_str(), filename);
+        UnmapAssetFile(cache);
+        return false;
+    }
+
+    // Compressed on a machine with other formats available
+    if (!IsFormatSupported((TextureFormat)header.format))
+    {
+        ILOG("Texture cache %s is %s, not supported here, compressing %s again", cachePath.c_str(), GetTextureFormatName((TextureFormat)header.format), filename);
+        UnmapAssetFile(cache);
+        return false;
+    }
+
+    texture.format = (TextureFormat)header.format;
+    texture.width = header.width;
+    texture.height = header.height;
+    texture.levelCount = header.levelCount;
+    texture.decodedSize = header.decodedSize;
+    for (u32 i = 0; i < header.levelCount; ++i)
+    {
+        const TextureCacheLevel& level = header.levels[i];
+        texture.levels[i] = CompressedTextureLevel{ level.offset, level.size, level.width, level.height };
+    }
+
+    const u8* payload = cache.data + sizeof(TextureCacheHeader);
+    texture.data.assign(payload, payload + (cache.size - sizeof(TextureCacheHeader)));
+
+    UnmapAssetFile(cache);
+    return true;
+}
+
+void SaveTextureCache(const char* filename, u32 usageFlags, const CompressedTexture& texture)
+{
+    TextureCacheHeader header = {};
+    header.magic = TEXTURE_CACHE_MAGIC;
+    header.version = TEXTURE_CACHE_VERSION;
+    header.usageFlags = usageFlags;
+
+    if (!HashFile(filename, header.sourceHash, header.sourceSize))
+        return;
+
+    header.format = texture.format;
+    header.width = texture.width;
+    header.height = texture.height;
+    header.levelCount = texture.levelCount;
+    header.decodedSize = texture.decodedSize;
+    for (u32 i = 0; i < texture.levelCount; ++i)
+    {
+        const CompressedTextureLevel& level = texture.levels[i];
+        header.levels[i] = TextureCacheLevel{ level.offset, level.size, level.width, level.height };
+    }
+    header.payloadHash = HashBytes(texture.data.data(), texture.data.size());
+
+    std::string cachePath = MakeCachePath(filename);
+    FILE* file = fopen(cachePath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing texture cache %s", cachePath.c_str());
+        return;
+    }
+
+    fwrite(&header, 1, sizeof(header), file);
+    fwrite(texture.data.data(), 1, texture.data.size(), file);
+    fclose(file);
+}
+
+bool LoadCompressedTexture(const char* filename, u32 usageFlags, CompressedTexture& texture)
+{
+    if (ReadTextureCache(filename, usageFlags, texture))
+        return true;
+
+    Image image = LoadImage(filename, (usageFlags & TEXTURE_USAGE_FLIP_VERTICALLY) != 0);
+    if (!image.pixels)
+        return false;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    const bool normalMap = (usageFlags & TEXTURE_USAGE_NORMAL_MAP) != 0;
+    CompressImage(image, ChooseTextureFormat(image, normalMap), usageFlags, texture);
+    FreeImage(image);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    ILOG("Compressed %s to %s (%u levels) in %.1f ms", filename, GetTextureFormatName(texture.format), texture.levelCount,
+         std::chrono::duration<f32, std::milli>(end - start).count());
+
+    SaveTextureCache(filename, usageFlags, texture);
+    return true;
+}
@@ -0,0 +1,130 @@
+//
+// texture_compression.h: CPU block compression of textures (BC1/BC3/BC5/BC7) with their
+// whole mip chain, and a binary on-disk container (.btex) next to the source image so
+// a texture is only encoded once. The GPU keeps the blocks as they are, which takes 4x
+// to 8x less memory and bandwidth than the decoded RGBA8 image.
+//
+
+#pragma once
+
+#include "platform.h"
+#include "texture_mips.h"
+#include <glad/glad.h>
+
+struct Image;
+
+#define TEXTURE_CACHE_MAGIC     0x58455442 // 'BTEX'
+#define TEXTURE_CACHE_VERSION   2
+#define TEXTURE_CACHE_EXTENSION ".btex"
+
+#define MAX_TEXTURE_LEVELS MAX_MIP_LEVELS
+
+// Compressed textures are used for everything loaded asynchronously. With 0, they are
+// decoded and uploaded as RGB(A)8 like before.
+#define COMPRESS_TEXTURES 1
+
+// Colour textures go to BC7 instead of BC1/BC3. Better quality (no 565 endpoints, no
+// shared alpha/colour interpolation) at twice the size of BC1 and a slower encoder.
+#define TEXTURE_PREFER_BC7 0
+
+enum TextureFormat
+{
+    TEXTURE_FORMAT_BC1, // RGB, 4 bpp
+    TEXTURE_FORMAT_BC3, // RGBA, 8 bpp: BC1 colour + BC4 alpha
+    TEXTURE_FORMAT_BC5, // RG, 8 bpp: two BC4 channels, for tangent space normal maps
+    TEXTURE_FORMAT_BC7, // RGBA, 8 bpp, mode 6 only
+};
+
+enum TextureUsageFlags
+{
+    TEXTURE_USAGE_NORMAL_MAP      = 1 << 0, // Only X and Y are kept, Z is rebuilt in the shader
+    TEXTURE_USAGE_FLIP_VERTICALLY = 1 << 1, // Rows flipped at decode, as LoadImage does by default
+    TEXTURE_USAGE_SRGB            = 1 << 2, // Gamma encoded colour (albedo, emissive, skybox)
+};
+
+// Largest level kept at load, the levels above it are dropped before the upload. The
+// cache keeps the whole chain, so changing the tier doesn't recompress anything.
+enum TextureQuality
+{
+    TEXTURE_QUALITY_LOW,    // 512
+    TEXTURE_QUALITY_MEDIUM, // 1024
+    TEXTURE_QUALITY_HIGH,   // 2048
+    TEXTURE_QUALITY_FULL,   // As authored
+};
+
+#define DEFAULT_TEXTURE_QUALITY TEXTURE_QUALITY_FULL
+
+struct CompressedTextureLevel
+{
+    u32 offset; // In CompressedTexture::data
+    u32 size;
+    u32 width;
+    u32 height;
+};
+
+struct CompressedTexture
+{
+    TextureFormat          format;
+    u32                    width;
+    u32                    height;
+    u32                    levelCount;
+    CompressedTextureLevel levels[MAX_TEXTURE_LEVELS];
+    std::vector<u8>        data;
+    u64                    decodedSize; // Bytes the decoded mip chain would take, for the stats
+};
+
+/**
+ * OpenGL internal format of the blocks of a format.
+ */
+GLenum GetCompressedFormatGL(TextureFormat format);
+
+/**
+ * Bytes per 4x4 block (8 for BC1, 16 for the rest).
+ */
+u32 GetBlockSize(TextureFormat format);
+
+const char* GetTextureFormatName(TextureFormat format);
+
+/**
+ * BC5 for normal maps, BC1 or BC3 (depending on alpha) for the rest, or BC7 when it's
+ * preferred or the S3TC formats aren't available.
+ */
+TextureFormat ChooseTextureFormat(const Image& image, bool normalMap);
+
+/**
+ * Builds the mip chain of the image (see GenerateMipChain) and compresses every level,
+ * with the block rows split among the job system workers. Blocks until all of them are
+ * done.
+ */
+void CompressImage(const Image& image, TextureFormat format, u32 usageFlags, CompressedTexture& texture);
+
+/**
+ * Largest width or height of the textures loaded with a quality tier, UINT32_MAX for
+ * TEXTURE_QUALITY_FULL.
+ */
+u32 GetTextureQualityMaxSize(TextureQuality quality);
+
+const char* GetTextureQualityName(TextureQuality quality);
+
+/**
+ * Drops the top levels of the texture until it fits in maxSize (the last level is
+ * always kept).
+ */
+void DropTopLevels(CompressedTexture& texture, u32 maxSize);
+
+/**
+ * Reads the compressed texture cached next to 'filename'. Like the mesh cache, it is
+ * only used if it was generated from the very same source file and usage flags, and
+ * its format can be sampled on this GPU. Returns false if it is missing, stale or
+ * corrupt.
+ */
+bool ReadTextureCache(const char* filename, u32 usageFlags, CompressedTexture& texture);
+
+void SaveTextureCache(const char* filename, u32 usageFlags, const CompressedTexture& texture);
+
+/**
+ * Gets the compressed texture of an image file, from its cache or by decoding and
+ * compressing it (and then saving the cache). Only touches the CPU, so it can run on
+ * the job system. Returns false if the image cannot be loaded.
+ */
+bool LoadCompressedTexture(const char* filename, u32 usageFlags, CompressedTexture& texture);
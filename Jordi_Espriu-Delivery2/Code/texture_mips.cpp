@@ -0,0 +1,276 @@
+#include "texture_mips.h"
+#include "job_system.h"
+
+#include <immintrin.h>
+
+#define KAISER_RADIUS 3.0f // In destination texels
+#define KAISER_ALPHA  4.0f
+
+#define SRGB_ENCODE_TABLE_SIZE 16384
+
+struct SRGBTables
+{
+    f32 decode[256];
+    u8  encode[SRGB_ENCODE_TABLE_SIZE]; // Indexed by the linear value, quantized
+};
+
+// Filter weights of every destination texel along one axis, clamped at the edges
+struct FilterTaps
+{
+    u32              tapCount;
+    std::vector<i32> first;   // Per destination texel, can be out of the image
+    std::vector<f32> weights; // tapCount per destination texel
+};
+
+struct MipPassData
+{
+    const f32*        src;
+    f32*              dst;
+    u32               srcWidth;
+    u32               srcHeight;
+    u32               dstWidth;
+    u32               dstHeight;
+    const FilterTaps* taps;
+    u32               flags;
+    u8*               out; // RGBA8 of the destination level, written by the vertical pass
+};
+
+static f32 SRGBToLinear(f32 c)
+{
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static f32 LinearToSRGB(f32 c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static const SRGBTables& GetSRGBTables()
+{
+    static SRGBTables tables = [] {
+        SRGBTables t;
+        for (u32 i = 0; i < 256; ++i)
+            t.decode[i] = SRGBToLinear(i / 255.0f);
+        for (u32 i = 0; i < SRGB_ENCODE_TABLE_SIZE; ++i)
+            t.encode[i] = (u8)(LinearToSRGB(i / (f32)(SRGB_ENCODE_TABLE_SIZE - 1)) * 255.0f + 0.5f);
+        return t;
+    }();
+    return tables;
+}
+
+// Modified Bessel function of the first kind, order 0
+static f32 BesselI0(f32 x)
+{
+    f32 sum = 1.0f, term = 1.0f;
+    for (u32 k = 1; k < 32; ++k)
+    {
+        term *= (x * 0.5f / k) * (x * 0.5f / k);
+        sum += term;
+        if (term < sum * 1e-7f)
+            break;
+    }
+    return sum;
+}
+
+static f32 Sinc(f32 x)
+{
+    if (glm::abs(x) < 1e-5f)
+        return 1.0f;
+    x *= glm::pi<f32>();
+    return sinf(x) / x;
+}
+
+// t is the distance in destination texels
+static f32 EvaluateFilter(MipFilter filter, f32 t)
+{
+    if (filter == MIP_FILTER_BOX)
+        return glm::abs(t) < 0.5f ? 1.0f : (glm::abs(t) == 0.5f ? 0.5f : 0.0f);
+
+    if (glm::abs(t) >= KAISER_RADIUS)
+        return 0.0f;
+
+    const f32 x = t / KAISER_RADIUS;
+    return Sinc(t) * BesselI0(KAISER_ALPHA * sqrtf(1.0f - x * x)) / BesselI0(KAISER_ALPHA);
+}
+
+static void BuildFilterTaps(u32 srcSize, u32 dstSize, MipFilter filter, FilterTaps& taps)
+{
+    const f32 scale = (f32)srcSize / dstSize;
+    const f32 radius = filter == MIP_FILTER_BOX ? 0.5f : KAISER_RADIUS;
+    const f32 support = radius * scale; // In source texels
+
+    taps.tapCount = (u32)ceilf(support * 2.0f) + 1;
+    taps.first.resize(dstSize);
+    taps.weights.resize(dstSize * taps.tapCount);
+
+    for (u32 x = 0; x < dstSize; ++x)
+    {
+        const f32 center = (x + 0.5f) * scale;
+        const i32 first = (i32)floorf(center - support);
+        f32* weights = &taps.weights[x * taps.tapCount];
+
+        f32 sum = 0.0f;
+        for (u32 k = 0; k < taps.tapCount; ++k)
+        {
+            const f32 distance = (first + (i32)k + 0.5f - center) / scale;
+            weights[k] = EvaluateFilter(filter, distance);
+            sum += weights[k];
+        }
+        for (u32 k = 0; k < taps.tapCount; ++k)
+            weights[k] /= sum;
+
+        taps.first[x] = first;
+    }
+}
+
+static void DecodeRows(u32 begin, u32 end, void* data)
+{
+    const MipPassData& pass = *(const MipPassData*)data;
+    const SRGBTables& tables = GetSRGBTables();
+    const bool srgb = (pass.flags & MIP_CHAIN_SRGB) != 0;
+
+    for (u32 y = begin; y < end; ++y)
+    {
+        const u8* in = pass.out + y * pass.dstWidth * 4;
+        f32* out = pass.dst + y * pass.dstWidth * 4;
+        for (u32 x = 0; x < pass.dstWidth * 4; x += 4)
+        {
+            for (u32 c = 0; c < 3; ++c)
+                out[x + c] = srgb ? tables.decode[in[x + c]] : in[x + c] / 255.0f;
+            out[x + 3] = in[x + 3] / 255.0f;
+        }
+    }
+}
+
+static void FilterRowsHorizontally(u32 begin, u32 end, void* data)
+{
+    const MipPassData& pass = *(const MipPassData*)data;
+    const FilterTaps& taps = *pass.taps;
+    const i32 lastX = (i32)pass.srcWidth - 1;
+
+    for (u32 y = begin; y < end; ++y)
+    {
+        const f32* in = pass.src + y * pass.srcWidth * 4;
+        f32* out = pass.dst + y * pass.dstWidth * 4;
+        for (u32 x = 0; x < pass.dstWidth; ++x)
+        {
+            const f32* weights = &taps.weights[x * taps.tapCount];
+            __m128 sum = _mm_setzero_ps();
+            for (u32 k = 0; k < taps.tapCount; ++k)
+            {
+                const i32 sx = glm::clamp(taps.first[x] + (i32)k, 0, lastX);
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(in + sx * 4), _mm_set1_ps(weights[k])));
+            }
+            _mm_storeu_ps(out + x * 4, sum);
+        }
+    }
+}
+
+// Also renormalizes, clamps and encodes the rows to RGBA8
+static void FilterRowsVertically(u32 begin, u32 end, void* data)
+{
+    const MipPassData& pass = *(const MipPassData*)data;
+    const FilterTaps& taps = *pass.taps;
+    const SRGBTables& tables = GetSRGBTables();
+    const i32 lastY = (i32)pass.srcHeight - 1;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for (u32 y = begin; y < end; ++y)
+    {
+        f32* out = pass.dst + y * pass.dstWidth * 4;
+        for (u32 x = 0; x < pass.dstWidth; ++x)
+            _mm_storeu_ps(out + x * 4, zero);
+
+        // Row by row, so the source is read sequentially
+        const f32* weights = &taps.weights[y * taps.tapCount];
+        for (u32 k = 0; k < taps.tapCount; ++k)
+        {
+            const i32 sy = glm::clamp(taps.first[y] + (i32)k, 0, lastY);
+            const f32* in = pass.src + sy * pass.dstWidth * 4;
+            const __m128 weight = _mm_set1_ps(weights[k]);
+            for (u32 x = 0; x < pass.dstWidth; ++x)
+                _mm_storeu_ps(out + x * 4, _mm_add_ps(_mm_loadu_ps(out + x * 4), _mm_mul_ps(_mm_loadu_ps(in + x * 4), weight)));
+        }
+
+        u8* encoded = pass.out + y * pass.dstWidth * 4;
+        for (u32 x = 0; x < pass.dstWidth; ++x)
+        {
+            f32* texel = out + x * 4;
+            _mm_storeu_ps(texel, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(texel), zero), one));
+
+            if (pass.flags & MIP_CHAIN_NORMAL_MAP)
+            {
+                glm::vec3 n = glm::vec3(texel[0], texel[1], texel[2]) * 2.0f - 1.0f;
+                n = glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 0.0f, 1.0f);
+                for (u32 c = 0; c < 3; ++c)
+                    texel[c] = n[c] * 0.5f + 0.5f;
+            }
+
+            for (u32 c = 0; c < 3; ++c)
+            {
+                if (pass.flags & MIP_CHAIN_SRGB)
+                    encoded[x * 4 + c] = tables.encode[(u32)(texel[c] * (SRGB_ENCODE_TABLE_SIZE - 1) + 0.5f)];
+                else
+                    encoded[x * 4 + c] = (u8)(texel[c] * 255.0f + 0.5f);
+            }
+            encoded[x * 4 + 3] = (u8)(texel[3] * 255.0f + 0.5f);
+        }
+    }
+}
+
+void GenerateMipChain(const u8* rgba, u32 width, u32 height, u32 flags, MipFilter filter, MipChain& chain)
+{
+    chain.levelCount = 0;
+    u32 size = 0;
+    for (u32 w = width, h = height; chain.levelCount < MAX_MIP_LEVELS; w = glm::max(w / 2, 1u), h = glm::max(h / 2, 1u))
+    {
+        chain.levels[chain.levelCount++] = MipLevel{ size, w, h };
+        size += w * h * 4;
+        if (w == 1 && h == 1)
+            break;
+    }
+    chain.pixels.resize(size);
+    memcpy(chain.pixels.data(), rgba, width * height * 4);
+
+    // Linear floats of the previous level, the horizontally filtered rows and the new level
+    std::vector<f32> level(width * height * 4);
+    std::vector<f32> filtered, next;
+
+    MipPassData pass = {};
+    pass.dst = level.data();
+    pass.dstWidth = width;
+    pass.dstHeight = height;
+    pass.flags = flags;
+    pass.out = chain.pixels.data();
+    ParallelFor(height, 64, DecodeRows, &pass);
+
+    FilterTaps horizontalTaps, verticalTaps;
+    for (u32 levelIdx = 1; levelIdx < chain.levelCount; ++levelIdx)
+    {
+        const MipLevel& src = chain.levels[levelIdx - 1];
+        const MipLevel& dst = chain.levels[levelIdx];
+        BuildFilterTaps(src.width, dst.width, filter, horizontalTaps);
+        BuildFilterTaps(src.height, dst.height, filter, verticalTaps);
+
+        filtered.resize(dst.width * src.height * 4);
+        pass.src = level.data();
+        pass.dst = filtered.data();
+        pass.srcWidth = src.width;
+        pass.srcHeight = src.height;
+        pass.dstWidth = dst.width;
+        pass.dstHeight = src.height;
+        pass.taps = &horizontalTaps;
+        ParallelFor(src.height, glm::max(4096 / dst.width, 1u), FilterRowsHorizontally, &pass);
+
+        next.resize(dst.width * dst.height * 4);
+        pass.src = filtered.data();
+        pass.dst = next.data();
+        pass.dstHeight = dst.height;
+        pass.taps = &verticalTaps;
+        pass.out = chain.pixels.data() + dst.offset;
+        ParallelFor(dst.height, glm::max(4096 / dst.width, 1u), FilterRowsVertically, &pass);
+
+        level.swap(next);
+    }
+}
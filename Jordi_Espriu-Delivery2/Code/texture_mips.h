@@ -0,0 +1,46 @@
+//
+// texture_mips.h: CPU generation of texture mip chains. Every level is filtered from the
+// previous one in linear space (colour textures are decoded from sRGB first) with a box
+// or a Kaiser windowed sinc filter, on whole RGBA pixels with SSE and with the rows
+// split among the job system workers.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define MAX_MIP_LEVELS 16
+
+enum MipFilter
+{
+    MIP_FILTER_BOX,    // Average of the texels under each destination texel, cheap but blurry
+    MIP_FILTER_KAISER, // Windowed sinc, keeps the detail of the smaller levels
+};
+
+#define DEFAULT_MIP_FILTER MIP_FILTER_KAISER
+
+enum MipChainFlags
+{
+    MIP_CHAIN_SRGB       = 1 << 0, // RGB is gamma encoded colour, filtered after decoding it
+    MIP_CHAIN_NORMAL_MAP = 1 << 1, // RGB is a unit vector, renormalized on every level
+};
+
+struct MipLevel
+{
+    u32 offset; // In MipChain::pixels
+    u32 width;
+    u32 height;
+};
+
+struct MipChain
+{
+    u32             levelCount;
+    MipLevel        levels[MAX_MIP_LEVELS];
+    std::vector<u8> pixels; // RGBA8, every level one after the other
+};
+
+/**
+ * Generates every level of the chain down to 1x1 from 'rgba' (width x height RGBA8
+ * pixels, copied as level 0). Blocks until done, the calling thread helps the workers.
+ */
+void GenerateMipChain(const u8* rgba, u32 width, u32 height, u32 flags, MipFilter filter, MipChain& chain);
@@ -0,0 +1,367 @@
+#include "texture_registry.h"
+#include "engine.h"
+#include "gl_extensions.h"
+#include "job_system.h"
+
+#include <algorithm>
+
+struct TextureLoadRequest
+{
+    App*               app;
+    u32                textureIdx;
+    std::string        filepath;
+    u32                usageFlags;
+    u32                maxSize;    // Of the texture quality tier when it was requested
+    u64                contentKey;
+    Image              image;
+    CompressedTexture* compressed;
+};
+
+void InitTextureRegistry(App* app)
+{
+    TextureRegistry& registry = app->textureRegistry;
+    registry.byPath.clear();
+    registry.byContent.clear();
+    registry.residentBytes = 0;
+    registry.decodedBytes = 0;
+    registry.frame = 0;
+    registry.stats = {};
+
+    registry.budgetBytes = (u64)DEFAULT_TEXTURE_BUDGET_MB * 1024 * 1024;
+    if (registry.budgetBytes == 0 && GLExt.gpuMemoryInfo)
+    {
+        GLint totalKB = 0;
+        glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &totalKB);
+        registry.budgetBytes = (u64)totalKB * 1024 / 2;
+    }
+
+    ILOG("Texture budget: %s%.0f MB", registry.budgetBytes ? "" : "none, ", registry.budgetBytes / (1024.0f * 1024.0f));
+}
+
+static u64 HashPath(const char* filepath)
+{
+    return HashBytes(filepath, strlen(filepath));
+}
+
+static u32 FindTexture(App* app, const char* filepath)
+{
+    auto it = app->textureRegistry.byPath.find(HashPath(filepath));
+    if (it == app->textureRegistry.byPath.end() || app->textures[it->second].filepath != filepath)
+        return UINT32_MAX;
+    return it->second;
+}
+
+static u32 CreateTexture(App* app, const char* filepath, u32 placeholderTexIdx, u32 usageFlags)
+{
+    Texture tex = {};
+    tex.handle = app->textures[placeholderTexIdx].handle;
+    tex.filepath = filepath;
+    tex.state = ASSET_LOADING;
+    tex.usageFlags = usageFlags;
+    tex.placeholderTexIdx = placeholderTexIdx;
+    tex.lastUsedFrame = app->textureRegistry.frame;
+
+    u32 texIdx = (u32)app->textures.size();
+    app->textures.push_back(tex);
+
+    // A collision only costs loading that path again
+    u64 pathHash = HashPath(filepath);
+    if (app->textureRegistry.byPath.count(pathHash) == 0)
+        app->textureRegistry.byPath[pathHash] = texIdx;
+    else
+        ELOG("Texture path hash collision: %s and %s", filepath, app->textures[app->textureRegistry.byPath[pathHash]].filepath.c_str());
+
+    return texIdx;
+}
+
+static u64 MakeContentKey(u64 sourceHash, u32 usageFlags)
+{
+    return HashBytes(&usageFlags, sizeof(usageFlags), sourceHash);
+}
+
+static u64 GetDecodedImageSize(const Image& image)
+{
+    // Plus a third for the mip chain
+    return (u64)image.size.y * image.stride * 4 / 3;
+}
+
+static void AddResidentTexture(App* app, u32 texIdx, u64 decodedSize, u64 residentSize)
+{
+    Texture& tex = app->textures[texIdx];
+    tex.decodedSize = decodedSize;
+    tex.residentSize = residentSize;
+    AddTextureMemory(app, tex.filepath.c_str(), decodedSize, residentSize);
+}
+
+// Makes texIdx share the storage of the texture with the same content, if there is one
+static bool ShareTextureContent(App* app, u32 texIdx, u64 contentKey)
+{
+    TextureRegistry& registry = app->textureRegistry;
+    Texture& tex = app->textures[texIdx];
+    tex.contentKey = contentKey;
+
+    auto it = registry.byContent.find(contentKey);
+    if (it == registry.byContent.end() || it->second == texIdx)
+    {
+        registry.byContent[contentKey] = texIdx;
+        return false;
+    }
+
+    Texture& owner = app->textures[it->second];
+    tex.aliasOf = it->second;
+    tex.state = ASSET_LOADED;
+    owner.refCount += tex.refCount;
+    registry.stats.dedups++;
+    ILOG("Texture %s is the same image as %s, sharing it", tex.filepath.c_str(), owner.filepath.c_str());
+    return true;
+}
+
+static void UploadTextureJob(void* data)
+{
+    TextureLoadRequest* request = (TextureLoadRequest*)data;
+    App* app = request->app;
+    Texture& tex = app->textures[request->textureIdx];
+
+    const bool loaded = request->compressed || request->image.pixels;
+    if (loaded && ShareTextureContent(app, request->textureIdx, request->contentKey))
+    {
+        if (request->compressed)
+            delete request->compressed;
+        else
+            FreeImage(request->image);
+    }
+    else if (request->compressed)
+    {
+        // The queue owns the texture now, it stays ASSET_LOADING until it is done
+        AddResidentTexture(app, request->textureIdx, request->compressed->decodedSize, request->compressed->data.size());
+        QueueCompressedTextureUpload(app, request->textureIdx, request->compressed);
+    }
+    else if (request->image.pixels)
+    {
+        const u64 size = GetDecodedImageSize(request->image);
+        AddResidentTexture(app, request->textureIdx, size, size);
+        QueueTextureUpload(app, request->textureIdx, request->image);
+    }
+    else
+    {
+        tex.handle = app->textures[app->magentaTexIdx].handle;
+        tex.state = ASSET_FAILED;
+    }
+
+    app->pendingAssetLoads--;
+    delete request;
+}
+
+static void DecodeTextureJob(void* data)
+{
+    TextureLoadRequest* request = (TextureLoadRequest*)data;
+
+    u64 sourceHash, sourceSize;
+    if (HashFile(request->filepath.c_str(), sourceHash, sourceSize))
+        request->contentKey = MakeContentKey(sourceHash, request->usageFlags);
+
+#if COMPRESS_TEXTURES
+    request->compressed = new CompressedTexture;
+    if (LoadCompressedTexture(request->filepath.c_str(), request->usageFlags | TEXTURE_USAGE_FLIP_VERTICALLY, *request->compressed))
+    {
+        DropTopLevels(*request->compressed, request->maxSize);
+    }
+    else
+    {
+        delete request->compressed;
+        request->compressed = NULL;
+    }
+#else
+    request->image = LoadImage(request->filepath.c_str());
+#endif
+
+    // The upload needs the GL context
+    Job upload = { UploadTextureJob, request, NULL, JOB_QUEUE_MAIN_THREAD };
+    RunJobs(&upload, 1);
+}
+
+static void RequestTextureLoad(App* app, u32 texIdx)
+{
+    const Texture& tex = app->textures[texIdx];
+    TextureLoadRequest* request = new TextureLoadRequest{ app, texIdx, tex.filepath, tex.usageFlags, GetTextureQualityMaxSize(app->textureQuality), 0, {}, NULL };
+    app->pendingAssetLoads++;
+
+    Job decode = { DecodeTextureJob, request, NULL, JOB_QUEUE_BACKGROUND };
+    RunJobs(&decode, 1);
+}
+
+u32 LoadTexture2DAsync(App* app, const char* filepath, u32 placeholderTexIdx, u32 usageFlags)
+{
+    u32 texIdx = FindTexture(app, filepath);
+    if (texIdx != UINT32_MAX)
+        return texIdx;
+
+    texIdx = CreateTexture(app, filepath, placeholderTexIdx, usageFlags);
+    RequestTextureLoad(app, texIdx);
+    return texIdx;
+}
+
+// Every level comes with the texture, nothing is generated on the GPU
+static GLuint CreateTexture2DFromCompressed(const CompressedTexture& texture)
+{
+    const GLenum format = GetCompressedFormatGL(texture.format);
+
+    GLuint texHandle;
+    glGenTextures(1, &texHandle);
+    glBindTexture(GL_TEXTURE_2D, texHandle);
+    glTexStorage2D(GL_TEXTURE_2D, texture.levelCount, format, texture.width, texture.height);
+    for (u32 levelIdx = 0; levelIdx < texture.levelCount; ++levelIdx)
+    {
+        const CompressedTextureLevel& level = texture.levels[levelIdx];
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, levelIdx, 0, 0, level.width, level.height, format, level.size, texture.data.data() + level.offset);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levelCount - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return texHandle;
+}
+
+u32 LoadTexture2D(App* app, const char* filepath, u32 usageFlags)
+{
+    u32 texIdx = FindTexture(app, filepath);
+    if (texIdx != UINT32_MAX)
+        return texIdx;
+
+    // Reloaded asynchronously if evicted, with the placeholder of its kind meanwhile
+    const u32 placeholderTexIdx = (usageFlags & TEXTURE_USAGE_NORMAL_MAP) ? app->normalTexIdx : app->whiteTexIdx;
+
+    u64 sourceHash, sourceSize;
+    if (!HashFile(filepath, sourceHash, sourceSize))
+    {
+        ELOG("Could not open file %s", filepath);
+        return UINT32_MAX;
+    }
+
+#if COMPRESS_TEXTURES
+    CompressedTexture texture;
+    if (!LoadCompressedTexture(filepath, usageFlags | TEXTURE_USAGE_FLIP_VERTICALLY, texture))
+        return UINT32_MAX;
+
+    texIdx = CreateTexture(app, filepath, placeholderTexIdx, usageFlags);
+    if (!ShareTextureContent(app, texIdx, MakeContentKey(sourceHash, usageFlags)))
+    {
+        DropTopLevels(texture, GetTextureQualityMaxSize(app->textureQuality));
+        AddResidentTexture(app, texIdx, texture.decodedSize, texture.data.size());
+        app->textures[texIdx].handle = CreateTexture2DFromCompressed(texture);
+        app->textures[texIdx].state = ASSET_LOADED;
+    }
+#else
+    Image image = LoadImage(filepath);
+    if (!image.pixels)
+        return UINT32_MAX;
+
+    texIdx = CreateTexture(app, filepath, placeholderTexIdx, usageFlags);
+    if (!ShareTextureContent(app, texIdx, MakeContentKey(sourceHash, usageFlags)))
+    {
+        AddResidentTexture(app, texIdx, GetDecodedImageSize(image), GetDecodedImageSize(image));
+        app->textures[texIdx].handle = CreateTexture2DFromImage(image);
+        app->textures[texIdx].state = ASSET_LOADED;
+    }
+    FreeImage(image);
+#endif
+
+    return texIdx;
+}
+
+void AddTextureRef(App* app, u32 texIdx)
+{
+    Texture& tex = app->textures[texIdx];
+    tex.refCount++;
+    if (tex.aliasOf != UINT32_MAX)
+        app->textures[tex.aliasOf].refCount++;
+}
+
+void ReleaseTextureRef(App* app, u32 texIdx)
+{
+    Texture& tex = app->textures[texIdx];
+    ASSERT(tex.refCount > 0, "Texture reference released twice");
+    tex.refCount--;
+    if (tex.aliasOf != UINT32_MAX)
+        app->textures[tex.aliasOf].refCount--;
+}
+
+GLuint UseTexture(App* app, u32 texIdx)
+{
+    u32 ownerIdx = app->textures[texIdx].aliasOf != UINT32_MAX ? app->textures[texIdx].aliasOf : texIdx;
+    Texture& tex = app->textures[ownerIdx];
+    tex.lastUsedFrame = app->textureRegistry.frame;
+
+    if (tex.state == ASSET_EVICTED)
+    {
+        tex.state = ASSET_LOADING;
+        app->textureRegistry.stats.reloads++;
+        RequestTextureLoad(app, ownerIdx);
+    }
+
+    return tex.handle;
+}
+
+static void EvictTexture(App* app, u32 texIdx)
+{
+    TextureRegistry& registry = app->textureRegistry;
+    Texture& tex = app->textures[texIdx];
+
+    glDeleteTextures(1, &tex.handle);
+    tex.handle = app->textures[tex.placeholderTexIdx].handle;
+    tex.state = ASSET_EVICTED;
+
+    registry.residentBytes -= tex.residentSize;
+    registry.decodedBytes -= tex.decodedSize;
+    tex.residentSize = 0;
+    tex.decodedSize = 0;
+    registry.stats.evictions++;
+}
+
+void UpdateTextureRegistry(App* app)
+{
+    TextureRegistry& registry = app->textureRegistry;
+    registry.frame++;
+
+    if (registry.budgetBytes == 0 || registry.residentBytes <= registry.budgetBytes)
+        return;
+
+    // Uploaded textures owning their storage, not used for a while. Placeholders have no path.
+    std::vector<u32> candidates;
+    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+    {
+        const Texture& tex = app->textures[texIdx];
+        if (tex.aliasOf == UINT32_MAX && tex.state == ASSET_LOADED && tex.residentSize > 0 && !tex.filepath.empty() &&
+            tex.lastUsedFrame + TEXTURE_EVICTION_MIN_AGE <= registry.frame)
+            candidates.push_back(texIdx);
+    }
+
+    // Unreferenced ones first, then the least recently used
+    std::sort(candidates.begin(), candidates.end(), [app](u32 a, u32 b) {
+        const Texture& ta = app->textures[a];
+        const Texture& tb = app->textures[b];
+        if ((ta.refCount > 0) != (tb.refCount > 0))
+            return ta.refCount == 0;
+        return ta.lastUsedFrame < tb.lastUsedFrame;
+    });
+
+    for (u32 texIdx : candidates)
+    {
+        if (registry.residentBytes <= registry.budgetBytes)
+            break;
+        EvictTexture(app, texIdx);
+    }
+}
+
+void AddTextureMemory(App* app, const char* name, u64 decodedSize, u64 residentSize)
+{
+    TextureRegistry& registry = app->textureRegistry;
+    registry.decodedBytes += decodedSize;
+    registry.residentBytes += residentSize;
+    ILOG("Loaded %s: %.1f KB (%.1f KB decoded), textures total %.1f MB (%.1f MB decoded)", name,
+         residentSize / 1024.0f, decodedSize / 1024.0f,
+         registry.residentBytes / (1024.0f * 1024.0f), registry.decodedBytes / (1024.0f * 1024.0f));
+}
@@ -0,0 +1,81 @@
+//
+// texture_registry.h: Loading and residency of the 2D textures. They are looked up by
+// the hash of their path, images loaded under several paths share a single GPU texture
+// (by the hash of their content), materials hold references to them, and the least
+// recently used ones are evicted when over the VRAM budget (back to their placeholder)
+// and reloaded when used again.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+#include <unordered_map>
+
+struct App;
+
+// With 0, the budget is half the GPU memory when the driver reports it, none otherwise
+#define DEFAULT_TEXTURE_BUDGET_MB 0
+
+// Frames since its last use before a texture can be evicted, so what's on screen never is
+#define TEXTURE_EVICTION_MIN_AGE 2
+
+struct TextureRegistryStats
+{
+    u32 evictions;
+    u32 reloads;
+    u32 dedups;    // Textures sharing the storage of another one
+};
+
+struct TextureRegistry
+{
+    std::unordered_map<u64, u32> byPath;    // Hash of the path -> texture
+    std::unordered_map<u64, u32> byContent; // Hash of the source file and usage -> texture owning the storage
+    u64                          residentBytes;
+    u64                          decodedBytes; // What the resident textures would take as RGB(A)8
+    u64                          budgetBytes;  // 0 for no budget
+    u32                          frame;
+    TextureRegistryStats         stats;
+};
+
+void InitTextureRegistry(App* app);
+
+/**
+ * Loads (or finds) a texture right away. usageFlags are TextureUsageFlags, the image is
+ * always flipped vertically.
+ */
+u32 LoadTexture2D(App* app, const char* filepath, u32 usageFlags = 0);
+
+/**
+ * Returns the index of a texture that uses the handle of placeholderTexIdx until the
+ * image is decoded and compressed (on the job system) and uploaded (through the upload
+ * queue). If it fails to load, it gets magentaTexIdx's handle. usageFlags are
+ * TextureUsageFlags: normal maps are compressed to BC5, sRGB colour is mipmapped in
+ * linear space. The levels above the app->textureQuality tier are not uploaded.
+ */
+u32 LoadTexture2DAsync(App* app, const char* filepath, u32 placeholderTexIdx, u32 usageFlags = 0);
+
+/**
+ * References held by materials (or anything else keeping a texture index). Textures
+ * without references are the first ones evicted.
+ */
+void AddTextureRef(App* app, u32 texIdx);
+void ReleaseTextureRef(App* app, u32 texIdx);
+
+/**
+ * Handle to bind for a texture this frame. Marks it as used and, if it was evicted,
+ * starts reloading it (meanwhile, the handle is the one of its placeholder).
+ */
+GLuint UseTexture(App* app, u32 texIdx);
+
+/**
+ * Evicts the least recently used textures until the resident ones fit in the budget.
+ * Called once per frame, before anything is drawn.
+ */
+void UpdateTextureRegistry(App* app);
+
+/**
+ * Accounts the memory of a texture that is not in the registry (e.g. the skybox), it
+ * counts for the budget but is never evicted.
+ */
+void AddTextureMemory(App* app, const char* name, u64 decodedSize, u64 residentSize);
@@ -0,0 +1,379 @@
+#include "upload_queue.h"
+#include "engine.h"
+#include "buffer_management.h"
+#include "texture_compression.h"
+
+#include <chrono>
+#include <algorithm>
+
+// A piece of a geometry request that fits in this frame's budget, staged after sorting
+struct GeometryChunk
+{
+    UploadType type;
+    GLuint     handle;
+    u32        dstOffset;
+    const u8*  data;
+    u32        size;
+};
+
+void InitUploadQueue(App* app)
+{
+    UploadQueue& queue = app->uploadQueue;
+    queue.requests.clear();
+    queue.copies.clear();
+    queue.nextTicket = 1;
+    queue.completedTicket = 0;
+    queue.pendingBytes = 0;
+    queue.byteBudget = UPLOAD_DEFAULT_BYTE_BUDGET;
+    queue.timeBudgetMs = UPLOAD_DEFAULT_TIME_BUDGET_MS;
+    queue.stats = {};
+
+    app->uploadBuffer = CreateRingBuffer(UPLOAD_STAGING_REGION_SIZE, CONSTANT_BUFFER_FRAMES, GL_COPY_READ_BUFFER);
+}
+
+static u32 PushUploadRequest(UploadQueue& queue, UploadRequest& request)
+{
+    request.ticket = queue.nextTicket++;
+    request.staged = 0;
+    queue.pendingBytes += request.size;
+    queue.requests.push_back(request);
+    return request.ticket;
+}
+
+u32 QueueGeometryUpload(App* app, UploadType type, u32 poolIdx, u32 dstOffset, const void* data, u32 size)
+{
+    ASSERT(type == UPLOAD_VERTICES || type == UPLOAD_INDICES, "Not a geometry upload");
+    if (size == 0)
+        return 0;
+
+    UploadRequest request = {};
+    request.type = type;
+    request.targetIdx = poolIdx;
+    request.dstOffset = dstOffset;
+    request.data = (const u8*)data;
+    request.size = size;
+    return PushUploadRequest(app->uploadQueue, request);
+}
+
+u32 QueueTextureUpload(App* app, u32 textureIdx, const Image& image)
+{
+    UploadRequest request = {};
+    request.type = UPLOAD_TEXTURE_2D;
+    request.targetIdx = textureIdx;
+    request.data = (const u8*)image.pixels;
+    request.width = image.size.x;
+    request.height = image.size.y;
+    request.channels = image.nchannels;
+    request.size = image.size.y * image.stride;
+    return PushUploadRequest(app->uploadQueue, request);
+}
+
+u32 QueueCompressedTextureUpload(App* app, u32 textureIdx, CompressedTexture* texture)
+{
+    UploadRequest request = {};
+    request.type = UPLOAD_TEXTURE_2D;
+    request.targetIdx = textureIdx;
+    request.data = texture->data.data();
+    request.size = (u32)texture->data.size();
+    request.width = texture->width;
+    request.height = texture->height;
+    request.compressed = texture;
+    return PushUploadRequest(app->uploadQueue, request);
+}
+
+bool IsUploadComplete(const UploadQueue& queue, u32 ticket)
+{
+    return ticket <= queue.completedTicket;
+}
+
+static void GetTextureFormat(u32 channels, GLenum& internalFormat, GLenum& dataFormat)
+{
+    switch (channels)
+    {
+        case 1: internalFormat = GL_R8; dataFormat = GL_RED; break;
+        case 2: internalFormat = GL_RG8; dataFormat = GL_RG; break;
+        case 3: internalFormat = GL_RGB8; dataFormat = GL_RGB; break;
+        case 4: internalFormat = GL_RGBA8; dataFormat = GL_RGBA; break;
+        default: ELOG("Upload queue - Unsupported number of channels"); internalFormat = GL_RGB8; dataFormat = GL_RGB;
+    }
+}
+
+// Immutable storage with the whole mip chain, level 0 is filled by bands of rows
+static GLuint CreateTextureStorage(const UploadRequest& request)
+{
+    GLenum internalFormat, dataFormat;
+    u32 levels = 1;
+    if (request.compressed)
+    {
+        internalFormat = GetCompressedFormatGL(request.compressed->format);
+        levels = request.compressed->levelCount;
+    }
+    else
+    {
+        GetTextureFormat(request.channels, internalFormat, dataFormat);
+        while ((glm::max(request.width, request.height) >> levels) > 0)
+            levels++;
+    }
+
+    GLuint texHandle;
+    glGenTextures(1, &texHandle);
+    glBindTexture(GL_TEXTURE_2D, texHandle);
+    glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, request.width, request.height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return texHandle;
+}
+
+static void IssueUploadCopies(App* app)
+{
+    UploadQueue& queue = app->uploadQueue;
+    Buffer& staging = app->uploadBuffer;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, staging.handle);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.handle);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (const UploadCopy& copy : queue.copies)
+    {
+        if (copy.type == UPLOAD_TEXTURE_2D)
+        {
+            glBindTexture(GL_TEXTURE_2D, copy.handle);
+            if (copy.compressedFormat != GL_NONE)
+            {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, copy.dstOffset, copy.width, copy.size, copy.compressedFormat, copy.compressedSize, (void*)(u64)copy.srcOffset);
+            }
+            else
+            {
+                GLenum internalFormat, dataFormat;
+                GetTextureFormat(copy.channels, internalFormat, dataFormat);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, copy.dstOffset, copy.width, copy.size, dataFormat, GL_UNSIGNED_BYTE, (void*)(u64)copy.srcOffset);
+            }
+
+            // Last rows of the texture, it replaces the placeholder
+            if (copy.textureIdx != UINT32_MAX)
+            {
+                // Compressed textures come with their mip chain
+                if (copy.compressedFormat == GL_NONE)
+                    glGenerateMipmap(GL_TEXTURE_2D);
+                Texture& texture = app->textures[copy.textureIdx];
+                texture.handle = copy.handle;
+                texture.state = ASSET_LOADED;
+            }
+        }
+        else
+        {
+            // Not through GL_ELEMENT_ARRAY_BUFFER, that would change the index buffer of the bound VAO
+            glBindBuffer(GL_COPY_WRITE_BUFFER, copy.handle);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, copy.srcOffset, copy.dstOffset, copy.size);
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Stages one region of the staging ring (or less, within the budgets) and issues its copies
+static void DrainUploadQueue(App* app, u32 byteBudget, f32 timeBudgetMs)
+{
+    UploadQueue& queue = app->uploadQueue;
+    Buffer& staging = app->uploadBuffer;
+    GeometryPool& pool = app->geometryPool;
+    UploadQueueStats& stats = queue.stats;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    BeginBufferRegion(staging);
+    const u32 budgetEnd = staging.head + glm::min(byteBudget, staging.regionSize);
+    queue.copies.clear();
+
+    // Textures are staged right away, geometry chunks are only collected to be sorted
+    std::vector<GeometryChunk> geometryChunks;
+    u32 geometryBytes = 0;
+
+    while (!queue.requests.empty())
+    {
+        UploadRequest& request = queue.requests.front();
+        const u32 remaining = request.size - request.staged;
+
+        if (request.type == UPLOAD_TEXTURE_2D && request.compressed)
+        {
+            // Whole rows of blocks of the current level only
+            AlignHead(staging, 4);
+            const CompressedTexture& texture = *request.compressed;
+            const CompressedTextureLevel& level = texture.levels[request.level];
+            const u32 rowSize = ((level.width + 3) / 4) * GetBlockSize(texture.format);
+            const u32 end = staging.head + geometryBytes;
+            const u32 available = end < budgetEnd ? budgetEnd - end : 0;
+            const u32 chunkSize = glm::min(level.offset + level.size - request.staged, available / rowSize * rowSize);
+            if (chunkSize == 0)
+                break;
+
+            if (request.textureHandle == 0)
+                request.textureHandle = CreateTextureStorage(request);
+
+            // In pixels, the last band of a level can end at a partial block
+            const u32 firstRow = (request.staged - level.offset) / rowSize * 4;
+
+            UploadCopy copy = {};
+            copy.type = UPLOAD_TEXTURE_2D;
+            copy.handle = request.textureHandle;
+            copy.srcOffset = staging.head;
+            copy.dstOffset = firstRow;
+            copy.size = glm::min(chunkSize / rowSize * 4, level.height - firstRow);
+            copy.width = level.width;
+            copy.compressedFormat = GetCompressedFormatGL(texture.format);
+            copy.compressedSize = chunkSize;
+            copy.level = request.level;
+            copy.textureIdx = request.staged + chunkSize == request.size ? request.targetIdx : UINT32_MAX;
+            queue.copies.push_back(copy);
+
+            PushData(staging, request.data + request.staged, chunkSize);
+            request.staged += chunkSize;
+            queue.pendingBytes -= chunkSize;
+            stats.bytes += chunkSize;
+
+            if (request.staged == level.offset + level.size)
+                request.level++;
+        }
+        else if (request.type == UPLOAD_TEXTURE_2D)
+        {
+            // Whole rows only, the unpack offset of a band must be aligned to its pixel size
+            AlignHead(staging, 4);
+            const u32 rowSize = request.width * request.channels;
+            const u32 end = staging.head + geometryBytes;
+            const u32 available = end < budgetEnd ? budgetEnd - end : 0;
+            const u32 chunkSize = glm::min(remaining, available / rowSize * rowSize);
+            if (chunkSize == 0)
+                break;
+
+            if (request.textureHandle == 0)
+                request.textureHandle = CreateTextureStorage(request);
+
+            UploadCopy copy = {};
+            copy.type = UPLOAD_TEXTURE_2D;
+            copy.handle = request.textureHandle;
+            copy.srcOffset = staging.head;
+            copy.dstOffset = request.staged / rowSize;
+            copy.size = chunkSize / rowSize;
+            copy.width = request.width;
+            copy.channels = request.channels;
+            copy.textureIdx = request.staged + chunkSize == request.size ? request.targetIdx : UINT32_MAX;
+            queue.copies.push_back(copy);
+
+            PushData(staging, request.data + request.staged, chunkSize);
+            request.staged += chunkSize;
+            queue.pendingBytes -= chunkSize;
+            stats.bytes += chunkSize;
+        }
+        else
+        {
+            const u32 end = staging.head + geometryBytes;
+            const u32 available = end < budgetEnd ? budgetEnd - end : 0;
+            const u32 chunkSize = glm::min(remaining, available);
+            if (chunkSize == 0)
+                break;
+
+            GeometryChunk chunk;
+            chunk.type = request.type;
+            chunk.handle = request.type == UPLOAD_VERTICES ? pool.vertexPools[request.targetIdx].bufferHandle : pool.indexBufferHandle;
+            chunk.dstOffset = request.dstOffset + request.staged;
+            chunk.data = request.data + request.staged;
+            chunk.size = chunkSize;
+            geometryChunks.push_back(chunk);
+
+            geometryBytes += chunkSize;
+            request.staged += chunkSize;
+            queue.pendingBytes -= chunkSize;
+            stats.bytes += chunkSize;
+        }
+
+        if (request.staged == request.size)
+        {
+            if (request.compressed)
+                delete request.compressed;
+            else if (request.type == UPLOAD_TEXTURE_2D)
+            {
+                // FreeImage only needs the pixels, request.data is image.pixels
+                Image image = {};
+                image.pixels = (void*)request.data;
+                FreeImage(image);
+            }
+
+            // The copies are issued below, before anyone can check the ticket
+            queue.completedTicket = request.ticket;
+            queue.requests.pop_front();
+            stats.requestsCompleted++;
+        }
+
+        auto now = std::chrono::high_resolution_clock::now();
+        if (std::chrono::duration<f32, std::milli>(now - start).count() > timeBudgetMs)
+            break;
+    }
+
+    // Sorted by destination, the chunks that are contiguous in it become a single copy
+    std::sort(geometryChunks.begin(), geometryChunks.end(), [](const GeometryChunk& a, const GeometryChunk& b) {
+        return a.handle != b.handle ? a.handle < b.handle : a.dstOffset < b.dstOffset;
+    });
+
+    const u32 firstGeometryCopy = (u32)queue.copies.size();
+    for (const GeometryChunk& chunk : geometryChunks)
+    {
+        const u32 srcOffset = staging.head;
+        PushData(staging, chunk.data, chunk.size);
+
+        if (queue.copies.size() > firstGeometryCopy)
+        {
+            UploadCopy& last = queue.copies.back();
+            if (last.handle == chunk.handle && last.dstOffset + last.size == chunk.dstOffset)
+            {
+                last.size += chunk.size;
+                continue;
+            }
+        }
+
+        UploadCopy copy = {};
+        copy.type = chunk.type;
+        copy.handle = chunk.handle;
+        copy.srcOffset = srcOffset;
+        copy.dstOffset = chunk.dstOffset;
+        copy.size = chunk.size;
+        copy.textureIdx = UINT32_MAX;
+        queue.copies.push_back(copy);
+    }
+
+    // The copies read the staging buffer, so it has to be unmapped (if not persistent) first
+    UnmapBufferRegion(staging);
+    IssueUploadCopies(app);
+    EndBufferRegion(staging);
+
+    stats.copies += (u32)queue.copies.size();
+    auto end = std::chrono::high_resolution_clock::now();
+    stats.timeMs += std::chrono::duration<f32, std::milli>(end - start).count();
+}
+
+void ProcessUploadQueue(App* app)
+{
+    UploadQueue& queue = app->uploadQueue;
+    queue.stats = {};
+
+    if (queue.requests.empty())
+        return;
+
+    // A row of the widest texture always fits
+    DrainUploadQueue(app, glm::max(queue.byteBudget, 64u * 1024u), queue.timeBudgetMs);
+}
+
+void FlushUploadQueue(App* app)
+{
+    UploadQueue& queue = app->uploadQueue;
+    while (!queue.requests.empty())
+        DrainUploadQueue(app, UPLOAD_STAGING_REGION_SIZE, FLT_MAX);
+}
@@ -0,0 +1,129 @@
+//
+// upload_queue.h: Deferred uploads of geometry and texture data. Requests are staged
+// through a persistently mapped ring buffer (used as the source of buffer copies and
+// as the pixel unpack buffer of texture uploads) and drained every frame within a byte
+// and time budget, so assets arriving mid-session don't stall a frame.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+#include <deque>
+
+struct App;
+struct Image;
+struct CompressedTexture;
+
+#define UPLOAD_STAGING_REGION_SIZE    (8 * 1024 * 1024)
+#define UPLOAD_DEFAULT_BYTE_BUDGET    (4 * 1024 * 1024)
+#define UPLOAD_DEFAULT_TIME_BUDGET_MS 2.0f
+
+enum UploadType
+{
+    UPLOAD_VERTICES,   // Into the buffer of a vertex pool of the geometry pool
+    UPLOAD_INDICES,    // Into the index buffer of the geometry pool
+    UPLOAD_TEXTURE_2D, // Level 0 of a texture, by bands of rows, mipmaps generated at the end.
+                       // Compressed textures upload every level, by bands of block rows.
+};
+
+struct UploadRequest
+{
+    UploadType type;
+    u32        ticket;
+    u32        targetIdx;  // Vertex pool or texture index
+    u32        dstOffset;  // In bytes, for geometry
+    const u8*  data;       // Owned by the caller for geometry, by the request for textures
+    u32        size;       // In bytes
+    u32        staged;     // Bytes already staged
+
+    // Textures
+    u32        width;
+    u32        height;
+    u32        channels;
+    GLuint     textureHandle; // Created when its first rows are staged
+    CompressedTexture* compressed; // Owned by the request, NULL if not compressed
+    u32        level;         // Being staged, for compressed textures
+};
+
+// A copy out of the staging buffer. They are recorded while staging and issued once
+// the region is unmapped (which only matters when it isn't persistently mapped).
+struct UploadCopy
+{
+    UploadType type;
+    GLuint     handle;     // Destination buffer or texture
+    u32        srcOffset;  // In the staging buffer
+    u32        dstOffset;  // In bytes for buffers, first row for textures
+    u32        size;       // In bytes for buffers, rows for textures
+    u32        width;
+    u32        channels;
+    u32        textureIdx; // Texture completed by this copy, UINT32_MAX otherwise
+
+    // Compressed textures
+    GLenum     compressedFormat; // GL_NONE if not compressed
+    u32        compressedSize;   // In bytes
+    u32        level;
+};
+
+struct UploadQueueStats
+{
+    u32 bytes;
+    u32 copies;            // After coalescing
+    u32 requestsCompleted;
+    f32 timeMs;
+};
+
+struct UploadQueue
+{
+    std::deque<UploadRequest> requests;
+    std::vector<UploadCopy>   copies;
+    u32                       nextTicket;
+    u32                       completedTicket; // Requests complete in order
+    u64                       pendingBytes;
+
+    u32                       byteBudget;
+    f32                       timeBudgetMs;
+    UploadQueueStats          stats;
+};
+
+/**
+ * Creates the staging ring buffer (app->uploadBuffer). Must be called before queueing
+ * anything.
+ */
+void InitUploadQueue(App* app);
+
+/**
+ * Queues a copy of size bytes to dstOffset of the vertex pool (UPLOAD_VERTICES) or of
+ * the index buffer (UPLOAD_INDICES) of the geometry pool. The data is not copied, it
+ * has to stay alive until the upload completes. Returns the ticket of the request.
+ */
+u32 QueueGeometryUpload(App* app, UploadType type, u32 poolIdx, u32 dstOffset, const void* data, u32 size);
+
+/**
+ * Queues the upload of a decoded image into a new texture. The queue takes ownership
+ * of the pixels. Until the upload completes, the texture keeps its placeholder handle.
+ */
+u32 QueueTextureUpload(App* app, u32 textureIdx, const Image& image);
+
+/**
+ * Same for a block compressed texture with its mip chain. The queue takes ownership of
+ * the texture (it has to be allocated with new).
+ */
+u32 QueueCompressedTextureUpload(App* app, u32 textureIdx, CompressedTexture* texture);
+
+/**
+ * True once every command of the request with that ticket has been issued. Ticket 0 is
+ * always complete.
+ */
+bool IsUploadComplete(const UploadQueue& queue, u32 ticket);
+
+/**
+ * Stages and issues queued uploads until the byte or time budget of the frame runs out.
+ * At least one chunk is uploaded per call, so progress is guaranteed.
+ */
+void ProcessUploadQueue(App* app);
+
+/**
+ * Issues every queued upload, ignoring the budgets (e.g. before moving geometry around).
+ */
+void FlushUploadQueue(App* app);
@@ -0,0 +1,158 @@
+#include "vertex_encoding.h"
+#include "geometry_pool.h"
+
+#include <glm/gtc/packing.hpp>
+
+VertexDecoding MakeVertexDecoding(VertexEncoding encoding, const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+{
+    VertexDecoding decoding;
+    if (encoding == VERTEX_ENCODING_COMPACT)
+    {
+        // Flat AABBs still need a scale, that axis quantizes to 0 anyway
+        decoding.positionOffset = glm::vec4(aabbMin, 0.0f);
+        decoding.positionScale = glm::vec4(glm::max(aabbMax - aabbMin, glm::vec3(1e-6f)), (f32)encoding);
+    }
+    else
+    {
+        decoding.positionOffset = glm::vec4(0.0f);
+        decoding.positionScale = glm::vec4(1.0f, 1.0f, 1.0f, (f32)encoding);
+    }
+    return decoding;
+}
+
+static const VertexBufferAttribute* FindAttribute(const VertexBufferLayout& layout, u8 location)
+{
+    for (const VertexBufferAttribute& attribute : layout.attributes)
+        if (attribute.location == location)
+            return &attribute;
+    return NULL;
+}
+
+static glm::vec3 ReadVec3(const float* vertex, const VertexBufferAttribute* attribute)
+{
+    const float* v = vertex + attribute->offset / sizeof(float);
+    return glm::vec3(v[0], v[1], v[2]);
+}
+
+static u16 QuantizeUnorm16(f32 v)
+{
+    return (u16)(glm::clamp(v, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+static i16 QuantizeSnorm16(f32 v)
+{
+    return (i16)roundf(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+glm::quat EncodeQTangent(const glm::vec3& normal, const glm::vec3& tangent, const glm::vec3& bitangent)
+{
+    const glm::vec3 n = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 0.0f, 1.0f);
+
+    // Gram-Schmidt, or any perpendicular if the tangent is missing or degenerate
+    glm::vec3 t = tangent - n * glm::dot(n, tangent);
+    if (glm::length(t) < 1e-6f)
+        t = glm::cross(glm::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f), n);
+    t = glm::normalize(t);
+    const glm::vec3 b = glm::cross(n, t);
+
+    glm::quat q = glm::normalize(glm::quat_cast(glm::mat3(t, b, n)));
+    if (q.w < 0.0f)
+        q = -q;
+
+    // w must not quantize to 0, its sign is the handedness
+    const f32 bias = 1.0f / 32767.0f;
+    if (q.w < bias)
+    {
+        const f32 scale = sqrtf(1.0f - bias * bias) / glm::length(glm::vec3(q.x, q.y, q.z));
+        q = glm::quat(bias, q.x * scale, q.y * scale, q.z * scale);
+    }
+
+    if (glm::dot(bitangent, b) < 0.0f)
+        q = -q;
+    return q;
+}
+
+void EncodeCompactVertices(const float* vertices, u32 vertexCount, const VertexBufferLayout& floatLayout,
+                           const VertexDecoding& decoding, VertexBufferLayout& layout, std::vector<u8>& encoded)
+{
+    const u32 floatStride = floatLayout.stride / sizeof(float);
+    const VertexBufferAttribute* position = FindAttribute(floatLayout, POSITION_LOCATION);
+    const VertexBufferAttribute* normal = FindAttribute(floatLayout, NORMAL_LOCATION);
+    const VertexBufferAttribute* texCoord = FindAttribute(floatLayout, TEXCOORD_LOCATION);
+    const VertexBufferAttribute* tangent = FindAttribute(floatLayout, TANGENT_LOCATION);
+    const VertexBufferAttribute* bitangent = FindAttribute(floatLayout, BITANGENT_LOCATION);
+    ASSERT(position && normal, "Vertices to encode need a position and a normal");
+
+    bool halfTexCoords = texCoord != NULL;
+    for (u32 i = 0; i < vertexCount && halfTexCoords; ++i)
+    {
+        const float* uv = vertices + i * floatStride + texCoord->offset / sizeof(float);
+        halfTexCoords = glm::abs(uv[0]) <= COMPACT_TEXCOORD_MAX_RANGE && glm::abs(uv[1]) <= COMPACT_TEXCOORD_MAX_RANGE;
+    }
+
+    layout = {};
+    layout.attributes.push_back(VertexBufferAttribute{ POSITION_LOCATION, 4, 0, GL_UNSIGNED_SHORT, true });
+    layout.attributes.push_back(VertexBufferAttribute{ NORMAL_LOCATION, 4, 8, GL_SHORT, true });
+    layout.stride = 16;
+    if (texCoord)
+    {
+        layout.attributes.push_back(VertexBufferAttribute{ TEXCOORD_LOCATION, 2, layout.stride, (GLenum)(halfTexCoords ? GL_HALF_FLOAT : GL_FLOAT), false });
+        layout.stride += halfTexCoords ? 2 * sizeof(u16) : 2 * sizeof(float);
+    }
+
+    const glm::vec3 offset = glm::vec3(decoding.positionOffset);
+    const glm::vec3 scale = glm::vec3(decoding.positionScale);
+
+    encoded.resize((size_t)vertexCount * layout.stride);
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        const float* vertex = vertices + i * floatStride;
+        u8* out = encoded.data() + (size_t)i * layout.stride;
+
+        const glm::vec3 p = (ReadVec3(vertex, position) - offset) / scale;
+        const u16 quantizedPosition[4] = { QuantizeUnorm16(p.x), QuantizeUnorm16(p.y), QuantizeUnorm16(p.z), 0 };
+        memcpy(out, quantizedPosition, sizeof(quantizedPosition));
+
+        const glm::vec3 n = ReadVec3(vertex, normal);
+        const glm::vec3 t = tangent ? ReadVec3(vertex, tangent) : glm::vec3(0.0f);
+        const glm::vec3 b = bitangent ? ReadVec3(vertex, bitangent) : glm::cross(n, t);
+        const glm::quat q = EncodeQTangent(n, t, b);
+        const i16 qtangent[4] = { QuantizeSnorm16(q.x), QuantizeSnorm16(q.y), QuantizeSnorm16(q.z), QuantizeSnorm16(q.w) };
+        memcpy(out + 8, qtangent, sizeof(qtangent));
+
+        if (texCoord)
+        {
+            const float* uv = vertex + texCoord->offset / sizeof(float);
+            if (halfTexCoords)
+            {
+                const u16 halfUV[2] = { glm::packHalf1x16(uv[0]), glm::packHalf1x16(uv[1]) };
+                memcpy(out + 16, halfUV, sizeof(halfUV));
+            }
+            else
+            {
+                memcpy(out + 16, uv, 2 * sizeof(float));
+            }
+        }
+    }
+}
+
+GLenum EncodeIndices(const u32* indices, u32 indexCount, u32 vertexCount, std::vector<u8>& encoded)
+{
+    if (vertexCount > 65536)
+    {
+        encoded.resize((size_t)indexCount * sizeof(u32));
+        memcpy(encoded.data(), indices, encoded.size());
+        return GL_UNSIGNED_INT;
+    }
+
+    encoded.resize((size_t)indexCount * sizeof(u16));
+    u16* out = (u16*)encoded.data();
+    for (u32 i = 0; i < indexCount; ++i)
+        out[i] = (u16)indices[i];
+    return GL_UNSIGNED_SHORT;
+}
+
+u32 GetIndexSize(GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+}
@@ -0,0 +1,71 @@
+//
+// vertex_encoding.h: Compact vertex and index formats for the imported meshes.
+// Positions are quantized to 16 bits relative to the AABB of the mesh (dequantized per
+// instance in the vertex shader), the normal, tangent and bitangent are a single
+// QTangent (a quaternion whose sign is the handedness of the frame), texture
+// coordinates are half floats, and submeshes with few vertices get 16 bit indices.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+#include <glm/gtc/quaternion.hpp>
+
+struct VertexBufferLayout;
+
+enum VertexEncoding
+{
+    VERTEX_ENCODING_FLOAT,   // 14 floats: position, normal, uv, tangent and bitangent
+    VERTEX_ENCODING_COMPACT, // 20 bytes: unorm16 position, snorm16 QTangent, half uv
+};
+
+// Encoding of the models imported from now on, part of the mesh cache key
+#define MODEL_VERTEX_ENCODING VERTEX_ENCODING_COMPACT
+
+// Texture coordinates beyond it (tiling) would lose too much as half floats, they stay floats
+#define COMPACT_TEXCOORD_MAX_RANGE 2.0f
+
+// Vertex attribute locations, as the shaders declare them
+#define POSITION_LOCATION  0
+#define NORMAL_LOCATION    1 // The QTangent in the compact encoding
+#define TEXCOORD_LOCATION  2
+#define TANGENT_LOCATION   3
+#define BITANGENT_LOCATION 4
+
+#define INSTANCE_DECODING_BINDING 6
+
+// Per instance, read by the vertex shaders to decode the vertices of its mesh
+struct VertexDecoding
+{
+    glm::vec4 positionOffset; // xyz: min of the AABB the positions are quantized in
+    glm::vec4 positionScale;  // xyz: size of that AABB, w: VertexEncoding
+};
+
+/**
+ * Vertex decoding of a mesh. The float encoding has offset 0 and scale 1, so the
+ * shaders can always apply it.
+ */
+VertexDecoding MakeVertexDecoding(VertexEncoding encoding, const glm::vec3& aabbMin, const glm::vec3& aabbMax);
+
+/**
+ * Converts vertices in the float layout built on import (position and normal, then
+ * the optional uv and tangent and bitangent) to the compact encoding, returning its
+ * layout. Positions are quantized in the AABB of 'decoding'.
+ */
+void EncodeCompactVertices(const float* vertices, u32 vertexCount, const VertexBufferLayout& floatLayout,
+                           const VertexDecoding& decoding, VertexBufferLayout& layout, std::vector<u8>& encoded);
+
+/**
+ * A unit quaternion rotating the Z axis to the normal and the X axis to the tangent
+ * (orthogonalized), negated if the bitangent is -cross(normal, tangent).
+ */
+glm::quat EncodeQTangent(const glm::vec3& normal, const glm::vec3& tangent, const glm::vec3& bitangent);
+
+/**
+ * Writes the indices as 16 bits if every vertex can be addressed with them, 32 bits
+ * otherwise. Returns the GL index type.
+ */
+GLenum EncodeIndices(const u32* indices, u32 indexCount, u32 vertexCount, std::vector<u8>& encoded);
+
+u32 GetIndexSize(GLenum indexType);
@@ -38,59 +38,98 @@ void main() {
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-layout(location=0) in vec3 aPosition;
-layout(location=1) in vec3 aNormals;
+layout(location=0) in vec4 aPosition;
+layout(location=1) in vec4 aNormals;
 layout(location=2) in vec2 aTexCoord;
+layout(location=5) in uint aInstanceIdx;
 
-struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     	 float 			intensity;
+struct Light
+{
+	vec4	positionRadius;
+	vec4	colorIntensity;
+	vec4	directionType; // w: 0 dir, 1 point
 };
 
 layout(binding = 0, std140) uniform GlobalParms
 {
 	vec3 			uCameraPosition;
- 	int 			uLightCount;
- 	Light			uLight[16];
+	int 			uLightCount;
+	int 			uDirectionalLightCount;
+	mat4 			uViewMatrix;
+	mat4 			uViewProjectionMatrix;
+	uvec4 			uClusterGrid;
+	vec4 			uClusterDepthParams; // near, far, slice scale, slice bias
+};
+
+layout(binding = 2, std430) readonly buffer Lights
+{
+	Light uLights[];
 };
 
-layout(binding = 1, std140) uniform LocalParms
+// World matrices of the instances, aInstanceIdx is advanced per instance from the base instance of the draw
+layout(binding = 5, std430) readonly buffer InstanceMatrices
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	mat4 uInstanceWorldMatrices[];
 };
 
+// How to decode the vertices of the mesh of the instances, same indexing as the matrices
+struct VertexDecoding
+{
+	vec4	positionOffset;
+	vec4	positionScale; // w: 0 floats, 1 compact (quantized position, QTangent instead of the normal)
+};
+
+layout(binding = 6, std430) readonly buffer InstanceDecodings
+{
+	VertexDecoding uInstanceDecodings[];
+};
+
+vec3 RotateByQuaternion(vec4 q, vec3 v)
+{
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
 out vec2 vTexCoord;
 out vec3 vNormals;
 out vec3 vViewDir;
 out vec3 vPosition;
 
 void main() {
-    gl_Position = uWorldViewProjectionMatrix * uWorldMatrix * vec4(aPosition, 1.0);
-    vNormals = mat3(transpose(inverse(uWorldMatrix))) * aNormals;
+    mat4 worldMatrix = uInstanceWorldMatrices[aInstanceIdx];
+    VertexDecoding decoding = uInstanceDecodings[aInstanceIdx];
+    vec3 position = aPosition.xyz * decoding.positionScale.xyz + decoding.positionOffset.xyz;
+    vec3 normal = decoding.positionScale.w > 0.5 ? RotateByQuaternion(normalize(aNormals), vec3(0.0, 0.0, 1.0)) : aNormals.xyz;
+
+    gl_Position = uViewProjectionMatrix * worldMatrix * vec4(position, 1.0);
+    vNormals = mat3(transpose(inverse(worldMatrix))) * normal;
     vTexCoord = aTexCoord;
-    vViewDir = uCameraPosition - aPosition;
-    vPosition = vec3(uWorldMatrix * vec4(aPosition,1.0));
+    vViewDir = uCameraPosition - position;
+    vPosition = vec3(worldMatrix * vec4(position,1.0));
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
- struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     float 			intensity;
+struct Light
+{
+	vec4	positionRadius;
+	vec4	colorIntensity;
+	vec4	directionType; // w: 0 dir, 1 point
 };
 
 layout(binding = 0, std140) uniform GlobalParms
 {
 	vec3 			uCameraPosition;
 	int 			uLightCount;
-	Light			uLight[16];
+	int 			uDirectionalLightCount;
+	mat4 			uViewMatrix;
+	mat4 			uViewProjectionMatrix;
+	uvec4 			uClusterGrid;
+	vec4 			uClusterDepthParams; // near, far, slice scale, slice bias
+};
+
+layout(binding = 2, std430) readonly buffer Lights
+{
+	Light uLights[];
 };
 
 in vec2 vTexCoord;
@@ -110,11 +149,11 @@ vec3 PointLight(vec3 lightPosition, vec3 color, vec3 normal, vec3 fragPosition,
 void main() {
 	vec3 lightsColors = vec3(0.0,0.0,0.0);
 	for(int i = 0; i < uLightCount; ++i)
-	{		if(uLight[i].type == 0) //Directional
-			    lightsColors += DirectionalLight(uLight[i].position, uLight[i].color, normalize(vNormals));
+	{		if(uLights[i].directionType.w == 0.0) //Directional
+			    lightsColors += DirectionalLight(uLights[i].positionRadius.xyz, uLights[i].colorIntensity.rgb, normalize(vNormals));
             else //PointLight
             {
-                lightsColors += PointLight(uLight[i].position, uLight[i].color, vNormals, vPosition,normalize(vViewDir), vTexCoord);
+                lightsColors += PointLight(uLights[i].positionRadius.xyz, uLights[i].colorIntensity.rgb, vNormals, vPosition,normalize(vViewDir), vTexCoord);
             }
 	}
 	oColor 		= vec4(lightsColors, 1.0)*texture(uTexture, vTexCoord);
@@ -173,24 +212,45 @@ vec3 PointLight(vec3 lightPos, vec3 color, vec3 normal, vec3 fragPosition, vec3
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-layout(location=0) in vec3 aPosition;
-layout(location=1) in vec3 aNormals;
+layout(location=0) in vec4 aPosition;
+layout(location=1) in vec4 aNormals;   // Or the QTangent, in the compact encoding
 layout(location=2) in vec2 aTexCoord;
 layout(location=3) in vec3 aTangents;
 layout(location=4) in vec3 aBiTangents;
+layout(location=5) in uint aInstanceIdx;
 
 layout(binding = 0, std140) uniform GlobalParms
 {
 	vec3 			uCameraPosition;
- 	int 			uLightCount;
+	int 			uLightCount;
+	int 			uDirectionalLightCount;
+	mat4 			uViewMatrix;
+	mat4 			uViewProjectionMatrix;
+};
+
+// World matrices of the instances, aInstanceIdx is advanced per instance from the base instance of the draw
+layout(binding = 5, std430) readonly buffer InstanceMatrices
+{
+	mat4 uInstanceWorldMatrices[];
+};
+
+// How to decode the vertices of the mesh of the instances, same indexing as the matrices
+struct VertexDecoding
+{
+	vec4	positionOffset;
+	vec4	positionScale; // w: 0 floats, 1 compact (quantized position, QTangent instead of the normal)
 };
 
-layout(binding = 1, std140) uniform LocalParms
+layout(binding = 6, std430) readonly buffer InstanceDecodings
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	VertexDecoding uInstanceDecodings[];
 };
 
+vec3 RotateByQuaternion(vec4 q, vec3 v)
+{
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
 out vec2 vTexCoord;
 out vec3 vNormals;
 out vec3 vViewDir;
@@ -199,15 +259,30 @@ out mat3 TBN;
 out mat3 worldViewMatrix;
 
 void main() {
-    gl_Position = uWorldViewProjectionMatrix * uWorldMatrix * vec4(aPosition, 1.0);
-    vNormals = mat3(transpose(inverse(uWorldMatrix))) * aNormals;
+    mat4 worldMatrix = uInstanceWorldMatrices[aInstanceIdx];
+    VertexDecoding decoding = uInstanceDecodings[aInstanceIdx];
+    vec3 position = aPosition.xyz * decoding.positionScale.xyz + decoding.positionOffset.xyz;
+    vec3 normal = aNormals.xyz;
+    vec3 tangent = aTangents;
+    vec3 bitangent = aBiTangents;
+    if (decoding.positionScale.w > 0.5)
+    {
+        // The sign of w is the handedness of the frame
+        vec4 q = normalize(aNormals);
+        normal = RotateByQuaternion(q, vec3(0.0, 0.0, 1.0));
+        tangent = RotateByQuaternion(q, vec3(1.0, 0.0, 0.0));
+        bitangent = cross(normal, tangent) * (aNormals.w < 0.0 ? -1.0 : 1.0);
+    }
+
+    gl_Position = uViewProjectionMatrix * worldMatrix * vec4(position, 1.0);
+    vNormals = mat3(transpose(inverse(worldMatrix))) * normal;
     vTexCoord = aTexCoord;
-    vViewDir = uCameraPosition - aPosition;
-    vPosition = vec3(uWorldMatrix * vec4(aPosition,1.0));
-    worldViewMatrix = mat3(uWorldMatrix);
-    vec3 T = normalize(vec3(uWorldMatrix * vec4(aTangents,   0.0)));
-    vec3 B = normalize(vec3(uWorldMatrix * vec4(aBiTangents, 0.0)));
-    vec3 N = normalize(vec3(uWorldMatrix * vec4(vNormals,    0.0)));
+    vViewDir = uCameraPosition - position;
+    vPosition = vec3(worldMatrix * vec4(position,1.0));
+    worldViewMatrix = mat3(worldMatrix);
+    vec3 T = normalize(vec3(worldMatrix * vec4(tangent,   0.0)));
+    vec3 B = normalize(vec3(worldMatrix * vec4(bitangent, 0.0)));
+    vec3 N = normalize(vec3(worldMatrix * vec4(vNormals,    0.0)));
     TBN = mat3(T,B,N);
 }
 
@@ -229,12 +304,6 @@ layout(binding = 0, std140) uniform GlobalParms
 	int 			uLightCount;
 };
 
-layout(binding = 1, std140) uniform LocalParms
-{
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
-};
-
 in vec2 vTexCoord;
 in vec3 vNormals;
 in vec3 vViewDir;
@@ -262,8 +331,9 @@ void main() {
     if(uShowRelief == 1)
     {
         tCoords = reliefMapping(tCoords, vViewDir);
-        normals = texture(uNormalTexture, vTexCoord).rgb;
-        normals = normals * 2.0 - 1.0;
+        // Normal maps are BC5 (only X and Y), Z is rebuilt from them
+        normals.xy = texture(uNormalTexture, vTexCoord).rg * 2.0 - 1.0;
+        normals.z = sqrt(max(1.0 - dot(normals.xy, normals.xy), 0.0));
         normals = normalize(inverse(transpose(TBN)) * normals);
     }
 
@@ -272,7 +342,7 @@ void main() {
 	oNormals 	= vec4(normals, 1.0);
     
     oAlbedo   =   texture(uAlbedoTexture, tCoords);
-    oPosition = vec4(transpose(TBN)*vPosition, 1.0);
+    oPosition = vec4(vPosition, 1.0);
     gl_FragDepth = gl_FragCoord.z - 0.2;
 }
 
@@ -325,20 +395,6 @@ vec2 reliefMapping(vec2 texCoords, vec3 viewDir)
 layout(location=0) in vec3 aPosition;
 layout(location=1) in vec2 aTexCoord;
 
-struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     float 	intensity;
-};
-
-layout(binding = 0, std140) uniform GlobalParms
-{
-	vec3 			uCameraPosition;
- 	int 			uLightCount;
- 	Light			uLight[16];
-};
 
 out vec2 vTexCoord;
 
@@ -351,37 +407,63 @@ void main() {
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
- struct Light{
-	 unsigned int 	type; // 0: dir, 1: point
-	 vec3	color;
-	 vec3	direction;
-	 vec3	position;
-     float 	intensity;
+struct Light
+{
+	vec4	positionRadius;
+	vec4	colorIntensity;
+	vec4	directionType; // w: 0 dir, 1 point
+};
+
+layout(binding = 0, std140) uniform GlobalParms
+{
+	vec3 			uCameraPosition;
+	int 			uLightCount;
+	int 			uDirectionalLightCount;
+	mat4 			uViewMatrix;
+	mat4 			uViewProjectionMatrix;
+	uvec4 			uClusterGrid;
+	vec4 			uClusterDepthParams; // near, far, slice scale, slice bias
+};
+
+layout(binding = 2, std430) readonly buffer Lights
+{
+	Light uLights[];
+};
+
+// Offset and count in uLightIndices of each cluster
+layout(binding = 3, std430) readonly buffer LightClusters
+{
+	uvec2 uClusters[];
+};
+
+layout(binding = 4, std430) readonly buffer LightIndices
+{
+	uint uLightIndices[];
 };
 
 vec3 DirectionalLight(Light light, vec3 normal, vec3 view_dir, vec2 texCoords){
     vec3 lightColor = vec3(1.);
     // Ambient
-    vec3 ambient = lightColor * 0.15 * light.color;
+    vec3 ambient = lightColor * 0.15 * light.colorIntensity.rgb;
 
     // Diffuse
-    vec3 lightDirection = normalize(-light.position);
-    float diffuseIntensity = max(dot(normal, light.direction),0.0);
-    vec3 diffuse = diffuseIntensity * lightColor * light.color;
+    vec3 lightDirection = normalize(-light.positionRadius.xyz);
+    float diffuseIntensity = max(dot(normal, light.directionType.xyz),0.0);
+    vec3 diffuse = diffuseIntensity * lightColor * light.colorIntensity.rgb;
 
     // Specular
     float specularStrength = 0.01;
     float specularIntensity = pow(max(dot(normal, lightDirection),0.0),0.1);
-    vec3 specular = specularStrength * specularIntensity * lightColor * light.intensity;
+    vec3 specular = specularStrength * specularIntensity * lightColor * light.colorIntensity.a;
     
-    return (ambient + diffuse + specular) * light.intensity;
+    return (ambient + diffuse + specular) * light.colorIntensity.a;
 }
 
 vec3 PointLight(Light light, vec3 normal, vec3 frag_pos, vec3 view_dir, vec2 texCoords)
 {
-    vec3 ambient = light.color;
+    vec3 ambient = light.colorIntensity.rgb;
 
-    vec3 lightDir = normalize(light.position - frag_pos);
+    vec3 lightDir = normalize(light.positionRadius.xyz - frag_pos);
     float diff = max(dot(normal, lightDir), 0.0);
     vec3 diffuse = ambient * diff;
 
@@ -389,18 +471,13 @@ vec3 PointLight(Light light, vec3 normal, vec3 frag_pos, vec3 view_dir, vec2 tex
     float spec = pow(max(dot(view_dir, reflectDir), 0.0), 0.0) * 0.01;
     vec3 specular = ambient * spec;
 
-    float distance = length(light.position - frag_pos);
-    float range = 1/distance;      
-	return (diffuse + specular) * range * light.intensity;
+    // Smooth falloff to zero at the light radius, so lights can be bound to clusters
+    float distance = length(light.positionRadius.xyz - frag_pos);
+    float window = clamp(1.0 - pow(distance / light.positionRadius.w, 4.0), 0.0, 1.0);
+    float range = window * window / distance;
+	return (diffuse + specular) * range * light.colorIntensity.a;
 }
 
-layout(binding = 0, std140) uniform GlobalParms
-{
-	vec3 			uCameraPosition;
-	int 			uLightCount;
-	Light			uLight[16];
-};
-
 uniform sampler2D uPositionTexture;
 uniform sampler2D uNormalsTexture;
 uniform sampler2D uAlbedoTexture;
@@ -416,16 +493,20 @@ void main() {
 
 	vec3 viewDir = normalize(uCameraPosition - fragPos);
 	vec3 lightsColors = vec3(0.0,0.0,0.0);
-	for(int i = 0; i < uLightCount; ++i)
-	{		
-        if(uLight[i].type == 0) //Directional
-        {
-			lightsColors += DirectionalLight(uLight[i], norms, normalize(viewDir), vTexCoord);
-        }
-        else //PointLight
-        {
-            lightsColors += PointLight(uLight[i], norms, fragPos, viewDir, vTexCoord);
-        }
+	for(int i = 0; i < uDirectionalLightCount; ++i)
+	{
+		lightsColors += DirectionalLight(uLights[i], norms, normalize(viewDir), vTexCoord);
+	}
+
+	// Point lights come from the cluster of the fragment
+	float viewDepth = -(uViewMatrix * vec4(fragPos, 1.0)).z;
+	uvec3 cluster;
+	cluster.xy = uvec2(clamp(vTexCoord, vec2(0.0), vec2(0.999)) * vec2(uClusterGrid.xy));
+	cluster.z = uint(clamp(log(max(viewDepth, uClusterDepthParams.x)) * uClusterDepthParams.z + uClusterDepthParams.w, 0.0, float(uClusterGrid.z - 1)));
+	uvec2 clusterLights = uClusters[(cluster.z * uClusterGrid.y + cluster.y) * uClusterGrid.x + cluster.x];
+	for(uint i = 0; i < clusterLights.y; ++i)
+	{
+		lightsColors += PointLight(uLights[uLightIndices[clusterLights.x + i]], norms, fragPos, viewDir, vTexCoord);
 	}
     oColor = vec4(lightsColors + diffuseCol * 0.2, 1.0);
 }